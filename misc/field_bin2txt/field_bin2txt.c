@@ -0,0 +1,93 @@
+/* Converts binary files with fields on dipoles, produced by ADDA with '-store_format bin', into the text format (the
+ * same as produced by ADDA with '-store_format text'). See StoreFieldsBin() in src/CalculateE.c for the description of
+ * the binary format.
+ *
+ * Copyright (C) ADDA contributors
+ * This file is part of ADDA.
+ *
+ * ADDA is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ADDA is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ADDA. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// should be the same as in src/CalculateE.c
+#define FLD_MAGIC     "ADDAFLD"
+#define FLD_BOM       0x01020304
+#define FLD_VERSION   1
+#define FLD_HEAD_SIZE 64
+#define FLD_NAME_SIZE 16
+#define GFORM         "%.10g"
+
+//======================================================================================================================
+
+static void Error(const char *msg,const char *fname)
+// prints error message and exits
+{
+	fprintf(stderr,"ERROR: %s '%s'\n",msg,fname);
+	exit(EXIT_FAILURE);
+}
+
+//======================================================================================================================
+
+int main(int argc,char **argv)
+{
+	FILE *in,*out;
+	unsigned char head[FLD_HEAD_SIZE];
+	uint32_t bom,version,head_size,cmplx;
+	uint64_t N,i;
+	char name[FLD_NAME_SIZE];
+	double rec[9];
+	size_t nval;
+	int j;
+
+	if (argc<2 || argc>3) {
+		fprintf(stderr,"Usage: field_bin2txt <input.bin> [<output>]\n"
+			"Converts binary file with fields on dipoles (produced by ADDA with '-store_format bin') into text format. "
+			"If <output> is omitted, the result is written to stdout.\n");
+		return EXIT_FAILURE;
+	}
+	if ((in=fopen(argv[1],"rb"))==NULL) Error("Failed to open file",argv[1]);
+	// read and test header
+	if (fread(head,1,FLD_HEAD_SIZE,in)!=FLD_HEAD_SIZE) Error("Failed to read header from file",argv[1]);
+	if (memcmp(head,FLD_MAGIC,sizeof(FLD_MAGIC))!=0) Error("Unknown format of file",argv[1]);
+	memcpy(&bom,head+8,sizeof(bom));
+	if (bom!=FLD_BOM) Error("Byte order differs from the one of the current machine for file",argv[1]);
+	memcpy(&version,head+12,sizeof(version));
+	if (version>FLD_VERSION) Error("Unsupported (newer) version of the format in file",argv[1]);
+	memcpy(&head_size,head+16,sizeof(head_size));
+	memcpy(&cmplx,head+20,sizeof(cmplx));
+	memcpy(&N,head+24,sizeof(N));
+	memcpy(name,head+32,FLD_NAME_SIZE);
+	name[FLD_NAME_SIZE-1]='\0';
+	if (head_size>FLD_HEAD_SIZE && fseek(in,head_size,SEEK_SET)!=0) Error("Failed to skip header of file",argv[1]);
+	// open output
+	if (argc==3) {
+		if ((out=fopen(argv[2],"w"))==NULL) Error("Failed to open file",argv[2]);
+	}
+	else out=stdout;
+	// the same headers and formats as used in StoreFields() in src/CalculateE.c
+	nval=(cmplx ? 9 : 6);
+	if (cmplx) fprintf(out,"x y z |%s|^2 %sx.r %sx.i %sy.r %sy.i %sz.r %sz.i\n",name,name,name,name,name,name,name);
+	else fprintf(out,"x y z |%s|^2 %sx %sy %sz\n",name,name,name,name);
+	for (i=0;i<N;i++) {
+		if (fread(rec,sizeof(double),nval,in)!=nval) Error("Unexpected end of file",argv[1]);
+		for (j=0;j<3;j++) fprintf(out,GFORM" ",rec[j]);
+		if (cmplx) fprintf(out,GFORM,rec[3]*rec[3]+rec[4]*rec[4] + rec[5]*rec[5]+rec[6]*rec[6] + rec[7]*rec[7]+rec[8]*rec[8]);
+		else fprintf(out,GFORM,rec[3]*rec[3]+rec[4]*rec[4]+rec[5]*rec[5]);
+		for (j=3;j<(int)nval;j++) fprintf(out," "GFORM,rec[j]);
+		fprintf(out,"\n");
+	}
+	if (fgetc(in)!=EOF) Error("Extra data at the end of file",argv[1]);
+	fclose(in);
+	if (out!=stdout) fclose(out);
+	return EXIT_SUCCESS;
+}
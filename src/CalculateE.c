@@ -28,6 +28,7 @@
 #include "vars.h"
 // system headers
 #include <math.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -37,11 +38,13 @@
 extern double * restrict muel_phi,* restrict muel_phi_buf;
 extern doublecomplex * restrict EplaneX, * restrict EplaneY, * restrict EyzplX, * restrict EyzplY;
 extern const double dtheta_deg,dtheta_rad;
-extern doublecomplex * restrict ampl_alphaX,* restrict ampl_alphaY;
+extern doublecomplex * restrict ampl_alpha;
 extern double * restrict muel_alpha;
+extern const size_t theta0_loc,nTheta_loc;
 // defined and initialized in crosssec.c
 extern const Parms_1D phi_sg;
 extern const double ezLab[3],exSP[3];
+extern const bool avg_mirror;
 // defined and initialized in GenerateB.c
 extern const double C0dipole,C0dipole_refl;
 extern int vorticity;
@@ -49,6 +52,7 @@ extern int vorticity;
 extern const bool store_int_field,store_dip_pol,store_beam,store_scat_grid,calc_Cext,calc_Cabs,
 	calc_Csca,calc_vec,calc_asym,calc_mat_force,store_force,store_ampl;
 extern const int phi_int_type;
+extern const enum fform store_format;
 // defined and initialized in timing.c
 extern TIME_TYPE Timing_EPlane,Timing_EPlaneComm,Timing_IntField,Timing_IntFieldOne,Timing_ScatQuan,Timing_IncBeam;
 extern size_t TotalEFieldPlane;
@@ -65,6 +69,13 @@ extern size_t TotalEFieldPlane;
 #define AMPL_FORMAT EFORM" "EFORM" "EFORM" "EFORM" "EFORM" "EFORM" "EFORM" "EFORM
 #define ANGLE_FORMAT "%.2f"
 #define RMSE_FORMAT "%.3E"
+// binary format for fields on dipoles, see StoreFieldsBin()
+#define FLD_MAGIC     "ADDAFLD" // 8 bytes, including terminating zero
+#define FLD_BOM       0x01020304
+#define FLD_VERSION   1
+#define FLD_HEAD_SIZE 64
+#define FLD_NAME_SIZE 16
+#define FLD_CHUNK     65536 // number of records written at once
 #define COMP44M(a) (a)[0][0],(a)[0][1],(a)[0][2],(a)[0][3],(a)[1][0],(a)[1][1],(a)[1][2],(a)[1][3],(a)[2][0],\
 	(a)[2][1],(a)[2][2],(a)[2][3],(a)[3][0],(a)[3][1],(a)[3][2],(a)[3][3]
 
@@ -178,26 +189,28 @@ void MuellerMatrix(void)
 	int i;
 	size_t index,index1,k_or,j,n,ind;
 	double co,si,alph;
+	const doublecomplex *aY,*aX; // amplitudes for Y and X incident polarizations (for orientation averaging)
 	TIME_TYPE tstart;
 
 	// redundant initialization to remove warnings
 	mueller=ampl=NULL;
 	co=si=0;
 
-	// Everything is done on ROOT only
-	if (!IFROOT) return;
-
 	if (orient_avg) { // Amplitude matrix (ampl_alplha) => Mueller matrix (muel_alpha)
 		/* amplitude matrix is not integrated (hence not used here). We do check store_mueller because orient_avg may
 		 * have sense (though very little) without it (e.g. to compute only averaged cross sections).
+		 * This is done by each processor for its own range of theta, amplitudes for which are located in the beginning
+		 * of ampl_alpha (see calculate_one_orientation in calculator.c)
 		 */
 		if (store_mueller) {
-			index1=index=0;
+			index1=0;
 			for (k_or=0;k_or<alpha_int.N;k_or++) {
 				alph=Deg2Rad(alpha_int.val[k_or]); // read current alpha
 				co=cos(alph);
 				si=sin(alph);
-				for (i=0;i<nTheta;i++) {
+				for (j=0;j<nTheta_loc;j++) {
+					aY=ampl_alpha + 4*(j*alpha_int.N+k_or);
+					aX=aY+2;
 					// transform amplitude matrix, multiplying by rotation matrix (-alpha)
 					/* Note, that amplitude matrix for vortex beams (e.g., Bessel ones) have to be additionally
 					 * multiplied by the phase factor exp(-I*vorticity*alpha) and additional factor I^vorticity for
@@ -205,26 +218,25 @@ void MuellerMatrix(void)
 					 * amplitude matrix here. Hence, these phase factors are ignored for orientation averaging.
 					 */
 					if (yzplane) { // here the default (alpha=0) is yz-plane, so par=Y, per=X
-						s2 =  co*ampl_alphaY[index+1] + si*ampl_alphaX[index+1]; // s2 =  co*s20 + si*s30
-						s3 = -si*ampl_alphaY[index+1] + co*ampl_alphaX[index+1]; // s3 = -si*s20 + co*s30
-						s4 =  co*ampl_alphaY[index] + si*ampl_alphaX[index];     // s4 =  co*s40 + si*s10
-						s1 = -si*ampl_alphaY[index] + co*ampl_alphaX[index];     // s1 = -si*s40 + co*s10
+						s2 =  co*aY[1] + si*aX[1]; // s2 =  co*s20 + si*s30
+						s3 = -si*aY[1] + co*aX[1]; // s3 = -si*s20 + co*s30
+						s4 =  co*aY[0] + si*aX[0]; // s4 =  co*s40 + si*s10
+						s1 = -si*aY[0] + co*aX[0]; // s1 = -si*s40 + co*s10
 					}
 					else { // scat_plane; here the default (alpha=0) is xz-plane, so par=X, per=-Y
-						s2 =  co*ampl_alphaX[index+1] - si*ampl_alphaY[index+1]; // s2 =  co*s20 + si*s30
-						s3 = -si*ampl_alphaX[index+1] - co*ampl_alphaY[index+1]; // s3 = -si*s20 + co*s30
-						s4 =  co*ampl_alphaX[index] - si*ampl_alphaY[index];     // s4 =  co*s40 + si*s10
-						s1 = -si*ampl_alphaX[index] - co*ampl_alphaY[index];     // s1 = -si*s40 + co*s10
+						s2 =  co*aX[1] - si*aY[1]; // s2 =  co*s20 + si*s30
+						s3 = -si*aX[1] - co*aY[1]; // s3 = -si*s20 + co*s30
+						s4 =  co*aX[0] - si*aY[0]; // s4 =  co*s40 + si*s10
+						s1 = -si*aX[0] - co*aY[0]; // s1 = -si*s40 + co*s10
 					}
-					theta=i*dtheta_deg;
+					theta=(theta0_loc+j)*dtheta_deg;
 					ComputeMuellerMatrix((double (*)[4])(muel_alpha+index1),s1,s2,s3,s4,theta);
-					index+=2;
 					index1+=16;
 				}
 			}
 		}
 	}
-	else {
+	else if (IFROOT) { // everything else is done on ROOT only
 		tstart=GET_TIME(); // here Mueller matrix is saved to file
 		if (yzplane) { // par=Y, per=X
 			if (store_ampl) {
@@ -444,7 +456,7 @@ static void CalcEplaneYZ(const enum incpol which,const enum Eftype type)
 	double co,si;           // temporary, cos and sin of some angle
 	double alph;
 	TIME_TYPE tstart;
-	size_t k_or;
+	size_t k_or,stride; // stride is the distance between values of Eplane for successive theta
 	int orient,Norient;
 	enum incpol choice;
 
@@ -482,13 +494,14 @@ static void CalcEplaneYZ(const enum incpol which,const enum Eftype type)
 				vMultScal(-1,incPol,incPolpar);
 			}
 			// initialize Eplane
-			if (orient_avg) {
-				if (choice==INCPOL_Y) Eplane=ampl_alphaY + 2*nTheta*k_or;
-				else Eplane=ampl_alphaX + 2*nTheta*k_or; // choice==INCPOL_X
+			if (orient_avg) { // ampl_alpha is ordered by theta first, see calculator.c
+				Eplane=ampl_alpha + 4*k_or + ((choice==INCPOL_Y) ? 0 : 2);
+				stride=4*alpha_int.N;
 			}
 			else {
 				if (choice==INCPOL_Y) Eplane=EyzplY;
 				else Eplane=EyzplX; // choice==INCPOL_X
+				stride=2;
 			}
 
 			for (i=0;i<nTheta;i++) {
@@ -498,16 +511,20 @@ static void CalcEplaneYZ(const enum incpol which,const enum Eftype type)
 				LinComb(prop,incPolpar,co,si,robserver); // robserver = co*prop + si*incPolpar;
 				CalcField(ebuff,robserver);
 				// convert to (l,r) frame
-				Eplane[2*i]=crDotProd(ebuff,incPolper); // Eper[i]=Esca.incPolper
-				LinComb(prop,incPolpar,-si,co,epar);    // epar=-si*prop+co*incPolpar
-				Eplane[2*i+1]=crDotProd(ebuff,epar);    // Epar[i]=Esca.epar
+				Eplane[stride*i]=crDotProd(ebuff,incPolper); // Eper[i]=Esca.incPolper
+				LinComb(prop,incPolpar,-si,co,epar);         // epar=-si*prop+co*incPolpar
+				Eplane[stride*i+1]=crDotProd(ebuff,epar);    // Epar[i]=Esca.epar
 			} //  end for i
 
-			// Accumulate Eplane to root and sum
-			D("Accumulating Eplane started");
-			// accumulate only on processor 0 !, done in one operation
-			Accumulate(Eplane,cmplx_type,2*nTheta,&Timing_EPlaneComm);
-			D("Accumulating Eplane finished");
+			/* Accumulate Eplane to root and sum; for orientation averaging it is done later for all alpha at once (see
+			 * calculate_one_orientation in calculator.c)
+			 */
+			if (!orient_avg) {
+				D("Accumulating Eplane started");
+				// accumulate only on processor 0 !, done in one operation
+				Accumulate(Eplane,cmplx_type,2*nTheta,&Timing_EPlaneComm);
+				D("Accumulating Eplane finished");
+			}
 
 			Timing_EPlane = GET_TIME() - tstart;
 			Timing_EField += Timing_EPlane;
@@ -533,7 +550,7 @@ static void CalcScatPlane(const enum incpol which,const enum Eftype type)
 	double unitSP[3];       // unit vector (perpendicular to ezLab), which determines the scattering plane
 	double alph;
 	TIME_TYPE tstart;
-	size_t k_or;
+	size_t k_or,stride; // stride is the distance between values of Eplane for successive theta
 	int orient,Norient;
 	enum incpol choice;
 
@@ -588,13 +605,14 @@ static void CalcScatPlane(const enum incpol which,const enum Eftype type)
 				vCopy(tmp3,unitSP);
 			}
 			// initialize Eplane
-			if (orient_avg) {
-				if (choice==INCPOL_Y) Eplane=ampl_alphaY + 2*nTheta*k_or;
-				else Eplane=ampl_alphaX + 2*nTheta*k_or; // choice==INCPOL_X
+			if (orient_avg) { // ampl_alpha is ordered by theta first, see calculator.c
+				Eplane=ampl_alpha + 4*k_or + ((choice==INCPOL_Y) ? 0 : 2);
+				stride=4*alpha_int.N;
 			}
 			else {
 				if (choice==INCPOL_Y) Eplane=EplaneY;
 				else Eplane=EplaneX; // choice==INCPOL_X
+				stride=2;
 			}
 
 			for (i=0;i<nTheta;i++) {
@@ -604,16 +622,20 @@ static void CalcScatPlane(const enum incpol which,const enum Eftype type)
 				LinComb(ezLab,unitSP,co,si,robserver); // robserver = co*ezLab + si*unitSP;
 				CalcField(ebuff,robserver);
 				// convert to (l,r) frame
-				Eplane[2*i]=crDotProd(ebuff,incPolper); // Eper[i]=Esca.incPolper
-				LinComb(ezLab,unitSP,-si,co,epar);        // epar=-si*ezLab+co*unitSP
-				Eplane[2*i+1]=crDotProd(ebuff,epar);    // Epar[i]=Esca.epar
+				Eplane[stride*i]=crDotProd(ebuff,incPolper); // Eper[i]=Esca.incPolper
+				LinComb(ezLab,unitSP,-si,co,epar);           // epar=-si*ezLab+co*unitSP
+				Eplane[stride*i+1]=crDotProd(ebuff,epar);    // Epar[i]=Esca.epar
 			} //  end for i
 
-			// Accumulate Eplane to root and sum
-			D("Accumulating Eplane started");
-			// accumulate only on processor 0 !, done in one operation
-			Accumulate(Eplane,cmplx_type,2*nTheta,&Timing_EPlaneComm);
-			D("Accumulating Eplane finished");
+			/* Accumulate Eplane to root and sum; for orientation averaging it is done later for all alpha at once (see
+			 * calculate_one_orientation in calculator.c)
+			 */
+			if (!orient_avg) {
+				D("Accumulating Eplane started");
+				// accumulate only on processor 0 !, done in one operation
+				Accumulate(Eplane,cmplx_type,2*nTheta,&Timing_EPlaneComm);
+				D("Accumulating Eplane finished");
+			}
 
 			Timing_EPlane = GET_TIME() - tstart;
 			Timing_EField += Timing_EPlane;
@@ -624,6 +646,68 @@ static void CalcScatPlane(const enum incpol which,const enum Eftype type)
 
 //======================================================================================================================
 
+static void StoreFieldsBin(const doublecomplex * restrict cmplxF,const double * restrict realF,
+	const char * restrict fname,const char * restrict field_name)
+/* Write fields on each dipole to binary file 'fname'; one of cmplxF and realF should be NULL (see StoreFields). The
+ * file is self-describing and has the following layout (all values in native byte order, which can be checked by the
+ * byte-order mark):
+ * bytes 0-7   - magic string FLD_MAGIC (including terminating zero)
+ *       8-11  - byte-order mark FLD_BOM (uint32)
+ *       12-15 - format version (uint32)
+ *       16-19 - size of the header in bytes, i.e. offset of the data (uint32)
+ *       20-23 - 1 for complex fields and 0 for real ones (uint32)
+ *       24-31 - number of dipoles N (uint64)
+ *       32-47 - name of the field, e.g. "E" (null-padded string)
+ *       48-63 - reserved (zeros)
+ * followed by N records (in the same order as lines of the text file), each consisting of 3 coordinates and 3 field
+ * components (each complex value is represented by real and imaginary parts) as doubles. The squared norm of the
+ * field is not stored, since it can be easily recomputed. Tool misc/field_bin2txt converts such files into text format.
+ */
+{
+	unsigned char head[FLD_HEAD_SIZE];
+	uint32_t u32;
+	uint64_t u64;
+	size_t nval,nchunks,c,start,n,j,k;
+	double * restrict buf;
+	binout * restrict bo;
+	const bool cmplx_mode=(cmplxF!=NULL);
+
+	// build header
+	memset(head,0,FLD_HEAD_SIZE);
+	memcpy(head,FLD_MAGIC,sizeof(FLD_MAGIC));
+	u32=FLD_BOM;
+	memcpy(head+8,&u32,sizeof(u32));
+	u32=FLD_VERSION;
+	memcpy(head+12,&u32,sizeof(u32));
+	u32=FLD_HEAD_SIZE;
+	memcpy(head+16,&u32,sizeof(u32));
+	u32=cmplx_mode;
+	memcpy(head+20,&u32,sizeof(u32));
+	u64=nvoid_Ndip;
+	memcpy(head+24,&u64,sizeof(u64));
+	strncpy((char *)head+32,field_name,FLD_NAME_SIZE-1);
+	// write records in chunks to limit memory overhead
+	nval=(cmplx_mode ? 9 : 6);
+	MALLOC_VECTOR(buf,double,nval*MIN(FLD_CHUNK,MAX(local_nvoid_Ndip,1)),ALL);
+	bo=BinOutOpen(fname,head,FLD_HEAD_SIZE);
+	nchunks=BinOutSeek(bo,FLD_HEAD_SIZE,nval*sizeof(double),local_nvoid_Ndip,FLD_CHUNK,NULL);
+	for (c=0;c<nchunks;c++) {
+		start=c*FLD_CHUNK;
+		if (start>=local_nvoid_Ndip) n=0;
+		else n=MIN(FLD_CHUNK,local_nvoid_Ndip-start);
+		for (j=0,k=3*start;j<n;j++,k+=3) {
+			memcpy(buf+nval*j,DipoleCoord+k,3*sizeof(double));
+			if (cmplx_mode) memcpy(buf+nval*j+3,cmplxF+k,3*sizeof(doublecomplex));
+			else memcpy(buf+nval*j+3,realF+k,3*sizeof(double));
+		}
+		BinOutWrite(bo,buf,n);
+	}
+	BinOutClose(bo);
+	Free_general(buf);
+}
+
+//======================================================================================================================
+
 static void StoreFields(const enum incpol which,doublecomplex * restrict cmplxF,
 	double * restrict realF,const char * restrict fname_preffix,const char * restrict tmpl UOIP,
 	const char * restrict field_name,const char * restrict fullname)
@@ -636,8 +720,8 @@ static void StoreFields(const enum incpol which,doublecomplex * restrict cmplxF,
  * there is difference in the first row between different fields). 'fullname' is for standard output.
  *
  * This (parallel) algorithm is far from being optimal due to the (redundant) concatenation step. However, this is
- * mainly the limitation of the text file. The only feasible way to improve it is to use binary format like NetCDF
- * (which may work on top of MPI_IO).
+ * mainly the limitation of the text file. For large number of dipoles, binary format ('-store_format bin') should be
+ * used instead - then all processors write directly into a single file (using MPI-IO in parallel mode).
  */
 {
 	FILE * restrict file; // file to store the fields
@@ -654,6 +738,14 @@ static void StoreFields(const enum incpol which,doublecomplex * restrict cmplxF,
 	strcpy(fname_sh,fname_preffix);
 	if (which==INCPOL_Y) strcat(fname_sh,F_YSUF);
 	else strcat(fname_sh,F_XSUF); // which==INCPOL_X
+	if (store_format==FF_BIN) {
+		strcat(fname_sh,F_BINSUF);
+		SnprintfErr(ALL_POS,fname,MAX_FNAME,"%s/%s",directory,fname_sh);
+		StoreFieldsBin(cmplxF,realF,fname,field_name);
+		if (IFROOT) PRINTFB("%s saved to binary file\n",fullname);
+		Timing_FileIO += GET_TIME() - tstart;
+		return;
+	}
 	// choose filename for direct saving
 #ifdef PARALLEL
 	size_t shift=SnprintfErr(ALL_POS,fname,MAX_FNAME,"%s/",directory);
@@ -879,7 +971,7 @@ int CalculateE(const enum incpol which,const enum Eftype type)
 	// Calculate the scattered field for the whole solid-angle
 	if (all_dir) CalcAlldir();
 	// Calculate the scattered field on the given grid of angles
-	if (scat_grid) CalcScatGrid(which);
+	if (scat_grid) CalcScatGrid(which,type);
 	// Calculate integral scattering quantities (cross sections, asymmetry parameter, electric forces)
 	if (calc_Cext || calc_Cabs || calc_Csca || calc_asym || calc_mat_force) CalcIntegralScatQuantities(which);
 	// saves internal fields and/or dipole polarizations to text file
@@ -897,7 +989,7 @@ void SaveMuellerAndCS(double * restrict in)
 {
 	FILE * restrict mueller,* restrict CCfile;
 	char fname[MAX_FNAME];
-	int i;
+	int i,j;
 	double Cext,Cabs,*muel;
 	TIME_TYPE tstart;
 
@@ -906,6 +998,10 @@ void SaveMuellerAndCS(double * restrict in)
 	Cext=in[0];
 	Cabs=in[1];
 	muel=in+2;
+	/* when reflection symmetries are used to reduce the range of orientations, the integral over the full range is
+	 * (M+DMD)/2 with D=diag(1,1,-1,-1), i.e. the elements mixing (I,Q) and (U,V) vanish
+	 */
+	if (avg_mirror) for (i=0;i<nTheta;i++) for (j=0;j<16;j++) if ((j<8)!=(j%4<2)) muel[16*i+j]=0;
 
 	if (store_mueller) { // save Mueller matrix
 		SnprintfErr(ONE_POS,fname,MAX_FNAME,"%s/"F_MUEL,directory);
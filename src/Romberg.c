@@ -8,9 +8,12 @@
  * is not so certain for trapezoid rule).
  *
  * 2D Romberg is two-level integration, where final error is estimated based on both the errors of outer and inner
- * integration. It uses function pointer to calculate values as needed. Therefore it is adaptive, but can also be used
- * in non-adaptive regime on precalculated values. Two instances of Romberg 2D should not be used in parallel (they use
- * common storage). E.g. calculation of Csca inside orientation averaging must not be done.
+ * integration. It is implemented as an integrator object (romb2d), which hands out batches of nodes, where the
+ * function values are required, and accepts the results for them. Therefore it is adaptive, but the caller may evaluate
+ * all nodes of a batch in parallel. The first Jmin refinement stages (of both inner and outer integrations) do not
+ * depend on the convergence, so they are combined into a single (large) batch. Several instances may be used
+ * simultaneously, since all the state is stored in the object. Romberg2D() is a simple wrapper, which calls the
+ * function node by node in the same order as a straightforward nested integration.
  *
  * Integration parameters are described in a special structure Parms_1D defined in types.h. They must be set outside of
  * the Romberg routine. All routines normalize the result on the interval width, i.e. actually averaging takes place.
@@ -38,7 +41,6 @@
 #include <string.h>
 
 #include "memory.h"
-#include "io.h"
 
 // SEMI-GLOBAL VARIABLES
 
@@ -47,29 +49,49 @@ extern const bool full_al_range;
 
 // LOCAL VARIABLES
 
-/* Due to heavy use of static local variables for communication between functions in this source file, the
- * implementation is not thread-safe. Should not be called in parallel from multiple threads (e.g. OpenMP)
- */
-static int dim;              // dimension of the data (integrated simultaneously)
-static int N_eval;           // number of function evaluations in inner cycle
-static int N_tot_eval;       // total number of function evaluation
-static int no_convergence;   // number of inner integrals that did not converge
-static FILE * restrict file; // file to print info
-// used in inner loop
-static int size_in;      // size of M array
-static double ** restrict M_in,    // array of M values
-              * restrict T_in,     // T_m^0
-              * restrict dummy_in; // save function values
-// used in outer loop
-static int size_out;
-static double ** restrict M_out,* restrict T_out,* restrict dummy_out; // analogous to the above
-// common arrays with frequently used values
-static double * restrict tv1, // 4^m
-              * restrict tv2, // 1/(4^m-1)
-              * restrict tv3; // 2*4^m-1
-// pointer to the function that is integrated
-static double (*func)(int theta,int phi,double * restrict res);
-static const Parms_1D *input; // parameters of integration
+// state of a single inner integration (for fixed theta), see InnerStage()
+typedef struct {
+	int fixed;      // index of theta
+	bool onepoint;  // whether only one point is used, e.g. for theta==0, when all phi points are equivalent
+	int step;       // outer step, to which this integration belongs (see OpenStep)
+	bool done;      // whether the integration is finished
+	int m,m0;       // next refinement stage and index of M_0^m in array M (equals 0 for periodic, m otherwise)
+	int n_st;       // number of refinement stages in the current batch
+	int start;      // index of the first node of these stages in the batch
+	int n_eval;     // number of function evaluations
+	double int_err; // absolute error of previous layer integration
+	double abs_err; // estimate of the absolute error (for the first element), used by the outer integration
+	double err;     // relative error
+	double ** restrict M,* restrict T,* restrict res; // array of M values, T_m^0, and result
+} inner_state;
+
+struct romb2d_struct { // state of 2D integration, see Romberg2DInit()
+	Parms_1D input[2];     // parameters of integration
+	int dim;               // dimension of the data (integrated simultaneously)
+	bool wide;             // whether batches should include all nodes, which are surely required
+	int N_tot_eval;        // total number of function evaluations
+	int no_convergence;    // number of inner integrals that did not converge
+	FILE * restrict file;  // file to print info
+	char fname[MAX_FNAME]; // its name
+	int size_in,size_out;  // sizes of M arrays for inner and outer integrations
+	int sure_in,sure_out;  // numbers of the first refinement stages, which are performed irrespective of convergence
+	// outer integration; analogous to inner_state
+	double ** restrict M_out,* restrict T_out;
+	int m0_out;
+	double int_err_out,err_out;
+	bool finished;           // whether the outer integration is finished
+	double * restrict res;   // final result
+	int step0,step1;         // range [step0,step1) of open outer steps (see OpenStep)
+	int n_in;                // number of inner integrations in the open outer steps
+	inner_state * restrict in; // and their states
+	// common arrays with frequently used values
+	double * restrict tv1, // 4^m
+	       * restrict tv2, // 1/(4^m-1)
+	       * restrict tv3; // 2*4^m-1
+	// current batch
+	int N_batch;                                     // number of nodes
+	int * restrict batch_th,* restrict batch_ph;     // their indices
+};
 
 //======================================================================================================================
 
@@ -170,279 +192,269 @@ double Romberg1D(const Parms_1D param,         // parameters of integration
 
 //======================================================================================================================
 
-static void AllocateAll(void)
-// allocates all needed memory
-{
-	int i,maxdim;
-
-	// inner loop vectors
-	size_in=input[PHI].periodic ? 0 : input[PHI].Jmax;
-	MALLOC_DMATRIX(M_in,size_in+1,dim,ONE);
-	MALLOC_VECTOR(T_in,double,dim,ONE);
-	MALLOC_VECTOR(dummy_in,double,dim,ONE);
-	// outer loop vectors
-	size_out=input[THETA].periodic ? 0 : input[THETA].Jmax;
-	MALLOC_DMATRIX(M_out,size_out+1,dim,ONE);
-	MALLOC_VECTOR(T_out,double,dim,ONE);
-	MALLOC_VECTOR(dummy_out,double,dim,ONE);
-	// common to fasten calculations; needed only for really Romberg
-	maxdim=MAX(size_in,size_out);
-	if (maxdim!=0) {
-		MALLOC_VECTOR(tv1,double,maxdim+1,ONE);
-		MALLOC_DVECTOR2(tv2,1,maxdim,ONE);
-		MALLOC_VECTOR(tv3,double,maxdim+1,ONE);
-		tv1[0]=1;
-		for (i=1;i<maxdim;i++) {
-			tv1[i]=tv1[i-1]*4;
-			tv2[i]=1/(tv1[i]-1);
-			tv3[i-1]=2*tv1[i-1]-1;
-		}
-	}
-}
-
-//======================================================================================================================
-
-static void FreeAll(void)
-// frees all memory
-{
-	// inner
-	Free_dMatrix(M_in,size_in+1);
-	Free_general(T_in);
-	Free_general(dummy_in);
-	// outer
-	Free_dMatrix(M_out,size_out+1);
-	Free_general(T_out);
-	Free_general(dummy_out);
-	// common
-	if (size_in!=0 || size_out!=0) {
-		Free_general(tv1);
-		Free_dVector2(tv2,1);
-		Free_general(tv3);
-	}
-}
-
-//======================================================================================================================
-
-static void RombergIterate(double ** restrict M,  // array of M values
-                           const int m)           // maximum order
+static void RombergIterate(const romb2d * restrict r,double ** restrict M, // array of M values
+                           const int m)                                     // maximum order
 /* performs one Romberg iteration; transforms previous array of M into a new one
  * M_m^k=((4^m)*M_(m-1)^(k+1)-M_(m-1)^k)/(4^m-1); our storage implies M_(m-1-k)^k -old-> M[k] -new-> M_(m-k)^k
  */
 {
 	int k,comp;
 
-	for (k=m-1;k>=0;k--) for (comp=0;comp<dim;comp++) M[k][comp]=tv2[m-k]*(tv1[m-k]*M[k+1][comp]-M[k][comp]);
+	for (k=m-1;k>=0;k--) for (comp=0;comp<r->dim;comp++)
+		M[k][comp]=r->tv2[m-k]*(r->tv1[m-k]*M[k+1][comp]-M[k][comp]);
 }
 
 //======================================================================================================================
 
-static double InnerInitT(const int fixed,double * restrict res)
-/* Calculate term T_0^0 for the inner integration of func over phi_min < phi < phi_max for fixed
- * theta = th_f
- */
+static void AddInner(romb2d * restrict r,const int fixed,const bool onepoint,const int step)
+// adds inner integration for theta=fixed to the list of open ones
 {
-	int comp;
-	double err;
-
-	// calculate first point
-	err=(*func)(fixed,0,res);
-	N_eval++;
-
-	if (!input[PHI].equival) {
-		// calculate last point
-		err=0.5*(err+(*func)(fixed,input[PHI].Grid_size-1,dummy_in));
-		N_eval++;
-		for (comp=0;comp<dim;++comp) res[comp] = 0.5*(dummy_in[comp]+res[comp]);
+	inner_state *in=r->in+r->n_in;
+
+	in->fixed=fixed;
+	in->onepoint = onepoint || r->input[PHI].Grid_size==1;
+	in->step=step;
+	in->done=false;
+	in->m=in->m0=0;
+	in->n_st=in->n_eval=0;
+	// redundant initialization to remove warnings
+	in->int_err=in->abs_err=in->err=0;
+	if (!in->onepoint) {
+		MALLOC_DMATRIX(in->M,r->size_in+1,r->dim,ONE);
+		MALLOC_VECTOR(in->T,double,r->dim,ONE);
 	}
-	return err;
+	MALLOC_VECTOR(in->res,double,r->dim,ONE);
+	r->n_in++;
 }
 
 //======================================================================================================================
 
-static double InnerTrapzd(const int fixed,double * restrict res,const int n)
-/* Calculate n'th refinement (term M_0^n) for the inner integration of func over phi_min < phi < phi_max for fixed
- * theta = th_f
+static void OpenStep(romb2d * restrict r,const int s)
+/* opens outer step s, i.e. adds the corresponding inner integrations. Step 0 calculates term T_0^0 (or the single
+ * point, if there is only one), step s>0 - (s-1)'th refinement (term M_0^(s-1)) of the outer integration
  */
 {
-	int comp,step;
+	int step;
 	size_t j;
-	double temp,err;
-
-	step=(input[PHI].Grid_size-1)>>n;
-	// init sum
-	for (comp=0;comp<dim;++comp) res[comp]=0;
-	err=0;
-	// accumulate sum
-	for (j=step>>1;j<input[PHI].Grid_size;j+=step) {
-		err+=(*func)(fixed,j,dummy_in);
-		N_eval++;
-		for (comp=0;comp<dim;++comp) res[comp]+=dummy_in[comp];
-	}
-	// scale it
-	temp=pow(2,-n);
-	for (comp=0;comp<dim;++comp) res[comp]*=temp;
-	return (err*temp);
-}
+	const Parms_1D *th=r->input+THETA;
 
-//======================================================================================================================
-
-static double InnerRomberg(const int fixed,double * restrict res,const bool onepoint)
-/* Integrate (average) func for fixed theta=fixed; returns estimate of the absolute error (for the first element); if
- * function is periodic then only the first column of the table is used  - i.e. trapezoid rule; if 'onepoint' is true
- * only one point is used for evaluation, this is used e.g. for theta==0, when all phi points are equivalent
- */
-{
-	int m,m0,comp;
-	double abs_res,abs_err; // norms of result and error
-	double int_err; // absolute error of previous layer integration
-	double err;
-
-	// redundant initialization to remove warnings
-	abs_err=err=int_err=0;
-
-	if (input[PHI].Grid_size==1 ||  onepoint) { // if only one point (really or assumed)
-		int_err=(*func)(fixed,0,res);
-		N_eval++;
-		return int_err;
-	}
-	m0=0; // equals 0 for periodic, m otherwise
-	for (m=0;m<input[PHI].Jmax;m++) {
-		// calculate T_0^m
-		if (m==0) int_err=InnerInitT(fixed,T_in);
+	if (s==0) {
+		if (th->Grid_size==1) AddInner(r,0,false,0);
 		else {
-			if (input[PHI].periodic) for (comp=0;comp<dim;++comp) T_in[comp]=0.5*(T_in[comp]+M_in[0][comp]);
-			else {
-				for (comp=0;comp<dim;++comp) T_in[comp]=tv3[m-1]*tv2[m]*(T_in[comp]-M_in[0][comp])+M_in[0][comp];
-				m0=m;
-			}
-		}
-		// get new integrand values (M_0^m)
-		int_err=0.5*(int_err+InnerTrapzd(fixed,M_in[m0],m));
-		// generate M_1^(m-1), M_2^(m-2), ..., M_(m-1)^1, M_m^0
-		if (m0!=0) RombergIterate(M_in,m);
-		// get error and check for convergence
-		if (m>=input[PHI].Jmin-1) { // this is always reached, sooner or later
-			abs_res=0.5*fabs(M_in[0][0]+T_in[0]);
-			abs_err=0.5*fabs(M_in[0][0]-T_in[0])+int_err;
-			if (abs_res==0) err=0;
-			else err=abs_err/abs_res;
-			if (err<input[PHI].eps) break;
+			AddInner(r,0,th->min==-1 && full_al_range,0);
+			if (!th->equival) AddInner(r,th->Grid_size-1,th->max==1 && full_al_range,0);
 		}
 	}
-	// set result
-	for (comp=0;comp<dim;++comp) res[comp]=0.5*(M_in[0][comp]+T_in[comp]);
-	// set no_convergence
-	if (err>=input[PHI].eps) {
-		fprintf(file,"Inner_qromb converged only to d="GFORMDEF" for cosine value #%d\n",err,fixed);
-		no_convergence++;
+	else {
+		step=(th->Grid_size-1)>>(s-1);
+		for (j=step>>1;j<th->Grid_size;j+=step) AddInner(r,j,false,s);
 	}
-	return (abs_err);
+	r->step1=s+1;
 }
 
 //======================================================================================================================
 
-static double OuterInitT(double * restrict res)
-// Calculate term T_0^0 for the outer integration of func; returns absolute error of the inner integration
+static void BatchNode(romb2d * restrict r,const int theta,const int phi)
+// adds a single node to the current batch
 {
-	int comp;
-	double err;
+	r->batch_th[r->N_batch]=theta;
+	r->batch_ph[r->N_batch]=phi;
+	r->N_batch++;
+}
 
-	// calculate first point
-	err=InnerRomberg(0,res,input[THETA].min==-1 && full_al_range);
+//======================================================================================================================
+
+static void BatchStage(romb2d * restrict r,const int fixed,const int m)
+// adds to the batch all nodes, required for m'th refinement of the inner integration for theta=fixed (see InnerStage)
+{
+	int step;
+	size_t j;
+	const Parms_1D *ph=r->input+PHI;
 
-	if (!input[THETA].equival) {
-		// calculate last point
-		err=0.5*(err + InnerRomberg(input[THETA].Grid_size-1,dummy_out,input[THETA].max==1 && full_al_range));
-		for (comp=0;comp<dim;++comp) res[comp] = 0.5*(dummy_out[comp]+res[comp]);
+	if (m==0) {
+		BatchNode(r,fixed,0);
+		if (!ph->equival) BatchNode(r,fixed,ph->Grid_size-1);
 	}
-	return err;
+	step=(ph->Grid_size-1)>>m;
+	for (j=step>>1;j<ph->Grid_size;j+=step) BatchNode(r,fixed,j);
 }
 
 //======================================================================================================================
 
-static double OuterTrapzd(double * restrict res,const int n)
-/* Calculate n'th refinement for the outer integration of func (term M_0^n); returns absolute error of the inner
- * integration
+static void InnerStage(const romb2d * restrict r,inner_state * restrict in,const double * restrict * val,
+	const double * restrict * err)
+/* performs next (m'th) refinement stage of the inner integration, using function values (and their errors), which are
+ * taken sequentially from val and err (the pointers are shifted accordingly). For m=0 it includes calculation of term
+ * T_0^0 and then term M_0^m is calculated and used to check the convergence. If function is periodic then only the
+ * first column of the table is used - i.e. trapezoid rule.
  */
 {
 	int comp,step;
 	size_t j;
-	double temp,err;
-
-	step=(input[THETA].Grid_size-1)>>n;
-	// init sum
-	for (comp=0;comp<dim;++comp) res[comp]=0;
-	err=0;
-	// accumulate sum
-	for (j=step>>1;j<input[THETA].Grid_size;j+=step) {
-		err+=InnerRomberg(j,dummy_out,false);
-		for (comp=0;comp<dim;++comp) res[comp]+=dummy_out[comp];
+	double temp,e,abs_res;
+	double * restrict M0;
+	const int m=in->m,dim=r->dim;
+	const Parms_1D *ph=r->input+PHI;
+
+	// calculate T_0^m
+	if (m==0) {
+		e=*((*err)++);
+		memcpy(in->T,*val,dim*sizeof(double));
+		(*val)+=dim;
+		in->n_eval++;
+		if (!ph->equival) {
+			e=0.5*(e+*((*err)++));
+			for (comp=0;comp<dim;++comp) in->T[comp]=0.5*((*val)[comp]+in->T[comp]);
+			(*val)+=dim;
+			in->n_eval++;
+		}
+		in->int_err=e;
+	}
+	else {
+		if (ph->periodic) for (comp=0;comp<dim;++comp) in->T[comp]=0.5*(in->T[comp]+in->M[0][comp]);
+		else {
+			for (comp=0;comp<dim;++comp)
+				in->T[comp]=r->tv3[m-1]*r->tv2[m]*(in->T[comp]-in->M[0][comp])+in->M[0][comp];
+			in->m0=m;
+		}
+	}
+	// get new integrand values (M_0^m)
+	M0=in->M[in->m0];
+	step=(ph->Grid_size-1)>>m;
+	for (comp=0;comp<dim;++comp) M0[comp]=0;
+	e=0;
+	for (j=step>>1;j<ph->Grid_size;j+=step) {
+		e+=*((*err)++);
+		for (comp=0;comp<dim;++comp) M0[comp]+=(*val)[comp];
+		(*val)+=dim;
+		in->n_eval++;
+	}
+	temp=pow(2,-m);
+	for (comp=0;comp<dim;++comp) M0[comp]*=temp;
+	in->int_err=0.5*(in->int_err+e*temp);
+	// generate M_1^(m-1), M_2^(m-2), ..., M_(m-1)^1, M_m^0
+	if (in->m0!=0) RombergIterate(r,in->M,m);
+	// get error and check for convergence
+	if (m>=ph->Jmin-1) { // this is always reached, sooner or later
+		abs_res=0.5*fabs(in->M[0][0]+in->T[0]);
+		in->abs_err=0.5*fabs(in->M[0][0]-in->T[0])+in->int_err;
+		if (abs_res==0) in->err=0;
+		else in->err=in->abs_err/abs_res;
+		if (in->err<ph->eps) in->done=true;
 	}
-	// scale it
-	temp=pow(2,-n);
-	for (comp=0;comp<dim;++comp) res[comp]*=temp;
-	return (err*temp);
+	in->m++;
+	if (in->m==ph->Jmax) in->done=true;
+	// set result
+	if (in->done) for (comp=0;comp<dim;++comp) in->res[comp]=0.5*(in->M[0][comp]+in->T[comp]);
 }
 
 //======================================================================================================================
 
-static double OuterRomberg(double * restrict res)
-/* Performs outer integration (averaging). Returns relative error of integration (for the first element). If function is
- * periodic then only the first column of the table is used - i.e. trapezoid rule
+static void OuterStep(romb2d * restrict r,const int s)
+/* performs outer step s (see OpenStep), using the results of the inner integrations. Prints information about the
+ * latter to the log and checks the convergence of the outer integration (when applicable)
  */
 {
-	int m,m0,comp;
-	double abs_res,abs_err; // norms of result and error
-	double int_err; // absolute error of previous layer integration
-	double err;
-
-	// redundant initialization to remove warnings
-	err=int_err=0;
-
-	if (input[THETA].Grid_size==1) { // if only one point
-		N_eval=0;
-		int_err=InnerRomberg(0,res,false);
-		fprintf(file,"single\t\t%d integrand-values were used.\n",N_eval);
-		N_tot_eval+=N_eval;
-		return ((res[0]==0) ? 0 : (int_err/fabs(res[0])));
+	int i,m,comp,n_eval;
+	double e,temp,abs_res,abs_err;
+	double * restrict M0;
+	inner_state *in;
+	const int dim=r->dim;
+	const Parms_1D *th=r->input+THETA;
+
+	// finalize inner integrations (in the order of theta)
+	n_eval=0;
+	for (i=0;i<r->n_in;i++) {
+		in=r->in+i;
+		if (in->step!=s) continue;
+		n_eval+=in->n_eval;
+		if (!in->onepoint && in->err>=r->input[PHI].eps) {
+			fprintf(r->file,"Inner_qromb converged only to d="GFORMDEF" for cosine value #%d\n",in->err,in->fixed);
+			r->no_convergence++;
+		}
+	}
+	in=NULL;
+	for (i=0;i<r->n_in;i++) if (r->in[i].step==s) {
+		in=r->in+i;
+		break;
+	}
+	if (th->Grid_size==1) { // if only one point
+		memcpy(r->res,in->res,dim*sizeof(double));
+		fprintf(r->file,"single\t\t%d integrand-values were used.\n",n_eval);
+		r->N_tot_eval+=n_eval;
+		r->err_out = (r->res[0]==0) ? 0 : (in->abs_err/fabs(r->res[0]));
+		r->finished=true;
+		return;
 	}
-	m0=0; // equals 0 for periodic, m otherwise
-	for (m=0;m<input[THETA].Jmax;m++) {
-		// calculate T_0^m
-		if (m==0) {
-			N_eval=0;
-			int_err=OuterInitT(T_out);
-			fprintf(file,"init\t\t%d integrand-values were used.\n",N_eval);
-			N_tot_eval+=N_eval;
+	if (s==0) { // calculate T_0^0
+		e=in->abs_err;
+		memcpy(r->T_out,in->res,dim*sizeof(double));
+		if (!th->equival) {
+			in++;
+			e=0.5*(e+in->abs_err);
+			for (comp=0;comp<dim;++comp) r->T_out[comp]=0.5*(in->res[comp]+r->T_out[comp]);
 		}
+		r->int_err_out=e;
+		fprintf(r->file,"init\t\t%d integrand-values were used.\n",n_eval);
+		r->N_tot_eval+=n_eval;
+		return;
+	}
+	m=s-1;
+	// calculate T_0^m
+	if (m>0) {
+		if (th->periodic) for (comp=0;comp<dim;++comp) r->T_out[comp]=0.5*(r->T_out[comp]+r->M_out[0][comp]);
 		else {
-			if (input[THETA].periodic) for (comp=0;comp<dim;++comp) T_out[comp]=0.5*(T_out[comp]+M_out[0][comp]);
-			else {
-				for (comp=0;comp<dim;++comp) T_out[comp]=tv3[m-1]*tv2[m]*(T_out[comp]-M_out[0][comp])+M_out[0][comp];
-				m0=m;
-			}
-		}
-		// get new integrand values (M_0^m)
-		N_eval=0;
-		int_err=0.5*(int_err+OuterTrapzd(M_out[m0],m));
-		fprintf(file,"%d\t\t%d integrand-values were used.\n",m+1,N_eval);
-		N_tot_eval+=N_eval;
-		// generate M_1^(m-1), M_2^(m-2), ..., M_(m-1)^1, M_m^0
-		if (m0!=0) RombergIterate(M_out,m);
-		// get error and check for convergence
-		if (m>=input[THETA].Jmin-1) { // this is always reached, sooner or later
-			abs_res=0.5*fabs(M_out[0][0]+T_out[0]);
-			// absolute error is sum of the errors for current integration and accumulated inner error
-			abs_err=0.5*fabs(M_out[0][0]-T_out[0])+int_err;
-			if (abs_res==0) err=0;
-			else err=abs_err/abs_res;
-			if (err<input[THETA].eps) break;
+			for (comp=0;comp<dim;++comp)
+				r->T_out[comp]=r->tv3[m-1]*r->tv2[m]*(r->T_out[comp]-r->M_out[0][comp])+r->M_out[0][comp];
+			r->m0_out=m;
 		}
 	}
+	// get new integrand values (M_0^m)
+	M0=r->M_out[r->m0_out];
+	for (comp=0;comp<dim;++comp) M0[comp]=0;
+	e=0;
+	for (;in<r->in+r->n_in && in->step==s;in++) {
+		e+=in->abs_err;
+		for (comp=0;comp<dim;++comp) M0[comp]+=in->res[comp];
+	}
+	temp=pow(2,-m);
+	for (comp=0;comp<dim;++comp) M0[comp]*=temp;
+	r->int_err_out=0.5*(r->int_err_out+e*temp);
+	fprintf(r->file,"%d\t\t%d integrand-values were used.\n",m+1,n_eval);
+	r->N_tot_eval+=n_eval;
+	// generate M_1^(m-1), M_2^(m-2), ..., M_(m-1)^1, M_m^0
+	if (r->m0_out!=0) RombergIterate(r,r->M_out,m);
+	// get error and check for convergence
+	if (m>=th->Jmin-1) { // this is always reached, sooner or later
+		abs_res=0.5*fabs(r->M_out[0][0]+r->T_out[0]);
+		// absolute error is sum of the errors for current integration and accumulated inner error
+		abs_err=0.5*fabs(r->M_out[0][0]-r->T_out[0])+r->int_err_out;
+		if (abs_res==0) r->err_out=0;
+		else r->err_out=abs_err/abs_res;
+		if (r->err_out<th->eps) r->finished=true;
+	}
+	if (m==th->Jmax-1) r->finished=true;
 	// set result
-	for (comp=0;comp<dim;++comp) res[comp]=0.5*(M_out[0][comp]+T_out[comp]);
+	if (r->finished) for (comp=0;comp<dim;++comp) r->res[comp]=0.5*(r->M_out[0][comp]+r->T_out[comp]);
+}
 
-	return (err);
+//======================================================================================================================
+
+static void FreeInner(romb2d * restrict r)
+// frees all inner integrations
+{
+	int i;
+	inner_state *in;
+
+	for (i=0;i<r->n_in;i++) {
+		in=r->in+i;
+		if (!in->onepoint) {
+			Free_dMatrix(in->M,r->size_in+1);
+			Free_general(in->T);
+		}
+		Free_general(in->res);
+	}
+	r->n_in=0;
 }
 
 //======================================================================================================================
@@ -451,29 +463,61 @@ static inline const char *TextTest(const bool cond)
 {
 	return cond ? "true" : "false";
 }
+
 //======================================================================================================================
 
-void Romberg2D(const Parms_1D parms_input[2],double (*func_input)(int theta,int phi,double * restrict res),
-	const int dim_input,double * restrict res,const char * restrict fname)
-/* Integrate 2D func with Romberg's method according to input's parameters. Function func_input returns the estimate of
- * the absolute error. Argument dim_input gives the number of components of (double *). Consistency between 'func' and
- * 'dim_input' is the user's responsibility. Result is normalized on the interval widths, i.e. actually averaging takes
- * place.
+romb2d *Romberg2DInit(const Parms_1D parms_input[2],const int dim_input,const bool wide,const char * restrict fname)
+/* Initializes 2D integration according to input's parameters. Argument dim_input gives the number of components of the
+ * function values. If 'wide' is true, each batch contains all the nodes, which are surely required at this point;
+ * otherwise, each batch corresponds to a single refinement stage of one inner integration (as for nested integration).
+ * Log is printed to file 'fname'.
  */
 {
-	double error;
+	romb2d *r;
+	int i,maxdim;
 	const char *buf1,*buf2;
 	const char *se1,*se2,*sp1,*sp2;
-
-	// initialize global values
-	dim = dim_input;
-	func = func_input;
-	input = parms_input;
-	file=FOpenErr(fname,"w",ONE_POS);
-	no_convergence = 0;
-	N_tot_eval=0;
-
-	AllocateAll(); // allocate memory
+	const Parms_1D *input;
+
+	MALLOC_VECTOR(r,void,sizeof(romb2d),ONE);
+	memcpy(r->input,parms_input,2*sizeof(Parms_1D));
+	input=r->input;
+	r->dim=dim_input;
+	r->wide=wide;
+	r->no_convergence=0;
+	r->N_tot_eval=0;
+	r->finished=false;
+	r->m0_out=0;
+	// redundant initialization to remove warnings
+	r->int_err_out=r->err_out=0;
+	SnprintfErr(ONE_POS,r->fname,MAX_FNAME,"%s",fname);
+	r->file=FOpenErr(fname,"w",ONE_POS);
+	// allocate memory
+	r->size_in=input[PHI].periodic ? 0 : input[PHI].Jmax;
+	r->size_out=input[THETA].periodic ? 0 : input[THETA].Jmax;
+	MALLOC_DMATRIX(r->M_out,r->size_out+1,r->dim,ONE);
+	MALLOC_VECTOR(r->T_out,double,r->dim,ONE);
+	MALLOC_VECTOR(r->res,double,r->dim,ONE);
+	// each theta is integrated only once, and each node is evaluated only once
+	MALLOC_VECTOR(r->in,void,input[THETA].Grid_size*sizeof(inner_state),ONE);
+	MALLOC_VECTOR(r->batch_th,int,input[THETA].Grid_size*input[PHI].Grid_size,ONE);
+	MALLOC_VECTOR(r->batch_ph,int,input[THETA].Grid_size*input[PHI].Grid_size,ONE);
+	// common to fasten calculations; needed only for really Romberg
+	maxdim=MAX(r->size_in,r->size_out);
+	if (maxdim!=0) {
+		MALLOC_VECTOR(r->tv1,double,maxdim+1,ONE);
+		MALLOC_DVECTOR2(r->tv2,1,maxdim,ONE);
+		MALLOC_VECTOR(r->tv3,double,maxdim+1,ONE);
+		r->tv1[0]=1;
+		for (i=1;i<maxdim;i++) {
+			r->tv1[i]=r->tv1[i-1]*4;
+			r->tv2[i]=1/(r->tv1[i]-1);
+			r->tv3[i-1]=2*r->tv1[i-1]-1;
+		}
+	}
+	// the first stages until the convergence is checked (but at least one)
+	r->sure_in=MIN(MAX(input[PHI].Jmin,1),input[PHI].Jmax);
+	r->sure_out=MIN(MAX(input[THETA].Jmin,1),input[THETA].Jmax);
 
 	if (orient_avg) {
 		buf1="BETA";
@@ -488,7 +532,7 @@ void Romberg2D(const Parms_1D parms_input[2],double (*func_input)(int theta,int
 	sp1=TextTest(input[THETA].periodic);
 	sp2=TextTest(input[PHI].periodic);
 	// print info
-	fprintf(file,
+	fprintf(r->file,
 		"                   %4s(rad)   cos(%s)\n"
 		"EPS                    %-7g   "GFORMDEF"\n"
 		"Refinement stages:\n"
@@ -505,26 +549,155 @@ void Romberg2D(const Parms_1D parms_input[2],double (*func_input)(int theta,int
 		input[PHI].min,input[THETA].min,
 		input[PHI].max,input[THETA].max,
 		se2,se1,sp2,sp1);
-	fprintf(file,"\n\nOuter-Loop\tInner Loop\n");
+	fprintf(r->file,"\n\nOuter-Loop\tInner Loop\n");
+	// open the outer steps, which are surely required
+	r->n_in=0;
+	r->step0=0;
+	OpenStep(r,0);
+	if (input[THETA].Grid_size!=1) for (i=1;i<=r->sure_out;i++) OpenStep(r,i);
+	return r;
+}
 
-	error=OuterRomberg(res); // main calculation
+//======================================================================================================================
 
+int Romberg2DNext(romb2d * restrict r,const int ** theta,const int ** phi)
+/* Returns the number of nodes in the next batch and sets theta and phi to the arrays of their indices (valid until the
+ * next call of Romberg2DSubmit). Zero is returned, when the integration is finished. Function values for these nodes
+ * (in the same order) should then be passed to Romberg2DSubmit.
+ */
+{
+	int i,k;
+	inner_state *in;
+
+	r->N_batch=0;
+	if (!r->finished) for (i=0;i<r->n_in;i++) {
+		in=r->in+i;
+		if (in->done) continue;
+		in->start=r->N_batch;
+		if (in->onepoint) {
+			BatchNode(r,in->fixed,0);
+			in->n_st=1;
+		}
+		else {
+			in->n_st = (r->wide && in->m<r->sure_in) ? r->sure_in-in->m : 1;
+			for (k=in->m;k<in->m+in->n_st;k++) BatchStage(r,in->fixed,k);
+		}
+		if (!r->wide) break;
+	}
+	(*theta)=r->batch_th;
+	(*phi)=r->batch_ph;
+	return r->N_batch;
+}
+
+//======================================================================================================================
+
+void Romberg2DSubmit(romb2d * restrict r,const double * restrict values,const double * restrict errors)
+/* Accepts the function values (blocks of size dim) for all nodes of the last batch, and estimates of their absolute
+ * errors (NULL means zero errors). When all inner integrations of the open outer steps are finished, performs the
+ * latter and opens the next one (if required).
+ */
+{
+	int i,k;
+	inner_state *in;
+	const double *val,*err;
+	double * restrict zero=NULL;
+	bool all_done;
+
+	if (errors==NULL) {
+		MALLOC_VECTOR(zero,double,r->N_batch,ONE);
+		for (i=0;i<r->N_batch;i++) zero[i]=0;
+		errors=zero;
+	}
+	all_done=true;
+	for (i=0;i<r->n_in;i++) {
+		in=r->in+i;
+		if (!in->done && in->n_st>0) {
+			val=values+in->start*r->dim;
+			err=errors+in->start;
+			if (in->onepoint) {
+				memcpy(in->res,val,r->dim*sizeof(double));
+				in->abs_err=err[0];
+				in->n_eval=1;
+				in->done=true;
+			}
+			else for (k=0;k<in->n_st && !in->done;k++) InnerStage(r,in,&val,&err);
+			in->n_st=0;
+		}
+		if (!in->done) all_done=false;
+	}
+	Free_general(zero);
+	// perform outer steps and open next one
+	if (all_done) {
+		for (i=r->step0;i<r->step1 && !r->finished;i++) OuterStep(r,i);
+		FreeInner(r);
+		r->step0=r->step1;
+		if (!r->finished) OpenStep(r,r->step1);
+	}
+}
+
+//======================================================================================================================
+
+void Romberg2DFinish(romb2d * restrict r,double * restrict res)
+// puts the result of the integration into res, finalizes the log, and frees the integrator object
+{
+	const Parms_1D *input=r->input;
+
+	memcpy(res,r->res,r->dim*sizeof(double));
 	// finalize log
-	if (error<input[THETA].eps) {
-		if (no_convergence==0) PrintBoth(file,"All inner integrations converged\n"
-		                                      "The outer integration converged\n");
-		else PrintBoth(file,"%d inner integrations did not converge.\n"
-		                    "The outer integration converged\n",no_convergence);
+	if (r->err_out<input[THETA].eps) {
+		if (r->no_convergence==0) PrintBoth(r->file,"All inner integrations converged\n"
+		                                            "The outer integration converged\n");
+		else PrintBoth(r->file,"%d inner integrations did not converge.\n"
+		                       "The outer integration converged\n",r->no_convergence);
 	}
 	else {
-		if (no_convergence==0) PrintBoth(file,"Only the outer integration did not converge \n"
-		                                      "It reached d="GFORMDEF"\n",error);
-		else PrintBoth(file,"%d inner integrations did not converge.\n"
-		                    "The outer integration did not converge\n"
-		                    "The outer integration reached d="GFORMDEF"\n",no_convergence,error);
+		if (r->no_convergence==0) PrintBoth(r->file,"Only the outer integration did not converge \n"
+		                                            "It reached d="GFORMDEF"\n",r->err_out);
+		else PrintBoth(r->file,"%d inner integrations did not converge.\n"
+		                       "The outer integration did not converge\n"
+		                       "The outer integration reached d="GFORMDEF"\n",r->no_convergence,r->err_out);
+	}
+	PrintBoth(r->file,"In total %d evaluations were used\n",r->N_tot_eval);
+	FCloseErr(r->file,r->fname,ONE_POS);
+	// free all memory
+	FreeInner(r);
+	Free_dMatrix(r->M_out,r->size_out+1);
+	Free_general(r->T_out);
+	Free_general(r->res);
+	Free_general(r->in);
+	Free_general(r->batch_th);
+	Free_general(r->batch_ph);
+	if (r->size_in!=0 || r->size_out!=0) {
+		Free_general(r->tv1);
+		Free_dVector2(r->tv2,1);
+		Free_general(r->tv3);
 	}
-	PrintBoth(file,"In total %d evaluations were used\n",N_tot_eval);
-	FCloseErr(file,fname,ONE_POS);
+	Free_general(r);
+}
 
-	FreeAll(); // free all memory
+//======================================================================================================================
+
+void Romberg2D(const Parms_1D parms_input[2],double (*func)(int theta,int phi,double * restrict res),
+	const int dim_input,double * restrict res,const char * restrict fname)
+/* Integrate 2D func with Romberg's method according to input's parameters. Function func returns the estimate of the
+ * absolute error. Argument dim_input gives the number of components of (double *). Consistency between 'func' and
+ * 'dim_input' is the user's responsibility. Result is normalized on the interval widths, i.e. actually averaging takes
+ * place. The function is called for one node at a time in the order of nested integration.
+ */
+{
+	int i,n;
+	const int *theta,*phi;
+	double * restrict values,* restrict errors;
+	romb2d *r;
+
+	r=Romberg2DInit(parms_input,dim_input,false,fname);
+	while ((n=Romberg2DNext(r,&theta,&phi))>0) {
+		MALLOC_VECTOR(values,double,n*dim_input,ONE);
+		MALLOC_VECTOR(errors,double,n,ONE);
+		for (i=0;i<n;i++) errors[i]=(*func)(theta[i],phi[i],values+i*dim_input);
+		Romberg2DSubmit(r,values,errors);
+		Free_general(values);
+		Free_general(errors);
+	}
+	Romberg2DFinish(r,res);
 }
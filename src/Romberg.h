@@ -23,7 +23,14 @@
 
 double Romberg1D(Parms_1D param,int size,const double * restrict data,double * restrict ss);
 
-void Romberg2D(const Parms_1D parms_input[2],double (*func_input)(int theta,int phi,double * restrict res),
-	int dim_input, double * restrict res, const char * restrict fname);
+// integrator object for 2D Romberg, defined in Romberg.c
+typedef struct romb2d_struct romb2d;
+
+romb2d *Romberg2DInit(const Parms_1D parms_input[2],int dim_input,bool wide,const char * restrict fname);
+int Romberg2DNext(romb2d * restrict r,const int ** theta,const int ** phi);
+void Romberg2DSubmit(romb2d * restrict r,const double * restrict values,const double * restrict errors);
+void Romberg2DFinish(romb2d * restrict r,double * restrict res);
+void Romberg2D(const Parms_1D parms_input[2],double (*func)(int theta,int phi,double * restrict res),int dim_input,
+	double * restrict res,const char * restrict fname);
 
 #endif // __Romberg_h
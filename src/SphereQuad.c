@@ -0,0 +1,491 @@
+/* Routines for integration (averaging) over the unit sphere, used as alternatives to 2D Romberg for orientation
+ * averaging over beta and gamma
+ *
+ * Lebedev quadrature is based on Lebedev V.I., Laikov D.N. "A quadrature formula for the sphere of the 131st algebraic
+ * order of accuracy," Doklady Mathematics 59, 477-481 (1999). Points are generated from the orbits of the octahedral
+ * group, and their parameters (only several low orders are included) are taken from the tables of this paper. Error
+ * is estimated by comparison with the lower-order rule, which uses a subset of the same orbits (embedded rule). Such
+ * estimate is conservative, since it corresponds to the error of the lower-order rule.
+ *
+ * Quasi Monte Carlo integration uses the first two dimensions of the Sobol sequence with random linear scrambling and
+ * digital shift (Matousek J. "On the L2-discrepancy for anchored boxes," J. Complexity 14, 527-556 (1998)). The points
+ * are mapped uniformly onto the sphere (equally spaced in cos(beta) and gamma). The first 2^J points form a (0,J,2)-net
+ * for any J, therefore the number of points is doubled at each refinement stage and the error is estimated by
+ * comparison with the result for the first half of the points (embedded rule).
+ *
+ * Both are implemented as an integrator object (sphquad), analogous to that of 2D Romberg, which hands out batches of
+ * nodes and accepts the function values for them. Nodes are indexed by a single number, which is used as both beta and
+ * gamma indices of the arrays filled by SphereQuadNodes. All routines normalize the result on the sphere area, i.e.
+ * actually averaging takes place.
+ *
+ * Copyright (C) ADDA contributors
+ * This file is part of ADDA.
+ *
+ * ADDA is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ADDA is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ADDA. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#include "const.h" // keep this first
+#include "SphereQuad.h" // corresponding header
+// project headers
+#include "cmplx.h"
+#include "io.h"
+#include "memory.h"
+#include "mt19937ar.h"
+// system headers
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// LOCAL VARIABLES
+
+/* orbits of the octahedral group, which are used to generate points of Lebedev quadrature; the points are all
+ * permutations of coordinates and their signs of the following (a,b are the parameters of the orbit, c is the rest):
+ * 1 - (1,0,0), 6 points; 2 - (0,a,a), a=1/sqrt(2), 12 points; 3 - (a,a,a), a=1/sqrt(3), 8 points;
+ * 4 - (a,a,c), 24 points; 5 - (a,c,0), 24 points; 6 - (a,b,c), 48 points
+ */
+typedef struct {
+	int code;   // type of orbit (see above)
+	double a,b; // its parameters (if needed)
+	double v;   // weight of each point
+} leb_orbit;
+
+static const leb_orbit leb6[]={{1,0,0,1/6.0}};
+static const leb_orbit leb14[]={{1,0,0,1/15.0},{3,0,0,3/40.0}};
+static const leb_orbit leb26[]={{1,0,0,1/21.0},{2,0,0,4/105.0},{3,0,0,9/280.0}};
+static const leb_orbit leb38[]={{1,0,0,1/105.0},{3,0,0,9/280.0},{5,0.4597008433809831,0,1/35.0}};
+static const leb_orbit leb50[]={{1,0,0,0.1269841269841270e-1},{2,0,0,0.2257495590828924e-1},
+	{3,0,0,0.2109375000000000e-1},{4,0.3015113445777636,0,0.2017333553791887e-1}};
+static const leb_orbit leb74[]={{1,0,0,0.5130671797338464e-3},{2,0,0,0.1660406956574204e-1},
+	{3,0,0,-0.2958603896103896e-1},{4,0.4803844614152614,0,0.2657620708215946e-1},
+	{5,0.3207726489807764,0,0.1652217099371571e-1}};
+static const leb_orbit leb86[]={{1,0,0,0.1154401154401154e-1},{3,0,0,0.1194390908585628e-1},
+	{4,0.3696028464541502,0,0.1111055571060340e-1},{4,0.6943540066026664,0,0.1187650129453714e-1},
+	{5,0.3742430390903412,0,0.1181230374690448e-1}};
+static const leb_orbit leb110[]={{1,0,0,0.3828270494937162e-2},{3,0,0,0.9793737512487512e-2},
+	{4,0.1851156353447362,0,0.8211737283191111e-2},{4,0.6904210483822922,0,0.9942814891178103e-2},
+	{4,0.3956894730559419,0,0.9595471336070963e-2},{5,0.4783690288121502,0,0.9694996361663028e-2}};
+static const leb_orbit leb170[]={{1,0,0,0.5544842902037365e-2},{2,0,0,0.6071332770670752e-2},
+	{3,0,0,0.6383674773515093e-2},{4,0.2551252621114134,0,0.5183387587747790e-2},
+	{4,0.6743601460362766,0,0.6317929009813725e-2},{4,0.4318910696719410,0,0.6201670006589077e-2},
+	{5,0.2613931360335988,0,0.5477143385137348e-2},{6,0.4990453161796037,0.1446630744325115,0.5968383987681156e-2}};
+static const leb_orbit leb194[]={{1,0,0,0.1782340447244611e-2},{2,0,0,0.5716905949977102e-2},
+	{3,0,0,0.5573383178848738e-2},{4,0.6712973442695226,0,0.5608704082587997e-2},
+	{4,0.2892465627575439,0,0.5158237711805383e-2},{4,0.4446933178717437,0,0.5518771467273614e-2},
+	{4,0.1299335447650067,0,0.4106777028169394e-2},{5,0.3457702197611283,0,0.5051846064614808e-2},
+	{6,0.1590417105383530,0.8360360154824589,0.5530248916233094e-2}};
+
+typedef struct {
+	int N;                 // number of points
+	int n_orb;             // number of orbits
+	const leb_orbit *orb;  // orbits
+} leb_rule;
+
+#define LEB_RULE(n) {n,LENGTH(leb##n),leb##n}
+// in increasing order, should be consistent with LEBEDEV_LIST
+static const leb_rule leb_rules[]={LEB_RULE(6),LEB_RULE(14),LEB_RULE(26),LEB_RULE(38),LEB_RULE(50),LEB_RULE(74),
+	LEB_RULE(86),LEB_RULE(110),LEB_RULE(170),LEB_RULE(194)};
+#undef LEB_RULE
+
+#define ORBIT_EPS 1e-12 // tolerance for comparison of orbit parameters
+#define SOBOL_BITS 32   // number of bits in Sobol points
+#define SOBOL_SEED 5489 // seed for scrambling, fixed for reproducibility
+
+struct sphquad_struct { // state of integration over the sphere, see SphereQuadInit()
+	Parms_sphere input;        // parameters of integration
+	int dim;                   // dimension of the data (integrated simultaneously)
+	size_t N;                  // maximum number of points
+	FILE * restrict file;      // file to print info
+	char fname[MAX_FNAME];     // its name
+	double * restrict w,       // weights of Lebedev rule
+	       * restrict w_low;   // weights of the embedded rule (zero for points, which are not used in it)
+	int N_low;                 // number of points in the embedded rule (0 if not available)
+	int J;                     // current refinement stage (for Sobol)
+	size_t N_done;             // number of used points
+	bool finished;             // whether integration is finished
+	bool err_avail;            // whether error estimate is available
+	double err;                // relative error (for the first element)
+	double * restrict sum,     // (weighted) sum of the function values
+	       * restrict sum_low; // the same for the embedded rule
+	int N_batch;               // number of nodes in the current batch
+	int * restrict batch;      // their indices
+};
+
+//======================================================================================================================
+
+static const leb_rule *FindLebedev(const int N)
+// returns Lebedev rule with N points, or NULL if it is not available
+{
+	int i;
+
+	for (i=0;i<LENGTH(leb_rules);i++) if (leb_rules[i].N==N) return leb_rules+i;
+	return NULL;
+}
+
+//======================================================================================================================
+
+static const leb_orbit *FindOrbit(const leb_rule * restrict rule,const leb_orbit * restrict orb)
+// returns the orbit of the rule, which coincides with orb, or NULL if there is no such
+{
+	int i;
+	const leb_orbit *o;
+
+	for (i=0;i<rule->n_orb;i++) {
+		o=rule->orb+i;
+		if (o->code==orb->code && fabs(o->a-orb->a)<ORBIT_EPS && fabs(o->b-orb->b)<ORBIT_EPS) return o;
+	}
+	return NULL;
+}
+
+//======================================================================================================================
+
+static const leb_rule *EmbeddedLebedev(const leb_rule * restrict rule)
+/* returns Lebedev rule of the largest order, all orbits of which are present in the given rule, or NULL if there is no
+ * such
+ */
+{
+	int i;
+	const leb_rule *low;
+
+	for (low=rule-1;low>=leb_rules;low--) {
+		for (i=0;i<low->n_orb;i++) if (FindOrbit(rule,low->orb+i)==NULL) break;
+		if (i==low->n_orb) return low;
+	}
+	return NULL;
+}
+
+//======================================================================================================================
+
+static int GenOrbit(const leb_orbit * restrict orb,double (* restrict xyz)[3])
+// generates all points of the orbit (see above) into xyz and returns their number
+{
+	int n,i,k,perm,sign;
+	double base[3],p[3];
+	bool found;
+	// all permutations of three coordinates
+	static const int perms[6][3]={{0,1,2},{0,2,1},{1,0,2},{1,2,0},{2,0,1},{2,1,0}};
+
+	switch (orb->code) {
+		case 1: base[0]=1; base[1]=base[2]=0; break;
+		case 2: base[0]=0; base[1]=base[2]=sqrt(0.5); break;
+		case 3: base[0]=base[1]=base[2]=sqrt(1/3.0); break;
+		case 4: base[0]=base[1]=orb->a; base[2]=sqrt(1-2*orb->a*orb->a); break;
+		case 5: base[0]=orb->a; base[1]=sqrt(1-orb->a*orb->a); base[2]=0; break;
+		case 6: base[0]=orb->a; base[1]=orb->b; base[2]=sqrt(1-orb->a*orb->a-orb->b*orb->b); break;
+		default: LogError(ONE_POS,"Unknown type of orbit (%d) for Lebedev quadrature",orb->code);
+	}
+	// add all distinct points, obtained by permutations and changes of signs
+	n=0;
+	for (perm=0;perm<6;perm++) for (sign=0;sign<8;sign++) {
+		for (k=0;k<3;k++) p[k] = ((sign>>k)&1) ? -base[perms[perm][k]] : base[perms[perm][k]];
+		found=false;
+		for (i=0;i<n && !found;i++)
+			found = fabs(xyz[i][0]-p[0])<ORBIT_EPS && fabs(xyz[i][1]-p[1])<ORBIT_EPS && fabs(xyz[i][2]-p[2])<ORBIT_EPS;
+		if (!found) {
+			memcpy(xyz[n],p,3*sizeof(double));
+			n++;
+		}
+	}
+	return n;
+}
+
+//======================================================================================================================
+
+static void LebedevPoints(const leb_rule * restrict rule,double * restrict beta,double * restrict gamma,
+	double * restrict w,double * restrict w_low)
+/* generates points of Lebedev rule as angles beta and gamma (in degrees), and weights of the rule and of the embedded
+ * one; any of the output arrays can be NULL
+ */
+{
+	int i,j,n,ind;
+	double xyz[48][3]; // maximum number of points in the orbit
+	const leb_rule *low;
+	const leb_orbit *orb_low;
+
+	low=EmbeddedLebedev(rule);
+	ind=0;
+	for (i=0;i<rule->n_orb;i++) {
+		n=GenOrbit(rule->orb+i,xyz);
+		orb_low = (low==NULL) ? NULL : FindOrbit(low,rule->orb+i);
+		for (j=0;j<n;j++) {
+			if (beta!=NULL) beta[ind]=Rad2Deg(acos(xyz[j][2]));
+			if (gamma!=NULL) {
+				gamma[ind]=Rad2Deg(atan2(xyz[j][1],xyz[j][0]));
+				if (gamma[ind]<0) gamma[ind]+=FULL_ANGLE;
+			}
+			if (w!=NULL) w[ind]=rule->orb[i].v;
+			if (w_low!=NULL) w_low[ind] = (orb_low==NULL) ? 0 : orb_low->v;
+			ind++;
+		}
+	}
+	if (ind!=rule->N) LogError(ONE_POS,"Inconsistent number of points (%d instead of %d) in Lebedev quadrature",ind,
+		rule->N);
+}
+
+//======================================================================================================================
+
+static inline uint32_t Parity(uint32_t x)
+// returns parity of bits of x
+{
+	x^=x>>16;
+	x^=x>>8;
+	x^=x>>4;
+	x^=x>>2;
+	x^=x>>1;
+	return x&1;
+}
+
+//======================================================================================================================
+
+static void SobolPoints(const size_t N,double * restrict beta,double * restrict gamma)
+/* generates first N points of scrambled 2D Sobol sequence as angles beta and gamma (in degrees). Scrambling is
+ * random, but always with the same seed; hence the result is the same for all processors and all runs
+ */
+{
+	int d,i,k;
+	size_t j;
+	uint32_t v[2][SOBOL_BITS],mask[SOBOL_BITS],shift[2],x[2],t;
+	mt_state st;
+
+	init_genrand_r(&st,SOBOL_SEED);
+	// direction numbers: the first dimension is van der Corput sequence, the second - primitive polynomial x+1
+	for (k=0;k<SOBOL_BITS;k++) {
+		v[0][k]=(uint32_t)1<<(SOBOL_BITS-1-k);
+		v[1][k] = (k==0) ? v[0][0] : (v[1][k-1]^(v[1][k-1]>>1));
+	}
+	// random linear scrambling (lower-triangular matrix with unit diagonal, starting from most significant bit)
+	for (d=0;d<2;d++) {
+		for (i=0;i<SOBOL_BITS;i++) {
+			t=(uint32_t)1<<(SOBOL_BITS-1-i);
+			mask[i]=t|((uint32_t)genrand_int32_r(&st)&~(t|(t-1)));
+		}
+		for (k=0;k<SOBOL_BITS;k++) {
+			t=0;
+			for (i=0;i<SOBOL_BITS;i++) if (Parity(mask[i]&v[d][k])) t|=(uint32_t)1<<(SOBOL_BITS-1-i);
+			v[d][k]=t;
+		}
+		shift[d]=(uint32_t)genrand_int32_r(&st);
+	}
+	// generate points and map them uniformly on the sphere
+	for (j=0;j<N;j++) {
+		x[0]=shift[0];
+		x[1]=shift[1];
+		for (k=0;(j>>k)!=0;k++) if ((j>>k)&1) {
+			x[0]^=v[0][k];
+			x[1]^=v[1][k];
+		}
+		beta[j]=Rad2Deg(acos(1-2*ldexp(x[0]+0.5,-SOBOL_BITS)));
+		gamma[j]=FULL_ANGLE*ldexp(x[1]+0.5,-SOBOL_BITS);
+	}
+}
+
+//======================================================================================================================
+
+size_t SphereQuadSize(const Parms_sphere * restrict parms_input)
+// returns the (maximum) number of points used by the integration scheme, or 0 if the scheme is not available
+{
+	switch (parms_input->scheme) {
+		case AVG_LEBEDEV: return (FindLebedev(parms_input->N)==NULL) ? 0 : (size_t)parms_input->N;
+		case AVG_SOBOL: return (size_t)1<<parms_input->Jmax;
+		default: return 0;
+	}
+}
+
+//======================================================================================================================
+
+void SphereQuadNodes(const Parms_sphere * restrict parms_input,double * restrict beta,double * restrict gamma)
+// fills arrays of beta and gamma (in degrees) for all nodes of the integration scheme; size is given by SphereQuadSize
+{
+	if (parms_input->scheme==AVG_LEBEDEV) LebedevPoints(FindLebedev(parms_input->N),beta,gamma,NULL,NULL);
+	else SobolPoints(SphereQuadSize(parms_input),beta,gamma);
+}
+
+//======================================================================================================================
+
+sphquad *SphereQuadInit(const Parms_sphere * restrict parms_input,const int dim_input,const char * restrict fname)
+/* Initializes integration over the sphere according to input's parameters. Argument dim_input gives the number of
+ * components of the function values. Log is printed to file 'fname'.
+ */
+{
+	sphquad *q;
+	const leb_rule *rule,*low;
+
+	MALLOC_VECTOR(q,void,sizeof(sphquad),ONE);
+	q->input=*parms_input;
+	q->dim=dim_input;
+	q->N=SphereQuadSize(parms_input);
+	q->N_done=0;
+	q->finished=false;
+	q->err_avail=false;
+	q->err=0;
+	q->w=q->w_low=NULL;
+	q->N_low=0;
+	SnprintfErr(ONE_POS,q->fname,MAX_FNAME,"%s",fname);
+	q->file=FOpenErr(fname,"w",ONE_POS);
+	MALLOC_VECTOR(q->sum,double,q->dim,ONE);
+	MALLOC_VECTOR(q->sum_low,double,q->dim,ONE);
+	memset(q->sum,0,q->dim*sizeof(double));
+	memset(q->sum_low,0,q->dim*sizeof(double));
+	MALLOC_VECTOR(q->batch,int,q->N,ONE);
+	// print info
+	if (q->input.scheme==AVG_LEBEDEV) {
+		rule=FindLebedev(q->input.N);
+		low=EmbeddedLebedev(rule);
+		if (low!=NULL) q->N_low=low->N;
+		MALLOC_VECTOR(q->w,double,q->N,ONE);
+		MALLOC_VECTOR(q->w_low,double,q->N,ONE);
+		LebedevPoints(rule,NULL,NULL,q->w,q->w_low);
+		fprintf(q->file,
+			"Lebedev quadrature over the unit sphere (BETA,GAMMA)\n"
+			"EPS                    "GFORMDEF"\n"
+			"Number of points       %d\n",
+			q->input.eps,q->input.N);
+		if (q->N_low==0) fprintf(q->file,"Embedded rule          not available\n");
+		else fprintf(q->file,"Embedded rule          %d points\n",q->N_low);
+		fprintf(q->file,"\n\nPoints\t\tRelative error\n");
+	}
+	else {
+		q->J=q->input.Jmin;
+		fprintf(q->file,
+			"Scrambled Sobol points over the unit sphere (BETA,GAMMA)\n"
+			"EPS                    "GFORMDEF"\n"
+			"Refinement stages:\n"
+			"Minimum                %d\n"
+			"Maximum                %d\n",
+			q->input.eps,q->input.Jmin,q->input.Jmax);
+		fprintf(q->file,"\n\nStage\t\tPoints\t\tRelative error\n");
+	}
+	return q;
+}
+
+//======================================================================================================================
+
+int SphereQuadNext(sphquad * restrict q,const int ** nodes)
+/* Returns the number of nodes in the next batch and sets nodes to the array of their indices (valid until the next call
+ * of SphereQuadSubmit). Zero is returned, when the integration is finished. Function values for these nodes (in the
+ * same order) should then be passed to SphereQuadSubmit.
+ */
+{
+	size_t j,end;
+
+	q->N_batch=0;
+	if (!q->finished) {
+		end = (q->input.scheme==AVG_LEBEDEV) ? q->N : ((size_t)1<<q->J);
+		for (j=q->N_done;j<end;j++) q->batch[q->N_batch++]=(int)j;
+	}
+	(*nodes)=q->batch;
+	return q->N_batch;
+}
+
+//======================================================================================================================
+
+static void SetError(sphquad * restrict q,const double res0,const double low0)
+// sets relative error (for the first element) from the results of the main and embedded rules
+{
+	q->err_avail=true;
+	if (res0==0) q->err=0;
+	else q->err=fabs(res0-low0)/fabs(res0);
+}
+
+//======================================================================================================================
+
+void SphereQuadSubmit(sphquad * restrict q,const double * restrict values)
+/* Accepts the function values (blocks of size dim) for all nodes of the last batch. Then checks the convergence and
+ * decides whether the next refinement stage is required.
+ */
+{
+	int i,comp,ind;
+	size_t half;
+	const double *val;
+	double tmp;
+
+	if (q->input.scheme==AVG_LEBEDEV) {
+		for (i=0;i<q->N_batch;i++) {
+			ind=q->batch[i];
+			val=values+i*q->dim;
+			for (comp=0;comp<q->dim;comp++) {
+				q->sum[comp]+=q->w[ind]*val[comp];
+				q->sum_low[comp]+=q->w_low[ind]*val[comp];
+			}
+		}
+		q->N_done=q->N;
+		if (q->N_low!=0) {
+			SetError(q,q->sum[0],q->sum_low[0]);
+			fprintf(q->file,"%zu\t\t"GFORMDEF"\n",q->N,q->err);
+		}
+		else fprintf(q->file,"%zu\t\tnot available\n",q->N);
+		q->finished=true;
+	}
+	else {
+		// the embedded rule is the first half of the points; its sum is saved on the way
+		half=(size_t)1<<(q->J-1);
+		for (i=0;i<q->N_batch;i++) {
+			if (q->N_done+i==half) memcpy(q->sum_low,q->sum,q->dim*sizeof(double));
+			val=values+i*q->dim;
+			for (comp=0;comp<q->dim;comp++) q->sum[comp]+=val[comp];
+		}
+		q->N_done+=q->N_batch;
+		tmp=q->sum_low[0]/half;
+		SetError(q,q->sum[0]/q->N_done,tmp);
+		fprintf(q->file,"%d\t\t%zu\t\t"GFORMDEF"\n",q->J,q->N_done,q->err);
+		if (q->err<q->input.eps || q->J==q->input.Jmax) q->finished=true;
+		else q->J++;
+	}
+}
+
+//======================================================================================================================
+
+void SphereQuadFinish(sphquad * restrict q,double * restrict res)
+// puts the result of the integration into res, finalizes the log, and frees the integrator object
+{
+	int comp;
+	double norm;
+
+	// for Lebedev the weights are already normalized
+	norm = (q->input.scheme==AVG_LEBEDEV) ? 1 : 1.0/q->N_done;
+	for (comp=0;comp<q->dim;comp++) res[comp]=norm*q->sum[comp];
+	// finalize log
+	if (!q->err_avail) PrintBoth(q->file,"Error estimate is not available (no embedded rule)\n");
+	else if (q->err<q->input.eps) PrintBoth(q->file,"The integration converged\n");
+	else PrintBoth(q->file,"The integration did not converge\n"
+	                       "It reached d="GFORMDEF"\n",q->err);
+	PrintBoth(q->file,"In total %zu evaluations were used\n",q->N_done);
+	FCloseErr(q->file,q->fname,ONE_POS);
+	// free all memory
+	Free_general(q->sum);
+	Free_general(q->sum_low);
+	Free_general(q->batch);
+	Free_general(q->w);
+	Free_general(q->w_low);
+	Free_general(q);
+}
+
+//======================================================================================================================
+
+void SphereQuad(const Parms_sphere * restrict parms_input,double (*func)(int beta,int gamma,double * restrict res),
+	const int dim_input,double * restrict res,const char * restrict fname)
+/* Integrate (average) func over the unit sphere according to input's parameters. Function func is called with the
+ * same index of the node for both beta and gamma (see SphereQuadNodes); its return value is not used. Argument
+ * dim_input gives the number of components of (double *).
+ */
+{
+	int i,n;
+	const int *nodes;
+	double * restrict values;
+	sphquad *q;
+
+	q=SphereQuadInit(parms_input,dim_input,fname);
+	while ((n=SphereQuadNext(q,&nodes))>0) {
+		MALLOC_VECTOR(values,double,n*dim_input,ONE);
+		for (i=0;i<n;i++) (*func)(nodes[i],nodes[i],values+i*dim_input);
+		SphereQuadSubmit(q,values);
+		Free_general(values);
+	}
+	SphereQuadFinish(q,res);
+}
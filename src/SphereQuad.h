@@ -0,0 +1,36 @@
+/* Definitions of routines for integration (averaging) over the unit sphere
+ *
+ * Copyright (C) ADDA contributors
+ * This file is part of ADDA.
+ *
+ * ADDA is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ADDA is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ADDA. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifndef __SphereQuad_h
+#define __SphereQuad_h
+
+// project headers
+#include "types.h" // needed for Parms_sphere
+
+// supported numbers of points for Lebedev quadrature
+#define LEBEDEV_LIST "6, 14, 26, 38, 50, 74, 86, 110, 170, 194"
+
+// integrator object for the unit sphere, defined in SphereQuad.c
+typedef struct sphquad_struct sphquad;
+
+size_t SphereQuadSize(const Parms_sphere * restrict parms_input);
+void SphereQuadNodes(const Parms_sphere * restrict parms_input,double * restrict beta,double * restrict gamma);
+sphquad *SphereQuadInit(const Parms_sphere * restrict parms_input,int dim_input,const char * restrict fname);
+int SphereQuadNext(sphquad * restrict q,const int ** nodes);
+void SphereQuadSubmit(sphquad * restrict q,const double * restrict values);
+void SphereQuadFinish(sphquad * restrict q,double * restrict res);
+void SphereQuad(const Parms_sphere * restrict parms_input,double (*func)(int beta,int gamma,double * restrict res),
+	int dim_input,double * restrict res,const char * restrict fname);
+
+#endif // __SphereQuad_h
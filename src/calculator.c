@@ -20,33 +20,56 @@
 #include "crosssec.h"
 #include "debug.h"
 #include "fft.h"
+#include "hmatrix.h"
 #include "interaction.h"
 #include "io.h"
 #include "memory.h"
 #include "oclcore.h"
 #include "Romberg.h"
+#include "SphereQuad.h"
 #include "timing.h"
 #include "vars.h"
 // system headers
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef OPENMP
+#	include <omp.h>
+#endif
 
 // SEMI-GLOBAL VARIABLES
 
 // defined and initialized in crosssec.c
 extern const Parms_1D parms[2],parms_alpha;
+extern const Parms_sphere parms_sphere;
 extern const angle_set beta_int,gamma_int,theta_int,phi_int;
 // defined and initialized in param.c
 extern const bool avg_inc_pol;
+#ifdef SPARSE
+extern const enum spstore sparse_store;
+extern const bool sparse_sym,sparse_ring;
+extern const double aca_eps;
+#endif
 extern const double polNlocRp;
 extern const char *alldir_parms,*scat_grid_parms;
+#ifdef PARALLEL
+extern const int orient_groups;
+#endif
+#if defined(PARALLEL) && !defined(SPARSE)
+extern const bool load_balance;
+// defined and initialized in make_particle.c
+extern unsigned short * restrict slabPosition;
+extern size_t * restrict slabSpanStart;
+#endif
 // defined and initialized in timing.c
 extern TIME_TYPE Timing_Init,Timing_Init_Int;
 #ifdef OPENCL
 extern TIME_TYPE Timing_OCL_Init;
 #endif
-extern size_t TotalEval;
+extern size_t TotalEval,TotalIter,TotalMatVec;
+#ifdef PARALLEL
+extern TIME_TYPE Timing_OrientComm;
+#endif
 
 // used in CalculateE.c
 double * restrict muel_phi; // used to store values of Mueller matrix for different phi (to integrate)
@@ -55,8 +78,13 @@ double * restrict muel_phi_buf; // additional for integrating with different mul
 doublecomplex * restrict EplaneX, * restrict EplaneY;
 doublecomplex * restrict EyzplX, * restrict EyzplY; // same for scattering in yz-plane
 double dtheta_deg,dtheta_rad; // delta theta in degrees and radians
-doublecomplex * restrict ampl_alphaX,* restrict ampl_alphaY; // amplitude matrix for different values of alpha
-double * restrict muel_alpha; // mueller matrix for different values of alpha
+/* amplitude matrix for different values of theta, alpha, and two incident polarizations (in this order of indices, the
+ * latter is the fastest); its part for the local range of theta is then transformed into mueller matrix for different
+ * values of alpha (muel_alpha)
+ */
+doublecomplex * restrict ampl_alpha;
+double * restrict muel_alpha;
+size_t theta0_loc,nTheta_loc; // local range of theta (first index and number), used for integration over alpha
 
 // used in crosssec.c
 doublecomplex * restrict E_ad; // complex field E, calculated for alldir
@@ -72,14 +100,28 @@ doublecomplex * restrict Avecbuffer; // used to hold the result of matrix-vector
 doublecomplex * restrict vec1,* restrict vec2,* restrict vec3,* restrict vec4;
 // used in matvec.c
 #ifdef SPARSE
-doublecomplex * restrict arg_full; // vector to hold argvec for all dipoles
+doublecomplex * restrict arg_full; // vector to hold argvec for all dipoles (one per node, see SharedVector)
+doublecomplex * restrict sym_buf;  // buffers for all OpenMP threads (except one) used in MatVec with sparse_sym
+doublecomplex * restrict Gstore,* restrict Rstore; // stored interaction terms (direct and reflected) for local dipoles
+doublecomplex *ring_buf[2]; // buffers for blocks of argvec in the ring exchange (-sparse_ring); then arg_full is not used
 #endif
 
 // LOCAL VARIABLES
 
+#ifdef SPARSE
+#	define SPARSE_STORE_FRAC 0.5 // maximum fraction of available memory used for automatic storage of interaction matrix
+#endif
 static size_t block_theta; // size of one block of mueller matrix - 16*nTheta
 static int finish_avg; // whether to stop orientation averaging; defined as int to simplify MPI casting
 static double * restrict out; // used to collect both mueller matrix and integral scattering quantities when orient_avg
+static double * restrict muel_int; // mueller matrix integrated over alpha for the local range of theta (except root)
+// distribution of theta among processors in number of elements of ampl_alpha and integrated mueller matrix
+static size_t * restrict ampl_counts,* restrict muel_counts;
+#ifdef PARALLEL
+// used for orientation averaging by several groups of processors (-orient_groups)
+static int * restrict batch_nodes;  // indices of beta and gamma for the current batch of orientations (all processors)
+static double * restrict batch_res; // and results (blocks of size block_theta+2), final ones are only on root
+#endif
 
 /* the following definitions and data are from Gutkowicz-Krusin D, Draine BT. "Propagation of electromagnetic waves on a
  * rectangular lattice of polarizable points" (2004). Available from: http://arxiv.org/abs/astro-ph/0403082.
@@ -292,6 +334,10 @@ int CalculateE(enum incpol which,enum Eftype type);
 bool TestExtendThetaRange(void);
 void MuellerMatrix(void);
 void SaveMuellerAndCS(double * restrict in);
+#ifdef SPARSE
+// matvec.c
+void InitSparseStore(void);
+#endif
 
 //======================================================================================================================
 
@@ -613,6 +659,11 @@ static void calculate_one_orientation(double * restrict res)
 // performs calculation for one orientation; may do orientation averaging and put the result in res
 {
 	TIME_TYPE tstart;
+	size_t j;
+	double err,norms[2],*buf;
+#ifdef PARALLEL
+	TIME_TYPE tcomm;
+#endif
 
 	if (orient_avg) {
 		alph_deg=0;
@@ -626,15 +677,13 @@ static void calculate_one_orientation(double * restrict res)
 		if (!orient_avg) fprintf(logfile,"\nhere we go, calc Y\n\n");
 	}
 	InitCC(INCPOL_Y);
-	// symR implies that prop is along z (in particle RF). Then it is fine for both definitions of scattering angles
-	if (symR && !scat_grid) {
+	/* symR implies that prop is along z (in particle RF). Then it is fine for both definitions of scattering angles.
+	 * For scat_grid the field for X-polarization is obtained by 90-degree rotation over prop (see CalcScatGrid).
+	 */
+	if (symR) {
 		if (CalculateE(INCPOL_Y,CE_PARPER)==CHP_EXIT) return;
 	}
 	else { // no rotational symmetry
-		/* TODO: in case of scat_grid we run twice to get the full electric field with incoming light polarized in X and
-		 * Y direction. In case of rotational symmetry this is not needed but requires lots more programming so we leave
-		 * this optimization to a later time.
-		 */
 		if (CalculateE(INCPOL_Y,CE_NORMAL)==CHP_EXIT) return;
 
 		if (IFROOT) {
@@ -649,14 +698,34 @@ static void calculate_one_orientation(double * restrict res)
 		if (CalculateE(INCPOL_X,CE_NORMAL)==CHP_EXIT) return;
 	}
 	D("CalculateE finished");
+	tstart=GET_TIME();
+#ifdef PARALLEL
+	// amplitude matrix is summed over processors, each of them retains only its own range of theta
+	if (orient_avg && store_mueller) ReduceScatter(ampl_alpha,cmplx_type,ampl_counts,&Timing_OrientComm);
+#endif
 	MuellerMatrix();
 	D("MuellerMatrix finished");
-	if (IFROOT && orient_avg) {
-		tstart=GET_TIME();
-		if (store_mueller) PRINTFB("\nError of alpha integration (Mueller) is "GFORMDEF"\n",
-			Romberg1D(parms_alpha,block_theta,muel_alpha,res+2));
-		memcpy(res,muel_alpha-2,2*sizeof(double));
-		D("Integration over alpha completed on root");
+	if (orient_avg) {
+		if (store_mueller) {
+			// each processor integrates its own range of theta, then the results are collected on root
+			buf = IFROOT ? res+2 : muel_int;
+			norms[0]=norms[1]=0;
+			if (nTheta_loc>0) {
+				err=Romberg1D(parms_alpha,16*nTheta_loc,muel_alpha,buf);
+				for (j=0;j<16*nTheta_loc;j++) norms[0]+=buf[j]*buf[j];
+				norms[1]=err*err*norms[0];
+			}
+#ifdef PARALLEL
+			// relative mean-square error over all theta is obtained from the norms of the result and the error
+			Accumulate(norms,double_type,2,&tcomm);
+			Timing_OrientComm+=tcomm;
+			GatherVar(buf,double_type,muel_counts,&Timing_OrientComm);
+#endif
+			if (IFROOT) PRINTFB("\nError of alpha integration (Mueller) is "GFORMDEF"\n",
+				(norms[0]==0) ? 0 : sqrt(norms[1]/norms[0]));
+		}
+		if (IFROOT) memcpy(res,muel_alpha-2,2*sizeof(double));
+		D("Integration over alpha completed");
 		Timing_Integration += GET_TIME() - tstart;
 	}
 	TotalEval++;
@@ -664,8 +733,41 @@ static void calculate_one_orientation(double * restrict res)
 
 //======================================================================================================================
 
+#ifdef PARALLEL
+
+static void orient_batch(int n,const int * restrict beta_i,const int * restrict gamma_i)
+/* calculates a batch of orientations, distributing them among the groups of processors in a round-robin manner. Called
+ * with the batch of orientations given by the integrator (Romberg or over the unit sphere) on root and with n=0 by all
+ * other processors (then the input is ignored). Results are collected on root in batch_res. Call with n=0 on root
+ * finishes the orientation averaging.
+ */
+{
+	int i;
+	size_t j,dim=block_theta+2;
+
+	if (IFWROOT) {
+		memcpy(batch_nodes,beta_i,n*sizeof(int));
+		memcpy(batch_nodes+n,gamma_i,n*sizeof(int));
+	}
+	BcastOrientBatch(&n,batch_nodes);
+	finish_avg=(n==0);
+	if (finish_avg) return;
+	// only roots of the groups fill in their results, all the rest is zero
+	REALLOC_VECTOR(batch_res,double,n*dim,ALL);
+	for (j=0;j<n*dim;j++) batch_res[j]=0;
+	for (i=orientGroup;i<n;i+=orient_groups) {
+		bet_deg=beta_int.val[batch_nodes[i]];
+		gam_deg=gamma_int.val[batch_nodes[n+i]];
+		calculate_one_orientation(batch_res+i*dim);
+	}
+	AccumulateGroups(batch_res,double_type,n*dim,&Timing_OrientComm);
+}
+
+#endif // PARALLEL
+//======================================================================================================================
+
 static double orient_integrand(int beta_i,int gamma_i, double * restrict res)
-// function that provides interface with Romberg integration
+// function that provides interface with integration over beta and gamma (Romberg or over the unit sphere)
 {
 	BcastOrient(&beta_i,&gamma_i,&finish_avg);
 	if (finish_avg) return 0;
@@ -681,6 +783,7 @@ static double orient_integrand(int beta_i,int gamma_i, double * restrict res)
 static void AllocateEverything(void)
 // allocates a lot of arrays and performs memory analysis
 {
+	int i;
 	double tmp;
 	size_t temp_int;
 	double memmax;
@@ -703,10 +806,64 @@ static void AllocateEverything(void)
 	}
 	memory+=5*tmp;
 #ifdef SPARSE
-	if (!prognosis) { // overflow of 3*nvoid_Ndip is tested in MakeParticle()
-		MALLOC_VECTOR(arg_full,complex,3*nvoid_Ndip,ALL);
+	bool store=false; // whether the interaction matrix is stored
+	if (sparse_store!=SS_NONE) {
+		// overflow of NDCOMP*local_nvoid_Ndip is impossible, since 3*nvoid_Ndip is tested in MakeParticle()
+		const size_t nstore=MultOverflow(NDCOMP*local_nvoid_Ndip,nvoid_Ndip,ONE_POS,"Gstore");
+		const int nmat = surface ? 2 : 1;
+		const double storeSize=nmat*sizeof(doublecomplex)*(double)nstore;
+		store=true;
+		if (sparse_store==SS_AUTO) { // decision is made collectively, so that all processors use the same mode
+			double nfail = (storeSize<=SPARSE_STORE_FRAC*AvailableMemory()) ? 0 : 1;
+			MyInnerProduct(&nfail,double_type,1,NULL);
+			store = (nfail==0);
+		}
+		if (IFROOT) PrintBoth(logfile,"Interaction matrix %s stored (requires "FFORMM" MB in total)\n",
+			store ? "is" : "is not",nmat*NDCOMP*sizeof(doublecomplex)*(double)nvoid_Ndip*nvoid_Ndip/MBYTE);
+		if (store) {
+			if (!prognosis) {
+				MALLOC_VECTOR(Gstore,complex,nstore,ALL);
+				if (surface) MALLOC_VECTOR(Rstore,complex,nstore,ALL);
+			}
+			memory+=storeSize;
+			if (sparse_sym) LogWarning(EC_WARN,ONE_POS,"Option '-sparse_sym' is ignored, since the interaction matrix "
+				"is stored");
+			if (sparse_ring) LogWarning(EC_WARN,ONE_POS,"Option '-sparse_ring' is ignored, since the interaction "
+				"matrix is stored");
+		}
+	}
+	if (sparse_ring && !store) { // two buffers for the largest block of argvec (one is enough in sequential mode)
+		size_t start,nmax=0;
+		int step;
+		const int nbuf = (nprocs>1) ? 2 : 1;
+		for (step=0;step<nprocs;step++) nmax=MAX(nmax,RingBlock(step,&start));
+		if (!prognosis) for (step=0;step<nbuf;step++) MALLOC_VECTOR(ring_buf[step],complex,3*nmax,ALL);
+		memory+=nbuf*3*nmax*sizeof(doublecomplex);
 	}
-	memory+=3*nvoid_Ndip*sizeof(doublecomplex);
+	else {
+		if (!prognosis) { // overflow of 3*nvoid_Ndip is tested in MakeParticle(); one copy per node
+			MALLOC_SHARED(arg_full,3*nvoid_Ndip);
+		}
+		memory+=SharedSize(3*nvoid_Ndip*sizeof(doublecomplex));
+	}
+	if (aca_eps!=UNDEF) {
+		if (prognosis) {
+			if (IFROOT) PrintBoth(logfile,"Memory for the hierarchical matrix is not included in the estimate below, "
+				"since it depends on the ranks of low-rank blocks\n");
+		}
+		else {
+			TIME_TYPE startInitHm=GET_TIME();
+			memory+=InitHmatrix();
+			Timing_Init_Int+=GET_TIME()-startInitHm;
+		}
+	}
+#	ifdef OPENMP
+	if (sparse_sym && !store && omp_get_max_threads()>1) {
+		const size_t nbuf=MultOverflow(omp_get_max_threads()-1,local_nRows,ONE_POS,"sym_buf");
+		if (!prognosis) MALLOC_VECTOR(sym_buf,complex,nbuf,ALL);
+		memory+=nbuf*sizeof(doublecomplex);
+	}
+#	endif
 #endif // SPARSE
 	/* additional vectors for iterative methods. Potentially, this procedure can be fully automated for any new
 	 * iterative solver, based on the information contained in structure array 'params' in file iterative.c. However,
@@ -812,25 +969,34 @@ static void AllocateEverything(void)
 		}
 	}
 	if (orient_avg) {
-		tmp=2*((double)nTheta)*alpha_int.N;
+		/* values of theta are distributed among processors in contiguous blocks, so that each of them computes mueller
+		 * matrix and integrates it over alpha for its own block
+		 */
+		nTheta_loc=nTheta/nprocs + (ringid<nTheta%nprocs);
+		theta0_loc=ringid*(size_t)(nTheta/nprocs) + MIN(ringid,nTheta%nprocs);
+		tmp=4*((double)nTheta)*alpha_int.N;
 		if (!prognosis) {
-			// this covers these 2 and next 2 malloc calls
-			CheckOverflow(8*tmp+2,ONE_POS_FUNC);
+			// this covers this and next 2 malloc calls
+			CheckOverflow(4*tmp+2,ONE_POS_FUNC);
 			if (store_mueller) {
 				temp_int=tmp;
-				MALLOC_VECTOR(ampl_alphaX,complex,temp_int,ONE);
-				MALLOC_VECTOR(ampl_alphaY,complex,temp_int,ONE);
+				MALLOC_VECTOR(ampl_alpha,complex,temp_int,ONE);
 			}
-		}
-		memory += 2*tmp*sizeof(doublecomplex);
-		if (IFROOT) {
-			if (!prognosis) {
-				MALLOC_VECTOR(muel_alpha,double,block_theta*alpha_int.N+2,ONE);
-				muel_alpha+=2;
-				MALLOC_VECTOR(out,double,block_theta+2,ONE);
+			MALLOC_VECTOR(muel_alpha,double,16*nTheta_loc*alpha_int.N+2,ONE);
+			muel_alpha+=2;
+			if (IFROOT) MALLOC_VECTOR(out,double,block_theta+2,ONE);
+			else MALLOC_VECTOR(muel_int,double,16*nTheta_loc,ONE);
+			MALLOC_VECTOR(ampl_counts,sizet,nprocs,ONE);
+			MALLOC_VECTOR(muel_counts,sizet,nprocs,ONE);
+			for (i=0;i<nprocs;i++) {
+				temp_int=nTheta/nprocs + (i<nTheta%nprocs);
+				ampl_counts[i]=4*temp_int*alpha_int.N;
+				muel_counts[i]=16*temp_int;
 			}
-			memory += (8*tmp*(1+1.0/alpha_int.N)+4)*sizeof(double);
 		}
+		memory += tmp*sizeof(doublecomplex) + (16*nTheta_loc*alpha_int.N+2)*sizeof(double);
+		if (IFROOT) memory += (block_theta+2)*sizeof(double);
+		else memory += 16*nTheta_loc*sizeof(double);
 	}
 	/* estimate of the memory (only the fastest scaling part):
 	 * MatVec - (288+384nprocs/boxX [+192/nprocs])*Ndip
@@ -846,6 +1012,9 @@ static void AllocateEverything(void)
 	 * Sparse mode - each processor needs (265--457, depending on iterative solver)*local_nvoid_Ndip + 60*nvoid_Ndip
 	 *               and division is uniform, i.e. local_nvoid_Ndip = nvoid_Ndip/nprocs
 	 *               Sommerfeld table - same as above, but it is not divided among processors.
+	 *               With '-sparse_ring' 48*nvoid_Ndip is replaced by 96*local_nvoid_Ndip.
+	 *               Stored interaction matrix (-sparse_store) - 96*nvoid_Ndip*local_nvoid_Ndip (twice more for surf).
+	 *               Hierarchical matrix (-sparse_aca) depends on the ranks of blocks, and is not estimated in prognosis.
 	 *               Part of the memory is currently not distributed among processors - see issues 160,175.
 	 */
 	MAXIMIZE(memPeak,memory);
@@ -876,9 +1045,22 @@ void FreeEverything(void)
 	Free_cVector(expsY);
 	Free_cVector(expsZ);
 	Free_general(position); // allocated in MakeParticle();
+	Free_general(spanStart); // allocated in MakeParticle();
+#	ifdef PARALLEL
+	if (load_balance) {
+		Free_general(slabPosition);
+		Free_general(slabSpanStart);
+	}
+#	endif
 #else	
-	Free_general(position_full); // allocated in MakeParticle();
-	Free_cVector(arg_full);
+	Free_shared(position_full); // allocated in MakeParticle();
+	Free_shared(arg_full);
+	Free_cVector(sym_buf);
+	Free_cVector(Gstore);
+	Free_cVector(Rstore);
+	Free_cVector(ring_buf[0]);
+	Free_cVector(ring_buf[1]);
+	if (aca_eps!=UNDEF) FreeHmatrix();
 #endif // SPARSE
 	Free_cVector(xvec);
 	Free_cVector(rvec);
@@ -945,14 +1127,12 @@ void FreeEverything(void)
 	Free_general(material);
 
 	if (orient_avg) {
-		if (IFROOT) {
-			if (store_mueller) {
-				Free_cVector(ampl_alphaX);
-				Free_cVector(ampl_alphaY);
-			}
-			Free_general(muel_alpha-2);
-			Free_general(out);
-		}
+		if (store_mueller) Free_cVector(ampl_alpha);
+		Free_general(muel_alpha-2);
+		if (IFROOT) Free_general(out);
+		else Free_general(muel_int);
+		Free_general(ampl_counts);
+		Free_general(muel_counts);
 		Free_general(alpha_int.val);
 		Free_general(beta_int.val);
 		Free_general(gamma_int.val);
@@ -967,6 +1147,13 @@ void FreeEverything(void)
 void Calculator (void)
 {
 	char fname[MAX_FNAME];
+#ifdef PARALLEL
+	int n;
+	size_t cnt[3];
+	const int *beta_i,*gamma_i;
+	romb2d *romb;
+	sphquad *sph;
+#endif
 
 	// initialize variables
 #ifdef OPENCL
@@ -992,9 +1179,17 @@ void Calculator (void)
 	D("InitDmatrix started");
 	InitDmatrix();
 	D("InitDmatrix finished");
+	FreeInteractionTables();
 #endif // !SPARSE
 	// allocate most (that is not already allocated; perform memory analysis
 	AllocateEverything();
+#ifdef SPARSE
+	if (Gstore!=NULL) {
+		startInitInt=GET_TIME();
+		InitSparseStore();
+		Timing_Init_Int+=GET_TIME()-startInitInt;
+	}
+#endif
 	// finish initialization
 	if (!orient_avg) alpha_int.N=1;
 	Timing_Init = GET_TIME() - tstart_main;
@@ -1002,11 +1197,61 @@ void Calculator (void)
 	if (prognosis) return;
 	// main calculation part
 	if (orient_avg) {
+#ifdef PARALLEL
+		if (orient_groups>1) {
+			// for other schemes each node corresponds to the same index in beta_int and gamma_int
+			if (parms_sphere.scheme==AVG_ROMBERG) MALLOC_VECTOR(batch_nodes,int,2*beta_int.N*gamma_int.N,ALL);
+			else MALLOC_VECTOR(batch_nodes,int,2*beta_int.N,ALL);
+			batch_res=NULL;
+			if (IFWROOT) {
+				SnprintfErr(ONE_POS,fname,MAX_FNAME,"%s/"F_LOG_ORAVG,directory);
+				D("Orientation averaging started on root");
+				if (parms_sphere.scheme==AVG_ROMBERG) {
+					// each batch contains all orientations, which are surely required at this point
+					romb=Romberg2DInit(parms,block_theta+2,true,fname);
+					while ((n=Romberg2DNext(romb,&beta_i,&gamma_i))>0) {
+						orient_batch(n,beta_i,gamma_i);
+						Romberg2DSubmit(romb,batch_res,NULL);
+					}
+					Romberg2DFinish(romb,out);
+				}
+				else {
+					sph=SphereQuadInit(&parms_sphere,block_theta+2,fname);
+					while ((n=SphereQuadNext(sph,&beta_i))>0) {
+						orient_batch(n,beta_i,beta_i);
+						SphereQuadSubmit(sph,batch_res);
+					}
+					SphereQuadFinish(sph,out);
+				}
+				D("Orientation averaging finished on root");
+				orient_batch(0,NULL,NULL); // finishes calculations by other groups
+				SaveMuellerAndCS(out);
+			}
+			else while (!finish_avg) orient_batch(0,NULL,NULL);
+			Free_general(batch_nodes);
+			Free_general(batch_res);
+			// sum up counters over all groups on root, counting each orientation once
+			if (IFROOT) {
+				cnt[0]=TotalEval;
+				cnt[1]=TotalIter;
+				cnt[2]=TotalMatVec;
+			}
+			else cnt[0]=cnt[1]=cnt[2]=0;
+			AccumulateGroups(cnt,sizet_type,3,&Timing_OrientComm);
+			if (IFWROOT) {
+				TotalEval=cnt[0];
+				TotalIter=cnt[1];
+				TotalMatVec=cnt[2];
+			}
+		}
+		else
+#endif
 		if (IFROOT) {
 			SnprintfErr(ONE_POS,fname,MAX_FNAME,"%s/"F_LOG_ORAVG,directory);
-			D("Romberg2D started on root");
-			Romberg2D(parms,orient_integrand,block_theta+2,out,fname);
-			D("Romberg2D finished on root");
+			D("Orientation averaging started on root");
+			if (parms_sphere.scheme==AVG_ROMBERG) Romberg2D(parms,orient_integrand,block_theta+2,out,fname);
+			else SphereQuad(&parms_sphere,orient_integrand,block_theta+2,out,fname);
+			D("Orientation averaging finished on root");
 			finish_avg=true;
 			/* first two are dummy variables; this call corresponds to one in orient_integrand by other processors;
 			 * TODO: replace by a call without unnecessary overhead
@@ -32,8 +32,30 @@
 
 #ifdef ADDA_MPI
 MPI_Datatype mpi_dcomplex,mpi_int3,mpi_double3,mpi_dcomplex3; // combined datatypes
-int *recvcounts,*displs; // arrays of size ringid required for AllGather operations
+size_t *recvcounts,*displs; // arrays of size nprocs (in dipoles) required for AllGather operations
 bool displs_init=false;  // whether arrays above are initialized
+/* communicator of the current group of processors, which solves the same orientation (-orient_groups). Used instead of
+ * MPI_COMM_WORLD in all communications, except the ones between the groups
+ */
+static MPI_Comm grpComm;
+#	ifdef SPARSE
+static MPI_Request ringReq[2]; // requests for nonblocking send and receive in RingShift
+#	endif
+#	ifdef SUPPORT_MPI_SHARED
+/* communicators of processors of grpComm, which can share memory (on the same node), and of the first processors on
+ * each node (leaders, MPI_COMM_NULL on other processors); created by InitNodeComm
+ */
+static MPI_Comm nodeComm=MPI_COMM_NULL,leadComm=MPI_COMM_NULL;
+static int nodeSize;          // number of processors in nodeComm
+static int * restrict nodeOf; // indices of nodes (ranks of their leaders in leadComm) for all processors of grpComm
+// arrays in node-shared memory, allocated by SharedVector
+#		define MAX_SHARED 8 // maximum number of such arrays at a time
+static struct {
+	void *ptr;   // start of the array
+	MPI_Win win; // corresponding shared-memory window
+} shArr[MAX_SHARED];
+static int shNum; // current number of arrays in shArr
+#	endif
 #endif
 
 /* whether a synchronize call should be performed before parallel timing. It makes communication timing more accurate,
@@ -42,23 +64,67 @@ bool displs_init=false;  // whether arrays above are initialized
  */
 #define SYNCHRONIZE_TIMING
 
+/* maximum number of elements in a single call of MPI function, limited by the int type of its count argument. Larger
+ * messages are divided into chunks or described by derived datatypes (see LargeContiguous). It can be decreased at
+ * compile time (e.g. by -DMAX_MES_COUNT=1000) to test the corresponding code on small problems.
+ */
+#ifndef MAX_MES_COUNT
+#	define MAX_MES_COUNT INT_MAX
+#endif
+
 #ifdef PARALLEL
-#ifndef SPARSE
 
 // SEMI-GLOBAL VARIABLES
 
+#ifndef SPARSE
 // defined and allocated in fft.c
-extern double * restrict BT_buffer, * restrict BT_rbuffer;
+extern double * restrict BT_buffer;
+#endif
+// defined and initialized in param.c
+extern const int orient_groups;
+#ifndef SPARSE
+extern const int procGridY,procGridZ;
+extern const enum btmethod bt_method;
 // defined and initialized in timing.c
 extern TIME_TYPE Timing_InitDmComm;
 
 // LOCAL VARIABLES
 
-static int Ntrans;         // number of transmissions; used in CalcPartner
 static int * restrict gr_comm_size;  // sizes of transmissions for granule generator communications
 static int * restrict gr_comm_overl; // shows whether two sequential transmissions overlap
 static unsigned char * restrict gr_comm_ob; // buffer for overlaps
 static bool * restrict gr_comm_buf;         // buffer for MPI transfers
+/* parts of local arrays exchanged with each processor, when converting between the balanced distribution of dipoles
+ * (-load_balance) and that of FFT slabs: counts and displacements (in dipoles) in the balanced arrays (bal_*) and in
+ * the slab ones (slab_*), see SetLoadBalance
+ */
+static size_t * restrict bal_cnt,* restrict bal_dsp,* restrict slab_cnt,* restrict slab_dsp;
+static int * restrict lb_scnt,* restrict lb_sdsp,* restrict lb_rcnt,* restrict lb_rdsp; // the same in MPI elements
+// numbers of dipoles on each processor for uniform and balanced distributions, and the balanced ranges of z-layers
+static size_t * restrict lb_unif,* restrict lb_bal;
+static int * restrict lb_z;
+#ifdef ADDA_MPI
+static MPI_Datatype bt_type;          // part of a single component of Xmatrix, corresponding to one processor
+static MPI_Datatype bt_ptype;         // the same part packed into BT_buffer (contiguous)
+static MPI_Request * restrict bt_req; // requests for nonblocking transfers in BlockTransposeStart (for 3 components)
+static int bt_nreq[3];                // number of active requests for each component
+/* communicators of processors with the same z-range (yComm, of size procGridY) and the same y-range (zComm); used only
+ * for 2D grid of processors (when both its dimensions are larger than 1)
+ */
+static MPI_Comm yComm=MPI_COMM_NULL,zComm=MPI_COMM_NULL;
+// data for a single stage of block transposition (see TransposeStage)
+typedef struct {
+	MPI_Comm comm;         // communicator of processors, taking part in the stage
+	MPI_Comm graph;        // the same as a graph of all-to-all neighbors (for BTM_NEIGHBOR)
+	int id,np;             // rank of the current processor in comm and size of comm
+	int * restrict node;   // ranks of processors of comm in nodeComm (MPI_UNDEFINED for other nodes), for BTM_NODE
+} bt_stage;
+static bt_stage bt_st[3];              // stages for grpComm (1D grid of processors), zComm, and yComm
+static enum btmethod bt_meth;          // method of block transposition (BTM_AUTO is replaced by ChooseBTMethod)
+static MPI_Win bt_win=MPI_WIN_NULL;    // shared-memory window for BTM_NODE
+static size_t bt_win_size;             // size of the segment of bt_win for each processor (in doubles)
+static double ** restrict bt_shm;      // pointers to segments of bt_win of all processors in nodeComm
+#endif
 #endif // !SPARSE
 
 
@@ -88,20 +154,29 @@ static inline size_t IndexBlock(const size_t x,const size_t y,const size_t z,con
 
 //======================================================================================================================
 
-static inline int CalcPartner(const int tran)
-/* calculate ringid of partner processor for current transmission; used in BlockTranspose. Many different
- * implementations are possible; the only requirements are
- * 1) f(tran,f(tran,ringid))=ringid
- * 2) f({1,2,Ntrans},ringid)={0,1,Ntrans}\ringid
- * where f=nprocs is equivalent to skipping this transmission (relevant for odd nprocs)
+static inline int NumTrans(const int np)
+// number of transmissions for pairwise exchange between np processors; used in CalcPartner
+{
+	return IS_EVEN(np) ? np-1 : np;
+}
+
+//======================================================================================================================
+
+static inline int CalcPartner(const int tran,const int id,const int np)
+/* calculate rank of partner processor (among np ones, current has rank id) for current transmission; used in
+ * BlockTranspose. Many different implementations are possible; the only requirements are
+ * 1) f(tran,f(tran,id))=id
+ * 2) f({1,2,Ntrans},id)={0,1,Ntrans}\id
+ * where Ntrans=NumTrans(np) and f=np is equivalent to skipping this transmission (relevant for odd np)
  */
 {
 	int part;
+	const int Ntrans=NumTrans(np);
 
-	if (ringid==0) part=tran;
-	else if (ringid==tran) part=0;
+	if (id==0) part=tran;
+	else if (id==tran) part=0;
 	else {
-		part=2*tran-ringid;
+		part=2*tran-id;
 		if (part<=0) part+=Ntrans;
 		else if (part>Ntrans) part-=Ntrans;
 	}
@@ -159,6 +234,7 @@ static MPI_Datatype MPIVarType(var_type type,bool reduce,int *mult)
 	if (reduce) *mult=1; // default value when direct correspondence is possible
 	switch (type) {
 		case uchar_type: return MPI_UNSIGNED_CHAR;
+		case ushort_type: return MPI_UNSIGNED_SHORT;
 		case int_type: return MPI_INT;
 		case sizet_type: return MPI_SIZE_T;
 		case double_type: return MPI_DOUBLE;
@@ -198,21 +274,303 @@ static MPI_Datatype MPIVarType(var_type type,bool reduce,int *mult)
 	LogError(ONE_POS,"Variable type %d is not supported",(int)type);
 }
 
+//======================================================================================================================
+/* The following functions form a thin layer above MPI, which allows transfers of any size (limited only by size_t).
+ * Since MPI functions take the number of elements as int, large messages are either divided into chunks of at most
+ * MAX_MES_COUNT elements, or described by derived datatypes, which are then transferred as a single element.
+ */
+
+static inline size_t TypeExtent(MPI_Datatype type)
+// returns the extent of MPI datatype (in bytes)
+{
+	MPI_Aint lb,extent;
+
+	MPI_Type_get_extent(type,&lb,&extent);
+	return (size_t)extent;
+}
+
+//======================================================================================================================
+
+static bool IntCounts(const size_t * restrict counts,const size_t * restrict disps,const size_t mult,
+	int * restrict cnt,int * restrict dsp)
+/* converts counts and displacements (arrays of size nprocs), multiplied by 'mult', into int arrays cnt and dsp for
+ * v-variants of MPI collective functions. Returns false, if any of the values exceeds MAX_MES_COUNT, then the arrays
+ * are not usable. When all processors pass the same arrays (e.g. for gather operations), the result is the same for all
+ * of them; otherwise the caller should agree on it among processors (see RedistributeDipoles).
+ */
+{
+	int i;
+
+	for (i=0;i<nprocs;i++) {
+		if (counts[i]*mult>MAX_MES_COUNT || disps[i]*mult>MAX_MES_COUNT) return false;
+		cnt[i]=(int)(counts[i]*mult);
+		dsp[i]=(int)(disps[i]*mult);
+	}
+	return true;
+}
+
+//======================================================================================================================
+
+static void LargeContiguous(const size_t n,MPI_Datatype base,MPI_Datatype *type)
+/* creates and commits a datatype for n contiguous elements of 'base'. If n exceeds MAX_MES_COUNT, the datatype is
+ * composed of a vector of full chunks and a remainder.
+ */
+{
+	const size_t q=n/MAX_MES_COUNT,r=n%MAX_MES_COUNT;
+	MPI_Datatype parts[2];
+	MPI_Aint disps[2];
+	int blocks[2]={1,1};
+
+	if (q==0) MPI_Type_contiguous((int)n,base,type);
+	else {
+		if (q>INT_MAX) LogError(ALL_POS,"int overflow in MPI function for large datatype (%zu)",n);
+		MPI_Type_vector((int)q,MAX_MES_COUNT,MAX_MES_COUNT,base,parts);
+		MPI_Type_contiguous((int)r,base,parts+1);
+		disps[0]=0;
+		disps[1]=(MPI_Aint)(q*MAX_MES_COUNT*TypeExtent(base));
+		MPI_Type_create_struct(2,blocks,disps,parts,type);
+		MPI_Type_free(parts);
+		MPI_Type_free(parts+1);
+	}
+	MPI_Type_commit(type);
+}
+
+//======================================================================================================================
+
+static void BcastLarge(void * restrict data,const size_t n,MPI_Datatype type,const int root,MPI_Comm comm)
+// broadcasts n elements of 'type' from processor 'root' to all processors of 'comm'
+{
+	char * restrict ptr=data;
+	const size_t ext=TypeExtent(type);
+	size_t i;
+	int cnt;
+
+	for (i=0;i<n;i+=cnt) {
+		cnt=(int)MIN(n-i,MAX_MES_COUNT);
+		MPI_Bcast(ptr+i*ext,cnt,type,root,comm);
+	}
+}
+
+//======================================================================================================================
+
+static void ReduceLarge(void * restrict data,const size_t n,MPI_Datatype type,MPI_Op op,const int root,
+	const bool isroot,MPI_Comm comm)
+/* reduces n elements of 'type' from all processors of 'comm' to processor 'root' (isroot specifies whether it is the
+ * current one), where data is replaced by the result; data on other processors is not changed
+ */
+{
+	char * restrict ptr=data;
+	const size_t ext=TypeExtent(type);
+	size_t i;
+	int cnt;
+
+	for (i=0;i<n;i+=cnt) {
+		cnt=(int)MIN(n-i,MAX_MES_COUNT);
+		if (isroot) MPI_Reduce(MPI_IN_PLACE,ptr+i*ext,cnt,type,op,root,comm);
+		else MPI_Reduce(ptr+i*ext,NULL,cnt,type,op,root,comm);
+	}
+}
+
+//======================================================================================================================
+
+static void AllreduceLarge(const void * restrict from,void * restrict to,const size_t n,MPI_Datatype type,MPI_Op op)
+/* reduces n elements of 'type' over the group of processors, the result (in 'to') is available on all of them; 'from'
+ * can be NULL, then the operation is performed in place
+ */
+{
+	const char * restrict src=from;
+	char * restrict dest=to;
+	const size_t ext=TypeExtent(type);
+	size_t i;
+	int cnt;
+
+	for (i=0;i<n;i+=cnt) {
+		cnt=(int)MIN(n-i,MAX_MES_COUNT);
+		if (from==NULL) MPI_Allreduce(MPI_IN_PLACE,dest+i*ext,cnt,type,op,grpComm);
+		else MPI_Allreduce(src+i*ext,dest+i*ext,cnt,type,op,grpComm);
+	}
+}
+
+//======================================================================================================================
+
+static void SendLarge(const void * restrict data,const size_t n,MPI_Datatype type,const int dest)
+// sends n elements of 'type' to processor 'dest' (in chunks); to be matched by RecvLarge
+{
+	const char * restrict ptr=data;
+	const size_t ext=TypeExtent(type);
+	size_t i;
+	int cnt;
+
+	for (i=0;i<n;i+=cnt) {
+		cnt=(int)MIN(n-i,MAX_MES_COUNT);
+		MPI_Send(ptr+i*ext,cnt,type,dest,0,grpComm);
+	}
+}
+
+//======================================================================================================================
+
+static void RecvLarge(void * restrict data,const size_t n,MPI_Datatype type,const int src)
+// receives n elements of 'type' from processor 'src' (in chunks); to be matched by SendLarge
+{
+	char * restrict ptr=data;
+	const size_t ext=TypeExtent(type);
+	size_t i;
+	int cnt;
+
+	for (i=0;i<n;i+=cnt) {
+		cnt=(int)MIN(n-i,MAX_MES_COUNT);
+		MPI_Recv(ptr+i*ext,cnt,type,src,0,grpComm,MPI_STATUS_IGNORE);
+	}
+}
+
+//======================================================================================================================
+
+#ifndef SPARSE
+static void SendrecvLarge(const void * restrict sendbuf,const size_t nsend,void * restrict recvbuf,const size_t nrecv,
+	MPI_Datatype type,const int part)
+/* exchanges data with processor 'part': sends nsend and receives nrecv elements of 'type'. The partner should call this
+ * function with swapped nsend and nrecv, then both messages are divided into the same number of chunks.
+ */
+{
+	const char * restrict sptr=sendbuf;
+	char * restrict rptr=recvbuf;
+	const size_t ext=TypeExtent(type);
+	size_t is,ir;
+	int scnt,rcnt;
+
+	for (is=ir=0;is<nsend || ir<nrecv;is+=scnt,ir+=rcnt) {
+		scnt=(int)MIN(nsend-is,MAX_MES_COUNT);
+		rcnt=(int)MIN(nrecv-ir,MAX_MES_COUNT);
+		MPI_Sendrecv(sptr+is*ext,scnt,type,part,0,rptr+ir*ext,rcnt,type,part,0,grpComm,MPI_STATUS_IGNORE);
+	}
+}
+#endif
+
+//======================================================================================================================
+
+#ifdef SUPPORT_MPI_SHARED
+static void InitNodeComm(void)
+/* creates nodeComm and leadComm, and fills nodeOf; further calls have no effect. Should be called by all processors of
+ * grpComm simultaneously
+ */
+{
+	int id;
+
+	if (nodeComm!=MPI_COMM_NULL) return;
+	MPI_Comm_split_type(grpComm,MPI_COMM_TYPE_SHARED,ringid,MPI_INFO_NULL,&nodeComm);
+	MPI_Comm_rank(nodeComm,&id);
+	MPI_Comm_size(nodeComm,&nodeSize);
+	MPI_Comm_split(grpComm,(id==0) ? 0 : MPI_UNDEFINED,ringid,&leadComm);
+	MALLOC_VECTOR(nodeOf,int,nprocs,ALL);
+	if (id==0) MPI_Comm_rank(leadComm,nodeOf+ringid);
+	MPI_Bcast(nodeOf+ringid,1,MPI_INT,0,nodeComm);
+	MPI_Allgather(MPI_IN_PLACE,0,MPI_INT,nodeOf,1,MPI_INT,grpComm);
+}
+
+//======================================================================================================================
+
+static int FindShared(const void * restrict ptr)
+// returns the index of the node-shared array in shArr, starting at ptr, or -1 if there is no such array
+{
+	int i;
+
+	for (i=0;i<shNum;i++) if (shArr[i].ptr==ptr) return i;
+	return -1;
+}
+
+//======================================================================================================================
+
+static void SyncNode(MPI_Win win)
+// makes all changes of node-shared memory (of window 'win') visible to all processors on the node
+{
+	MPI_Win_sync(win);
+	MPI_Barrier(nodeComm);
+	MPI_Win_sync(win);
+}
+
+//======================================================================================================================
+
+static void AllGatherShared(void * restrict x,const size_t * restrict counts,const size_t * restrict disps,
+	MPI_Datatype type,MPI_Win win)
+/* the same as AllGathervLarge, but for x in node-shared memory (with window 'win'). The blocks of all processors on the
+ * node are already in place, so only leaders exchange the data, each broadcasting the blocks of its node to the others
+ */
+{
+	int i,n,node,nnodes;
+	int *blen;
+	MPI_Aint *bdsp;
+	MPI_Datatype *btypes,ntype;
+	const size_t ext=TypeExtent(type);
+
+	SyncNode(win);
+	if (leadComm!=MPI_COMM_NULL) MPI_Comm_size(leadComm,&nnodes);
+	else nnodes=1;
+	if (nnodes>1) {
+		MALLOC_VECTOR(blen,int,nprocs,ALL);
+		MALLOC_VECTOR(bdsp,void,nprocs*sizeof(MPI_Aint),ALL);
+		MALLOC_VECTOR(btypes,void,nprocs*sizeof(MPI_Datatype),ALL);
+		for (node=0;node<nnodes;node++) {
+			// the blocks of processors on the node are combined into a single datatype (they need not be contiguous)
+			for (i=0,n=0;i<nprocs;i++) if (nodeOf[i]==node && counts[i]>0) {
+				blen[n]=1;
+				bdsp[n]=(MPI_Aint)(disps[i]*ext);
+				LargeContiguous(counts[i],type,btypes+n);
+				n++;
+			}
+			if (n>0) {
+				MPI_Type_create_struct(n,blen,bdsp,btypes,&ntype);
+				MPI_Type_commit(&ntype);
+				MPI_Bcast(x,1,ntype,node,leadComm);
+				MPI_Type_free(&ntype);
+				for (i=0;i<n;i++) MPI_Type_free(btypes+i);
+			}
+		}
+		Free_general(blen);
+		Free_general(bdsp);
+		Free_general(btypes);
+	}
+	SyncNode(win);
+}
+#endif
+
+//======================================================================================================================
+
+static void AllGathervLarge(void * restrict x,const size_t * restrict counts,const size_t * restrict disps,
+	MPI_Datatype type)
+/* in-place gather of blocks of variable length: counts[i] elements of 'type' at displacement disps[i] (in elements)
+ * are contributed by the i-th processor; on exit, x is fully filled on all processors. Large blocks are broadcasted
+ * one by one. Arrays in node-shared memory (see SharedVector) are handled by AllGatherShared.
+ */
+{
+	int i,*cnt,*dsp;
+	const size_t ext=TypeExtent(type);
+
+#ifdef SUPPORT_MPI_SHARED
+	if ((i=FindShared(x))>=0) {
+		AllGatherShared(x,counts,disps,type,shArr[i].win);
+		return;
+	}
+#endif
+	MALLOC_VECTOR(cnt,int,nprocs,ALL);
+	MALLOC_VECTOR(dsp,int,nprocs,ALL);
+	if (IntCounts(counts,disps,1,cnt,dsp)) MPI_Allgatherv(MPI_IN_PLACE,0,type,x,cnt,dsp,type,grpComm);
+	else for (i=0;i<nprocs;i++) BcastLarge((char *)x+disps[i]*ext,counts[i],type,i,grpComm);
+	Free_general(cnt);
+	Free_general(dsp);
+}
+
 //======================================================================================================================
 
 void InitDispls(void)
 // initialize arrays recvcounts and displs once, further calls have no effect
 {
 	if (!displs_init) {
-		if (nvoid_Ndip>INT_MAX)
-			LogError(ONE_POS,"int overflow in MPI function for number of non-void dipoles (%zu)",nvoid_Ndip);
-		MALLOC_VECTOR(recvcounts,int,nprocs,ALL);
-		MALLOC_VECTOR(displs,int,nprocs,ALL);
-		// !!! TODO: check for overflow of int
+		MALLOC_VECTOR(recvcounts,sizet,nprocs,ALL);
+		MALLOC_VECTOR(displs,sizet,nprocs,ALL);
 		recvcounts[ringid]=local_nvoid_Ndip;
 		displs[ringid]=local_nvoid_d0;
-		MPI_Allgather(MPI_IN_PLACE,0,MPI_INT,recvcounts,1,MPI_INT,MPI_COMM_WORLD);
-		MPI_Allgather(MPI_IN_PLACE,0,MPI_INT,displs,1,MPI_INT,MPI_COMM_WORLD);
+		MPI_Allgather(MPI_IN_PLACE,0,MPI_SIZE_T,recvcounts,1,MPI_SIZE_T,grpComm);
+		MPI_Allgather(MPI_IN_PLACE,0,MPI_SIZE_T,displs,1,MPI_SIZE_T,grpComm);
 		displs_init=true;
 	}
 }
@@ -229,19 +587,23 @@ void AllGather(void * restrict x_from,void * restrict x_to,const var_type type,T
 #ifdef ADDA_MPI
 	MPI_Datatype mes_type;
 	TIME_TYPE tstart;
+	size_t ext;
 
 	// redundant initialization to remove warnings
 	tstart=0;
 	if (timing!=NULL) {
 #ifdef SYNCHRONIZE_TIMING
-		MPI_Barrier(MPI_COMM_WORLD);  // synchronize to get correct timing
+		MPI_Barrier(grpComm);  // synchronize to get correct timing
 #endif
 		tstart=GET_TIME();
 	}
 	InitDispls(); // actually initialization is done only once
 	mes_type=MPIVarType(type,false,NULL);
-	if (x_from==NULL) MPI_Allgatherv(MPI_IN_PLACE,0,mes_type,x_to,recvcounts,displs,mes_type,MPI_COMM_WORLD);
-	else MPI_Allgatherv(x_from,local_nvoid_Ndip,mes_type,x_to,recvcounts,displs,mes_type,MPI_COMM_WORLD);
+	if (x_from!=NULL) {
+		ext=TypeExtent(mes_type);
+		memcpy((char *)x_to+local_nvoid_d0*ext,x_from,local_nvoid_Ndip*ext);
+	}
+	AllGathervLarge(x_to,recvcounts,displs,mes_type);
 	if (timing!=NULL) (*timing)+=GET_TIME()-tstart;
 #endif
 }
@@ -250,151 +612,457 @@ void AllGather(void * restrict x_from,void * restrict x_to,const var_type type,T
 
 //======================================================================================================================
 
-void InitComm(int *argc_p UOIP,char ***argv_p UOIP)
-// initialize communications in the beginning of the program
+size_t AllGatherCounts(const size_t n,size_t * restrict counts)
+/* given a number of elements n on each processor, gathers these numbers into array counts (of size nprocs) on all
+ * processors. Returns the total number of elements. To be used before AllGatherVar
+ */
 {
-#ifdef ADDA_MPI
-	int ver,subver;
+	int i;
+	size_t sum;
 
-	/* MPI_Init may alter argc and argv and interfere with normal parsing of command line parameters. The way of
-	 * altering is implementation depending. MPI searches for MPI parameters in the command line and removes them (we
-	 * assume some kind of removing does take place - otherwise ADDA will produce error 'unknown parameter'). The best
-	 * would be to change argc and argv so that they look like no special command line arguments are present. However,
-	 * MPICH 1.2.5, for example, just replaces corresponding parameters by NULLs. To incorporate it we introduce special
-	 * function to restore the command line
-	 */
-	MPI_Init(argc_p,argv_p);
-	tstart_main = GET_TIME(); // initialize program time
-	RecoverCommandLine(argc_p,argv_p);
-	// initialize ringid and nprocs
-	MPI_Comm_rank(MPI_COMM_WORLD,&ringid);
-	MPI_Comm_size(MPI_COMM_WORLD,&nprocs);
-#ifndef SPARSE
-	// initialize Ntrans
-	if (IS_EVEN(nprocs)) Ntrans=nprocs-1;
-	else Ntrans=nprocs;
-#endif
-	// define a few derived datatypes
-#ifdef SUPPORT_MPI_COMPLEX
-	mpi_dcomplex = MPI_C_DOUBLE_COMPLEX; // use built-in datatype if supported
-#else
-	MPI_Type_contiguous(2,MPI_DOUBLE,&mpi_dcomplex);
-	MPI_Type_commit(&mpi_dcomplex);
-#endif
-	MPI_Type_contiguous(3,MPI_INT,&mpi_int3);
-	MPI_Type_commit(&mpi_int3);
-	MPI_Type_contiguous(3,MPI_DOUBLE,&mpi_double3);
-	MPI_Type_commit(&mpi_double3);
-	MPI_Type_contiguous(3,mpi_dcomplex,&mpi_dcomplex3);
-	MPI_Type_commit(&mpi_dcomplex3);
-	// check MPI version at runtime
-	MPI_Get_version(&ver,&subver);
-	D("MPI library version: %d.%d",ver,subver);
-	/* Microsoft MPI claims to support most of the MPI 2.2 features (and even some of 3.1), but declares only 2.0, see
-	 * https://github.com/microsoft/Microsoft-MPI/issues/15 . We, thus, use the following hack to assume its support for
-	 * MPI 2.2. However, it is not perfect, if different vendor libraries are used at compile and runtime:
-	 * - compiling with MS_MPI and further linking with another library (conforming to MPI 2.0 or 2.1), the hack is too
-	 *   optimistic, and may cause further problems during execution.
-	 * - compiling with another library and further linking with MS_MPI, the hack is skipped and execution fails,
-	 *   although it may have worked.
-	 * However, such cross usage is unlikely because there are not many MPI implementations for Windows, and even the
-	 * main library file for MS_MPI is named differently (msmpi.lib).
-	 * To get more confidence, we can use MPI_Get_library_version(), but this will cause complete failure for some
-	 * older libraries that support MPI 2.2, but do not have this 3.0 function.
-	 */
-#ifdef MSMPI_VER
-	if (ver==2 && subver<2) {
-		D("But we assume that this is Microsoft MPI library that supports MPI 2.2");
-		subver=2;
-	}
-#endif
-	if (!GREATER_EQ2(ver,subver,RUN_MPI_VER_REQ,RUN_MPI_SUBVER_REQ)) {
-		if (GREATER_EQ2(ver,subver,MPI_VER_REQ,MPI_SUBVER_REQ)) // library fits into minimum requirements
-			LogError(ONE_POS,"MPI library version (%d.%d) is too old for current ADDA executable. Version %d.%d or "
-				"newer is required. Alternatively, you may recompile ADDA using this version of the library.",
-				ver,subver,RUN_MPI_VER_REQ,RUN_MPI_SUBVER_REQ);
-		else if (RUN_MPI_VER_REQ==MPI_VER_REQ && RUN_MPI_SUBVER_REQ==MPI_SUBVER_REQ) // executable requires minimum
-			LogError(ONE_POS,"MPI library version (%d.%d) is too old. Version %d.%d or newer is required",
-				ver,subver,RUN_MPI_VER_REQ,RUN_MPI_SUBVER_REQ);
-		else // two upgrade options
-			LogError(ONE_POS,"MPI library version (%d.%d) is too old. Version %d.%d or newer is required for the "
-				"current ADDA executable or at least %d.%d, if ADDA is recompiled using such library.",
-				ver,subver,RUN_MPI_VER_REQ,RUN_MPI_SUBVER_REQ,MPI_VER_REQ,MPI_SUBVER_REQ);
-	}
-	// if MPI crashes, it happens here
-	Synchronize();
-#elif !defined(PARALLEL)
-	nprocs=1;
-	ringid=ADDA_ROOT;
+	counts[ringid]=n;
+#ifdef ADDA_MPI
+	MPI_Allgather(MPI_IN_PLACE,0,MPI_SIZE_T,counts,1,MPI_SIZE_T,grpComm);
 #endif
-
-#ifndef SPARSE // CheckNprocs does not exist in sparse mode
-	// check if weird number of processors is specified; called even in sequential mode to initialize weird_nprocs
-	CheckNprocs();
-#endif // !SPARSE
+	sum=0;
+	for (i=0;i<nprocs;i++) sum+=counts[i];
+	return sum;
 }
 
 //======================================================================================================================
 
-void Stop(const int code)
-// stops the program with exit 'code'
+void AllGatherVar(void * restrict x UOIP,const var_type type UOIP,const size_t * restrict counts UOIP,
+	TIME_TYPE *timing UOIP)
+/* in-place gather of arrays of variable length; counts[i] is the number of elements contributed by the i-th processor,
+ * which are located in x (on that processor) directly after the elements of processors with smaller ringid. On exit, x
+ * is fully filled on all processors. Works for all types; increments 'timing' (if not NULL) by the time used.
+ */
 {
 #ifdef ADDA_MPI
-	if (code!=EXIT_SUCCESS) { // error occurred
-		fflush(NULL);
-		fprintf(stderr,"Aborting process %d\n",ringid);
-		MPI_Abort(MPI_COMM_WORLD,code);
-	}
-	else { // regular termination
-		// clean MPI constructs and some memory
-#ifndef SUPPORT_MPI_COMPLEX
-		MPI_Type_free(&mpi_dcomplex);
+	TIME_TYPE tstart;
+	int i;
+	size_t *dsp;
+
+	tstart=0;
+	if (timing!=NULL) {
+#ifdef SYNCHRONIZE_TIMING
+		MPI_Barrier(grpComm);  // synchronize to get correct timing
 #endif
-		MPI_Type_free(&mpi_int3);
-		MPI_Type_free(&mpi_double3);
-		MPI_Type_free(&mpi_dcomplex3);
-		if (displs_init) {
-			Free_general(recvcounts);
-			Free_general(displs);
-		}
-		// wait for all processors
-		fflush(NULL);
-		Synchronize();
-		// finalize MPI communications
-		MPI_Finalize();
+		tstart=GET_TIME();
 	}
+	MALLOC_VECTOR(dsp,sizet,nprocs,ALL);
+	dsp[0]=0;
+	for (i=1;i<nprocs;i++) dsp[i]=dsp[i-1]+counts[i-1];
+	AllGathervLarge(x,counts,dsp,MPIVarType(type,false,NULL));
+	Free_general(dsp);
+	if (timing!=NULL) (*timing)+=GET_TIME()-tstart;
 #endif
-	exit(code);
 }
 
 //======================================================================================================================
 
-void Synchronize(void)
-// synchronizes all processes
+void *SharedVector(const size_t n,const size_t elsize,OTHER_ARGUMENTS)
+/* allocates a vector of n elements of size elsize in memory shared by all processors on the same node (one copy per
+ * node). The vector is filled collectively (each processor writes only its own part), and then gathered by AllGather
+ * or AllGatherVar, which exchange the data only between the nodes; afterwards it is used read-only. Should be called by
+ * all processors of grpComm simultaneously. If shared memory is not supported (including sequential mode), a regular
+ * vector is allocated.
+ */
 {
-#ifdef ADDA_MPI
-	MPI_Barrier(MPI_COMM_WORLD);
+	const size_t size=MultOverflow(n,elsize,ERR_LOC_CALL,name);
+#if defined(ADDA_MPI) && defined(SUPPORT_MPI_SHARED)
+	int id,disp_unit;
+	MPI_Aint seg_size;
+	void *ptr;
+
+	InitNodeComm();
+	if (shNum==MAX_SHARED) LogError(ERR_LOC_CALL,"Too many node-shared vectors when allocating %s",name);
+	MPI_Comm_rank(nodeComm,&id);
+	/* the whole vector is allocated by the first processor on the node, others only get pointers to it. At least one
+	 * byte is allocated to have a unique pointer
+	 */
+	MPI_Win_allocate_shared((id==0) ? (MPI_Aint)MAX(size,1) : 0,1,MPI_INFO_NULL,nodeComm,&ptr,&(shArr[shNum].win));
+	MPI_Win_shared_query(shArr[shNum].win,0,&seg_size,&disp_unit,&(shArr[shNum].ptr));
+	if (shArr[shNum].ptr==NULL) LogError(ERR_LOC_CALL,"Could not allocate node-shared memory for %s",name);
+	// the memory is accessed only by direct loads and stores, synchronized by MPI_Win_sync and barriers
+	MPI_Win_lock_all(MPI_MODE_NOCHECK,shArr[shNum].win);
+	return shArr[shNum++].ptr;
+#else
+	return voidVector(size,ERR_LOC_CALL,name);
 #endif
 }
 
 //======================================================================================================================
 
-void MyBcast(void * restrict data UOIP,const var_type type UOIP,const size_t n_elem UOIP,TIME_TYPE *timing UOIP)
-/* casts values stored in '*data' from root processor to all other; works for all types;
- * increments 'timing' (if not NULL) by the time used
- */
+void Free_shared(void * restrict v)
+// frees vector allocated by SharedVector (if not NULL); should be called by all processors of grpComm simultaneously
 {
-#ifdef ADDA_MPI
-	TIME_TYPE tstart=0; // redundant initialization to remove warnings
+#if defined(ADDA_MPI) && defined(SUPPORT_MPI_SHARED)
+	int i;
+
+	if (v==NULL) return;
+	if ((i=FindShared(v))<0) LogError(ALL_POS,"Vector to be freed is not in node-shared memory");
+	MPI_Win_unlock_all(shArr[i].win);
+	MPI_Win_free(&(shArr[i].win));
+	shArr[i]=shArr[--shNum];
+#else
+	Free_general(v);
+#endif
+}
+
+//======================================================================================================================
+
+void SyncShared(const void * restrict v UOIP)
+/* should be called by all processors of grpComm before changing the vector v, allocated by SharedVector, which was
+ * already read by other processors after the last AllGather (otherwise, they may still be reading it); has no effect
+ * for regular vectors
+ */
+{
+#if defined(ADDA_MPI) && defined(SUPPORT_MPI_SHARED)
+	int i;
+
+	if ((i=FindShared(v))>=0) SyncNode(shArr[i].win);
+#endif
+}
+
+//======================================================================================================================
+
+size_t SharedSize(const size_t size)
+/* returns the part of node-shared memory of a given 'size' (in bytes), which is attributed to the current processor
+ * in the memory usage: all of it for the first processor on the node (and without shared memory), and none for others.
+ * Should be called by all processors of grpComm simultaneously.
+ */
+{
+#if defined(ADDA_MPI) && defined(SUPPORT_MPI_SHARED)
+	int id;
+
+	InitNodeComm();
+	MPI_Comm_rank(nodeComm,&id);
+	if (id!=0) return 0;
+#endif
+	return size;
+}
+
+//======================================================================================================================
+
+void ReduceScatter(void * restrict x UOIP,const var_type type UOIP,const size_t * restrict counts UOIP,
+	TIME_TYPE *timing UOIP)
+/* in-place reduce-scatter of arrays; x contains sum(counts) elements, which are added over all processors. Then the
+ * i-th processor receives the i-th block of counts[i] elements of the sum (blocks are ordered by ringid), which is
+ * located in the beginning of x. Works for all types; increments 'timing' (if not NULL) by the time used.
+ */
+{
+#ifdef ADDA_MPI
+	MPI_Datatype mes_type;
+	TIME_TYPE tstart;
+	int i,mult,*cnt,*idsp;
+	size_t ext,*dsp;
+
+	tstart=0;
+	if (timing!=NULL) {
+#ifdef SYNCHRONIZE_TIMING
+		MPI_Barrier(grpComm);  // synchronize to get correct timing
+#endif
+		tstart=GET_TIME();
+	}
+	mes_type=MPIVarType(type,true,&mult);
+	MALLOC_VECTOR(cnt,int,nprocs,ALL);
+	MALLOC_VECTOR(idsp,int,nprocs,ALL);
+	MALLOC_VECTOR(dsp,sizet,nprocs,ALL);
+	dsp[0]=0;
+	for (i=1;i<nprocs;i++) dsp[i]=dsp[i-1]+counts[i-1];
+	if (IntCounts(counts,dsp,mult,cnt,idsp)) MPI_Reduce_scatter(MPI_IN_PLACE,x,cnt,mes_type,MPI_SUM,grpComm);
+	else { // each block is reduced to its processor separately, then moved to the beginning of x
+		ext=mult*TypeExtent(mes_type);
+		for (i=0;i<nprocs;i++)
+			ReduceLarge((char *)x+dsp[i]*ext,counts[i]*mult,mes_type,MPI_SUM,i,i==ringid,grpComm);
+		memmove(x,(char *)x+dsp[ringid]*ext,counts[ringid]*ext);
+	}
+	Free_general(cnt);
+	Free_general(idsp);
+	Free_general(dsp);
+	if (timing!=NULL) (*timing)+=GET_TIME()-tstart;
+#endif
+}
+
+//======================================================================================================================
+
+void GatherVar(void * restrict x UOIP,const var_type type UOIP,const size_t * restrict counts UOIP,
+	TIME_TYPE *timing UOIP)
+/* in-place gather of arrays of variable length on root (inverse of ReduceScatter); counts[i] is the number of elements
+ * contributed by the i-th processor, which are located in the beginning of x (on that processor). On exit, x on root
+ * contains all these blocks ordered by ringid (the block of the root itself is not moved, since ADDA_ROOT is 0). Works
+ * for all types; increments 'timing' (if not NULL) by the time used.
+ */
+{
+#ifdef ADDA_MPI
+	MPI_Datatype mes_type;
+	TIME_TYPE tstart;
+	int i,*cnt,*idsp;
+	size_t *dsp;
+
+	tstart=0;
+	if (timing!=NULL) {
+#ifdef SYNCHRONIZE_TIMING
+		MPI_Barrier(grpComm);  // synchronize to get correct timing
+#endif
+		tstart=GET_TIME();
+	}
+	mes_type=MPIVarType(type,false,NULL);
+	MALLOC_VECTOR(cnt,int,nprocs,ALL);
+	MALLOC_VECTOR(idsp,int,nprocs,ALL);
+	MALLOC_VECTOR(dsp,sizet,nprocs,ALL);
+	dsp[0]=0;
+	for (i=1;i<nprocs;i++) dsp[i]=dsp[i-1]+counts[i-1];
+	if (IntCounts(counts,dsp,1,cnt,idsp)) {
+		if (IFROOT) MPI_Gatherv(MPI_IN_PLACE,0,mes_type,x,cnt,idsp,mes_type,ADDA_ROOT,grpComm);
+		else MPI_Gatherv(x,cnt[ringid],mes_type,NULL,NULL,NULL,mes_type,ADDA_ROOT,grpComm);
+	}
+	else { // point-to-point transfers in chunks
+		if (IFROOT) for (i=0;i<nprocs;i++) {
+			if (i!=ADDA_ROOT) RecvLarge((char *)x+dsp[i]*TypeExtent(mes_type),counts[i],mes_type,i);
+		}
+		else SendLarge(x,counts[ringid],mes_type,ADDA_ROOT);
+	}
+	Free_general(cnt);
+	Free_general(idsp);
+	Free_general(dsp);
+	if (timing!=NULL) (*timing)+=GET_TIME()-tstart;
+#endif
+}
+
+//======================================================================================================================
+
+#ifdef SPARSE
+
+size_t RingBlock(const int step UOIP,size_t * restrict start)
+/* returns the number of dipoles in the block of the argument vector, which is processed at 'step' of the ring exchange
+ * (see RingShift), and its starting (global) index in 'start'. This block belongs to processor (ringid-step) mod nprocs.
+ * The first call must be made by all processors simultaneously (in parallel mode).
+ */
+{
+#ifdef ADDA_MPI
+	const int src=(ringid+nprocs-step%nprocs)%nprocs;
+
+	InitDispls(); // actually initialization is done only once
+	*start=displs[src];
+	return recvcounts[src];
+#else
+	*start=local_nvoid_d0;
+	return local_nvoid_Ndip;
+#endif
+}
+
+#ifdef PARALLEL
+
+void RingShift(const doublecomplex * restrict sendbuf,doublecomplex * restrict recvbuf,const int step)
+/* starts the nonblocking transfer of the block of the argument vector, which is processed at 'step' (in sendbuf), to the
+ * next processor in the ring and of the block for the next step from the previous processor (into recvbuf). The
+ * transfer must be completed by RingWait; meanwhile sendbuf can be read but not modified.
+ */
+{
+#ifdef ADDA_MPI
+	size_t start;
+	const size_t nsend=RingBlock(step,&start),nrecv=RingBlock(step+1,&start);
+	const MPI_Datatype mes_type=MPIVarType(cmplx3_type,false,NULL);
+	MPI_Datatype stype,rtype;
+
+	// the datatypes can be freed right away, since they are retained by MPI until the transfers are completed
+	LargeContiguous(nsend,mes_type,&stype);
+	LargeContiguous(nrecv,mes_type,&rtype);
+	MPI_Isend(sendbuf,1,stype,(ringid+1)%nprocs,0,grpComm,ringReq);
+	MPI_Irecv(recvbuf,1,rtype,(ringid+nprocs-1)%nprocs,0,grpComm,ringReq+1);
+	MPI_Type_free(&stype);
+	MPI_Type_free(&rtype);
+#endif
+}
+
+//======================================================================================================================
+
+void RingWait(TIME_TYPE *timing)
+// completes the transfer started by RingShift; increments 'timing' by the time spent in waiting
+{
+#ifdef ADDA_MPI
+	const TIME_TYPE tstart=GET_TIME();
+
+	MPI_Waitall(2,ringReq,MPI_STATUSES_IGNORE);
+	(*timing)+=GET_TIME()-tstart;
+#endif
+}
+
+#endif // PARALLEL
+
+#endif // SPARSE
+
+//======================================================================================================================
+
+void InitComm(int *argc_p UOIP,char ***argv_p UOIP)
+// initialize communications in the beginning of the program
+{
+#ifdef ADDA_MPI
+	int ver,subver;
+
+	/* MPI_Init may alter argc and argv and interfere with normal parsing of command line parameters. The way of
+	 * altering is implementation depending. MPI searches for MPI parameters in the command line and removes them (we
+	 * assume some kind of removing does take place - otherwise ADDA will produce error 'unknown parameter'). The best
+	 * would be to change argc and argv so that they look like no special command line arguments are present. However,
+	 * MPICH 1.2.5, for example, just replaces corresponding parameters by NULLs. To incorporate it we introduce special
+	 * function to restore the command line
+	 */
+	MPI_Init(argc_p,argv_p);
+	tstart_main = GET_TIME(); // initialize program time
+	RecoverCommandLine(argc_p,argv_p);
+	// initialize ringid and nprocs
+	MPI_Comm_rank(MPI_COMM_WORLD,&ringid);
+	MPI_Comm_size(MPI_COMM_WORLD,&nprocs);
+	grpComm=MPI_COMM_WORLD;
+	// define a few derived datatypes
+#ifdef SUPPORT_MPI_COMPLEX
+	mpi_dcomplex = MPI_C_DOUBLE_COMPLEX; // use built-in datatype if supported
+#else
+	MPI_Type_contiguous(2,MPI_DOUBLE,&mpi_dcomplex);
+	MPI_Type_commit(&mpi_dcomplex);
+#endif
+	MPI_Type_contiguous(3,MPI_INT,&mpi_int3);
+	MPI_Type_commit(&mpi_int3);
+	MPI_Type_contiguous(3,MPI_DOUBLE,&mpi_double3);
+	MPI_Type_commit(&mpi_double3);
+	MPI_Type_contiguous(3,mpi_dcomplex,&mpi_dcomplex3);
+	MPI_Type_commit(&mpi_dcomplex3);
+	// check MPI version at runtime
+	MPI_Get_version(&ver,&subver);
+	D("MPI library version: %d.%d",ver,subver);
+	/* Microsoft MPI claims to support most of the MPI 2.2 features (and even some of 3.1), but declares only 2.0, see
+	 * https://github.com/microsoft/Microsoft-MPI/issues/15 . We, thus, use the following hack to assume its support for
+	 * MPI 2.2. However, it is not perfect, if different vendor libraries are used at compile and runtime:
+	 * - compiling with MS_MPI and further linking with another library (conforming to MPI 2.0 or 2.1), the hack is too
+	 *   optimistic, and may cause further problems during execution.
+	 * - compiling with another library and further linking with MS_MPI, the hack is skipped and execution fails,
+	 *   although it may have worked.
+	 * However, such cross usage is unlikely because there are not many MPI implementations for Windows, and even the
+	 * main library file for MS_MPI is named differently (msmpi.lib).
+	 * To get more confidence, we can use MPI_Get_library_version(), but this will cause complete failure for some
+	 * older libraries that support MPI 2.2, but do not have this 3.0 function.
+	 */
+#ifdef MSMPI_VER
+	if (ver==2 && subver<2) {
+		D("But we assume that this is Microsoft MPI library that supports MPI 2.2");
+		subver=2;
+	}
+#endif
+	if (!GREATER_EQ2(ver,subver,RUN_MPI_VER_REQ,RUN_MPI_SUBVER_REQ)) {
+		if (GREATER_EQ2(ver,subver,MPI_VER_REQ,MPI_SUBVER_REQ)) // library fits into minimum requirements
+			LogError(ONE_POS,"MPI library version (%d.%d) is too old for current ADDA executable. Version %d.%d or "
+				"newer is required. Alternatively, you may recompile ADDA using this version of the library.",
+				ver,subver,RUN_MPI_VER_REQ,RUN_MPI_SUBVER_REQ);
+		else if (RUN_MPI_VER_REQ==MPI_VER_REQ && RUN_MPI_SUBVER_REQ==MPI_SUBVER_REQ) // executable requires minimum
+			LogError(ONE_POS,"MPI library version (%d.%d) is too old. Version %d.%d or newer is required",
+				ver,subver,RUN_MPI_VER_REQ,RUN_MPI_SUBVER_REQ);
+		else // two upgrade options
+			LogError(ONE_POS,"MPI library version (%d.%d) is too old. Version %d.%d or newer is required for the "
+				"current ADDA executable or at least %d.%d, if ADDA is recompiled using such library.",
+				ver,subver,RUN_MPI_VER_REQ,RUN_MPI_SUBVER_REQ,MPI_VER_REQ,MPI_SUBVER_REQ);
+	}
+	// if MPI crashes, it happens here
+	Synchronize();
+#elif !defined(PARALLEL)
+	nprocs=1;
+	ringid=ADDA_ROOT;
+#endif
+
+#ifndef SPARSE // CheckNprocs does not exist in sparse mode
+	// check if weird number of processors is specified; called even in sequential mode to initialize weird_nprocs
+	CheckNprocs();
+#endif // !SPARSE
+}
+
+//======================================================================================================================
+
+void Stop(const int code)
+// stops the program with exit 'code'
+{
+#ifdef ADDA_MPI
+	if (code!=EXIT_SUCCESS) { // error occurred
+		fflush(NULL);
+		fprintf(stderr,"Aborting process %d\n",ringid);
+		MPI_Abort(MPI_COMM_WORLD,code);
+	}
+	else { // regular termination
+		// clean MPI constructs and some memory
+#ifndef SUPPORT_MPI_COMPLEX
+		MPI_Type_free(&mpi_dcomplex);
+#endif
+		MPI_Type_free(&mpi_int3);
+		MPI_Type_free(&mpi_double3);
+		MPI_Type_free(&mpi_dcomplex3);
+#ifdef SUPPORT_MPI_SHARED
+		// some node-shared vectors may be left, e.g., in prognosis mode
+		while (shNum>0) Free_shared(shArr[0].ptr);
+		if (nodeComm!=MPI_COMM_NULL) {
+			MPI_Comm_free(&nodeComm);
+			if (leadComm!=MPI_COMM_NULL) MPI_Comm_free(&leadComm);
+			Free_general(nodeOf);
+		}
+#endif
+#ifndef SPARSE
+		if (yComm!=MPI_COMM_NULL) MPI_Comm_free(&yComm);
+		if (zComm!=MPI_COMM_NULL) MPI_Comm_free(&zComm);
+		if (lb_z!=NULL) { // allocated in SetLoadBalance
+			Free_general(lb_z);
+			Free_general(bal_cnt);
+			Free_general(bal_dsp);
+			Free_general(slab_cnt);
+			Free_general(slab_dsp);
+			Free_general(lb_scnt);
+			Free_general(lb_sdsp);
+			Free_general(lb_rcnt);
+			Free_general(lb_rdsp);
+			Free_general(lb_unif);
+			Free_general(lb_bal);
+		}
+#endif
+		if (displs_init) {
+			Free_general(recvcounts);
+			Free_general(displs);
+		}
+		// wait for all processors
+		fflush(NULL);
+		Synchronize();
+		if (grpComm!=MPI_COMM_WORLD) MPI_Comm_free(&grpComm);
+		// finalize MPI communications
+		MPI_Finalize();
+	}
+#endif
+	exit(code);
+}
+
+//======================================================================================================================
+
+void Synchronize(void)
+// synchronizes all processes
+{
+#ifdef ADDA_MPI
+	MPI_Barrier(grpComm);
+#endif
+}
+
+//======================================================================================================================
+
+void MyBcast(void * restrict data UOIP,const var_type type UOIP,const size_t n_elem UOIP,TIME_TYPE *timing UOIP)
+/* casts values stored in '*data' from root processor to all other; works for all types;
+ * increments 'timing' (if not NULL) by the time used
+ */
+{
+#ifdef ADDA_MPI
+	TIME_TYPE tstart=0; // redundant initialization to remove warnings
 
-	if (n_elem>INT_MAX) LogError(ONE_POS,"int overflow in MPI function (%zu)",n_elem);
 	if (timing!=NULL) {
 #ifdef SYNCHRONIZE_TIMING
-		MPI_Barrier(MPI_COMM_WORLD); // synchronize to get correct timing
+		MPI_Barrier(grpComm); // synchronize to get correct timing
 #endif
 		tstart=GET_TIME();
 	}
-	MPI_Bcast(data,n_elem,MPIVarType(type,false,NULL),ADDA_ROOT,MPI_COMM_WORLD);
+	BcastLarge(data,n_elem,MPIVarType(type,false,NULL),ADDA_ROOT,grpComm);
 	if (timing!=NULL) (*timing)+=GET_TIME()-tstart;
 #endif
 }
@@ -414,7 +1082,7 @@ void BcastOrient(int *i UOIP, int *j UOIP, int *k UOIP)
 		buf[1]=*j;
 		buf[2]=*k;
 	}
-	MPI_Bcast(buf,3,MPI_INT,ADDA_ROOT,MPI_COMM_WORLD);
+	MPI_Bcast(buf,3,MPI_INT,ADDA_ROOT,grpComm);
 	if (!IFROOT) {
 		*i=buf[0];
 		*j=buf[1];
@@ -425,277 +1093,901 @@ void BcastOrient(int *i UOIP, int *j UOIP, int *k UOIP)
 
 //======================================================================================================================
 
-double AccumulateMax(double data UOIP,double *max UOIP)
-// given a single double on each processor, accumulates their sum (returns) and maximum on root processor
+#ifdef PARALLEL
+
+void SplitOrientGroups(void)
+/* splits all processors into orient_groups groups of consecutive processors, each working on its own orientations
+ * (-orient_groups); afterwards ringid and nprocs refer to the group, and all communications, except the following two
+ * functions, are performed inside the group
+ */
 {
 #ifdef ADDA_MPI
-	double buf;
-	// potentially can be optimized by combining into one operation
-	MPI_Reduce(&data,&buf,1,MPI_DOUBLE,MPI_SUM,ADDA_ROOT,MPI_COMM_WORLD);
-	MPI_Reduce(&data,max,1,MPI_DOUBLE,MPI_MAX,ADDA_ROOT,MPI_COMM_WORLD);
-	return buf;
-#else
-	return data;
+	int size=nprocs/orient_groups;
+
+	orientGroup=ringid/size;
+	MPI_Comm_split(MPI_COMM_WORLD,orientGroup,ringid,&grpComm);
+	MPI_Comm_rank(grpComm,&ringid);
+	MPI_Comm_size(grpComm,&nprocs);
+#	ifndef SPARSE
+	CheckNprocs(); // to update weird_nprocs, since the number of processors has changed
+#	endif
 #endif
 }
 
 //======================================================================================================================
 
-void Accumulate(void * restrict data UOIP,const var_type type UOIP,size_t n UOIP,TIME_TYPE *timing UOIP)
-// Gather and add complex vector on processor root; total time is saved in timing (NOT incremented).
-// Can be easily made to accept any variable type
+void BcastOrientBatch(int * restrict n,int * restrict nodes)
+/* casts a batch of orientations (their number and 2*n indices in 'nodes') from root to all processors of all the
+ * orientation groups; n=0 signals the end of orientation averaging
+ */
+{
+#ifdef ADDA_MPI
+	MPI_Bcast(n,1,MPI_INT,ADDA_ROOT,MPI_COMM_WORLD);
+	if (*n>0) MPI_Bcast(nodes,2*(*n),MPI_INT,ADDA_ROOT,MPI_COMM_WORLD);
+#endif
+}
+
+//======================================================================================================================
+
+void AccumulateGroups(void * restrict data,const var_type type,size_t n,TIME_TYPE *timing)
+/* Similar to Accumulate(), but adds data from all processors of all the orientation groups, the result is obtained on
+ * root of the first group; timing is incremented
+ */
 {
 #ifdef ADDA_MPI
 	MPI_Datatype mes_type;
 	int mult;
 	TIME_TYPE tstart;
 
-	if (n>INT_MAX) LogError(ONE_POS,"int overflow in MPI function (%zu)",n);
-#ifdef SYNCHRONIZE_TIMING
-	MPI_Barrier(MPI_COMM_WORLD); // synchronize to get correct timing
-#endif
 	tstart=GET_TIME();
 	mes_type=MPIVarType(type,true,&mult);
-	n*=mult;
-	// Strange, but MPI 2.2 doesn't seem to support calling the following the same way on all processes
-	if (IFROOT) MPI_Reduce(MPI_IN_PLACE,data,n,mes_type,MPI_SUM,ADDA_ROOT,MPI_COMM_WORLD);
-	else MPI_Reduce(data,NULL,n,mes_type,MPI_SUM,ADDA_ROOT,MPI_COMM_WORLD);
+	ReduceLarge(data,n*mult,mes_type,MPI_SUM,ADDA_ROOT,IFWROOT,MPI_COMM_WORLD);
+	(*timing)+=GET_TIME()-tstart;
+#endif
+}
+
+#endif // PARALLEL
+
+//======================================================================================================================
+
+double AccumulateMax(double data UOIP,double *max UOIP)
+// given a single double on each processor, accumulates their sum (returns) and maximum on root processor
+{
+#ifdef ADDA_MPI
+	double buf;
+	// potentially can be optimized by combining into one operation
+	MPI_Reduce(&data,&buf,1,MPI_DOUBLE,MPI_SUM,ADDA_ROOT,grpComm);
+	MPI_Reduce(&data,max,1,MPI_DOUBLE,MPI_MAX,ADDA_ROOT,grpComm);
+	return buf;
+#else
+	return data;
+#endif
+}
+
+//======================================================================================================================
+
+void Accumulate(void * restrict data UOIP,const var_type type UOIP,size_t n UOIP,TIME_TYPE *timing UOIP)
+// Gather and add complex vector on processor root; total time is saved in timing (NOT incremented).
+// Can be easily made to accept any variable type
+{
+#ifdef ADDA_MPI
+	MPI_Datatype mes_type;
+	int mult;
+	TIME_TYPE tstart;
+
+#ifdef SYNCHRONIZE_TIMING
+	MPI_Barrier(grpComm); // synchronize to get correct timing
+#endif
+	tstart=GET_TIME();
+	mes_type=MPIVarType(type,true,&mult);
+	ReduceLarge(data,n*mult,mes_type,MPI_SUM,ADDA_ROOT,IFROOT,grpComm);
 	(*timing)=GET_TIME()-tstart;
 #endif
 }
 
 //======================================================================================================================
 
-void MyInnerProduct(void * restrict data UOIP,const var_type type UOIP,size_t n UOIP,TIME_TYPE *timing UOIP)
-/* gather values stored in *data, add them and return them in *data; works for all types; increments 'timing' (if not
- * NULL) by the time used;
- * Similar to Accumulate(), but returns the result to _all_ processors, and timing is _incremented_
+void MyInnerProduct(void * restrict data UOIP,const var_type type UOIP,size_t n UOIP,TIME_TYPE *timing UOIP)
+/* gather values stored in *data, add them and return them in *data; works for all types; increments 'timing' (if not
+ * NULL) by the time used;
+ * Similar to Accumulate(), but returns the result to _all_ processors, and timing is _incremented_
+ */
+{
+#ifdef ADDA_MPI
+	MPI_Datatype mes_type;
+	int mult;
+	TIME_TYPE tstart=0; // redundant initialization to remove warnings
+
+	if (timing!=NULL) {
+#ifdef SYNCHRONIZE_TIMING
+		MPI_Barrier(grpComm); // synchronize to get correct timing
+#endif
+		tstart=GET_TIME();
+	}
+	mes_type=MPIVarType(type,true,&mult);
+	AllreduceLarge(NULL,data,n*mult,mes_type,MPI_SUM);
+	if (timing!=NULL) (*timing)+=GET_TIME()-tstart;
+#endif
+}
+
+//======================================================================================================================
+
+void ParSetup(void)
+// initialize common parameters; need to do in the beginning to enable call to MakeParticle
+{
+#ifndef SPARSE // FFT mode initialization
+#	ifdef PARALLEL
+	int unitY,unitZ,unitX;
+#	endif
+	// calculate size of 3D grid
+	gridX=fftFit(2*boxX,nprocs);
+#	ifdef PARALLEL
+	gridY=fftFit(2*boxY,2*procGridY);
+	gridZ=fftFit(2*boxZ,2*procGridZ);
+#	else
+	gridY=fftFit(2*boxY,1);
+	gridZ=fftFit(2*boxZ,2*nprocs);
+#	endif
+	// initialize some variables
+	smallY=gridY/2;
+	smallZ=gridZ/2;
+	/* if this check is passed then all other multiplications of 2 grids are OK, except for XY values, used in granule
+	 * generator
+	 */
+	gridYZ=MultOverflow(gridY,gridZ,ALL_POS,"gridYZ");
+#	ifdef PARALLEL
+	/* processors are arranged in a 2D grid procGridY x procGridZ (y index is the fastest), each of them has a part of y
+	 * and z ranges (all x). After the FFT along x, the data is distributed over x among all processors (see
+	 * BlockTranspose)
+	 */
+	unitY=smallY/procGridY; // this should always be an exact division
+	local_y0=(ringid%procGridY)*unitY;
+	local_y1=local_y0+unitY;
+	if (local_y1 > boxY) local_y1_coer=boxY;
+	else local_y1_coer=local_y1;
+	unitZ=smallZ/procGridZ; // this should always be an exact division
+	local_z0=(ringid/procGridY)*unitZ;
+	local_z1=local_z0+unitZ;
+	if (local_z1 > boxZ) local_z1_coer=boxZ;
+	else local_z1_coer=local_z1;
+	unitX=gridX/nprocs;
+	local_x0=ringid*unitX;
+	local_x1=(ringid+1)*unitX;
+#		ifdef ADDA_MPI
+	if (procGridY>1 && procGridZ>1) {
+		MPI_Comm_split(grpComm,ringid/procGridY,ringid%procGridY,&yComm);
+		MPI_Comm_split(grpComm,ringid%procGridY,ringid/procGridY,&zComm);
+	}
+#		endif
+#	else
+	local_y0=0;
+	local_y1=smallY;
+	local_y1_coer=boxY;
+	local_z0=0;
+	local_z1=smallZ;
+	local_z1_coer=boxZ;
+	local_x0=0;
+	local_x1=gridX;
+#	endif
+	if (local_y1_coer<=local_y0 || local_z1_coer<=local_z0) {
+		LogWarning(EC_INFO,ALL_POS,"No real dipoles are assigned");
+		if (local_y1_coer<=local_y0) local_y1_coer=local_y0;
+		if (local_z1_coer<=local_z0) local_z1_coer=local_z0;
+	}
+	local_Ny=local_y1-local_y0;
+	local_Nz=local_z1-local_z0;
+	local_Nx=local_x1-local_x0;
+	boxXY=boxX*(size_t)boxY; // overflow check is covered by gridYZ above
+	local_boxXY=boxX*(size_t)(local_y1_coer-local_y0);
+	local_Ndip=MultOverflow(local_boxXY,local_z1_coer-local_z0,ALL_POS,"local_Ndip");
+	D("%i :  %i %i %i %i %i %i %zu %zu \n",ringid,local_y0,local_y1_coer,local_y1,local_z0,local_z1_coer,local_z1,
+		local_Ndip,local_Nx);
+#else // SPARSE
+	/* For sparse mode, nvoid_Ndip is defined in InitDipFile(), and here we define local_nvoid_d0 and local_nvoid_d1,
+	 * since they are required already in ReadDipFile()
+	 */
+	D("%zu",nvoid_Ndip);
+#	ifdef PARALLEL
+	double unit_f=1.0/nprocs;
+	//making sure that the first local_f0 and last local_f1 are 0.0 and 1.0
+	double local_f0 = (ringid == 0) ? 0.0 : ringid*unit_f;
+	double local_f1 = (ringid == nprocs-1) ? 1.0 : (ringid+1)*unit_f;
+	local_nvoid_d0 = local_f0*nvoid_Ndip;
+	local_nvoid_d1 = local_f1*nvoid_Ndip;
+#	else
+	local_nvoid_d0=0;
+	local_nvoid_d1=nvoid_Ndip;
+#	endif // PARALLEL
+#endif
+}
+
+//======================================================================================================================
+
+void SetupLocalD(void)
+// initialize local_nvoid_d0 and local_nvoid_d1 in FFT mode. In sparse mode those are set earlier in ParSetup()
+{
+#ifdef ADDA_MPI
+	/* use of exclusive scan (MPI_Exscan) is logically more suitable, but it has special behavior for the ringid=0. The
+	 * latter would require special additional arrangements.
+	 */
+	MPI_Scan(&local_nvoid_Ndip,&local_nvoid_d1,1,MPI_SIZE_T,MPI_SUM,grpComm);
+	local_nvoid_d0=local_nvoid_d1-local_nvoid_Ndip;
+#else
+	local_nvoid_d0=0;
+	local_nvoid_d1=local_nvoid_Ndip;
+#endif
+}
+
+//======================================================================================================================
+
+void ReadField(const char * restrict fname,doublecomplex *restrict field)
+/* Reads a complex field from file 'fname' and stores into 'field'.
+ *
+ * In MPI mode the algorithm is very far from optimal, since the whole file is read in total nprocs/2 times.
+ * However, this is mainly the limitation of the text file (need to test for blank lines and format consistency).
+ * The only feasible way to improve it is to use binary format like NetCDF (which may work on top of MPI_IO)
+ */
+{
+	char linebuf[BUF_LINE];
+	TIME_TYPE tstart=GET_TIME();
+	FILE *file=FOpenErr(fname,"r",ALL_POS);
+	// the same format as used for saving the beam by StoreFields(...) in make_particle.c
+	const char format[]="%*f %*f %*f %*f %lf %lf %lf %lf %lf %lf";
+	const char test_form[]="%*f"; // a quick test for a blank line, without actual assignment
+	const int mustbe=6;
+	int scanned;
+	size_t i,j;
+	double buf[6];
+
+#if defined(ADDA_MPI) && defined(SYNCHRONIZE_TIMING)
+	MPI_Barrier(grpComm);  // synchronize to get correct timing
+#endif
+	// skips first line with headers and any comments, if present
+	size_t line=SkipNLines(file,1);
+	line+=SkipComments(file);
+	i=j=0;
+	while (FGetsError(file,fname,&line,linebuf,BUF_LINE,ONE_POS)!=NULL) {
+		// scan numbers in a line
+		if (i<local_nvoid_d0) { // just count non-blank lines
+			if (sscanf(linebuf,test_form)!=EOF) i++;
+		}
+		else if (i==nvoid_Ndip) { // tests that file doesn't contains extra data rows
+			if (sscanf(linebuf,test_form)!=EOF) LogError(ALL_POS,"Field file %s contains more data rows than number of "
+				"dipoles (%zu) in the particle",fname,nvoid_Ndip);
+		}
+		else { // here local_nvoid_d0 <= i < local_nvoid_d1
+			scanned=sscanf(linebuf,format,buf,buf+1,buf+2,buf+3,buf+4,buf+5);
+			field[j] = buf[0] + I*buf[1];
+			field[j+1] = buf[2] + I*buf[3];
+			field[j+2] = buf[4] + I*buf[5];
+			if (scanned==EOF) {
+				/* in most cases EOF indicates blank line (which we just skip), but it can also be a short (ill-format)
+				 * line, for which we test below. Otherwise, such lines may be interpreted differently b different
+				 * processors
+				 */
+				if (sscanf(linebuf,test_form)!=EOF)
+					LogError(ALL_POS,"Error occurred during scanning of line %zu from field file %s",line,fname);
+			}
+			else {
+				if (scanned!=mustbe) // this in most cases indicates wrong format
+					LogError(ALL_POS,"Error occurred during scanning of line %zu from field file %s",line,fname);
+				j+=3;
+				i++;
+				/* all processors stop reading file as soon as possible, but the last processor reads one more line to
+				 * test (above) for extra strings in the file
+				 */
+				if (i==local_nvoid_d1 && i!=nvoid_Ndip) break;
+			}
+		}
+	}
+#if defined(ADDA_MPI) && defined(SYNCHRONIZE_TIMING)
+	MPI_Barrier(grpComm);  // synchronize to get correct timing
+#endif
+	Timing_FileIO+=GET_TIME()-tstart;
+}
+
+//======================================================================================================================
+
+struct binout_struct { // handle of binary output file, see BinOutOpen()
+#ifdef ADDA_MPI
+	MPI_File fh;
+#else
+	FILE *file;
+#endif
+	const char *fname; // file name (pointer is stored as is, so it should be valid until BinOutClose)
+	size_t rec_size;   // size of one record in bytes
+};
+
+//======================================================================================================================
+
+binout *BinOutOpen(const char * restrict fname,const void * restrict header,const size_t head_size)
+/* Opens binary file 'fname' for writing and writes header of size 'head_size' (in bytes) at its beginning (by the root
+ * processor). The data are further written by BinOutSeek() and BinOutWrite().
+ *
+ * In MPI mode all processors write to a single file by MPI-IO, using file view to place their data in the right
+ * position. This eliminates the temporary files and their concatenation, which are required for text files.
+ */
+{
+	binout *bo;
+
+	MALLOC_VECTOR(bo,void,sizeof(binout),ALL);
+	bo->fname=fname;
+	bo->rec_size=1;
+#ifdef ADDA_MPI
+	MPI_Status status;
+
+	// MPI_File_open is collective and ignores MPI_MODE_CREATE for existing files, so remove possible old file first
+	if (IFROOT) MPI_File_delete(fname,MPI_INFO_NULL);
+	Synchronize();
+	if (MPI_File_open(grpComm,fname,MPI_MODE_CREATE|MPI_MODE_WRONLY,MPI_INFO_NULL,&(bo->fh))
+		!=MPI_SUCCESS) LogError(ALL_POS,"Failed to open file '%s' for parallel writing",fname);
+	if (IFROOT && MPI_File_write_at(bo->fh,0,header,head_size,MPI_BYTE,&status)!=MPI_SUCCESS)
+		LogError(ONE_POS,"Failed to write header to file '%s'",fname);
+#else
+	bo->file=FOpenErr(fname,"wb",ALL_POS);
+	if (fwrite(header,1,head_size,bo->file)!=head_size) LogError(ALL_POS,"Failed to write header to file '%s'",fname);
+#endif
+	return bo;
+}
+
+//======================================================================================================================
+
+size_t BinOutSeek(binout * restrict bo,const size_t disp,const size_t rec_size,const size_t n,const size_t chunk,
+	size_t * restrict start)
+/* Prepares to write a section of binary file 'bo', starting at 'disp' bytes from its beginning, which consists of
+ * records of size 'rec_size' (in bytes). Each processor writes 'n' records, placed after the records of all processors
+ * with smaller ringid. Index of the first local record in the section is returned in 'start' (if not NULL). The data
+ * are further written by BinOutWrite() in at most 'chunk' records at a time; the returned value is the number of calls
+ * of the latter that each processor should perform (the same for all processors, since writing is collective).
+ */
+{
+	size_t maxN,st;
+
+	bo->rec_size=rec_size;
+#ifdef ADDA_MPI
+	// see SetupLocalD() for the comment on MPI_Exscan
+	MPI_Scan(&n,&st,1,MPI_SIZE_T,MPI_SUM,grpComm);
+	st-=n;
+	MPI_File_set_view(bo->fh,(MPI_Offset)(disp+st*rec_size),MPI_BYTE,MPI_BYTE,"native",MPI_INFO_NULL);
+	MPI_Allreduce(&n,&maxN,1,MPI_SIZE_T,MPI_MAX,grpComm);
+	if (chunk*rec_size>INT_MAX) LogError(ALL_POS,"int overflow in MPI function for binary output (%zu)",chunk*rec_size);
+#else
+	st=0;
+	FSeekErr(bo->file,disp,bo->fname,ALL_POS);
+	maxN=n;
+#endif
+	if (start!=NULL) *start=st;
+	return (maxN+chunk-1)/chunk;
+}
+
+//======================================================================================================================
+
+void BinOutWrite(binout * restrict bo,const void * restrict buf,const size_t n)
+/* writes n records from 'buf' to binary file 'bo' (opened by BinOutOpen); in MPI mode this is a collective operation,
+ * and should be called the same number of times by all processors (n can be zero)
+ */
+{
+#ifdef ADDA_MPI
+	MPI_Status status;
+
+	if (MPI_File_write_all(bo->fh,buf,n*bo->rec_size,MPI_BYTE,&status)!=MPI_SUCCESS)
+		LogError(ALL_POS,"Failed to write data to file '%s'",bo->fname);
+#else
+	if (fwrite(buf,bo->rec_size,n,bo->file)!=n) LogError(ALL_POS,"Failed to write data to file '%s'",bo->fname);
+#endif
+}
+
+//======================================================================================================================
+
+void BinOutClose(binout * restrict bo)
+// closes binary file 'bo' and frees the handle
+{
+#ifdef ADDA_MPI
+	if (MPI_File_close(&(bo->fh))!=MPI_SUCCESS) LogError(ALL_POS,"Failed to close file '%s'",bo->fname);
+#else
+	FCloseErr(bo->file,bo->fname,ALL_POS);
+#endif
+	Free_general(bo);
+}
+
+//======================================================================================================================
+
+#ifndef SPARSE
+
+#ifdef ADDA_MPI
+static void BlockType(const int ncomp,const size_t lengthY,const size_t lengthZ,const size_t width,const int nslot,
+	const int np,MPI_Datatype *type)
+/* creates and commits a datatype for the part of X, which is exchanged with a single processor in TransposeStage (see
+ * its description for the meaning of arguments); the datatype starts at the first block of this part. Nested datatypes
+ * are used, so that the number of elements in each of them fits into int. Doubles are used as elementary type to match
+ * the packed parts (see LargeContiguous), which are transferred to or from this datatype.
+ */
+{
+	MPI_Datatype line,plane,comp;
+	const MPI_Aint elem=sizeof(doublecomplex);
+
+	if (2*np*width>INT_MAX || lengthY>INT_MAX || lengthZ>INT_MAX) LogError(ALL_POS,
+		"int overflow in MPI function for BT datatype (%zu)",MAX(2*np*width,MAX(lengthY,lengthZ)));
+	MPI_Type_vector(nslot,(int)(2*width),(int)(2*np*width),MPI_DOUBLE,&line);
+	MPI_Type_create_hvector((int)lengthY,1,(MPI_Aint)gridX*elem,line,&plane);
+	MPI_Type_create_hvector((int)lengthZ,1,(MPI_Aint)(lengthY*gridX)*elem,plane,&comp);
+	MPI_Type_create_hvector(ncomp,1,(MPI_Aint)local_Nsmall*elem,comp,type);
+	MPI_Type_commit(type);
+	MPI_Type_free(&line);
+	MPI_Type_free(&plane);
+	MPI_Type_free(&comp);
+}
+
+//======================================================================================================================
+
+static void PackBlocks(doublecomplex * restrict X,double * restrict buf,const int part,const int ncomp,
+	const size_t lengthY,const size_t lengthZ,const size_t width,const int nslot,const int np,const bool unpack)
+/* copies the blocks of X, which are exchanged with processor 'part' in TransposeStage (see its description for the
+ * meaning of other arguments), into contiguous buffer 'buf', or backwards (if 'unpack')
+ */
+{
+	size_t posit,y,z;
+	int comp,slot;
+	doublecomplex * restrict line;
+	const size_t step=2*width,msize=width*sizeof(doublecomplex),slot_step=np*width;
+
+	posit=0;
+	for(comp=0;comp<ncomp;comp++) for(z=0;z<lengthZ;z++) for(y=0;y<lengthY;y++) {
+		line=X+comp*local_Nsmall+IndexBlock(part*width,y,z,lengthY);
+		for(slot=0;slot<nslot;slot++,posit+=step) {
+			if (unpack) memcpy(line+slot*slot_step,buf+posit,msize);
+			else memcpy(buf+posit,line+slot*slot_step,msize);
+		}
+	}
+}
+
+//======================================================================================================================
+
+static void InitStage(bt_stage * restrict st,MPI_Comm comm)
+// initializes the data for the stage of block transposition among processors of 'comm', depending on bt_meth
+{
+	int i,*ranks;
+	MPI_Group grp,nodeGrp;
+
+	st->comm=comm;
+	MPI_Comm_rank(comm,&(st->id));
+	MPI_Comm_size(comm,&(st->np));
+	st->graph=MPI_COMM_NULL;
+	st->node=NULL;
+	MALLOC_VECTOR(ranks,int,2*st->np,ALL);
+#ifdef SUPPORT_MPI_NEIGHBOR
+	if (bt_meth==BTM_NEIGHBOR || bt_meth==BTM_AUTO) {
+		/* neighbors are all other processors in the increasing order of ranks; no reordering to keep these ranks. Unit
+		 * weights are given explicitly (stored in the second half of 'ranks'), since some compilers issue false
+		 * warnings for MPI_UNWEIGHTED
+		 */
+		for (i=0;i<st->np-1;i++) {
+			ranks[i] = (i<st->id) ? i : i+1;
+			ranks[st->np+i]=1;
+		}
+		MPI_Dist_graph_create_adjacent(comm,st->np-1,ranks,ranks+st->np,st->np-1,ranks,ranks+st->np,MPI_INFO_NULL,0,
+			&(st->graph));
+	}
+#endif
+#ifdef SUPPORT_MPI_SHARED
+	if (bt_meth==BTM_NODE || bt_meth==BTM_AUTO) {
+		InitNodeComm();
+		if (bt_shm==NULL) MALLOC_VECTOR(bt_shm,void,nodeSize*sizeof(double *),ALL);
+		for (i=0;i<st->np;i++) ranks[i]=i;
+		MALLOC_VECTOR(st->node,int,st->np,ALL);
+		MPI_Comm_group(comm,&grp);
+		MPI_Comm_group(nodeComm,&nodeGrp);
+		MPI_Group_translate_ranks(grp,st->np,ranks,nodeGrp,st->node);
+		MPI_Group_free(&grp);
+		MPI_Group_free(&nodeGrp);
+	}
+#endif
+	Free_general(ranks);
+}
+
+//======================================================================================================================
+
+static void FreeStage(bt_stage * restrict st)
+// frees the data, allocated by InitStage
+{
+	if (st->graph!=MPI_COMM_NULL) MPI_Comm_free(&(st->graph));
+	if (st->node!=NULL) Free_general(st->node);
+}
+
+//======================================================================================================================
+
+#ifdef SUPPORT_MPI_SHARED
+static void FreeNodeBuffer(void)
+// frees the shared-memory window, allocated by NodeBuffer
+{
+	if (bt_win!=MPI_WIN_NULL) {
+		MPI_Win_unlock_all(bt_win);
+		MPI_Win_free(&bt_win);
+		bt_win_size=0;
+	}
+}
+
+//======================================================================================================================
+
+static double *NodeBuffer(const size_t size)
+/* returns the segment of the current processor in the shared-memory window (used for BTM_NODE) of at least 'size'
+ * doubles; the window is reallocated, if it is smaller. Should be called by all processors of nodeComm simultaneously
+ * with the same 'size'. The segments of other processors are accessible through bt_shm.
+ */
+{
+	int i,disp_unit;
+	MPI_Aint seg_size;
+	double *ptr;
+
+	if (size>bt_win_size) {
+		FreeNodeBuffer();
+		MPI_Win_allocate_shared((MPI_Aint)(size*sizeof(double)),sizeof(double),MPI_INFO_NULL,nodeComm,&ptr,&bt_win);
+		// the window is accessed only by direct loads and stores, synchronized by MPI_Win_sync and barriers
+		MPI_Win_lock_all(MPI_MODE_NOCHECK,bt_win);
+		for (i=0;i<nodeSize;i++) MPI_Win_shared_query(bt_win,i,&seg_size,&disp_unit,bt_shm+i);
+		bt_win_size=size;
+	}
+	MPI_Comm_rank(nodeComm,&i);
+	return bt_shm[i];
+}
+#endif
+
+//======================================================================================================================
+
+static void TransposeStage(doublecomplex * restrict X,const int ncomp,const size_t lengthY,const size_t lengthZ,
+	const size_t width,const int nslot,const bt_stage * restrict st)
+/* one stage of the block transposition of X, consisting of the exchange between all processors in st->comm. X has
+ * ncomp components (separated by local_Nsmall), each consisting of lengthY*lengthZ lines along x. Each line is divided
+ * into nslot*np blocks of size 'width', and blocks with index p (modulo np) are exchanged with processor p, i.e.
+ * received blocks replace the sent ones. Outgoing blocks are packed into a buffer, while incoming ones are received
+ * directly into X using a derived datatype. The exchange is performed according to bt_meth:
+ * BTM_PAIR - np-1 (or np) rounds of pairwise exchanges, each using the same part of BT_buffer;
+ * BTM_ALLTOALL - single call to MPI_Alltoall, all parts are packed into BT_buffer (including the own one, which is thus
+ *                copied in place);
+ * BTM_NEIGHBOR - the same by MPI_Neighbor_alltoallw on the graph of all processors, excluding the own part;
+ * BTM_NODE - parts are packed into the shared-memory window, from which the processors on the same node directly
+ *            unpack them, while the parts for other nodes are transferred by pairwise exchanges.
+ */
+{
+	int transmission,part,i;
+	MPI_Datatype btype,ptype,rtype;
+	const int id=st->id,np=st->np;
+	const size_t bufsize=2*ncomp*lengthZ*lengthY*nslot*width; // size of the part for one processor (in doubles)
+#ifdef SUPPORT_MPI_NEIGHBOR
+	int *cnt;
+	MPI_Aint *sdsp,*rdsp;
+	MPI_Datatype *stypes,*rtypes;
+#endif
+#ifdef SUPPORT_MPI_SHARED
+	double * restrict buf;
+#endif
+
+	BlockType(ncomp,lengthY,lengthZ,width,nslot,np,&btype);
+	LargeContiguous(bufsize,MPI_DOUBLE,&ptype);
+	switch (bt_meth) {
+		case BTM_ALLTOALL:
+			for (part=0;part<np;part++) PackBlocks(X,BT_buffer+part*bufsize,part,ncomp,lengthY,lengthZ,width,nslot,np,
+				false);
+			// the extent of datatype is changed to the distance between the parts of consecutive processors in X
+			MPI_Type_create_resized(btype,0,(MPI_Aint)(width*sizeof(doublecomplex)),&rtype);
+			MPI_Type_commit(&rtype);
+			MPI_Alltoall(BT_buffer,1,ptype,X,1,rtype,st->comm);
+			MPI_Type_free(&rtype);
+			break;
+#ifdef SUPPORT_MPI_NEIGHBOR
+		case BTM_NEIGHBOR:
+			MALLOC_VECTOR(cnt,int,np-1,ALL);
+			MALLOC_VECTOR(sdsp,void,(np-1)*sizeof(MPI_Aint),ALL);
+			MALLOC_VECTOR(rdsp,void,(np-1)*sizeof(MPI_Aint),ALL);
+			MALLOC_VECTOR(stypes,void,(np-1)*sizeof(MPI_Datatype),ALL);
+			MALLOC_VECTOR(rtypes,void,(np-1)*sizeof(MPI_Datatype),ALL);
+			for (part=0,i=0;part<np;part++) if (part!=id) {
+				PackBlocks(X,BT_buffer+part*bufsize,part,ncomp,lengthY,lengthZ,width,nslot,np,false);
+				cnt[i]=1;
+				sdsp[i]=(MPI_Aint)(part*bufsize*sizeof(double));
+				rdsp[i]=(MPI_Aint)(IndexBlock(part*width,0,0,lengthY)*sizeof(doublecomplex));
+				stypes[i]=ptype;
+				rtypes[i]=btype;
+				i++;
+			}
+			MPI_Neighbor_alltoallw(BT_buffer,cnt,sdsp,stypes,X,cnt,rdsp,rtypes,st->graph);
+			Free_general(cnt);
+			Free_general(sdsp);
+			Free_general(rdsp);
+			Free_general(stypes);
+			Free_general(rtypes);
+			break;
+#endif
+#ifdef SUPPORT_MPI_SHARED
+		case BTM_NODE:
+			buf=NodeBuffer(np*bufsize);
+			for (part=0;part<np;part++) if (part!=id)
+				PackBlocks(X,buf+part*bufsize,part,ncomp,lengthY,lengthZ,width,nslot,np,false);
+			// make the packed parts visible to all processors on the node
+			MPI_Win_sync(bt_win);
+			MPI_Barrier(nodeComm);
+			MPI_Win_sync(bt_win);
+			for (part=0;part<np;part++) if (part!=id && st->node[part]!=MPI_UNDEFINED)
+				PackBlocks(X,bt_shm[st->node[part]]+id*bufsize,part,ncomp,lengthY,lengthZ,width,nslot,np,true);
+			for(transmission=1;transmission<=NumTrans(np);transmission++) {
+				part=CalcPartner(transmission,id,np);
+				if (part!=np && st->node[part]==MPI_UNDEFINED) MPI_Sendrecv(buf+part*bufsize,1,ptype,part,0,
+					X+IndexBlock(part*width,0,0,lengthY),1,btype,part,0,st->comm,MPI_STATUS_IGNORE);
+			}
+			// the window can be reused only after all processors on the node have read their parts from it
+			MPI_Barrier(nodeComm);
+			break;
+#endif
+		default: // BTM_PAIR, it is also used for BTM_AUTO until the method is chosen
+			for(transmission=1;transmission<=NumTrans(np);transmission++) {
+				// if part==np then skip this transmission
+				if ((part=CalcPartner(transmission,id,np))!=np) {
+					PackBlocks(X,BT_buffer,part,ncomp,lengthY,lengthZ,width,nslot,np,false);
+					MPI_Sendrecv(BT_buffer,1,ptype,part,0,X+IndexBlock(part*width,0,0,lengthY),1,btype,part,0,st->comm,
+						MPI_STATUS_IGNORE);
+				}
+			}
+			break;
+	}
+	MPI_Type_free(&btype);
+	MPI_Type_free(&ptype);
+}
+
+//======================================================================================================================
+
+static void TransposeAll(doublecomplex * restrict X,const int ncomp,const size_t lengthY,const size_t lengthZ,
+	const bool back)
+/* do the data-transposition of X (see TransposeStage for description of arguments) between the distribution over y
+ * and z (by the grid of processors) and that over x. For 2D grid of processors it is performed in two stages: first,
+ * whole groups of x-blocks are exchanged between processors with the same y-range, then single x-blocks are exchanged
+ * between processors with the same z-range. In the end, the x-block of processor with index ringid is stored by
+ * processor with (y,z) index ringid at the same place. Each stage is an involution, so inverse transposition ('back')
+ * consists of the same stages in the reverse order.
+ */
+{
+	if (procGridY==1 || procGridZ==1) TransposeStage(X,ncomp,lengthY,lengthZ,local_Nx,1,bt_st);
+	else {
+		if (!back) TransposeStage(X,ncomp,lengthY,lengthZ,procGridY*local_Nx,1,bt_st+1);
+		TransposeStage(X,ncomp,lengthY,lengthZ,local_Nx,procGridZ,bt_st+2);
+		if (back) TransposeStage(X,ncomp,lengthY,lengthZ,procGridY*local_Nx,1,bt_st+1);
+	}
+}
+
+//======================================================================================================================
+
+static const char *BTMethodName(const enum btmethod m)
+// returns the name of the block transposition method (as in the command line)
+{
+	switch (m) {
+		case BTM_PAIR: return "pair";
+		case BTM_ALLTOALL: return "alltoall";
+		case BTM_NEIGHBOR: return "neighbor";
+		case BTM_NODE: return "node";
+		case BTM_AUTO: return "auto";
+	}
+	LogError(ONE_POS,"Unknown block transposition method (%d)",(int)m);
+}
+#endif
+
+//======================================================================================================================
+
+#ifdef PARALLEL
+size_t BTBufferSize(const int ncomp,const size_t lengthY,const size_t lengthZ)
+/* returns the size (in doubles) of the buffer, required for BlockTranspose (ncomp=3) or BlockTranspose_DRm (ncomp=1),
+ * for given local dimensions lengthY and lengthZ. For collective methods of transposition, it holds the whole local
+ * array, while BTM_NODE uses a shared-memory window instead (allocated internally). Should be called after SetBTMethod.
  */
 {
-#ifdef ADDA_MPI
-	MPI_Datatype mes_type;
-	int mult;
-	TIME_TYPE tstart=0; // redundant initialization to remove warnings
-
-	if (n>INT_MAX) LogError(ONE_POS,"int overflow in MPI function (%zu)",n);
-	if (timing!=NULL) {
-#ifdef SYNCHRONIZE_TIMING
-		MPI_Barrier(MPI_COMM_WORLD); // synchronize to get correct timing
-#endif
-		tstart=GET_TIME();
+	size_t n=1; // number of x-blocks (of size local_Nx) in a line for a single transmission
+	if (bt_meth==BTM_NODE) return 0;
+	if (bt_meth==BTM_PAIR) {
+		if (procGridY>1 && procGridZ>1) n=MAX(procGridY,procGridZ);
 	}
-	mes_type=MPIVarType(type,true,&mult);
-	n*=mult;
-	MPI_Allreduce(MPI_IN_PLACE,data,n,mes_type,MPI_SUM,MPI_COMM_WORLD);
-	if (timing!=NULL) (*timing)+=GET_TIME()-tstart;
-#endif
+	else n=nprocs;
+	return 2*ncomp*lengthY*lengthZ*local_Nx*n;
 }
 
 //======================================================================================================================
 
-void ParSetup(void)
-// initialize common parameters; need to do in the beginning to enable call to MakeParticle
+void SetBTMethod(void)
+/* initializes the data for the stages of block transposition (communicators, etc.), depending on bt_method; should be
+ * called by all processors before the first transposition
+ */
 {
-#ifndef SPARSE // FFT mode initialization
-#	ifdef PARALLEL
-	int unitZ,unitX;
-#	endif
-	// calculate size of 3D grid
-	gridX=fftFit(2*boxX,nprocs);
-	gridY=fftFit(2*boxY,1);
-	gridZ=fftFit(2*boxZ,2*nprocs);
-	// initialize some variables
-	smallY=gridY/2;
-	smallZ=gridZ/2;
-	/* if this check is passed then all other multiplications of 2 grids are OK, except for XY values, used in granule
-	 * generator
-	 */
-	gridYZ=MultOverflow(gridY,gridZ,ALL_POS,"gridYZ");
-#	ifdef PARALLEL
-	unitZ=smallZ/nprocs; // this should always be an exact division
-	local_z0=ringid*unitZ;
-	local_z1=(ringid+1)*unitZ;
-	if (local_z1 > boxZ) local_z1_coer=boxZ;
-	else local_z1_coer=local_z1;
-	unitX=gridX/nprocs;
-	local_x0=ringid*unitX;
-	local_x1=(ringid+1)*unitX;
-#	else
-	local_z0=0;
-	local_z1=smallZ;
-	local_z1_coer=boxZ;
-	local_x0=0;
-	local_x1=gridX;
-#	endif
-	if (local_z1_coer<=local_z0) {
-		LogWarning(EC_INFO,ALL_POS,"No real dipoles are assigned");
-		local_z1_coer=local_z0;
+#ifdef ADDA_MPI
+	int i;
+
+	bt_meth=bt_method;
+	for (i=0;i<LENGTH(bt_st);i++) { // only some of the stages are used, but all are freed by FreeBTMethod
+		bt_st[i].graph=MPI_COMM_NULL;
+		bt_st[i].node=NULL;
 	}
-	local_Nz=local_z1-local_z0;
-	local_Nx=local_x1-local_x0;
-	boxXY=boxX*(size_t)boxY; // overflow check is covered by gridYZ above
-	local_Ndip=MultOverflow(boxXY,local_z1_coer-local_z0,ALL_POS,"local_Ndip");
-	D("%i :  %i %i %i %zu %zu \n",ringid,local_z0,local_z1_coer,local_z1,local_Ndip,local_Nx);
-#else // SPARSE
-	/* For sparse mode, nvoid_Ndip is defined in InitDipFile(), and here we define local_nvoid_d0 and local_nvoid_d1,
-	 * since they are required already in ReadDipFile()
-	 */
-	D("%zu",nvoid_Ndip);
-#	ifdef PARALLEL
-	double unit_f=1.0/nprocs;
-	//making sure that the first local_f0 and last local_f1 are 0.0 and 1.0
-	double local_f0 = (ringid == 0) ? 0.0 : ringid*unit_f;
-	double local_f1 = (ringid == nprocs-1) ? 1.0 : (ringid+1)*unit_f;
-	local_nvoid_d0 = local_f0*nvoid_Ndip;
-	local_nvoid_d1 = local_f1*nvoid_Ndip;
-#	else
-	local_nvoid_d0=0;
-	local_nvoid_d1=nvoid_Ndip;
-#	endif // PARALLEL
+	if (procGridY==1 || procGridZ==1) InitStage(bt_st,grpComm);
+	else {
+		InitStage(bt_st+1,zComm);
+		InitStage(bt_st+2,yComm);
+	}
+	if (IFROOT && bt_meth!=BTM_PAIR && bt_meth!=BTM_AUTO)
+		fprintf(logfile,"Block transposition method: %s\n",BTMethodName(bt_meth));
 #endif
 }
 
 //======================================================================================================================
 
-void SetupLocalD(void)
-// initialize local_nvoid_d0 and local_nvoid_d1 in FFT mode. In sparse mode those are set earlier in ParSetup()
+void FreeBTMethod(void)
+// frees the data, allocated by SetBTMethod and during block transpositions
 {
 #ifdef ADDA_MPI
-	/* use of exclusive scan (MPI_Exscan) is logically more suitable, but it has special behavior for the ringid=0. The
-	 * latter would require special additional arrangements.
-	 */
-	MPI_Scan(&local_nvoid_Ndip,&local_nvoid_d1,1,MPI_SIZE_T,MPI_SUM,MPI_COMM_WORLD);
-	local_nvoid_d0=local_nvoid_d1-local_nvoid_Ndip;
-#else
-	local_nvoid_d0=0;
-	local_nvoid_d1=local_nvoid_Ndip;
+	FreeStage(bt_st);
+	FreeStage(bt_st+1);
+	FreeStage(bt_st+2);
+#	ifdef SUPPORT_MPI_SHARED
+	FreeNodeBuffer();
+	Free_general(bt_shm);
+	bt_shm=NULL;
+#	endif
 #endif
 }
 
 //======================================================================================================================
 
-void ReadField(const char * restrict fname,doublecomplex *restrict field)
-/* Reads a complex field from file 'fname' and stores into 'field'.
- *
- * In MPI mode the algorithm is very far from optimal, since the whole file is read in total nprocs/2 times.
- * However, this is mainly the limitation of the text file (need to test for blank lines and format consistency).
- * The only feasible way to improve it is to use binary format like NetCDF (which may work on top of MPI_IO)
+void ChooseBTMethod(doublecomplex * restrict X UOIP)
+/* if bt_method is BTM_AUTO, chooses the fastest method of block transposition by timing several forward and backward
+ * transpositions of X (its content is destroyed). The results are shown in the log. Afterwards, the memory, required
+ * only for other methods, is freed.
  */
 {
-	char linebuf[BUF_LINE];
-	TIME_TYPE tstart=GET_TIME();
-	FILE *file=FOpenErr(fname,"r",ALL_POS);
-	// the same format as used for saving the beam by StoreFields(...) in make_particle.c
-	const char format[]="%*f %*f %*f %*f %lf %lf %lf %lf %lf %lf";
-	const char test_form[]="%*f"; // a quick test for a blank line, without actual assignment
-	const int mustbe=6;
-	int scanned;
-	size_t i,j;
-	double buf[6];
-
-#if defined(ADDA_MPI) && defined(SYNCHRONIZE_TIMING)
-	MPI_Barrier(MPI_COMM_WORLD);  // synchronize to get correct timing
-#endif
-	// skips first line with headers and any comments, if present
-	size_t line=SkipNLines(file,1);
-	line+=SkipComments(file);
-	i=j=0;
-	while (FGetsError(file,fname,&line,linebuf,BUF_LINE,ONE_POS)!=NULL) {
-		// scan numbers in a line
-		if (i<local_nvoid_d0) { // just count non-blank lines
-			if (sscanf(linebuf,test_form)!=EOF) i++;
-		}
-		else if (i==nvoid_Ndip) { // tests that file doesn't contains extra data rows
-			if (sscanf(linebuf,test_form)!=EOF) LogError(ALL_POS,"Field file %s contains more data rows than number of "
-				"dipoles (%zu) in the particle",fname,nvoid_Ndip);
+#ifdef ADDA_MPI
+	const enum btmethod list[]={BTM_PAIR,BTM_ALLTOALL,
+#	ifdef SUPPORT_MPI_NEIGHBOR
+		BTM_NEIGHBOR,
+#	endif
+#	ifdef SUPPORT_MPI_SHARED
+		BTM_NODE,
+#	endif
+	};
+	const int nrep=3; // number of timed repetitions
+	int i,j;
+	double t,tbest;
+	enum btmethod best;
+
+	if (bt_meth!=BTM_AUTO) return;
+	if (IFROOT) fprintf(logfile,"Timing of block transposition methods (one forward and backward transposition):\n");
+	tbest=0;
+	best=BTM_PAIR;
+	for (i=0;i<(int)LENGTH(list);i++) {
+		bt_meth=list[i];
+		// the first (untimed) transposition is performed to exclude the initialization overhead
+		TransposeAll(X,3,local_Ny,local_Nz,false);
+		TransposeAll(X,3,local_Ny,local_Nz,true);
+		MPI_Barrier(grpComm);
+		t=GET_TIME();
+		for (j=0;j<nrep;j++) {
+			TransposeAll(X,3,local_Ny,local_Nz,false);
+			TransposeAll(X,3,local_Ny,local_Nz,true);
 		}
-		else { // here local_nvoid_d0 <= i < local_nvoid_d1
-			scanned=sscanf(linebuf,format,buf,buf+1,buf+2,buf+3,buf+4,buf+5);
-			field[j] = buf[0] + I*buf[1];
-			field[j+1] = buf[2] + I*buf[3];
-			field[j+2] = buf[4] + I*buf[5];
-			if (scanned==EOF) {
-				/* in most cases EOF indicates blank line (which we just skip), but it can also be a short (ill-format)
-				 * line, for which we test below. Otherwise, such lines may be interpreted differently b different
-				 * processors
-				 */
-				if (sscanf(linebuf,test_form)!=EOF)
-					LogError(ALL_POS,"Error occurred during scanning of line %zu from field file %s",line,fname);
-			}
-			else {
-				if (scanned!=mustbe) // this in most cases indicates wrong format
-					LogError(ALL_POS,"Error occurred during scanning of line %zu from field file %s",line,fname);
-				j+=3;
-				i++;
-				/* all processors stop reading file as soon as possible, but the last processor reads one more line to
-				 * test (above) for extra strings in the file
-				 */
-				if (i==local_nvoid_d1 && i!=nvoid_Ndip) break;
-			}
+		t=(GET_TIME()-t)/nrep;
+		// the slowest processor determines the time; the choice is thus the same on all processors
+		MPI_Allreduce(MPI_IN_PLACE,&t,1,MPI_DOUBLE,MPI_MAX,grpComm);
+		if (IFROOT) fprintf(logfile,"  %-8s "GFORMDEF" s\n",BTMethodName(bt_meth),t);
+		if (i==0 || t<tbest) {
+			tbest=t;
+			best=bt_meth;
 		}
 	}
-#if defined(ADDA_MPI) && defined(SYNCHRONIZE_TIMING)
-	MPI_Barrier(MPI_COMM_WORLD);  // synchronize to get correct timing
+	bt_meth=best;
+	if (IFROOT) fprintf(logfile,"Block transposition method: %s (the fastest)\n",BTMethodName(bt_meth));
+#	ifdef SUPPORT_MPI_SHARED
+	if (bt_meth!=BTM_NODE) FreeNodeBuffer();
+#	endif
+	// BT_buffer was allocated for collective methods, so it is reallocated for others
+	if (bt_meth==BTM_PAIR || bt_meth==BTM_NODE) {
+		Free_general(BT_buffer);
+		MALLOC_VECTOR(BT_buffer,double,BTBufferSize(3,local_Ny,local_Nz),ALL);
+	}
 #endif
-	Timing_FileIO+=GET_TIME()-tstart;
 }
+#endif
 
 //======================================================================================================================
 
-#ifndef SPARSE
-
-void BlockTranspose(doublecomplex * restrict X UOIP,TIME_TYPE *timing UOIP)
-/* do the data-transposition, i.e. exchange, between fftX and fftY&fftZ; specializes at Xmatrix; do 3 components in one
- * message; increments 'timing' (if not NULL) by the time used
- *
- *  !!! TODO: Although size_t is used for bufsize,etc., MPI functions take int as arguments. This limits the largest
- *  possible size to some extent. Moreover, the size of int is not really well predicted. The exact implications of this
- *  are still unclear.
+void BlockTranspose(doublecomplex * restrict X UOIP,const bool back UOIP,TIME_TYPE *timing UOIP)
+/* do the data-transposition, i.e. exchange, between fftX and fftY&fftZ (or backwards, if 'back'); specializes at
+ * Xmatrix; do 3 components in one message; increments 'timing' (if not NULL) by the time used
  */
 {
 #ifdef ADDA_MPI
 	TIME_TYPE tstart;
-	size_t bufsize,msize,posit,step,y,z;
-	int transmission,part,Xpos,Xcomp;
-	MPI_Status status;
 
 	// redundant initialization to remove warnings
 	tstart=0;
 
 	if (timing!=NULL) {
 #ifdef SYNCHRONIZE_TIMING
-		MPI_Barrier(MPI_COMM_WORLD);  // synchronize to get correct timing
+		MPI_Barrier(grpComm);  // synchronize to get correct timing
 #endif
 		tstart=GET_TIME();
 	}
-	step=2*local_Nx;
-	msize=local_Nx*sizeof(doublecomplex);
-	bufsize=6*local_Nz*smallY*local_Nx;
-	if (bufsize>INT_MAX)
-		LogError(ALL_POS,"int overflow in MPI function for BT buffer (%zu)",bufsize);
+	TransposeAll(X,3,local_Ny,local_Nz,back);
+	if (timing!=NULL) (*timing)+=GET_TIME()-tstart;
+#endif
+}
 
-	for(transmission=1;transmission<=Ntrans;transmission++) {
-		// if part==nprocs then skip this transmission
-		if ((part=CalcPartner(transmission))!=nprocs) {
-			posit=0;
-			Xpos=local_Nx*part;
-			for(Xcomp=0;Xcomp<3;Xcomp++) for(z=0;z<local_Nz;z++) for(y=0;y<smallY;y++) {
-				memcpy(BT_buffer+posit,X+Xcomp*local_Nsmall+IndexBlock(Xpos,y,z,smallY),msize);
-				posit+=step;
-			}
+//======================================================================================================================
+
+void SetBTOverlap(void)
+// initializes datatype and requests for BlockTransposeStart; BT_buffer must have size 4*local_Nsmall (in doubles)
+{
+#ifdef ADDA_MPI
+	BlockType(1,local_Ny,local_Nz,local_Nx,1,nprocs,&bt_type);
+	LargeContiguous(2*local_Nz*local_Ny*local_Nx,MPI_DOUBLE,&bt_ptype);
+	MALLOC_VECTOR(bt_req,void,6*nprocs*sizeof(MPI_Request),ALL);
+#endif
+}
 
-			MPI_Sendrecv(BT_buffer, bufsize, MPI_DOUBLE, part, 0,
-				BT_rbuffer, bufsize, MPI_DOUBLE, part, 0,
-				MPI_COMM_WORLD,&status);
+//======================================================================================================================
 
-			posit=0;
+void FreeBTOverlap(void)
+// frees the datatype and requests, allocated in SetBTOverlap
+{
+#ifdef ADDA_MPI
+	MPI_Type_free(&bt_type);
+	MPI_Type_free(&bt_ptype);
+	Free_general(bt_req);
+#endif
+}
+
+//======================================================================================================================
+
+void BlockTransposeStart(doublecomplex * restrict X UOIP,const int Xcomp UOIP,TIME_TYPE *timing UOIP)
+/* starts the block transposition (same as in BlockTranspose) of a single component (Xcomp) of X by nonblocking
+ * transfers, which are completed by BlockTransposeWait. Outgoing data is first copied into one half of BT_buffer
+ * (depending on the parity of Xcomp), while incoming data is received directly into X. Hence, the transposition of the
+ * next component can be started before this one is finished, but the one after it reuses the same half of the buffer.
+ * Increments 'timing' (if not NULL) by the time used.
+ */
+{
+#ifdef ADDA_MPI
+	const TIME_TYPE tstart=GET_TIME();
+	doublecomplex * restrict Xc=X+Xcomp*local_Nsmall;
+	double * restrict buf=BT_buffer+2*(Xcomp%2)*local_Nsmall;
+	MPI_Request * restrict req=bt_req+2*nprocs*Xcomp;
+	const size_t step=2*local_Nx,msize=local_Nx*sizeof(doublecomplex),bufsize=2*local_Nz*local_Ny*local_Nx;
+	size_t posit,y,z;
+	int transmission,part,Xpos,n;
+
+	n=0;
+	for(transmission=1;transmission<=NumTrans(nprocs);transmission++) {
+		// if part==nprocs then skip this transmission
+		if ((part=CalcPartner(transmission,ringid,nprocs))!=nprocs) {
+			double * restrict sbuf=buf+part*bufsize;
 			Xpos=local_Nx*part;
-			for(Xcomp=0;Xcomp<3;Xcomp++) for(z=0;z<local_Nz;z++) for(y=0;y<smallY;y++) {
-				memcpy(X+Xcomp*local_Nsmall+IndexBlock(Xpos,y,z,smallY),BT_rbuffer+posit,msize);
+			posit=0;
+			for(z=0;z<local_Nz;z++) for(y=0;y<local_Ny;y++) {
+				memcpy(sbuf+posit,Xc+IndexBlock(Xpos,y,z,local_Ny),msize);
 				posit+=step;
 			}
+			// the tag distinguishes transfers of different components between the same processors
+			MPI_Irecv(Xc+Xpos,1,bt_type,part,Xcomp,grpComm,req+n++);
+			MPI_Isend(sbuf,1,bt_ptype,part,Xcomp,grpComm,req+n++);
 		}
 	}
+	bt_nreq[Xcomp]=n;
+	if (timing!=NULL) (*timing)+=GET_TIME()-tstart;
+#endif
+}
+
+//======================================================================================================================
+
+void BlockTransposeWait(const int Xcomp UOIP,TIME_TYPE *timing UOIP)
+/* completes the block transposition of component Xcomp, started by BlockTransposeStart; increments 'timing' (if not
+ * NULL) by the time used
+ */
+{
+#ifdef ADDA_MPI
+	const TIME_TYPE tstart=GET_TIME();
+
+	MPI_Waitall(bt_nreq[Xcomp],bt_req+2*nprocs*Xcomp,MPI_STATUSES_IGNORE);
 	if (timing!=NULL) (*timing)+=GET_TIME()-tstart;
 #endif
 }
@@ -710,41 +2002,12 @@ void BlockTranspose_DRm(doublecomplex * restrict X UOIP,const size_t lengthY UOI
 {
 #ifdef ADDA_MPI
 	TIME_TYPE tstart;
-	size_t bufsize,msize,posit,step,y,z;
-	int transmission,part,Xpos;
-	MPI_Status status;
 
 #ifdef SYNCHRONIZE_TIMING
-	MPI_Barrier(MPI_COMM_WORLD); // synchronize to get correct timing
+	MPI_Barrier(grpComm); // synchronize to get correct timing
 #endif
 	tstart=GET_TIME();
-	step=2*local_Nx;
-	msize=local_Nx*sizeof(doublecomplex);
-	bufsize = 2*lengthZ*lengthY*local_Nx;
-	if (bufsize>INT_MAX)
-		LogError(ALL_POS,"int overflow in MPI function for BT buffer (%zu)",bufsize);
-
-	for(transmission=1;transmission<=Ntrans;transmission++) {
-		if ((part=CalcPartner(transmission))!=nprocs) {
-			posit=0;
-			Xpos=local_Nx*part;
-			for(z=0;z<lengthZ;z++) for(y=0;y<lengthY;y++) {
-				memcpy(BT_buffer+posit,X+IndexBlock(Xpos,y,z,lengthY),msize);
-				posit+=step;
-			}
-
-			MPI_Sendrecv(BT_buffer,bufsize,MPI_DOUBLE,part,0,
-				BT_rbuffer,bufsize,MPI_DOUBLE,part,0,
-				MPI_COMM_WORLD,&status);
-
-			posit=0;
-			Xpos=local_Nx*part;
-			for(z=0;z<lengthZ;z++) for(y=0;y<lengthY;y++) {
-				memcpy(X+IndexBlock(Xpos,y,z,lengthY),BT_rbuffer+posit,msize);
-				posit+=step;
-			}
-		}
-	}
+	TransposeAll(X,1,lengthY,lengthZ,false);
 	Timing_InitDmComm += GET_TIME() - tstart;
 #endif
 }
@@ -825,7 +2088,7 @@ void CollectDomainGranul(unsigned char * restrict dom UOIP,const size_t gXY UOIP
 	TIME_TYPE tstart;
 
 #ifdef SYNCHRONIZE_TIMING
-	MPI_Barrier(MPI_COMM_WORLD); // synchronize to get correct timing
+	MPI_Barrier(grpComm); // synchronize to get correct timing
 #endif
 	tstart=GET_TIME();
 	unit=gXY*sizeof(char);
@@ -837,7 +2100,7 @@ void CollectDomainGranul(unsigned char * restrict dom UOIP,const size_t gXY UOIP
 					index-=gXY;
 					memcpy(gr_comm_ob,dom+index,unit);
 				}
-				MPI_Recv(dom+index,unit*gr_comm_size[i],MPI_UNSIGNED_CHAR,i,0,MPI_COMM_WORLD,&status);
+				MPI_Recv(dom+index,unit*gr_comm_size[i],MPI_UNSIGNED_CHAR,i,0,grpComm,&status);
 				if (gr_comm_overl[i-1]) for (j=0;j<gXY;j++) dom[index+j]|=gr_comm_ob[j];
 				index+=gXY*gr_comm_size[i];
 			}
@@ -850,7 +2113,7 @@ void CollectDomainGranul(unsigned char * restrict dom UOIP,const size_t gXY UOIP
 					memcpy(gr_comm_ob,dom+index,unit);
 					index+=gXY;
 				}
-				MPI_Recv(dom+index-gXY*gr_comm_size[i],unit*gr_comm_size[i],MPI_UNSIGNED_CHAR,i,0,MPI_COMM_WORLD,
+				MPI_Recv(dom+index-gXY*gr_comm_size[i],unit*gr_comm_size[i],MPI_UNSIGNED_CHAR,i,0,grpComm,
 					&status);
 				if (gr_comm_overl[i]) for (j=0;j<gXY;j++) dom[index-gXY+j]|=gr_comm_ob[j];
 				index-=gXY*gr_comm_size[i];
@@ -861,7 +2124,7 @@ void CollectDomainGranul(unsigned char * restrict dom UOIP,const size_t gXY UOIP
 		// the test here implies the test for above MPI_Recv as well
 		size_t size=(size_t)unit*(size_t)locgZ;
 		if (size>INT_MAX) LogError(ALL_POS,"int overflow in MPI function (%zu)",size);
-		MPI_Send(dom,size,MPI_UNSIGNED_CHAR,ADDA_ROOT,0,MPI_COMM_WORLD);
+		MPI_Send(dom,size,MPI_UNSIGNED_CHAR,ADDA_ROOT,0,grpComm);
 	}
 	(*timing)+=GET_TIME()-tstart;
 #endif
@@ -892,12 +2155,11 @@ void ExchangeFits(bool * restrict data UOIP,const size_t n UOIP,TIME_TYPE *timin
 #ifdef ADDA_MPI
 	TIME_TYPE tstart;
 
-	if (n>INT_MAX) LogError(ONE_POS,"int overflow in MPI function (%zu)",n);
 #ifdef SYNCHRONIZE_TIMING
-	MPI_Barrier(MPI_COMM_WORLD); // synchronize to get correct timing
+	MPI_Barrier(grpComm); // synchronize to get correct timing
 #endif
 	tstart=GET_TIME();
-	MPI_Allreduce(data,gr_comm_buf,n,mpi_bool,MPI_LAND,MPI_COMM_WORLD);
+	AllreduceLarge(data,gr_comm_buf,n,mpi_bool,MPI_LAND);
 	memcpy(data,gr_comm_buf,n*sizeof(bool));
 	(*timing)+=GET_TIME()-tstart;
 #endif
@@ -908,10 +2170,10 @@ void ExchangeFits(bool * restrict data UOIP,const size_t n UOIP,TIME_TYPE *timin
 #ifdef PARALLEL
 
 bool ExchangePhaseShifts(doublecomplex * restrict bottom, doublecomplex * restrict top,TIME_TYPE *timing)
-/* propagates slice of complex values from bottom to top. In the beginning 'top' contains phase shift over the current
- * processor, at the end 'bottom' and 'top' contain phase shifts from the bottom of the first processor to bottom and
- * top of the current processor. Potentially, can be optimized by some tree algorithm. However, there seem to be no
- * ready MPI function available.
+/* propagates slice of complex values (local part of a layer) from bottom to top. In the beginning 'top' contains phase
+ * shift over the current processor, at the end 'bottom' and 'top' contain phase shifts from the bottom of the first
+ * processor (in the column of the processor grid with the same y-range) to bottom and top of the current processor.
+ * Potentially, can be optimized by some tree algorithm. However, there seem to be no ready MPI function available.
  */
 {
 #ifdef ADDA_MPI
@@ -919,26 +2181,205 @@ bool ExchangePhaseShifts(doublecomplex * restrict bottom, doublecomplex * restri
 	TIME_TYPE tstart;
 	size_t i;
 
-	if (2*boxXY>INT_MAX) LogError(ONE_POS,"int overflow in MPI function (%zu)",2*boxXY);
+	if (2*local_boxXY>INT_MAX) LogError(ONE_POS,"int overflow in MPI function (%zu)",2*local_boxXY);
 #ifdef SYNCHRONIZE_TIMING
-	MPI_Barrier(MPI_COMM_WORLD); // synchronize to get correct timing
+	MPI_Barrier(grpComm); // synchronize to get correct timing
 #endif
 	tstart=GET_TIME();
 	// receive slice from previous processor and increment own slice by these values
-	if (ringid>0) { // It is important to use 0 instead of ROOT
-		MPI_Recv(bottom,2*boxXY,MPI_DOUBLE,ringid-1,0,MPI_COMM_WORLD,&status);
-		for (i=0;i<boxXY;i++) top[i]+=bottom[i];
+	if (ringid>=procGridY) { // It is important to use 0 instead of ROOT
+		MPI_Recv(bottom,2*local_boxXY,MPI_DOUBLE,ringid-procGridY,0,grpComm,&status);
+		for (i=0;i<local_boxXY;i++) top[i]+=bottom[i];
 	}
 	// send updated slice to previous processor
-	if (ringid<(nprocs-1)) MPI_Send(top,2*boxXY,MPI_DOUBLE,ringid+1,0,MPI_COMM_WORLD);
+	if (ringid<(nprocs-procGridY)) MPI_Send(top,2*local_boxXY,MPI_DOUBLE,ringid+procGridY,0,grpComm);
 #ifdef SYNCHRONIZE_TIMING
-	MPI_Barrier(MPI_COMM_WORLD); // synchronize to get correct timing
+	MPI_Barrier(grpComm); // synchronize to get correct timing
 #endif
 	(*timing)+=GET_TIME()-tstart;
-	return (ringid!=0);
+	return (ringid>=procGridY);
+#endif
+}
+
+//======================================================================================================================
+
+static inline int SlabZ(const int id)
+// first z-layer of the FFT slab of processor 'id', coerced to boxZ; SlabZ(nprocs) is the end of the last slab
+{
+	return (int)MIN(id*local_Nz,(size_t)boxZ);
+}
+
+//======================================================================================================================
+
+static int FillRanges(const size_t * restrict layCount,const size_t cap,int * restrict bounds)
+/* greedily divides z-layers into contiguous ranges, each with not more than 'cap' dipoles (assuming that each layer
+ * fits into it); returns the number of ranges. If 'bounds' is not NULL, also stores the first layers of ranges in it
+ * (at most nprocs of them), the remaining values (up to bounds[nprocs]) are set to boxZ.
+ */
+{
+	size_t cur;
+	int n,z;
+
+	cur=0;
+	n=1;
+	if (bounds!=NULL) bounds[0]=0;
+	for (z=0;z<boxZ;z++) {
+		if (cur+layCount[z]>cap) {
+			if (bounds!=NULL && n<nprocs) bounds[n]=z;
+			n++;
+			cur=0;
+		}
+		cur+=layCount[z];
+	}
+	if (bounds!=NULL) for (z=n;z<=nprocs;z++) bounds[z]=boxZ;
+	return n;
+}
+
+//======================================================================================================================
+
+size_t SetLoadBalance(const size_t * restrict layCount,int *z0)
+/* given the numbers of occupied dipoles in each z-layer of the whole box (layCount), divides the box into nprocs
+ * contiguous ranges of layers, minimizing the maximum number of dipoles per processor. Returns the number of dipoles of
+ * the current processor in the new (balanced) distribution and the first layer of its range in 'z0'. Also initializes
+ * the exchange patterns for RedistributeDipoles and data for PrintLoadBalance. Dipoles are ordered (first by z) in the
+ * same way in both distributions, hence each processor exchanges a contiguous part of its local array with each other
+ * processor. Can be used only for 1D grid of processors (along z).
+ */
+{
+	size_t *cum,lo,hi,mid,b0,b1,s0,s1;
+	int i,z;
+
+	// cum[z] is the number of dipoles in layers below z
+	MALLOC_VECTOR(cum,sizet,boxZ+1,ALL);
+	cum[0]=0;
+	lo=0;
+	for (z=0;z<boxZ;z++) {
+		cum[z+1]=cum[z]+layCount[z];
+		if (layCount[z]>lo) lo=layCount[z];
+	}
+	// the minimal maximum number of dipoles is found by bisection; the processors are then filled up to it
+	hi=cum[boxZ];
+	while (lo<hi) {
+		mid=lo+(hi-lo)/2;
+		if (FillRanges(layCount,mid,NULL)<=nprocs) hi=mid;
+		else lo=mid+1;
+	}
+	MALLOC_VECTOR(lb_z,int,nprocs+1,ALL);
+	FillRanges(layCount,lo,lb_z);
+	MALLOC_VECTOR(bal_cnt,sizet,nprocs,ALL);
+	MALLOC_VECTOR(bal_dsp,sizet,nprocs,ALL);
+	MALLOC_VECTOR(slab_cnt,sizet,nprocs,ALL);
+	MALLOC_VECTOR(slab_dsp,sizet,nprocs,ALL);
+	MALLOC_VECTOR(lb_scnt,int,nprocs,ALL);
+	MALLOC_VECTOR(lb_sdsp,int,nprocs,ALL);
+	MALLOC_VECTOR(lb_rcnt,int,nprocs,ALL);
+	MALLOC_VECTOR(lb_rdsp,int,nprocs,ALL);
+	MALLOC_VECTOR(lb_unif,sizet,nprocs,ALL);
+	MALLOC_VECTOR(lb_bal,sizet,nprocs,ALL);
+	b0=cum[lb_z[ringid]];
+	b1=cum[lb_z[ringid+1]];
+	s0=cum[SlabZ(ringid)];
+	s1=cum[SlabZ(ringid+1)];
+	for (i=0;i<nprocs;i++) {
+		// part of the local balanced array, which belongs to the slab of processor i
+		lo=MAX(b0,cum[SlabZ(i)]);
+		hi=MIN(b1,cum[SlabZ(i+1)]);
+		bal_cnt[i] = (hi>lo) ? hi-lo : 0;
+		bal_dsp[i] = (hi>lo) ? lo-b0 : 0;
+		// part of the local slab array, which belongs to the balanced range of processor i
+		lo=MAX(s0,cum[lb_z[i]]);
+		hi=MIN(s1,cum[lb_z[i+1]]);
+		slab_cnt[i] = (hi>lo) ? hi-lo : 0;
+		slab_dsp[i] = (hi>lo) ? lo-s0 : 0;
+		lb_unif[i]=cum[SlabZ(i+1)]-cum[SlabZ(i)];
+		lb_bal[i]=cum[lb_z[i+1]]-cum[lb_z[i]];
+	}
+	Free_general(cum);
+	*z0=lb_z[ringid];
+	return b1-b0;
+}
+
+//======================================================================================================================
+
+void RedistributeDipoles(const void * restrict from,void * restrict to,const var_type type,const int n_el,
+	const bool toSlab,TIME_TYPE *timing)
+/* moves the data of local dipoles ('n_el' elements of 'type' per dipole) from the balanced distribution to that of FFT
+ * slabs (if 'toSlab' is true) or backwards, see SetLoadBalance; increments 'timing' (if not NULL) by the time used
+ */
+{
+#ifdef ADDA_MPI
+	const size_t *scnt,*sdsp,*rcnt,*rdsp;
+	MPI_Datatype mes_type;
+	TIME_TYPE tstart;
+	size_t ext;
+	int transmission,part,useAll;
+
+	tstart=0;
+	if (timing!=NULL) {
+#ifdef SYNCHRONIZE_TIMING
+		MPI_Barrier(grpComm);  // synchronize to get correct timing
+#endif
+		tstart=GET_TIME();
+	}
+	if (toSlab) {
+		scnt=bal_cnt;
+		sdsp=bal_dsp;
+		rcnt=slab_cnt;
+		rdsp=slab_dsp;
+	}
+	else {
+		scnt=slab_cnt;
+		sdsp=slab_dsp;
+		rcnt=bal_cnt;
+		rdsp=bal_dsp;
+	}
+	mes_type=MPIVarType(type,false,NULL);
+	/* counts are different on different processors, so the choice between the collective and pairwise exchanges is
+	 * agreed among all of them (otherwise, they may call different communication functions and deadlock)
+	 */
+	useAll=IntCounts(scnt,sdsp,n_el,lb_scnt,lb_sdsp) && IntCounts(rcnt,rdsp,n_el,lb_rcnt,lb_rdsp);
+	MPI_Allreduce(MPI_IN_PLACE,&useAll,1,MPI_INT,MPI_LAND,grpComm);
+	if (useAll) MPI_Alltoallv(from,lb_scnt,lb_sdsp,mes_type,to,lb_rcnt,lb_rdsp,mes_type,grpComm);
+	else { // pairwise exchanges in chunks (the same schedule as in BlockTranspose)
+		ext=n_el*TypeExtent(mes_type);
+		memcpy((char *)to+rdsp[ringid]*ext,(const char *)from+sdsp[ringid]*ext,scnt[ringid]*ext);
+		for(transmission=1;transmission<=NumTrans(nprocs);transmission++)
+			if ((part=CalcPartner(transmission,ringid,nprocs))!=nprocs)
+				SendrecvLarge((const char *)from+sdsp[part]*ext,n_el*scnt[part],(char *)to+rdsp[part]*ext,
+					n_el*rcnt[part],mes_type,part);
+	}
+	if (timing!=NULL) (*timing)+=GET_TIME()-tstart;
 #endif
 }
 
+//======================================================================================================================
+
+void PrintLoadBalance(FILE * restrict file)
+// prints to 'file' the histogram of the numbers of dipoles per processor, as obtained by SetLoadBalance
+{
+	const size_t width=40; // maximum length of histogram bar
+	size_t maxU,maxB,avg,j,len;
+	int i;
+
+	maxU=maxB=0;
+	for (i=0;i<nprocs;i++) {
+		if (lb_unif[i]>maxU) maxU=lb_unif[i];
+		if (lb_bal[i]>maxB) maxB=lb_bal[i];
+	}
+	avg=(nvoid_Ndip+nprocs-1)/nprocs;
+	fprintf(file,"Distribution of occupied dipoles over processors (balanced):\n"
+		"  proc    z-range     uniform   balanced\n");
+	for (i=0;i<nprocs;i++) {
+		len=(maxB==0) ? 0 : (width*lb_bal[i]+maxB/2)/maxB;
+		if (lb_z[i+1]>lb_z[i]) fprintf(file,"%6d %6d-%-6d",i,lb_z[i],lb_z[i+1]-1);
+		else fprintf(file,"%6d %13s",i,"-");
+		fprintf(file," %10zu %10zu |",lb_unif[i],lb_bal[i]);
+		for (j=0;j<len;j++) fputc('#',file);
+		fputc('\n',file);
+	}
+	fprintf(file,"  maximum/average: %.3g (uniform), %.3g (balanced)\n",(double)maxU/avg,(double)maxB/avg);
+}
+
 #endif // PARALLEL
 
 #endif // !SPARSE
@@ -18,7 +18,10 @@
 // project headers
 #include "types.h"    // needed for doublecomplex
 #include "function.h" // for function attributes
+#include "memory.h"   // for OTHER_ARGUMENTS
 #include "timing.h"   // for TIME_TYPE
+// system headers
+#include <stdio.h> // for FILE
 
 // UOIP - Used Only In Parallel; to remove spurious 'unused' warnings in sequential mode
 #ifdef PARALLEL
@@ -27,7 +30,9 @@
 #	define UOIP ATT_UNUSED
 #endif
 
-typedef enum {uchar_type,int_type,int3_type,sizet_type,double_type,double3_type,cmplx_type,cmplx3_type} var_type;
+typedef enum {uchar_type,ushort_type,int_type,int3_type,sizet_type,double_type,double3_type,cmplx_type,cmplx3_type}
+	var_type;
+typedef struct binout_struct binout; // opaque handle of binary output file, defined in comm.c
 
 void Stop(int) ATT_NORETURN;
 void Synchronize(void);
@@ -38,17 +43,35 @@ void InitComm(int *argc_p,char ***argv_p);
 void ParSetup(void);
 void SetupLocalD(void);
 void MyBcast(void * restrict data,const var_type type,const size_t n_elem,TIME_TYPE *timing);
+size_t AllGatherCounts(size_t n,size_t * restrict counts);
+void AllGatherVar(void * restrict x,var_type type,const size_t * restrict counts,TIME_TYPE *timing);
+void *SharedVector(size_t n,size_t elsize,OTHER_ARGUMENTS) ATT_MALLOC;
+void Free_shared(void * restrict v);
+void SyncShared(const void * restrict v);
+size_t SharedSize(size_t size);
+void ReduceScatter(void * restrict x,var_type type,const size_t * restrict counts,TIME_TYPE *timing);
+void GatherVar(void * restrict x,var_type type,const size_t * restrict counts,TIME_TYPE *timing);
 void BcastOrient(int *i,int *j,int *k);
 void ReadField(const char * restrict fname,doublecomplex *restrict field);
+binout *BinOutOpen(const char * restrict fname,const void * restrict header,size_t head_size);
+size_t BinOutSeek(binout * restrict bo,size_t disp,size_t rec_size,size_t n,size_t chunk,size_t * restrict start);
+void BinOutWrite(binout * restrict bo,const void * restrict buf,size_t n);
+void BinOutClose(binout * restrict bo);
 
 #ifndef SPARSE
-void BlockTranspose(doublecomplex * restrict X,TIME_TYPE *timing);
+void BlockTranspose(doublecomplex * restrict X,bool back,TIME_TYPE *timing);
 void BlockTranspose_DRm(doublecomplex * restrict X,size_t lengthY,size_t lengthZ);
+void SetBTOverlap(void);
+void FreeBTOverlap(void);
+void BlockTransposeStart(doublecomplex * restrict X,int Xcomp,TIME_TYPE *timing);
+void BlockTransposeWait(int Xcomp,TIME_TYPE *timing);
 // used by granule generator
 void SetGranulComm(double z0,double z1,double gdZ,int gZ,size_t gXY,size_t buf_size,int *lz0,int *lz1,int sm_gr);
 void CollectDomainGranul(unsigned char * restrict dom,size_t gXY,int lz0,int locgZ,TIME_TYPE *timing);
 void FreeGranulComm(int sm_gr);
 void ExchangeFits(bool * restrict data,const size_t n,TIME_TYPE *timing);
+#else
+size_t RingBlock(int step,size_t * restrict start);
 #endif // !SPARSE
 
 #ifdef PARALLEL
@@ -56,13 +79,35 @@ void ExchangeFits(bool * restrict data,const size_t n,TIME_TYPE *timing);
 void CatNFiles(const char * restrict dir,const char * restrict tmpl,const char * restrict dest);
 bool ExchangePhaseShifts(doublecomplex * restrict bottom, doublecomplex * restrict top,TIME_TYPE *timing);
 void AllGather(void * restrict x_from,void * restrict x_to,var_type type,TIME_TYPE *timing);
+void SplitOrientGroups(void);
+void BcastOrientBatch(int * restrict n,int * restrict nodes);
+void AccumulateGroups(void * restrict data,var_type type,size_t n,TIME_TYPE *timing);
+#	ifndef SPARSE
+size_t BTBufferSize(int ncomp,size_t lengthY,size_t lengthZ);
+void SetBTMethod(void);
+void ChooseBTMethod(doublecomplex * restrict X);
+void FreeBTMethod(void);
+size_t SetLoadBalance(const size_t * restrict layCount,int *z0);
+void RedistributeDipoles(const void * restrict from,void * restrict to,var_type type,int n_el,bool toSlab,
+	TIME_TYPE *timing);
+void PrintLoadBalance(FILE * restrict file);
+#	else
+void RingShift(const doublecomplex * restrict sendbuf,doublecomplex * restrict recvbuf,int step);
+void RingWait(TIME_TYPE *timing);
+#	endif
 
 /* The advantage of using this define is that compiler may remove an unnecessary test in sequential mode. The define do
  * not include common 'if', etc. to make the structure of the code (in the main text) immediately visible.
  */
 #	define IFROOT (ringid==ADDA_ROOT)
+// root of all processors; differs from IFROOT only for several orientation groups (-orient_groups)
+#	define IFWROOT (IFROOT && orientGroup==0)
 #else
 #	define IFROOT (true)
+#	define IFWROOT (true)
 #endif
 
+// allocates node-shared vector (see SharedVector) of 'size' elements, analogous to MALLOC_VECTOR with who=ALL
+#define MALLOC_SHARED(vec,size) vec=SharedVector(size,sizeof(*(vec)),ALL,POSIT,#vec)
+
 #endif // __comm_h
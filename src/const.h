@@ -312,6 +312,11 @@ enum angleset {// types of angles set
 	AS_RANGE, // range with uniformly spaced points
 	AS_VALUES // any set of values
 };
+enum avgscheme { // schemes of integration over beta and gamma for orientation averaging
+	AVG_LEBEDEV, // Lebedev quadrature over the unit sphere
+	AVG_ROMBERG, // Romberg integration over the grid of beta and gamma
+	AVG_SOBOL    // scrambled Sobol points over the unit sphere (quasi Monte Carlo)
+};
 
 // types of phi_integr (should be different one-bit numbers)
 #define PHI_UNITY 1 // just integrate
@@ -326,6 +331,20 @@ enum sym { // ways to treat particle symmetries
 	SYM_ENF   // enforce
 };
 
+enum btmethod { // methods of block transposition in parallel FFT mode (see TransposeStage in comm.c)
+	BTM_PAIR,     // sequence of pairwise exchanges (MPI_Sendrecv)
+	BTM_ALLTOALL, // MPI_Alltoall
+	BTM_NEIGHBOR, // neighborhood collective (MPI_Neighbor_alltoallw) on the graph of all processors
+	BTM_NODE,     // through shared memory inside a node, and pairwise exchanges between nodes
+	BTM_AUTO      // the fastest of the above, determined at startup
+};
+
+enum spstore { // storage of the interaction matrix in sparse mode
+	SS_NONE, // do not store, compute interaction terms in each matrix-vector product
+	SS_FULL, // compute once and store all interaction terms for local dipoles
+	SS_AUTO  // store if the required memory is available
+};
+
 enum chpoint { // types of checkpoint (to save)
 	CHP_NONE,    // do not save checkpoint
 	CHP_NORMAL,  // save checkpoint if not finished in time and exit
@@ -365,9 +384,12 @@ enum init_field { // how to calculate initial field to be used in the iterative
 	// suffixes
 #define F_XSUF          "-X"
 #define F_YSUF          "-Y"
+#define F_BINSUF        ".bin"
 	// logs
 #define F_LOG           "log"
 #define F_LOG_ERR       "logerr.%d"    // ringid as argument
+#define F_LOG_GROUP     "log_group%d"  // orientGroup as argument
+#define F_STDOUT_GROUP  "stdout_group%d" // orientGroup as argument
 #define F_LOG_ORAVG     "log_orient_avg"
 #define F_LOG_INT_CSCA  "log_int_Csca"
 #define F_LOG_INT_ASYM  "log_int_asym"
@@ -395,6 +417,9 @@ enum init_field { // how to calculate initial field to be used in the iterative
 	// checkpoint files
 #define F_CHP_LOG       "chp.log"
 #define F_CHP           "chp.%d"   // ringid as argument
+	// cache of IGT table; WaveNum*dsX, dsY/dsX, dsZ/dsX, and igt_eps as arguments
+#define F_IGT_CACHE     "igt_kd%.12g_y%.12g_z%.12g_eps%.3g.bin"
+#define IGT_CACHE_MAGIC "ADDAIGT3"
 
 // default file and directory names; can be changed by command line options
 #define FD_ALLDIR_PARMS "alldir_params.dat"
@@ -409,6 +434,7 @@ enum init_field { // how to calculate initial field to be used in the iterative
 
 // shape formats; numbers should be nonnegative
 enum shform {
+	SF_BIN,      // ADDA binary format (with run-length encoding of occupancy)
 	SF_DDSCAT6,  // DDSCAT 6 format (FRMFIL), produced by calltarget
 	SF_DDSCAT7,  // DDSCAT 7 format (FRMFIL), produced by calltarget
 	SF_TEXT,     // ADDA text format for one-domain particles
@@ -418,6 +444,12 @@ enum shform {
 	 */
 };
 
+// formats for storing fields on dipoles (internal fields, incident beam, etc.)
+enum fform {
+	FF_BIN, // self-describing binary format, see StoreFieldsBin() in CalculateE.c
+	FF_TEXT // text format, one line per dipole
+};
+
 #define POSIT __FILE__,__LINE__ // position of the error in source code
 
 enum enwho { // who is calling
@@ -22,6 +22,7 @@
 #include "io.h"
 #include "memory.h"
 #include "Romberg.h"
+#include "SphereQuad.h"
 #include "timing.h"
 #include "vars.h"
 // system headers
@@ -54,11 +55,14 @@ double exSP[3]; // second vector, which determines the scattering plane passing
 // used in calculator.c
 Parms_1D parms_alpha; // parameters of integration over alpha
 Parms_1D parms[2];    // parameters for integration over theta,phi or beta,gamma
+Parms_sphere parms_sphere; // parameters for integration over beta,gamma with a scheme other than Romberg
 angle_set beta_int,gamma_int,theta_int,phi_int; // sets of angles
 // used in param.c
 const char *avg_string; // string for output of function that reads averaging parameters
 // used in Romberg.c
 bool full_al_range; // whether full range of alpha angle is used
+// used in CalculateE.c
+bool avg_mirror; // whether reflection symmetries are used to reduce the range of orientation averaging
 
 // LOCAL VARIABLES
 
@@ -134,22 +138,34 @@ void InitRotation (void)
 
 //======================================================================================================================
 
-static void ReadLineStart(FILE *  restrict file,                  // opened file
+static bool FindLineStart(FILE *  restrict file,                  // opened file
 	                      const char * restrict fname,            // ... its filename
                           char * restrict buf,const int buf_size, // buffer for line and its size
                           const char * restrict start)            // beginning of the line to search
-// reads the first line that starts with 'start'
+// reads the first line that starts with 'start'; returns false if the end of file is reached without finding it
 {
 	while (!feof(file)) {
 		fgets(buf,buf_size,file);
 		if (strstr(buf,start)==buf) { // if correct beginning
 			if (strstr(buf,"\n")==NULL && !feof(file))
 				LogError(ONE_POS,"Buffer overflow while reading '%s' (size of essential line > %d)",fname,buf_size-1);
-			else return; // line found and fits into buffer
+			else return true; // line found and fits into buffer
 		} // finish reading unmatched line
 		else while (strstr(buf,"\n")==NULL && !feof(file)) fgets(buf,buf_size,file);
 	}
-	LogError(ONE_POS,"String '%s' is not found (in correct place) in file '%s'",start,fname);
+	return false;
+}
+
+//======================================================================================================================
+
+static void ReadLineStart(FILE *  restrict file,                  // opened file
+	                      const char * restrict fname,            // ... its filename
+                          char * restrict buf,const int buf_size, // buffer for line and its size
+                          const char * restrict start)            // beginning of the line to search
+// reads the first line that starts with 'start'
+{
+	if (!FindLineStart(file,fname,buf,buf_size,start))
+		LogError(ONE_POS,"String '%s' is not found (in correct place) in file '%s'",start,fname);
 }
 
 //======================================================================================================================
@@ -226,6 +242,51 @@ static inline void ScanString(FILE * restrict file,const char * restrict fname,c
 
 //======================================================================================================================
 
+static void SetIntegrParms(
+	angle_set *a,   // pointer to angle set
+	Parms_1D *b,    // pointer to parameters of integration
+	const bool ifcos) // if space angles equally in cos
+// fill integration parameters and points of integration, given the range of angles and the number of refinements
+{
+	size_t i;
+	double unit;
+
+	if (a->min==a->max) {
+		a->N=b->Grid_size=1;
+		b->Jmax=1;
+	}
+	else {
+		a->N=b->Grid_size=(1 << b->Jmax) + 1;
+		if (b->equival && a->N>1) (a->N)--;
+	}
+	// initialize points of integration
+	MALLOC_VECTOR(a->val,double,a->N,ALL);
+	memory += a->N*sizeof(double);
+
+	if (ifcos) { // make equal intervals in cos(angle)
+		b->min=cos(Deg2Rad(a->max));
+		b->max=cos(Deg2Rad(a->min));
+		if (fabs(b->min)<ROUND_ERR) b->min=0; // just for convenience of display in log file
+		if (fabs(b->max)<ROUND_ERR) b->max=0;
+		if (b->Grid_size==1) a->val[0]=a->min;
+		else {
+			unit = (b->max - b->min)/(b->Grid_size-1);
+			for (i=0;i<a->N;i++) a->val[i] = Rad2Deg(acos(b->min+unit*i));
+		}
+	}
+	else { // make equal intervals in angle
+		b->min=Deg2Rad(a->min);
+		b->max=Deg2Rad(a->max);
+		if (b->Grid_size==1) a->val[0]=a->min;
+		else {
+			unit = (a->max - a->min)/(b->Grid_size-1);
+			for (i=0;i<a->N;i++) a->val[i] = a->min + unit*i;
+		}
+	}
+}
+
+//======================================================================================================================
+
 static void ScanIntegrParms(
 	FILE * restrict file,const char * restrict fname, // opened file and filename
 	angle_set *a,                                     // pointer to angle set
@@ -235,9 +296,6 @@ static void ScanIntegrParms(
 	const int buf_size)                               // and their size
 // scan integration parameters for angles from file
 {
-	size_t i;
-	double unit;
-
 	// scan file
 	ScanDouble(file,fname,buf,buf_size,"min=",&(a->min));
 	ScanDouble(file,fname,buf,buf_size,"max=",&(a->max));
@@ -253,13 +311,8 @@ static void ScanIntegrParms(
 	else if (strcmp(temp,"false")==0) b->periodic=false;
 	else LogError(ONE_POS,"Wrong argument of 'periodic' option in file %s",fname);
 
-	// fill all parameters
-	if (a->min==a->max) {
-		a->N=b->Grid_size=1;
-		b->Jmax=1;
-	}
-	else {
-		// consistency check
+	// consistency checks
+	if (a->min!=a->max) {
 		if (a->min>a->max) LogError(ONE_POS,
 			"Wrong range (min="GFORMDEF", max="GFORMDEF") in file %s (max must be >= min)",a->min,a->max,fname);
 		if (b->Jmax<b->Jmin)
@@ -268,38 +321,14 @@ static void ScanIntegrParms(
 		if (b->eps<0) LogError(ONE_POS,"Wrong eps ("GFORMDEF") in file %s (must be >=0)",b->eps,fname);
 		if (b->Jmax >= (int)(8*sizeof(int)))
 			LogError(ONE_POS,"Too large Jmax(%d) in file %s, it will cause integer overflow",b->Jmax,fname);
-
-		a->N=b->Grid_size=(1 << b->Jmax) + 1;
-		if (b->equival && a->N>1) (a->N)--;
 	}
-	// initialize points of integration
-	MALLOC_VECTOR(a->val,double,a->N,ALL);
-	memory += a->N*sizeof(double);
-
-	if (ifcos) { // make equal intervals in cos(angle)
-		// consistency check
+	if (ifcos) {
 		if (a->min<0) LogError(ONE_POS,"Wrong min ("GFORMDEF") in file %s (must be >=0 for this angle)",a->min,fname);
 		if (a->max>180)
 			LogError(ONE_POS,"Wrong max ("GFORMDEF") in file %s (must be <=180 for this angle)",a->max,fname);
-		b->min=cos(Deg2Rad(a->max));
-		b->max=cos(Deg2Rad(a->min));
-		if (fabs(b->min)<ROUND_ERR) b->min=0; // just for convenience of display in log file
-		if (fabs(b->max)<ROUND_ERR) b->max=0;
-		if (b->Grid_size==1) a->val[0]=a->min;
-		else {
-			unit = (b->max - b->min)/(b->Grid_size-1);
-			for (i=0;i<a->N;i++) a->val[i] = Rad2Deg(acos(b->min+unit*i));
-		}
-	}
-	else { // make equal intervals in angle
-		b->min=Deg2Rad(a->min);
-		b->max=Deg2Rad(a->max);
-		if (b->Grid_size==1) a->val[0]=a->min;
-		else {
-			unit = (a->max - a->min)/(b->Grid_size-1);
-			for (i=0;i<a->N;i++) a->val[i] = a->min + unit*i;
-		}
 	}
+	// fill all parameters
+	SetIntegrParms(a,b,ifcos);
 }
 
 //======================================================================================================================
@@ -355,6 +384,7 @@ void ReadAvgParms(const char * restrict fname)
 {
 	FILE * restrict input;
 	char buf[BUF_LINE],temp[BUF_LINE];
+	size_t n;
 
 	TIME_TYPE tstart=GET_TIME();
 	// open file
@@ -367,23 +397,163 @@ void ReadAvgParms(const char * restrict fname)
 	ScanIntegrParms(input,fname,&beta_int,&parms[THETA],true,buf,temp,BUF_LINE);
 	ReadLineStart(input,fname,buf,BUF_LINE,"gamma:");
 	ScanIntegrParms(input,fname,&gamma_int,&parms[PHI],false,buf,temp,BUF_LINE);
+	// optional section, Romberg is used by default
+	parms_sphere.scheme=AVG_ROMBERG;
+	if (FindLineStart(input,fname,buf,BUF_LINE,"beta_gamma:")) {
+		ScanString(input,fname,buf,BUF_LINE,"scheme=",temp);
+		if (strcmp(temp,"lebedev")==0) {
+			parms_sphere.scheme=AVG_LEBEDEV;
+			ScanInt(input,fname,buf,BUF_LINE,"N=",&(parms_sphere.N));
+			ScanDouble(input,fname,buf,BUF_LINE,"eps=",&(parms_sphere.eps));
+			if (SphereQuadSize(&parms_sphere)==0) LogError(ONE_POS,"Lebedev quadrature with N=%d points, specified "
+				"in file %s, is not available. Supported values are: "LEBEDEV_LIST,parms_sphere.N,fname);
+		}
+		else if (strcmp(temp,"sobol")==0) {
+			parms_sphere.scheme=AVG_SOBOL;
+			ScanInt(input,fname,buf,BUF_LINE,"Jmin=",&(parms_sphere.Jmin));
+			ScanInt(input,fname,buf,BUF_LINE,"Jmax=",&(parms_sphere.Jmax));
+			ScanDouble(input,fname,buf,BUF_LINE,"eps=",&(parms_sphere.eps));
+			if (parms_sphere.Jmax<parms_sphere.Jmin) LogError(ONE_POS,
+				"Wrong Jmax (%d) in file %s; it must be >= Jmin (%d)",parms_sphere.Jmax,fname,parms_sphere.Jmin);
+			if (parms_sphere.Jmin<1)
+				LogError(ONE_POS,"Wrong Jmin (%d) in file %s (must be >=1)",parms_sphere.Jmin,fname);
+			if (parms_sphere.Jmax >= (int)(8*sizeof(int)-1)) LogError(ONE_POS,
+				"Too large Jmax(%d) in file %s, it will cause integer overflow",parms_sphere.Jmax,fname);
+		}
+		else if (strcmp(temp,"romberg")!=0) LogError(ONE_POS,"Unknown scheme '%s' in file '%s'",temp,fname);
+		if (parms_sphere.scheme!=AVG_ROMBERG && parms_sphere.eps<0)
+			LogError(ONE_POS,"Wrong eps ("GFORMDEF") in file %s (must be >=0)",parms_sphere.eps,fname);
+	}
 	// close file
 	FCloseErr(input,fname,ALL_POS);
-	// print info to string
-	if (IFROOT) avg_string=dyn_sprintf(
-		"alpha: from "GFORMDEF" to "GFORMDEF" in %zu steps\n"
-		"beta: from "GFORMDEF" to "GFORMDEF" in (up to) %zu steps (equally spaced in cosine "
-			"values)\n"
-		"gamma: from "GFORMDEF" to "GFORMDEF" in (up to) %zu steps\n"
-		"see file 'log_orient_avg' for details\n",
-		alpha_int.min,alpha_int.max,alpha_int.N,beta_int.min,beta_int.max,beta_int.N,gamma_int.min,
-		gamma_int.max,gamma_int.N);
+	/* for other schemes the nodes on the whole unit sphere replace the grids of beta and gamma; i-th node is given by
+	 * i-th elements of both arrays
+	 */
+	if (parms_sphere.scheme!=AVG_ROMBERG) {
+		Free_general(beta_int.val);
+		Free_general(gamma_int.val);
+		memory -= (beta_int.N+gamma_int.N)*sizeof(double);
+		n=SphereQuadSize(&parms_sphere);
+		beta_int.N=gamma_int.N=n;
+		beta_int.min=gamma_int.min=0;
+		beta_int.max=FULL_ANGLE/2;
+		gamma_int.max=FULL_ANGLE;
+		MALLOC_VECTOR(beta_int.val,double,n,ALL);
+		MALLOC_VECTOR(gamma_int.val,double,n,ALL);
+		memory += 2*n*sizeof(double);
+		SphereQuadNodes(&parms_sphere,beta_int.val,gamma_int.val);
+	}
 	D("ReadAvgParms finished");
 	Timing_FileIO+=GET_TIME()-tstart;
 }
 
 //======================================================================================================================
 
+static void ReduceRange(
+	angle_set *a,       // pointer to angle set
+	Parms_1D *b,        // pointer to parameters of integration
+	const bool ifcos,   // if space angles equally in cos
+	const double min,   // new range of angles
+	const double max,
+	const int k,        // range is reduced by a factor of 2^k
+	const bool mirror)  // whether the new range lies between two mirror planes
+// reduce the range of angles and the number of refinements, keeping the same spacing of the grid
+{
+	Free_general(a->val);
+	memory -= a->N*sizeof(double);
+	a->min=min;
+	a->max=max;
+	b->Jmax=MAX(b->Jmax-k,1);
+	b->Jmin=MIN(MAX(b->Jmin-k,1),b->Jmax);
+	// both ends of the range between mirror planes need to be computed
+	if (mirror) b->equival=false;
+	SetIntegrParms(a,b,ifcos);
+}
+
+//======================================================================================================================
+
+void ReduceAvgParms(void)
+/* reduce ranges of beta and gamma using symmetries of the particle (should be called after they are finalized) and
+ * print info about orientation averaging to string. The reduction is performed only for full ranges of these angles
+ * and for Romberg integration. Rotations over z-axis of the particle (symR, and symX with symY) change only gamma, so
+ * they can always be used. Reflections additionally change alpha (to -alpha or 180-alpha) and reflect the incident
+ * beam and scattering directions over the xz-plane of the laboratory reference frame. Hence, they are used only for
+ * full range of alpha and plane incident wave, and the resulting Mueller matrix is symmetrized (see SaveMuellerAndCS).
+ * For all reductions the integrand is periodic or symmetric with respect to the ends of the new range, so the
+ * integration weights are the same as for the full range (up to the order of Romberg extrapolation).
+ */
+{
+	bool mirror;
+	int k=0; // total reduction of the domain is 2^k
+	char *str;
+
+	avg_mirror=false;
+	if (parms_sphere.scheme==AVG_ROMBERG) {
+		mirror = full_al_range && beamtype==B_PLANE;
+		// the integrand is periodic over gamma with period 360/2^k, or symmetric over the ends of [min,max]
+		if (gamma_int.min==0 && gamma_int.max==FULL_ANGLE && parms[PHI].periodic) {
+			if (symR && symX && mirror) {
+				ReduceRange(&gamma_int,&parms[PHI],false,0,FULL_ANGLE/8,3,true);
+				k=3;
+			}
+			else if (symR) {
+				ReduceRange(&gamma_int,&parms[PHI],false,0,FULL_ANGLE/4,2,false);
+				k=2;
+			}
+			else if (symX && symY) {
+				if (mirror) {
+					ReduceRange(&gamma_int,&parms[PHI],false,0,FULL_ANGLE/4,2,true);
+					k=2;
+				}
+				else {
+					ReduceRange(&gamma_int,&parms[PHI],false,0,FULL_ANGLE/2,1,false);
+					k=1;
+				}
+			}
+			// reflection over xz-plane (symY) maps gamma into -gamma, over yz-plane (symX) - into 180-gamma
+			else if (symY && mirror) {
+				ReduceRange(&gamma_int,&parms[PHI],false,0,FULL_ANGLE/2,1,true);
+				k=1;
+			}
+			else if (symX && mirror) {
+				ReduceRange(&gamma_int,&parms[PHI],false,FULL_ANGLE/4,3*FULL_ANGLE/4,1,true);
+				k=1;
+			}
+			avg_mirror = mirror && k!=0 && (symX || symY);
+		}
+		// reflection over xy-plane (symZ) maps beta into 180-beta
+		if (beta_int.min==0 && beta_int.max==FULL_ANGLE/2 && symZ && mirror) {
+			ReduceRange(&beta_int,&parms[THETA],true,0,FULL_ANGLE/4,1,true);
+			k++;
+			avg_mirror=true;
+		}
+	}
+	// print info to string
+	if (IFROOT) {
+		if (parms_sphere.scheme==AVG_ROMBERG) {
+			str=dyn_sprintf(
+				"alpha: from "GFORMDEF" to "GFORMDEF" in %zu steps\n"
+				"beta: from "GFORMDEF" to "GFORMDEF" in (up to) %zu steps (equally spaced in cosine values)\n"
+				"gamma: from "GFORMDEF" to "GFORMDEF" in (up to) %zu steps\n",
+				alpha_int.min,alpha_int.max,alpha_int.N,beta_int.min,beta_int.max,beta_int.N,gamma_int.min,
+				gamma_int.max,gamma_int.N);
+			if (k!=0) str=rea_sprintf(str,"ranges of beta and gamma are reduced by a factor of %d using symmetries of "
+				"the particle%s\n",1<<k,avg_mirror ? " (including reflections)" : "");
+			avg_string=rea_sprintf(str,"see file 'log_orient_avg' for details\n");
+		}
+		else avg_string=dyn_sprintf(
+			"alpha: from "GFORMDEF" to "GFORMDEF" in %zu steps\n"
+			"beta and gamma: %s over the whole unit sphere with %s%zu points\n"
+			"see file 'log_orient_avg' for details\n",
+			alpha_int.min,alpha_int.max,alpha_int.N,
+			(parms_sphere.scheme==AVG_LEBEDEV) ? "Lebedev quadrature" : "scrambled Sobol points",
+			(parms_sphere.scheme==AVG_LEBEDEV) ? "" : "up to ",beta_int.N);
+	}
+	D("ReduceAvgParms finished");
+}
+
+//======================================================================================================================
+
 void ReadAlldirParms(const char * restrict fname)
 /* read integration parameters for asymmetry-parameter & C_sca; should not be used together with orientation averaging
  * because they use the same storage space - parms
@@ -528,9 +698,11 @@ static void CalcFieldFree(doublecomplex ebuff[static restrict 3], // where to wr
 	doublecomplex a,dpr;
 	doublecomplex sum[3],tbuff[3],tmp=0; // redundant initialization to remove warnings
 	int i;
-	unsigned short ix,iy1,iy2,iz1,iz2;
 	size_t j,jjj;
-#ifdef SPARSE
+#ifndef SPARSE
+	size_t s,ix;
+#else
+	int ix,iy1,iy2,iz1,iz2;
 	doublecomplex expX, expY, expZ;
 #endif
 
@@ -541,11 +713,26 @@ static void CalcFieldFree(doublecomplex ebuff[static restrict 3], // where to wr
 	imExp_arr(-kdY*n[1],boxY,expsY);
 	imExp_arr(-kdZ*n[2],local_Nz_unif,expsZ);
 #endif // !SPARSE
+#ifndef SPARSE // FFT mode
+	/* this piece of code uses the row-span index (constructed in MakeParticle), i.e. that only x position changes from
+	 * dipole to dipole inside a span. Thus, the product of exponents along y and z is computed once per span, and the
+	 * exponent along x is obtained by a simple index increment.
+	 */
+	for (s=0;s<local_nSpan;s++) {
+		jjj=3*spanStart[s];
+		// a=exp(-ikr.n), but r is taken relative to the first dipole of the local box
+		ix=position[jjj];
+		tmp=expsY[position[jjj+1]]*expsZ[position[jjj+2]];
+		for (j=spanStart[s],jjj=3*j;j<spanStart[s+1];j++,jjj+=3,ix++) {
+			a=tmp*expsX[ix];
+			// sum(P*exp(-ik*r.n))
+			for(i=0;i<3;i++) sum[i]+=pvec[jjj+i]*a;
+		}
+	}
+#else // sparse mode - exponents are not precomputed
 	/* this piece of code tries to use that usually only x position changes from dipole to dipole, saving a complex
 	 * multiplication seems to be beneficial, even considering bookkeeping overhead; it may not be as good for very
-	 * porous particles though, but for them this part of code is anyway fast relative to the FFT on a large grid;
-	 * Further optimization is possible using some kind of plans, i.e. by preliminary analyzing the position of the
-	 * real dipoles on the grid.
+	 * porous particles though.
 	 */
 	iy1=iz1=UNDEF;
 	for (j=0;j<local_nvoid_Ndip;++j) {
@@ -558,21 +745,16 @@ static void CalcFieldFree(doublecomplex ebuff[static restrict 3], // where to wr
 		if (iy2!=iy1 || iz2!=iz1) {
 			iy1=iy2;
 			iz1=iz2;
-#ifndef SPARSE // FFT mode
-			tmp=expsY[iy2]*expsZ[iz2];
-		}
-		a=tmp*expsX[ix];
-#else // sparse mode - the difference is that exponents are not precomputed
 			expY=imExp(-kdY*n[1]*iy2);
 			expZ=imExp(-kdZ*n[2]*iz2);
 			tmp=expY*expZ;
 		}
 		expX=imExp(-kdX*n[0]*ix);
 		a=tmp*expX;
-#endif // SPARSE
 		// sum(P*exp(-ik*r.n))
 		for(i=0;i<3;i++) sum[i]+=pvec[jjj+i]*a;
 	} /* end for j */
+#endif // SPARSE
 	
 
 	// tbuff=(I-nxn).sum=sum-n*(n.sum)
@@ -1027,20 +1209,50 @@ void CalcAlldir(void)
 
 //======================================================================================================================
 
-void CalcScatGrid(const enum incpol which)
-// calculate scattered field in many directions
+static void RotateOverProp(const double in[static restrict 3],const enum incpol which,double out[static restrict 3])
+/* Rotates vector 'in' by 90 degrees over prop, so that incPolX is transformed into incPolY (for which==INCPOL_Y) or
+ * vice versa (for which==INCPOL_X): out = (in.prop)prop +- [(in.incPolX)incPolY - (in.incPolY)incPolX]. This is an
+ * inverse of the rotation, which transforms the solution for 'which' into that for the other incident polarization.
+ * Explicit definition through the basis vectors is used to avoid any assumption on the handedness of the latter.
+ */
+{
+	double tmp[3],sign;
+
+	if (which==INCPOL_Y) sign=1;
+	else sign=-1; // which==INCPOL_X
+	LinComb(incPolY,incPolX,sign*DotProd(in,incPolX),-sign*DotProd(in,incPolY),tmp);
+	LinComb(prop,tmp,DotProd(in,prop),1,out);
+}
+
+//======================================================================================================================
+
+void CalcScatGrid(const enum incpol which,const enum Eftype type)
+/* calculate scattered field in many directions. For type==CE_PARPER (requires symR, which implies prop along z) the
+ * field for the other incident polarization is also computed from the same internal fields. If R is the rotation over
+ * prop by 90 degrees, transforming the incident polarization 'which' into the other one, then the corresponding
+ * scattered field is Eo(n)=R.E(R^-1.n). Hence, Eo(n).e = E(R^-1.n).(R^-1.e) for any unit vector e.
+ */
 {
 	size_t i,j,n,point,index;
 	TIME_TYPE tstart;
 	double robserver[3],incPolpar[3],incPolper[3],cthet,sthet,th,ph;
+	double robs_rot[3],per_rot[3],par_rot[3];
 	doublecomplex ebuff[3];
-	doublecomplex *Egrid; // either EgridX or EgridY
+	doublecomplex *Egrid,*Egrid_rot; // either EgridX or EgridY; the latter - for the other polarization
 
 	// Calculate field
 	tstart = GET_TIME();
 	// choose which array to fill
-	if (which==INCPOL_Y) Egrid=EgridY;
-	else Egrid=EgridX; // which==INCPOL_X
+	if (which==INCPOL_Y) {
+		Egrid=EgridY;
+		Egrid_rot=EgridX;
+	}
+	else { // which==INCPOL_X
+		Egrid=EgridX;
+		Egrid_rot=EgridY;
+	}
+	// this should never happen, since symR is canceled for prop not along z
+	if (type==CE_PARPER && !propAlongZ) LogError(ONE_POS,"Incompatibility error in CalcScatGrid");
 	// set type of cycling through angles
 	if (angles.type==SG_GRID) n=angles.phi.N;
 	else n=1; // angles.type==SG_PAIRS
@@ -1063,6 +1275,15 @@ void CalcScatGrid(const enum incpol which)
 			index=2*point;
 			Egrid[index]=crDotProd(ebuff,incPolper);
 			Egrid[index+1]=crDotProd(ebuff,incPolpar);
+			// the same for the other polarization, using the rotated direction and basis vectors (see above)
+			if (type==CE_PARPER) {
+				RotateOverProp(robserver,which,robs_rot);
+				RotateOverProp(incPolper,which,per_rot);
+				RotateOverProp(incPolpar,which,par_rot);
+				CalcField(ebuff,robs_rot);
+				Egrid_rot[index]=crDotProd(ebuff,per_rot);
+				Egrid_rot[index+1]=crDotProd(ebuff,par_rot);
+			}
 			point++;
 			// show progress; the value is always from 0 to 100, so conversion to int is safe
 			if (((10*point)%angles.N)<10 && IFROOT) PRINTFB(" %d%%",(int)(100*point/angles.N));
@@ -1070,6 +1291,11 @@ void CalcScatGrid(const enum incpol which)
 	}
 	// accumulate fields; timing
 	Accumulate(Egrid,cmplx_type,2*angles.N,&Timing_EFieldSGComm);
+	if (type==CE_PARPER) {
+		TIME_TYPE tcomm;
+		Accumulate(Egrid_rot,cmplx_type,2*angles.N,&tcomm);
+		Timing_EFieldSGComm+=tcomm;
+	}
 	if (IFROOT) PRINTFB("  done\n");
 	Timing_EFieldSG = GET_TIME() - tstart;
 	Timing_EField += Timing_EFieldSG;
@@ -27,11 +27,12 @@ double DecayCross(void);
 double ScaCross(const char *f_suf);
 void ReadAlldirParms(const char * restrict fname);
 void ReadAvgParms(const char * restrict fname);
+void ReduceAvgParms(void);
 void ReadScatGridParms(const char * restrict fname);
 void SetScatPlane(const double ct,const double st,const double phi,double robs[static restrict 3],
 	double polPer[static restrict 3]);
 void CalcAlldir(void);
-void CalcScatGrid(enum incpol which);
+void CalcScatGrid(enum incpol which,enum Eftype type);
 void AsymParm_x(double *vec,const char *f_suf);
 void AsymParm_y(double *vec,const char *f_suf);
 void AsymParm_z(double *vec,const char *f_suf);
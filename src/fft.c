@@ -77,11 +77,19 @@
 
 // defined and initialized in interaction.c
 extern const int local_Nz_Rm;
+#ifdef PARALLEL
+// defined and initialized in param.c
+extern const bool bt_overlap,load_balance;
+extern const enum btmethod bt_method;
+extern const int procGridY,procGridZ;
+// defined and initialized in make_particle.c
+extern const size_t slab_nvoid_Ndip;
+#endif
 // defined and initialized in timing.c
 extern TIME_TYPE Timing_FFT_Init,Timing_Dm_Init;
 
 // used in comm.c
-double * restrict BT_buffer, * restrict BT_rbuffer; // buffers for BlockTranspose
+double * restrict BT_buffer; // buffer for BlockTranspose
 // used in matvec.c; in OpenCL mode some of those are not used at all, others - only locally
 doublecomplex * restrict Dmatrix; // holds FFT of the interaction matrix
 doublecomplex * restrict Rmatrix; // holds FFT of the reflection matrix
@@ -91,6 +99,9 @@ doublecomplex * restrict Xmatrix;
 doublecomplex * restrict slices; // used in inner cycle of matvec - holds 3 components (for fixed x)
 doublecomplex * restrict slices_tr; // additional storage space for slices to accelerate transpose
 doublecomplex * restrict slicesR,* restrict slicesR_tr; // same as above, but for reflected interaction
+#	ifdef PARALLEL
+doublecomplex * restrict slabBuf; // values on dipoles distributed over FFT slabs (for '-load_balance')
+#	endif
 #endif
 size_t DsizeY,DsizeZ,DsizeYZ; // size of the 'matrix' D
 size_t RsizeY; // size of the 'matrix' R; in OpenCL mode it is used in oclmatvec.c
@@ -112,6 +123,8 @@ static doublecomplex * restrict R2matrix; // same for surface (slice and slice_t
 static size_t D2sizeY; // size of the 'matrix' D2 (x-size is gridX), Z size is not used
 static size_t R2sizeY; // size of the 'matrix' R2 (x- and z-sizes are corresponding grids)
 static size_t lz_Dm,lz_Rm; // local sizes along z for D(2) and R(2) matrices
+static size_t ly_Dm,ly_Rm; // local sizes along y for D2 and R2 matrices
+static int y0_Dm,y0_Rm;    // starting (periodic) y for D2 and R2 matrices on current processor
 // the following two lines are defined in InitDmatrix but used in InitRmatrix, they are analogous to Dm values
 static size_t Rsize,R2sizeTot; // sizes of R and R2 matrices
 static int jstartR;            // starting index for y
@@ -131,6 +144,9 @@ static clFFT_Plan clplanX,clplanY,clplanZ;
 static fftw_plan planXf_Dm,planYf_slice,planZf_slice,planXf_Rm;
 #	ifndef OPENCL // these plans are used only if OpenCL is not used
 static fftw_plan planXf,planXb,planYf,planYb,planZf,planZb,planYRf,planZRf; // last two for reflected interaction
+#		ifdef PARALLEL
+static fftw_plan planXf_comp,planXb_comp; // same as planXf and planXb, but for a single component (used for bt_overlap)
+#		endif
 #	endif
 #elif defined(FFT_TEMPERTON)
 #	ifdef NO_FORTRAN
@@ -209,7 +225,7 @@ static inline size_t IndexGarbledD(const size_t x,int y,int z)
 	if (y<0) y+=gridY;
 	if (z<0) z+=gridZ;
 #ifdef PARALLEL
-	return(((z%lz_Dm)*D2sizeY+y)*gridX+(z/lz_Dm)*local_Nx+x%local_Nx);
+	return(((z%lz_Dm)*ly_Dm+y%ly_Dm)*gridX+((z/lz_Dm)*procGridY+y/ly_Dm)*local_Nx+x%local_Nx);
 #else
 	return((z*D2sizeY+y)*gridX+x);
 #endif
@@ -259,7 +275,7 @@ static inline size_t IndexGarbledR(const size_t x,int y,const int z)
 {
 	if (y<0) y+=gridY;
 #ifdef PARALLEL
-	return(((z%lz_Rm)*R2sizeY+y)*gridX+(z/lz_Rm)*local_Nx+x%local_Nx);
+	return(((z%lz_Rm)*ly_Rm+y%ly_Rm)*gridX+((z/lz_Rm)*procGridY+y/ly_Rm)*local_Nx+x%local_Nx);
 #else
 	return((z*R2sizeY+y)*gridX+x);
 #endif
@@ -380,7 +396,7 @@ void fftX(const int isign)
 	if (isign==FFT_FORWARD) fftw_execute(planXf);
 	else fftw_execute(planXb);
 #elif defined(FFT_TEMPERTON)
-	int nn=gridX,inc=1,jump=nn,lot=boxY;
+	int nn=gridX,inc=1,jump=nn,lot=local_y1_coer-local_y0;
 	size_t z;
 	/* Calls to Temperton FFT cause warnings for translation from doublecomplex to double pointers. However, such a cast
 	 * is perfectly valid in C99. So we set pragmas to remove these warnings.
@@ -389,13 +405,33 @@ void fftX(const int isign)
 	 * respects. This is also reasonable considering future switch to tgmath.h
 	 */
 	IGNORE_WARNING(-Wstrict-aliasing);
-	for (z=0;z<3*local_Nz;z++) cfft99_((double *)(Xmatrix+z*gridX*smallY),work,trigsX,ifaxX,&inc,&jump,&nn,&lot,&isign);
+	for (z=0;z<3*local_Nz;z++)
+		cfft99_((double *)(Xmatrix+z*gridX*local_Ny),work,trigsX,ifaxX,&inc,&jump,&nn,&lot,&isign);
 	STOP_IGNORE;
 #endif
 }
 
 //======================================================================================================================
 
+#ifdef PARALLEL
+void fftXcomp(const int isign,const int Xcomp)
+// FFT a single component of (buf)Xmatrix(x) for all y,z; called from matvec when bt_overlap is used
+{
+	doublecomplex * restrict X=Xmatrix+Xcomp*local_Nsmall;
+#	ifdef FFTW3
+	fftw_execute_dft(isign==FFT_FORWARD ? planXf_comp : planXb_comp,X,X);
+#	elif defined(FFT_TEMPERTON)
+	int nn=gridX,inc=1,jump=nn,lot=local_y1_coer-local_y0;
+	size_t z;
+	IGNORE_WARNING(-Wstrict-aliasing); // see comments in fftX
+	for (z=0;z<local_Nz;z++) cfft99_((double *)(X+z*gridX*local_Ny),work,trigsX,ifaxX,&inc,&jump,&nn,&lot,&isign);
+	STOP_IGNORE;
+#	endif
+}
+#endif
+
+//======================================================================================================================
+
 void fftY(const int isign)
 // FFT three components of slices_tr(y) for all z; called from matvec
 {
@@ -477,11 +513,11 @@ static void fftX_Dm(void)
 #ifdef FFTW3
 	fftw_execute(planXf_Dm);
 #elif defined(FFT_TEMPERTON)
-	int nn=gridX,inc=1,jump=nn,lot=D2sizeY,isign=FFT_FORWARD;
+	int nn=gridX,inc=1,jump=nn,lot=ly_Dm,isign=FFT_FORWARD;
 	size_t z;
 
 	IGNORE_WARNING(-Wstrict-aliasing);
-	for (z=0;z<lz_Dm;z++) cfft99_((double *)(D2matrix+z*gridX*D2sizeY),work,trigsX,ifaxX,&inc,&jump,&nn,&lot,&isign);
+	for (z=0;z<lz_Dm;z++) cfft99_((double *)(D2matrix+z*gridX*ly_Dm),work,trigsX,ifaxX,&inc,&jump,&nn,&lot,&isign);
 	STOP_IGNORE;
 #endif
 }
@@ -494,12 +530,12 @@ static void fftX_Rm(void)
 #ifdef FFTW3
 	fftw_execute(planXf_Rm);
 #elif defined(FFT_TEMPERTON)
-	int nn=gridX,inc=1,jump=nn,lot=R2sizeY,isign=FFT_FORWARD;
+	int nn=gridX,inc=1,jump=nn,lot=ly_Rm,isign=FFT_FORWARD;
 	size_t z;
 	const size_t zlim=local_Nz_Rm; // can be smaller by 1 than lz_Rm
 
 	IGNORE_WARNING(-Wstrict-aliasing);
-	for (z=0;z<zlim;z++) cfft99_((double *)(R2matrix+z*gridX*R2sizeY),work,trigsX,ifaxX,&inc,&jump,&nn,&lot,&isign);
+	for (z=0;z<zlim;z++) cfft99_((double *)(R2matrix+z*gridX*ly_Rm),work,trigsX,ifaxX,&inc,&jump,&nn,&lot,&isign);
 	STOP_IGNORE;
 #endif
 }
@@ -635,10 +671,10 @@ static void fftInitBeforeD(void)
 	planYf_slice=fftw_plan_many_dft(1,&grYint,gridZ,slice_tr,NULL,1,gridY,slice_tr,NULL,1,gridY,FFT_FORWARD,
 		PLAN_FFTW_DM);
 	planZf_slice=fftw_plan_many_dft(1,&grZint,gridY,slice,NULL,1,gridZ,slice,NULL,1,gridZ,FFT_FORWARD,PLAN_FFTW_DM);
-	planXf_Dm=fftw_plan_many_dft(1,&grXint,lz_Dm*D2sizeY,D2matrix,NULL,1,gridX,D2matrix,NULL,1,gridX,FFT_FORWARD,
+	planXf_Dm=fftw_plan_many_dft(1,&grXint,lz_Dm*ly_Dm,D2matrix,NULL,1,gridX,D2matrix,NULL,1,gridX,FFT_FORWARD,
 		PLAN_FFTW_DM);
 	// very similar to Dm, but local_Nz_Rm can be smaller by 1 than lz_Rm
-	if (surface) planXf_Rm=fftw_plan_many_dft(1,&grXint,local_Nz_Rm*R2sizeY,R2matrix,NULL,1,gridX,R2matrix,NULL,1,gridX,
+	if (surface) planXf_Rm=fftw_plan_many_dft(1,&grXint,local_Nz_Rm*ly_Rm,R2matrix,NULL,1,gridX,R2matrix,NULL,1,gridX,
 		FFT_FORWARD,PLAN_FFTW_DM);
 #elif defined(FFT_TEMPERTON)
 	int nn;
@@ -841,14 +877,26 @@ static void fftInitAfterD(void)
 	dims.n=gridX;
 	dims.is=dims.os=1;
 	howmany_dims[0].n=3*local_Nz;
-	howmany_dims[0].is=howmany_dims[0].os=smallY*gridX;
-	howmany_dims[1].n=boxY;
+	howmany_dims[0].is=howmany_dims[0].os=local_Ny*gridX;
+	howmany_dims[1].n=local_y1_coer-local_y0;
 	howmany_dims[1].is=howmany_dims[1].os=gridX;
 	planXf=fftw_plan_guru_dft(1,&dims,2,howmany_dims,Xmatrix,Xmatrix,FFT_FORWARD,PLAN_FFTW);
 #	ifdef PRECISE_TIMING
 	GET_SYSTEM_TIME(tvp+5);
 #	endif
 	planXb=fftw_plan_guru_dft(1,&dims,2,howmany_dims,Xmatrix,Xmatrix,FFT_BACKWARD,PLAN_FFTW);
+#	ifdef PARALLEL
+	/* plans for the first component are executed for other components by fftw_execute_dft. This requires the same
+	 * alignment, otherwise the plans are created without the assumption of SIMD alignment
+	 */
+	if (bt_overlap) {
+		const unsigned flags=PLAN_FFTW | ((fftw_alignment_of((double *)(Xmatrix+local_Nsmall))
+			==fftw_alignment_of((double *)Xmatrix)) ? 0 : FFTW_UNALIGNED);
+		howmany_dims[0].n=local_Nz;
+		planXf_comp=fftw_plan_guru_dft(1,&dims,2,howmany_dims,Xmatrix,Xmatrix,FFT_FORWARD,flags);
+		planXb_comp=fftw_plan_guru_dft(1,&dims,2,howmany_dims,Xmatrix,Xmatrix,FFT_BACKWARD,flags);
+	}
+#	endif
 #	ifdef PRECISE_TIMING
 	GET_SYSTEM_TIME(tvp+6);
 	// print precise timing of FFT planning
@@ -887,16 +935,15 @@ static void InitRmatrix(const double invNgrid)
  * latter function.
  */
 {
-	int i,j,k,Rcomp;
+	int i,j,k,Rcomp,jl;
 	size_t x,y,z,indexfrom,indexto,ind,index;
 
 	// allocate memory for Rmatrix (R2matrix is allocated earlier in InitDmatrix)
 	MALLOC_VECTOR(Rmatrix,complex,Rsize,ALL);
 #ifdef PARALLEL
 	// allocate buffer for BlockTranspose_DRm
-	size_t bufsize = 2*lz_Rm*R2sizeY*local_Nx;
+	size_t bufsize = BTBufferSize(1,ly_Rm,lz_Rm);
 	MALLOC_VECTOR(BT_buffer,double,bufsize,ALL);
-	MALLOC_VECTOR(BT_rbuffer,double,bufsize,ALL);
 #endif
 	if (IFROOT) PRINTFB("Calculating reflected Green's function (Rmatrix)\n");
 	/* Interaction matrix values are calculated all at once for performance reasons. They are stored in Rmatrix with
@@ -908,16 +955,21 @@ static void InitRmatrix(const double invNgrid)
 	 */
 	for (ind=0;ind<Rsize;ind++) Rmatrix[ind]=0;
 	// fill Rmatrix with values of reflected Green's tensor
-	for(k=0;k<local_Nz_Rm;k++) for (j=jstartR;j<boxY;j++) for (i=1-boxX;i<boxX;i++) {
-			index=NDCOMP*Index2matrix(i,j,k,R2sizeY);
+	for(k=0;k<local_Nz_Rm;k++) for (j=jstartR;j<boxY;j++) {
+		// only the local part of the (periodic) y-range is stored, relevant for 2D grid of processors
+		jl=(j<0 ? j+(int)gridY : j)-y0_Rm;
+		if (jl<0 || jl>=(int)ly_Rm) continue;
+		for (i=1-boxX;i<boxX;i++) {
+			index=NDCOMP*Index2matrix(i,jl,k,ly_Rm);
 			(*ReflTerm_int)(i,j,k,Rmatrix+index);
+		}
 	} // end of i,j,k loop
 	if (IFROOT) PRINTFB("Fourier transform of Rmatrix\n");
 	for(Rcomp=0;Rcomp<NDCOMP;Rcomp++) { // main cycle over components of Rmatrix
 		// fill R2matrix with precomputed values from Rmatrix
 		for (ind=0;ind<R2sizeTot;ind++) R2matrix[ind]=Rmatrix[NDCOMP*ind+Rcomp];
 		fftX_Rm(); // fftX R2matrix
-		BlockTranspose_DRm(R2matrix,R2sizeY,lz_Rm);
+		BlockTranspose_DRm(R2matrix,ly_Rm,lz_Rm);
 		for(x=local_x0;x<local_x1;x++) {
 			for (ind=0;ind<gridYZ;ind++) slice[ind]=0.0; // fill slice with 0.0
 			for(j=jstartR;j<boxY;j++) for(k=0;k<2*boxZ-1;k++) {
@@ -948,7 +1000,6 @@ static void InitRmatrix(const double invNgrid)
 #ifdef PARALLEL
 	// deallocate buffers for BlockTranspose_DRm
 	Free_general(BT_buffer);
-	Free_general(BT_rbuffer);
 #endif
 #ifdef OPENCL
 	// Setting kernel arguments which are always the same
@@ -983,11 +1034,12 @@ void InitDmatrix(void)
  * only once, so does not need to be very fast, however we tried to optimize it.
  */
 {
-	int i,j,k,kcor,Dcomp;
-	size_t x,y,z,indexfrom,indexto,ind,index,Dsize,D2sizeTot;
+	int i,j,k,kcor,Dcomp,i0,jl;
+	size_t x,y,z,indexfrom,indexto,ind,Dsize,D2sizeTot,n;
 	double invNgrid;
 	int nnn; // multiplier used for reduced_FFT or not reduced; 1 or 2
 	int jstart,kstart;
+	int *ijk; // integer distance vectors for InterTerm_batch
 	TIME_TYPE start,time1;
 #ifdef PRECISE_TIMING
 	// precise timing of the Dmatrix computation
@@ -1032,13 +1084,20 @@ void InitDmatrix(void)
 	}
 	// auxiliary parameters
 	lz_Dm=nnn*local_Nz;
+	ly_Dm=nnn*local_Ny;
+	y0_Dm=nnn*local_y0;
 	DsizeYZ=DsizeY*DsizeZ;
 	invNgrid=1.0/(gridX*((double)gridYZ));
 	local_Nsmall=(gridX/2)*(gridYZ/(2*nprocs)); // size of X vector (for 1 component)
 	// potentially this may cause unnecessary error during prognosis, but makes code cleaner
 	Dsize=MultOverflow(NDCOMP*local_Nx,DsizeYZ,ONE_POS_FUNC);
-	D2sizeTot=nnn*local_Nz*D2sizeY*gridX; // this should be approximately equal to Dsize/NDCOMP
-	if (IFROOT) fprintf(logfile,"The FFT grid is: %zux%zux%zu\n",gridX,gridY,gridZ);
+	D2sizeTot=lz_Dm*ly_Dm*gridX; // this should be approximately equal to Dsize/NDCOMP
+	if (IFROOT) {
+		fprintf(logfile,"The FFT grid is: %zux%zux%zu\n",gridX,gridY,gridZ);
+#ifdef PARALLEL
+		if (procGridY>1) fprintf(logfile,"The grid of processors (along y and z) is: %dx%d\n",procGridY,procGridZ);
+#endif
+	}
 
 	// part of the code for InitRmatrix is here to be compatible with prognosis and FFT init
 	if (surface) {
@@ -1059,9 +1118,11 @@ void InitDmatrix(void)
 			jstartR=1-boxY;
 		}
 		lz_Rm=2*local_Nz;
+		ly_Rm=(R2sizeY/smallY)*local_Ny;
+		y0_Rm=(R2sizeY/smallY)*local_y0;
 		// potentially this may cause unnecessary error during prognosis, but makes code cleaner
 		Rsize=MultOverflow(NDCOMP*local_Nx,RsizeY*gridZ,ONE_POS_FUNC);
-		R2sizeTot=lz_Rm*R2sizeY*gridX; // this should be approximately equal to Rsize/NDCOMP
+		R2sizeTot=lz_Rm*ly_Rm*gridX; // this should be approximately equal to Rsize/NDCOMP
 	}
 #ifdef OPENCL // perform setting up of buffers and kernels
 	/* The order of allocation is such that to have all bufslices* at the end to spent whatever memory is still
@@ -1222,6 +1283,9 @@ void InitDmatrix(void)
 		CL_CH_ERR(clSetKernelArg(cltransposeob,3,sizeof(size_t),&gridZ));
 		CL_CH_ERR(clSetKernelArg(cltransposeob,4,17*16*sizeof(doublecomplex),NULL));
 	}
+#endif
+#ifdef PARALLEL
+	SetBTMethod(); // required for BTBufferSize
 #endif
 	// memory estimation and exit for prognosis
 	MAXIMIZE(memPeak,memory);
@@ -1237,8 +1301,12 @@ void InitDmatrix(void)
 	double mem=sizeof(doublecomplex)*((double)Dsize+3*local_Nsmall+6*gridYZ);
 	if (surface) mem+=sizeof(doublecomplex)*((double)Rsize+6*gridYZ); // for Rmatrix, slicesR, and slicesR_tr
 #ifdef PARALLEL
-	const size_t BTsize = 6*smallY*local_Nz*local_Nx; // in doubles
-	mem+=2*BTsize*sizeof(double);
+	// with bt_overlap the buffer holds 2 components of Xmatrix for all processors
+	const size_t BTsize = bt_overlap ? 4*local_Nsmall : BTBufferSize(3,local_Ny,local_Nz); // in doubles
+	mem+=BTsize*sizeof(double);
+	// shared-memory window (per processor) replaces the buffer for BTM_NODE and is also tested for BTM_AUTO
+	if (bt_method==BTM_NODE || bt_method==BTM_AUTO) mem+=3*sizeof(doublecomplex)*(double)local_Nsmall;
+	if (load_balance) mem+=3*sizeof(doublecomplex)*(double)slab_nvoid_Ndip;
 #endif
 	// printout some information
 	if (IFROOT) {
@@ -1265,9 +1333,8 @@ void InitDmatrix(void)
 	// actually allocation of Xmatrix, slices, slices_tr is below after freeing of Dmatrix and its slice
 #ifdef PARALLEL
 	// allocate buffer for BlockTranspose_Dm
-	size_t bufsize = 2*lz_Dm*D2sizeY*local_Nx;
+	size_t bufsize = BTBufferSize(1,ly_Dm,lz_Dm);
 	MALLOC_VECTOR(BT_buffer,double,bufsize,ALL);
-	MALLOC_VECTOR(BT_rbuffer,double,bufsize,ALL);
 #endif
 	D("Initialize FFT (1st part)");
 	fftInitBeforeD();
@@ -1285,19 +1352,34 @@ void InitDmatrix(void)
 	 */
 	for (ind=0;ind<Dsize;ind++) Dmatrix[ind]=0;
 	// fill Dmatrix with values of Green's tensor
+	MALLOC_VECTOR(ijk,int,3*boxX,ALL);
 	for(k=nnn*local_z0;k<nnn*local_z1;k++) {
 		// correction of k is relevant only if reduced_FFT is not used
 		if (k>(int)smallZ) kcor=k-gridZ;
 		else kcor=k;
-		for (j=jstart;j<boxY;j++) for (i=1-boxX;i<boxX;i++) {
-			index=NDCOMP*Index2matrix(i,j,k-nnn*local_z0,D2sizeY);
-			/* The test for zero distance is somewhat non-optimal. However, other alternatives are not perfect either:
-			 * 1) complicate the loops to remove the zero element in the beginning (move tests to the upper level)
-			 * 2) call the function with zero - it will produce NaN. Then set this element to zero after the loop.
+		for (j=jstart;j<boxY;j++) {
+			// only the local part of the (periodic) y-range is stored, relevant for 2D grid of processors
+			jl=(j<0 ? j+(int)gridY : j)-y0_Dm;
+			if (jl<0 || jl>=(int)ly_Dm) continue;
+			/* Values for non-negative and negative i are stored in two contiguous parts of Dmatrix (see Index2matrix),
+			 * each of them is computed by a single call of InterTerm_batch. Zero distance is skipped (left zero).
 			 */
-			if (i!=0 || j!=0 || kcor!=0) (*InterTerm_int)(i,j,kcor,Dmatrix+index);
+			i0 = (j==0 && kcor==0) ? 1 : 0;
+			for (n=0,i=i0;i<boxX;i++,n++) {
+				ijk[3*n]=i;
+				ijk[3*n+1]=j;
+				ijk[3*n+2]=kcor;
+			}
+			(*InterTerm_batch)(ijk,n,Dmatrix+NDCOMP*Index2matrix(i0,jl,k-nnn*local_z0,ly_Dm));
+			for (n=0,i=1-boxX;i<0;i++,n++) {
+				ijk[3*n]=i;
+				ijk[3*n+1]=j;
+				ijk[3*n+2]=kcor;
+			}
+			(*InterTerm_batch)(ijk,n,Dmatrix+NDCOMP*Index2matrix(1-boxX,jl,k-nnn*local_z0,ly_Dm));
 		}
 	} // end of i,j,k loop
+	Free_general(ijk);
 	if (IFROOT) PRINTFB("Fourier transform of Dmatrix\n");
 #ifdef PRECISE_TIMING
 	GET_SYSTEM_TIME(tvp+11); // same as the last time-stamp in the following loop
@@ -1319,7 +1401,7 @@ void InitDmatrix(void)
 		GET_SYSTEM_TIME(tvp+4);
 		ElapsedInc(tvp+3,tvp+4,&Timing_fftX);
 #endif
-		BlockTranspose_DRm(D2matrix,D2sizeY,lz_Dm);
+		BlockTranspose_DRm(D2matrix,ly_Dm,lz_Dm);
 #ifdef PRECISE_TIMING
 		GET_SYSTEM_TIME(tvp+5);
 		ElapsedInc(tvp+4,tvp+5,&Timing_BT);
@@ -1385,7 +1467,6 @@ void InitDmatrix(void)
 #ifdef PARALLEL
 	// deallocate buffers for BlockTranspose_DRm
 	Free_general(BT_buffer);
-	Free_general(BT_rbuffer);
 #endif
 #ifdef OPENCL
 	// copy Dmatrix to OpenCL buffer, blocking to ensure completion before function end
@@ -1406,9 +1487,9 @@ void InitDmatrix(void)
 	Free_cVector(slice);
 	Free_cVector(slice_tr);
 #ifdef PARALLEL
-	// allocate buffers for BlockTranspose
+	// allocate buffer for BlockTranspose
 	MALLOC_VECTOR(BT_buffer,double,BTsize,ALL);
-	MALLOC_VECTOR(BT_rbuffer,double,BTsize,ALL);
+	if (bt_overlap) SetBTOverlap();
 #endif
 #ifndef OPENCL
 	// allocate memory for Xmatrix, slices and slices_tr - used in matvec
@@ -1419,6 +1500,10 @@ void InitDmatrix(void)
 		MALLOC_VECTOR(slicesR,complex,3*gridYZ,ALL);
 		MALLOC_VECTOR(slicesR_tr,complex,3*gridYZ,ALL);
 	}
+#	ifdef PARALLEL
+	if (load_balance) MALLOC_VECTOR(slabBuf,complex,3*slab_nvoid_Ndip,ALL);
+	ChooseBTMethod(Xmatrix);
+#	endif
 #endif
 	time1=GET_TIME();
 	Timing_Dm_Init=time1-start;
@@ -1529,11 +1614,19 @@ void Free_FFT_Dmat(void)
 	}
 #	ifdef PARALLEL
 	Free_general(BT_buffer);
-	Free_general(BT_rbuffer);
+	if (bt_overlap) FreeBTOverlap();
+	FreeBTMethod();
+	if (load_balance) Free_cVector(slabBuf);
 #	endif
 #	ifdef FFTW3 // these plans are defined only when OpenCL is not used
 	fftw_destroy_plan(planXf);
 	fftw_destroy_plan(planXb);
+#		ifdef PARALLEL
+	if (bt_overlap) {
+		fftw_destroy_plan(planXf_comp);
+		fftw_destroy_plan(planXb_comp);
+	}
+#		endif
 	fftw_destroy_plan(planYf);
 	fftw_destroy_plan(planYb);
 	fftw_destroy_plan(planZf);
@@ -32,6 +32,9 @@
 #define FFT_BACKWARD 1
 
 void fftX(int isign);
+#ifdef PARALLEL
+void fftXcomp(int isign,int Xcomp);
+#endif
 void fftY(int isign);
 void fftZ(int isign);
 void TransposeYZ(int direction);
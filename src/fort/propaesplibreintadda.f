@@ -12,8 +12,13 @@ c     permittivity", Phys. Rev. E 70(3), 036606-6 (2004).
 
 c     license: GNU GPL
 
+c     The routine is reentrant (can be called simultaneously from several
+c     OpenMP threads): the working array WRKSTR (of size NW) is provided
+c     by the caller, and the common block is private to each thread.
+
       subroutine propaespacelibreintadda(Rij,k0a,
-     $      gridspacex,gridspacey,gridspacez,relreq,result,IFAIL)
+     $      gridspacex,gridspacey,gridspacez,relreq,result,IFAIL,
+     $      WRKSTR,NW)
       implicit none
       integer i,j
 c     definition of the position of the dipole, observation, wavenumber
@@ -29,7 +34,7 @@ c     Re(G11),Re(G12),Re(G13),Re(G22),Re(G23),Re(G33),Im(G11),...,Im(G33)
 
 c     Variables needs for the integration
       integer  KEY, N, NF, NDIM, MINCLS, MAXCLS, IFAIL, NEVAL, NW
-      parameter (nw=4000000,ndim=3,nf=12)
+      parameter (ndim=3,nf=12)
       double precision A(NDIM), B(NDIM), WRKSTR(NW)
       double precision  ABSEST(NF), ABSREQ, RELREQ,err
       
@@ -38,6 +43,7 @@ c     Variables needs for the integration
       external fonctionigtadda
 
       common/k0xyz/k0,x,y,z,xx0,yy0,zz0
+c$omp threadprivate(/k0xyz/)
 
       x=Rij(1)
       y=Rij(2)
@@ -109,6 +115,7 @@ c*************************************************************
      $     ,Rvect(3),xx0,yy0,zz0
       double complex propaesplibre(3,3),const1,const2
       common/k0xyz/k0,x,y,z,xx0,yy0,zz0
+c$omp threadprivate(/k0xyz/)
 
       x0=zz(1)
       y0=zz(2)
@@ -0,0 +1,825 @@
+/* Hierarchical matrix for the matrix-vector product in sparse mode
+ *
+ * All dipoles are organized into a binary tree of clusters by recursive bisection (at the median) along the longest
+ * dimension of the bounding box. The tree is the same on all processors and is used both for rows (only local dipoles
+ * are relevant) and columns of the interaction matrix. The block structure of the matrix is obtained by the recursive
+ * traversal of unordered pairs of clusters. Blocks of well-separated (admissible) clusters are approximated by low-rank
+ * products sum_k u_k.v_k^T, which are computed once by the adaptive cross approximation (ACA) with partial pivoting
+ * [M. Bebendorf, "Approximation of boundary element matrices," Numer. Math. 86, 565-589 (2000)]. ACA requires only a
+ * few rows and columns of the block, i.e. the number of computed interaction terms is proportional to the rank times
+ * the block size. Admissible blocks, for which ACA does not converge with limited rank, are further subdivided. The
+ * remaining pairs of leaf clusters (near field) are computed directly in each matrix-vector product, exactly as in the
+ * standard sparse mode.
+ *
+ * The interaction matrix is complex-symmetric, which is assumed by some iterative solvers (e.g. QMR_CS). Therefore,
+ * only one block of each mirror pair (r,c) and (c,r) is approximated, and its transpose is used for the other one. This
+ * also halves the storage and the initialization time. In parallel mode a block, whose rows and columns contain local
+ * dipoles of different processors, is computed on both of them. Since ACA is deterministic, the resulting blocks are
+ * identical.
+ *
+ * The same approach is used with surface, since the reflected interaction term is also smooth for well-separated
+ * clusters (the distance to the image dipole is not smaller than that between dipoles themselves). The reflected term
+ * also keeps the matrix complex-symmetric.
+ *
+ * The work is distributed among OpenMP threads by clusters at a certain level of the tree (tasks), which cover disjoint
+ * sets of dipoles. All blocks are further subdivided down to this level, so that each one (or its transpose) is used
+ * only within a single task.
+ *
+ * Copyright (C) ADDA contributors
+ * This file is part of ADDA.
+ *
+ * ADDA is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ADDA is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ADDA. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+/* The following tests for compilation inconsistencies, but also helps proper syntax checking in IDE, such as Eclipse.
+ * Otherwise, a lot of unresolved-symbol errors are produced, when another build configuration is selected.
+ */
+#ifndef SPARSE
+#  error "This file is only for SPARSE mode"
+#  define SPARSE
+#endif
+
+#include "const.h" // keep this first
+#include "hmatrix.h" // corresponding header
+// project headers
+#include "cmplx.h"
+#include "comm.h"
+#include "interaction.h"
+#include "io.h"
+#include "memory.h"
+#include "sparse_ops.h"
+#include "vars.h"
+// system headers
+#include <math.h>
+#include <stdint.h> // for SIZE_MAX
+#include <stdlib.h>
+#ifdef OPENMP
+#	include <omp.h>
+#endif
+
+// SEMI-GLOBAL VARIABLES
+
+// defined and initialized in param.c
+extern const double aca_eps;
+
+// LOCAL VARIABLES
+
+#define HM_LEAF       32  // maximum number of dipoles in a leaf cluster
+#define HM_ETA        1.0 // admissibility parameter: min(diam1,diam2)<=HM_ETA*dist
+#define HM_MAX_RANK   128 // maximum rank of a low-rank block (see also LowRank), otherwise the block is subdivided
+#define HM_CHECK_RANK 8   // rank, starting from which the convergence rate of ACA is used to stop it early
+#define HM_BATCH      64  // number of interaction terms computed by a single call to InterTerm_batch
+#define HM_TASKS      8   // number of tasks (clusters) per OpenMP thread (if enough clusters are available)
+
+typedef struct {
+	size_t start,end;   // range of indices in the permutation array
+	size_t nloc;        // number of local dipoles in the cluster
+	size_t child[2];    // indices of children clusters (both are 0 for a leaf)
+	double lo[3],hi[3]; // bounding box
+} hm_cluster;
+
+typedef struct lr_block_struct {
+	size_t r,c;                   // row and column clusters
+	size_t rank;                  // number of terms in the low-rank approximation
+	doublecomplex **u,**v;        // the approximation is sum_k u[k].v[k]^T (u - column, v - row vectors)
+	struct lr_block_struct *next; // next element in the list
+} lr_block;
+
+typedef struct lr_use_struct {
+	const lr_block *blk;        // low-rank block
+	bool trans;                 // whether the block is used transposed (for the mirror block)
+	struct lr_use_struct *next; // next element in the list
+} lr_use;
+
+typedef struct near_block_struct {
+	size_t r,c;                     // row and column clusters
+	struct near_block_struct *next; // next element in the list
+} near_block;
+
+typedef struct {
+	size_t r;         // cluster, containing all rows of the blocks
+	lr_use *lr;       // list of uses of low-rank blocks
+	near_block *near; // list of near-field blocks
+} hm_task;
+
+typedef struct {
+	size_t r,c;        // pair of clusters at the level of tasks, which is further subdivided into blocks
+	lr_block *blk;     // list of low-rank blocks
+	lr_use *lr;        // list of their uses (once or twice for each block)
+	near_block *near;  // list of near-field blocks
+	double mem;        // memory occupied by all the above
+	/* statistics: numbers of low-rank blocks (each approximating a mirror pair), sum of their ranks, number of
+	 * near-field blocks, numbers of dipole pairs in low-rank and near-field blocks
+	 */
+	double nLR,sumRank,nNear,pairsLR,pairsNear;
+} hm_part;
+
+static hm_cluster *cl;     // tree of clusters of all dipoles
+static size_t *perm;       // permutation of dipoles, so that each cluster is a contiguous range
+static size_t nCl;         // number of clusters in the tree
+static size_t *clTask;     // index of task for each cluster (SIZE_MAX for clusters above the level of tasks)
+static hm_task *tasks;     // array of tasks
+static size_t nTasks;      // number of tasks
+static lr_block *lrBlocks; // list of all low-rank blocks
+
+// components of the full (3x3) matrix in the symmetric storage (6 components)
+static const int symInd[3][3]={{0,1,2},{1,3,4},{2,4,5}};
+// signs of components of the reflected term, corresponding to the full matrix (see ReflProdAdd in sparse_ops.h)
+static const double reflSign[3][3]={{1,1,1},{1,1,1},{-1,-1,1}};
+
+//======================================================================================================================
+
+static void Select(size_t * restrict idx,const int * restrict pos,const int dim,size_t lo,size_t hi,const size_t k)
+/* Reorders idx[lo..hi), so that the k-th element is in its sorted place (by coordinate dim of pos), smaller elements
+ * are before it and larger - after. Uses quickselect with three-way partitioning.
+ */
+{
+	size_t lt,gt,i,tmp;
+	int pivot,key;
+
+	while (hi-lo>1) {
+		pivot=pos[3*idx[lo+(hi-lo)/2]+dim];
+		lt=i=lo;
+		gt=hi;
+		while (i<gt) {
+			key=pos[3*idx[i]+dim];
+			if (key<pivot) {
+				tmp=idx[lt]; idx[lt]=idx[i]; idx[i]=tmp;
+				lt++;
+				i++;
+			}
+			else if (key>pivot) {
+				gt--;
+				tmp=idx[gt]; idx[gt]=idx[i]; idx[i]=tmp;
+			}
+			else i++;
+		}
+		// now [lo,lt) < pivot, [lt,gt) == pivot, [gt,hi) > pivot
+		if (k<lt) hi=lt;
+		else if (k>=gt) lo=gt;
+		else return;
+	}
+}
+
+//======================================================================================================================
+
+static inline bool IsLocal(const size_t j)
+// tests whether dipole j (global index) is local, i.e. corresponds to a row of the interaction matrix
+{
+	return j>=local_nvoid_d0 && j<local_nvoid_d1;
+}
+
+//======================================================================================================================
+
+static size_t BuildTree(const int * restrict pos,const size_t start,const size_t end)
+// builds recursively the tree of clusters for dipoles perm[start..end) (start<end); returns the index of the root
+{
+	const size_t ind=nCl++;
+	size_t k,mid;
+	int d,dim;
+
+	cl[ind].start=start;
+	cl[ind].end=end;
+	cl[ind].child[0]=cl[ind].child[1]=0;
+	for (d=0;d<3;d++) cl[ind].lo[d]=cl[ind].hi[d]=pos[3*perm[start]+d];
+	for (k=start+1;k<end;k++) for (d=0;d<3;d++) {
+		if (pos[3*perm[k]+d]<cl[ind].lo[d]) cl[ind].lo[d]=pos[3*perm[k]+d];
+		if (pos[3*perm[k]+d]>cl[ind].hi[d]) cl[ind].hi[d]=pos[3*perm[k]+d];
+	}
+	if (end-start>HM_LEAF) {
+		dim=0;
+		for (d=1;d<3;d++) if (cl[ind].hi[d]-cl[ind].lo[d]>cl[ind].hi[dim]-cl[ind].lo[dim]) dim=d;
+		mid=start+(end-start)/2;
+		Select(perm,pos,dim,start,end,mid);
+		cl[ind].child[0]=BuildTree(pos,start,mid);
+		cl[ind].child[1]=BuildTree(pos,mid,end);
+		cl[ind].nloc=cl[cl[ind].child[0]].nloc+cl[cl[ind].child[1]].nloc;
+	}
+	else for (k=start,cl[ind].nloc=0;k<end;k++) if (IsLocal(perm[k])) cl[ind].nloc++;
+	return ind;
+}
+
+//======================================================================================================================
+
+static void SetTask(const size_t c,const size_t k)
+// assigns task k to cluster c and all its descendants
+{
+	clTask[c]=k;
+	if (cl[c].child[0]!=0) {
+		SetTask(cl[c].child[0],k);
+		SetTask(cl[c].child[1],k);
+	}
+}
+
+//======================================================================================================================
+
+static bool Admissible(const hm_cluster * restrict a,const hm_cluster * restrict b)
+// tests whether two clusters are well-separated
+{
+	double diamA=0,diamB=0,dist=0,tmp;
+	int d;
+
+	for (d=0;d<3;d++) {
+		diamA+=(a->hi[d]-a->lo[d])*(a->hi[d]-a->lo[d]);
+		diamB+=(b->hi[d]-b->lo[d])*(b->hi[d]-b->lo[d]);
+		tmp=MAX(a->lo[d]-b->hi[d],b->lo[d]-a->hi[d]);
+		if (tmp>0) dist+=tmp*tmp;
+	}
+	return dist>0 && MIN(diamA,diamB)<=HM_ETA*HM_ETA*dist;
+}
+
+//======================================================================================================================
+
+static inline void SetFull(const doublecomplex sym[static NDCOMP],doublecomplex full[static 9])
+// sets the full (3x3, row-major) matrix from the symmetric storage
+{
+	int a,b;
+
+	for (a=0;a<3;a++) for (b=0;b<3;b++) full[3*a+b]=sym[symInd[a][b]];
+}
+
+//======================================================================================================================
+
+static inline void AddRefl(const doublecomplex refl[static NDCOMP],doublecomplex full[static 9])
+// adds the reflected interaction term to the full (3x3, row-major) matrix
+{
+	int a,b;
+
+	for (a=0;a<3;a++) for (b=0;b<3;b++) full[3*a+b]+=reflSign[a][b]*refl[symInd[a][b]];
+}
+
+//======================================================================================================================
+
+static void TensorsRow(const size_t i,const hm_cluster * restrict C,doublecomplex * restrict T)
+/* computes full interaction tensors between dipole i and all dipoles of cluster C (the latter must not include dipole i
+ * itself) and stores them in T (9 components per dipole of C)
+ */
+{
+	int ijk[3*HM_BATCH];
+	doublecomplex iterm[NDCOMP*HM_BATCH];
+	size_t jst,jend,jj,j3,n;
+	const size_t i3=3*i;
+
+	for (jst=C->start;jst<C->end;jst+=HM_BATCH) {
+		jend=MIN(jst+HM_BATCH,C->end);
+		for (n=0,jj=jst;jj<jend;jj++,n++) {
+			j3=3*perm[jj];
+			ijk[3*n]=position_full[i3]-position_full[j3];
+			ijk[3*n+1]=position_full[i3+1]-position_full[j3+1];
+			ijk[3*n+2]=position_full[i3+2]-position_full[j3+2];
+		}
+		(*InterTerm_batch)(ijk,n,iterm);
+		for (n=0,jj=jst;jj<jend;jj++,n++) SetFull(iterm+NDCOMP*n,T+9*(jj-C->start));
+	}
+	if (surface) for (jj=C->start;jj<C->end;jj++) {
+		j3=3*perm[jj];
+		(*ReflTerm_int)(position_full[i3]-position_full[j3],position_full[i3+1]-position_full[j3+1],
+			position_full[i3+2]+position_full[j3+2],iterm);
+		AddRefl(iterm,T+9*(jj-C->start));
+	}
+}
+
+//======================================================================================================================
+
+static void TensorsCol(const hm_cluster * restrict R,const size_t j,doublecomplex * restrict T)
+/* computes full interaction tensors between all dipoles of cluster R and dipole j (the former must not include dipole j
+ * itself) and stores them in T (9 components per dipole of R)
+ */
+{
+	int ijk[3*HM_BATCH];
+	doublecomplex iterm[NDCOMP*HM_BATCH];
+	size_t ist,iend,ii,i3,n;
+	const size_t j3=3*j;
+
+	for (ist=R->start;ist<R->end;ist+=HM_BATCH) {
+		iend=MIN(ist+HM_BATCH,R->end);
+		for (n=0,ii=ist;ii<iend;ii++,n++) {
+			i3=3*perm[ii];
+			ijk[3*n]=position_full[i3]-position_full[j3];
+			ijk[3*n+1]=position_full[i3+1]-position_full[j3+1];
+			ijk[3*n+2]=position_full[i3+2]-position_full[j3+2];
+		}
+		(*InterTerm_batch)(ijk,n,iterm);
+		for (n=0,ii=ist;ii<iend;ii++,n++) SetFull(iterm+NDCOMP*n,T+9*(ii-R->start));
+	}
+	if (surface) for (ii=R->start;ii<R->end;ii++) {
+		i3=3*perm[ii];
+		(*ReflTerm_int)(position_full[i3]-position_full[j3],position_full[i3+1]-position_full[j3+1],
+			position_full[i3+2]+position_full[j3+2],iterm);
+		AddRefl(iterm,T+9*(ii-R->start));
+	}
+}
+
+//======================================================================================================================
+
+static bool LowRank(lr_block * restrict blk,double * restrict mem)
+/* Approximates the block by ACA with partial pivoting up to relative accuracy aca_eps (in the Frobenius norm, estimated
+ * from the norm of the last added term). Returns false, if this requires rank larger than the limit (then nothing is
+ * allocated). The limit ensures that the block is not larger than its full storage, then the (failed) attempt is also not
+ * much more expensive than the direct computation of the block. Memory of the stored vectors is added to mem.
+ */
+{
+	const hm_cluster *R=cl+blk->r,*C=cl+blk->c;
+	const size_t M=3*(R->end-R->start),N=3*(C->end-C->start);
+	// low-rank block should not require more memory than full storage of the block (NDCOMP numbers per pair of dipoles)
+	const size_t kmax=MIN(HM_MAX_RANK,NDCOMP*(M/3)*(N/3)/(M+N));
+	doublecomplex *u[HM_MAX_RANK],*v[HM_MAX_RANK];
+	doublecomplex *Trow,*Tcol; // tensors for the last used row and column dipoles (since pivots often coincide)
+	doublecomplex piv,coef;
+	bool *used;
+	size_t k,l,r,ind,jmax,a,b,rowDip,colDip;
+	double norm2,normU,normV,max,tmp,first,rate;
+	bool conv;
+
+	MALLOC_VECTOR(used,bool,M,ALL);
+	MALLOC_VECTOR(Trow,complex,3*N,ALL);
+	MALLOC_VECTOR(Tcol,complex,3*M,ALL);
+	for (ind=0;ind<M;ind++) used[ind]=false;
+	rowDip=colDip=SIZE_MAX;
+	r=k=0;
+	norm2=first=0;
+	conv=false;
+	while (k<kmax) {
+		MALLOC_VECTOR(v[k],complex,N,ALL);
+		MALLOC_VECTOR(u[k],complex,M,ALL);
+		// residual row r
+		if (r/3!=rowDip) {
+			rowDip=r/3;
+			TensorsRow(perm[R->start+rowDip],C,Trow);
+		}
+		a=r%3;
+		for (ind=0;ind<N;ind++) v[k][ind]=Trow[9*(ind/3)+3*a+ind%3];
+		for (l=0;l<k;l++) {
+			coef=u[l][r];
+			for (ind=0;ind<N;ind++) v[k][ind]-=coef*v[l][ind];
+		}
+		used[r]=true;
+		max=0;
+		jmax=0;
+		for (ind=0;ind<N;ind++) if ((tmp=cAbs2(v[k][ind]))>max) {
+			max=tmp;
+			jmax=ind;
+		}
+		if (max==0) { // the row is already exactly approximated, which is unlikely unless the whole block is zero
+			Free_cVector(v[k]);
+			Free_cVector(u[k]);
+			if (k>0) conv=true;
+			else { // try the next unused row
+				while (r<M && used[r]) r++;
+				if (r==M) conv=true;
+			}
+			if (conv) break;
+			else continue;
+		}
+		piv=v[k][jmax];
+		for (ind=0;ind<N;ind++) v[k][ind]/=piv;
+		// residual column jmax
+		if (jmax/3!=colDip) {
+			colDip=jmax/3;
+			TensorsCol(R,perm[C->start+colDip],Tcol);
+		}
+		b=jmax%3;
+		for (ind=0;ind<M;ind++) u[k][ind]=Tcol[9*(ind/3)+3*(ind%3)+b];
+		for (l=0;l<k;l++) {
+			coef=v[l][jmax];
+			for (ind=0;ind<M;ind++) u[k][ind]-=coef*u[l][ind];
+		}
+		// update of the squared Frobenius norm of the approximation
+		normU=normV=0;
+		for (ind=0;ind<M;ind++) normU+=cAbs2(u[k][ind]);
+		for (ind=0;ind<N;ind++) normV+=cAbs2(v[k][ind]);
+		for (l=0;l<k;l++) {
+			doublecomplex dotU=0,dotV=0;
+			for (ind=0;ind<M;ind++) dotU+=u[k][ind]*conj(u[l][ind]);
+			for (ind=0;ind<N;ind++) dotV+=v[k][ind]*conj(v[l][ind]);
+			norm2+=2*creal(dotU*dotV);
+		}
+		norm2+=normU*normV;
+		k++;
+		if (normU*normV<=aca_eps*aca_eps*norm2) {
+			conv=true;
+			break;
+		}
+		/* Estimate the number of further iterations from the average rate of decrease of the added terms, and stop
+		 * early, if the rank is going to exceed the limit. This is important for large blocks, since the cost of each
+		 * iteration grows with k.
+		 */
+		if (k==1) first=normU*normV;
+		else if (k>=HM_CHECK_RANK) {
+			rate=log(normU*normV/first)/(k-1); // logarithm of the average decrease per iteration
+			if (rate>=0 || k+log(aca_eps*aca_eps*norm2/(normU*normV))/rate>kmax) break;
+		}
+		// next row - the largest element of the last column among the unused rows
+		max=-1;
+		for (ind=0;ind<M;ind++) if (!used[ind] && (tmp=cAbs2(u[k-1][ind]))>max) {
+			max=tmp;
+			r=ind;
+		}
+		if (max<0) { // all rows are used, so the approximation is exact
+			conv=true;
+			break;
+		}
+	}
+	Free_general(used);
+	Free_cVector(Trow);
+	Free_cVector(Tcol);
+	if (!conv) {
+		for (l=0;l<k;l++) {
+			Free_cVector(u[l]);
+			Free_cVector(v[l]);
+		}
+		return false;
+	}
+	blk->rank=k;
+	MALLOC_VECTOR(blk->u,void,k*sizeof(doublecomplex *),ALL);
+	MALLOC_VECTOR(blk->v,void,k*sizeof(doublecomplex *),ALL);
+	for (l=0;l<k;l++) {
+		blk->u[l]=u[l];
+		blk->v[l]=v[l];
+	}
+	(*mem)+=k*((M+N)*sizeof(doublecomplex)+2*sizeof(doublecomplex *));
+	return true;
+}
+
+//======================================================================================================================
+
+static void AddNear(hm_part * restrict p,const size_t r,const size_t c)
+// adds near-field block (r,c) to the list, if its rows contain local dipoles
+{
+	near_block *blk;
+
+	if (cl[r].nloc==0) return;
+	MALLOC_VECTOR(blk,void,sizeof(near_block),ALL);
+	blk->r=r;
+	blk->c=c;
+	blk->next=p->near;
+	p->near=blk;
+	p->mem+=sizeof(near_block);
+}
+
+//======================================================================================================================
+
+static void AddUse(hm_part * restrict p,const lr_block * restrict blk,const bool trans)
+// adds the use of low-rank block (transposed or not) to the list, if the corresponding rows contain local dipoles
+{
+	lr_use *use;
+
+	if (cl[trans ? blk->c : blk->r].nloc==0) return;
+	MALLOC_VECTOR(use,void,sizeof(lr_use),ALL);
+	use->blk=blk;
+	use->trans=trans;
+	use->next=p->lr;
+	p->lr=use;
+	p->mem+=sizeof(lr_use);
+}
+
+//======================================================================================================================
+
+static void BuildBlocks(hm_part * restrict p,const size_t r,const size_t c)
+/* recursively splits the mirror pair of blocks of clusters (r,c) and (c,r) into low-rank and near-field blocks, adding
+ * them to the lists in p; for r==c this is a single diagonal block. The statistics is accumulated only by the processor
+ * containing the first dipole of cluster r, so that each block is counted once.
+ */
+{
+	const hm_cluster *R=cl+r,*C=cl+c;
+	const double pairs=(double)(R->end-R->start)*(C->end-C->start);
+	const bool leafR=(R->child[0]==0),leafC=(C->child[0]==0);
+	const bool own=IsLocal(perm[R->start]);
+
+	if (R->nloc==0 && C->nloc==0) return;
+	if (r!=c && Admissible(R,C)) {
+		lr_block *blk;
+		MALLOC_VECTOR(blk,void,sizeof(lr_block),ALL);
+		blk->r=r;
+		blk->c=c;
+		if (LowRank(blk,&(p->mem))) {
+			blk->next=p->blk;
+			p->blk=blk;
+			p->mem+=sizeof(lr_block);
+			AddUse(p,blk,false);
+			AddUse(p,blk,true);
+			if (own) {
+				p->nLR++;
+				p->sumRank+=blk->rank;
+				p->pairsLR+=2*pairs;
+			}
+			return;
+		}
+		Free_general(blk);
+	}
+	if (leafR && leafC) {
+		AddNear(p,r,c);
+		if (r!=c) AddNear(p,c,r);
+		if (own) {
+			p->nNear+=(r==c) ? 1 : 2;
+			p->pairsNear+=(r==c) ? pairs : 2*pairs;
+		}
+	}
+	else if (r==c) {
+		BuildBlocks(p,R->child[0],R->child[0]);
+		BuildBlocks(p,R->child[0],R->child[1]);
+		BuildBlocks(p,R->child[1],R->child[1]);
+	}
+	else if (leafR) {
+		BuildBlocks(p,r,C->child[0]);
+		BuildBlocks(p,r,C->child[1]);
+	}
+	else if (leafC) {
+		BuildBlocks(p,R->child[0],c);
+		BuildBlocks(p,R->child[1],c);
+	}
+	else {
+		BuildBlocks(p,R->child[0],C->child[0]);
+		BuildBlocks(p,R->child[0],C->child[1]);
+		BuildBlocks(p,R->child[1],C->child[0]);
+		BuildBlocks(p,R->child[1],C->child[1]);
+	}
+}
+
+//======================================================================================================================
+
+static size_t RootPairs(const size_t r,const size_t c,hm_part * restrict parts,size_t n)
+/* recursively splits the mirror pair of blocks of clusters (r,c) and (c,r) down to the level of tasks (as in
+ * BuildBlocks, but without low-rank approximation). Resulting pairs of clusters are stored in parts (if not NULL)
+ * starting from index n; returns the updated number of pairs.
+ */
+{
+	const bool splitR=(clTask[r]==SIZE_MAX),splitC=(clTask[c]==SIZE_MAX);
+	int a,b;
+
+	if (cl[r].nloc==0 && cl[c].nloc==0) return n;
+	if (!splitR && !splitC) {
+		if (parts!=NULL) {
+			parts[n].r=r;
+			parts[n].c=c;
+		}
+		return n+1;
+	}
+	if (r==c) { // then both are split
+		n=RootPairs(cl[r].child[0],cl[r].child[0],parts,n);
+		n=RootPairs(cl[r].child[0],cl[r].child[1],parts,n);
+		n=RootPairs(cl[r].child[1],cl[r].child[1],parts,n);
+	}
+	else for (a=0;a<=splitR;a++) for (b=0;b<=splitC;b++)
+		n=RootPairs(splitR ? cl[r].child[a] : r,splitC ? cl[c].child[b] : c,parts,n);
+	return n;
+}
+
+//======================================================================================================================
+
+double InitHmatrix(void)
+/* builds the tree of clusters and the hierarchical matrix (including computation of all low-rank blocks); prints
+ * statistics to the log, and returns the memory (in bytes) used on this processor
+ */
+{
+	size_t k,n,nNew,nParts;
+	size_t *list,*listNew;
+	hm_part *parts;
+	double mem,nthr;
+	double stat[5]; // sum over parts (and processors) of the statistics in hm_part
+
+	nthr=1;
+#ifdef OPENMP
+	nthr=omp_get_max_threads();
+#endif
+	// the level of tasks should be the same on all processors, so it is determined by the total number of threads
+	MyInnerProduct(&nthr,double_type,1,NULL);
+	// tree
+	MALLOC_VECTOR(perm,sizet,nvoid_Ndip,ALL);
+	MALLOC_VECTOR(cl,void,(4*nvoid_Ndip/HM_LEAF+1)*sizeof(hm_cluster),ALL);
+	for (k=0;k<nvoid_Ndip;k++) perm[k]=k;
+	nCl=0;
+	BuildTree(position_full,0,nvoid_Ndip);
+	mem=nvoid_Ndip*sizeof(size_t)+nCl*sizeof(hm_cluster);
+	// tasks - clusters obtained by descending the tree, until there are enough of them
+	MALLOC_VECTOR(list,sizet,nCl,ALL);
+	MALLOC_VECTOR(listNew,sizet,nCl,ALL);
+	list[0]=0;
+	n=1;
+	while (n<HM_TASKS*nthr) {
+		for (k=nNew=0;k<n;k++) {
+			if (cl[list[k]].child[0]==0) listNew[nNew++]=list[k];
+			else {
+				listNew[nNew++]=cl[list[k]].child[0];
+				listNew[nNew++]=cl[list[k]].child[1];
+			}
+		}
+		if (nNew==n) break; // all are leaves
+		n=nNew;
+		for (k=0;k<n;k++) list[k]=listNew[k];
+	}
+	nTasks=n;
+	MALLOC_VECTOR(tasks,void,nTasks*sizeof(hm_task),ALL);
+	MALLOC_VECTOR(clTask,sizet,nCl,ALL);
+	for (k=0;k<nCl;k++) clTask[k]=SIZE_MAX;
+	for (k=0;k<nTasks;k++) {
+		tasks[k].r=list[k];
+		tasks[k].lr=NULL;
+		tasks[k].near=NULL;
+		SetTask(list[k],k);
+	}
+	Free_general(list);
+	Free_general(listNew);
+	mem+=nTasks*sizeof(hm_task);
+	// blocks are built independently for pairs of clusters at the level of tasks
+	nParts=RootPairs(0,0,NULL,0);
+	parts=NULL;
+	if (nParts>0) {
+		MALLOC_VECTOR(parts,void,nParts*sizeof(hm_part),ALL);
+		RootPairs(0,0,parts,0);
+	}
+	for (k=0;k<nParts;k++) {
+		parts[k].blk=NULL;
+		parts[k].lr=NULL;
+		parts[k].near=NULL;
+		parts[k].mem=parts[k].nLR=parts[k].sumRank=parts[k].nNear=parts[k].pairsLR=parts[k].pairsNear=0;
+	}
+#ifdef OPENMP
+#	pragma omp parallel for schedule(dynamic)
+#endif
+	for (k=0;k<nParts;k++) BuildBlocks(parts+k,parts[k].r,parts[k].c);
+	// blocks are moved to the lists of tasks, containing their rows
+	lrBlocks=NULL;
+	for (n=0;n<5;n++) stat[n]=0;
+	for (k=0;k<nParts;k++) {
+		hm_part *p=parts+k;
+		lr_block *lb;
+		lr_use *lu;
+		near_block *nb;
+		hm_task *t;
+
+		while ((lb=p->blk)!=NULL) {
+			p->blk=lb->next;
+			lb->next=lrBlocks;
+			lrBlocks=lb;
+		}
+		while ((lu=p->lr)!=NULL) {
+			p->lr=lu->next;
+			t=tasks+clTask[lu->trans ? lu->blk->c : lu->blk->r];
+			lu->next=t->lr;
+			t->lr=lu;
+		}
+		while ((nb=p->near)!=NULL) {
+			p->near=nb->next;
+			t=tasks+clTask[nb->r];
+			nb->next=t->near;
+			t->near=nb;
+		}
+		mem+=p->mem;
+		stat[0]+=p->nLR;
+		stat[1]+=p->sumRank;
+		stat[2]+=p->nNear;
+		stat[3]+=p->pairsLR;
+		stat[4]+=p->pairsNear;
+	}
+	Free_general(parts);
+	Free_general(clTask);
+	MyInnerProduct(stat,double_type,5,NULL);
+	if (IFROOT) PrintBoth(logfile,"Hierarchical matrix: %.0f low-rank blocks, each also used transposed (average rank "
+		"%.1f, %.1f%% of dipole pairs), %.0f near-field blocks\n",stat[0],(stat[0]==0) ? 0 : stat[1]/stat[0],
+		100*stat[3]/(stat[3]+stat[4]),stat[2]);
+	return mem;
+}
+
+//======================================================================================================================
+
+static void NearProd(const near_block * restrict blk,const doublecomplex * restrict argvec,
+	doublecomplex * restrict resultvec)
+// adds the product of the near-field block by argvec (for all dipoles) to resultvec; interaction terms are computed
+{
+	const hm_cluster *R=cl+blk->r,*C=cl+blk->c;
+	int ijk[3*HM_BATCH];
+	size_t jb[HM_BATCH];
+	doublecomplex iterm[NDCOMP*HM_BATCH];
+	size_t ii,i,i3,jst,jend,jj,j3,n,m;
+	doublecomplex *y;
+
+	for (ii=R->start;ii<R->end;ii++) {
+		i=perm[ii];
+		if (!IsLocal(i)) continue;
+		i3=3*i;
+		y=resultvec+3*(i-local_nvoid_d0);
+		for (jst=C->start;jst<C->end;jst+=HM_BATCH) {
+			jend=MIN(jst+HM_BATCH,C->end);
+			for (n=0,jj=jst;jj<jend;jj++) if (perm[jj]!=i) { // main interaction is not computed for self
+				j3=3*perm[jj];
+				ijk[3*n]=position_full[i3]-position_full[j3];
+				ijk[3*n+1]=position_full[i3+1]-position_full[j3+1];
+				ijk[3*n+2]=position_full[i3+2]-position_full[j3+2];
+				jb[n++]=j3;
+			}
+			(*InterTerm_batch)(ijk,n,iterm);
+			for (m=0;m<n;m++) SymProdAdd(iterm+NDCOMP*m,argvec+jb[m],y);
+		}
+		if (surface) for (jj=C->start;jj<C->end;jj++) { // surface interaction is computed always
+			j3=3*perm[jj];
+			(*ReflTerm_int)(position_full[i3]-position_full[j3],position_full[i3+1]-position_full[j3+1],
+				position_full[i3+2]+position_full[j3+2],iterm);
+			ReflProdAdd(iterm,argvec+j3,y);
+		}
+	}
+}
+
+//======================================================================================================================
+
+static void LowRankProd(const lr_use * restrict use,const doublecomplex * restrict argvec,
+	doublecomplex * restrict resultvec)
+// adds the product of the low-rank block (or its transpose) by argvec (for all dipoles) to resultvec
+{
+	const lr_block *blk=use->blk;
+	// for the transposed block, clusters and vectors (u and v) of rows and columns are interchanged
+	const hm_cluster *R=cl+(use->trans ? blk->c : blk->r),*C=cl+(use->trans ? blk->r : blk->c);
+	doublecomplex * const *rowVec=use->trans ? blk->v : blk->u;
+	doublecomplex * const *colVec=use->trans ? blk->u : blk->v;
+	const size_t m=R->end-R->start,n=C->end-C->start;
+	size_t l,ii,i,jj;
+	doublecomplex sum;
+	const doublecomplex *x,*vl,*ul;
+	doublecomplex *y;
+
+	for (l=0;l<blk->rank;l++) {
+		vl=colVec[l];
+		sum=0;
+		for (jj=0;jj<n;jj++) {
+			x=argvec+3*perm[C->start+jj];
+			sum+=vl[3*jj]*x[0]+vl[3*jj+1]*x[1]+vl[3*jj+2]*x[2];
+		}
+		ul=rowVec[l];
+		for (ii=0;ii<m;ii++) {
+			i=perm[R->start+ii];
+			if (!IsLocal(i)) continue;
+			y=resultvec+3*(i-local_nvoid_d0);
+			y[0]+=sum*ul[3*ii];
+			y[1]+=sum*ul[3*ii+1];
+			y[2]+=sum*ul[3*ii+2];
+		}
+	}
+}
+
+//======================================================================================================================
+
+void HmatrixProd(const doublecomplex * restrict argvec,doublecomplex * restrict resultvec)
+/* computes the product of the interaction matrix (without the diagonal part) by argvec (for all dipoles) and stores it
+ * in resultvec (for local dipoles)
+ */
+{
+	size_t k;
+
+#ifdef OPENMP
+#	pragma omp parallel for schedule(dynamic)
+#endif
+	for (k=0;k<nTasks;k++) {
+		const hm_cluster *R=cl+tasks[k].r;
+		const near_block *nb;
+		const lr_use *lu;
+		size_t ii;
+
+		if (R->nloc==0) continue;
+		for (ii=R->start;ii<R->end;ii++) if (IsLocal(perm[ii])) cvInit(resultvec+3*(perm[ii]-local_nvoid_d0));
+		for (nb=tasks[k].near;nb!=NULL;nb=nb->next) NearProd(nb,argvec,resultvec);
+		for (lu=tasks[k].lr;lu!=NULL;lu=lu->next) LowRankProd(lu,argvec,resultvec);
+	}
+}
+
+//======================================================================================================================
+
+void FreeHmatrix(void)
+// frees all memory used by the hierarchical matrix
+{
+	size_t k,l;
+	lr_block *lb;
+	lr_use *lu;
+	near_block *nb;
+
+	while ((lb=lrBlocks)!=NULL) {
+		lrBlocks=lb->next;
+		for (l=0;l<lb->rank;l++) {
+			Free_cVector(lb->u[l]);
+			Free_cVector(lb->v[l]);
+		}
+		Free_general(lb->u);
+		Free_general(lb->v);
+		Free_general(lb);
+	}
+	for (k=0;k<nTasks;k++) {
+		while ((lu=tasks[k].lr)!=NULL) {
+			tasks[k].lr=lu->next;
+			Free_general(lu);
+		}
+		while ((nb=tasks[k].near)!=NULL) {
+			tasks[k].near=nb->next;
+			Free_general(nb);
+		}
+	}
+	Free_general(tasks);
+	Free_general(cl);
+	Free_general(perm);
+	tasks=NULL;
+	nTasks=0;
+}
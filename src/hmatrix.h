@@ -0,0 +1,29 @@
+/* Definitions of the hierarchical matrix for sparse mode
+ *
+ * Copyright (C) ADDA contributors
+ * This file is part of ADDA.
+ *
+ * ADDA is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+ *
+ * ADDA is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with ADDA. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+#ifdef SPARSE
+
+#ifndef __hmatrix_h
+#define __hmatrix_h
+
+// project headers
+#include "types.h" // for doublecomplex
+
+double InitHmatrix(void);
+void HmatrixProd(const doublecomplex * restrict argvec,doublecomplex * restrict resultvec);
+void FreeHmatrix(void);
+
+#endif // __hmatrix_h
+
+#endif // SPARSE
@@ -24,7 +24,11 @@
 #include "vars.h"
 // system headers
 #include <float.h> // for DBL_EPSILON
+#include <stdint.h> // for uint64_t and SIZE_MAX
 #include <stdlib.h>
+#ifdef OPENMP
+#	include <omp.h>
+#endif
 
 // GLOBAL VARIABLES
 
@@ -36,6 +40,11 @@
 void (*InterTerm_int)(const int i,const int j,const int k,doublecomplex result[static restrict 6]);
 // same as above, but distance is passed as a double vector (in um)
 void (*InterTerm_real)(const double qvec[static restrict 3],doublecomplex result[static restrict 6]);
+/* same as InterTerm_int, but for a batch of n distance vectors given by array ijk (of size 3n) as {i,j,k} for each
+ * vector. The results are stored consecutively in result (of size 6n). Zero distance vectors are not allowed. It is
+ * designed for loops over many distance vectors (like in InitDmatrix), so that the implementation can be vectorized.
+ */
+void (*InterTerm_batch)(const int * restrict ijk,const size_t n,doublecomplex * restrict result);
 /* Calculates reflection term between two dipoles; given integer distance vector {i,j,k} (in units of d). k is the _sum_
  * of dipole indices along z with respect to the center of bottom dipoles of the particle. Bottom is considered for the
  * current processor (position) and the whole particle (position_full) in FFT and SPARSE modes respectively. The latter
@@ -58,7 +67,8 @@ void (*ReflTerm_real)(const double qvec[static restrict 3],doublecomplex result[
 // defined and initialized in make_particle.c
 extern const double ZsumShift;
 // defined and initialized in param.c
-extern const double igt_lim,igt_eps,nloc_Rp;
+extern const double igt_lim,igt_eps,nloc_Rp,som_eps;
+extern const char *igt_cache;
 // extern const bool InteractionRealArgs;
 
 // used in fft.c
@@ -75,10 +85,30 @@ int local_Nz_Rm; // number of local layers in Rmatrix, not greater than 2*boxZ-1
 // KroneckerDelta[mu,nu] - can serve both as multiplier, and as bool
 static const double dmunu[6] = {1.0, 0.0, 0.0, 1.0, 0.0, 1.0};
 static doublecomplex surfRCn; // reflection coefficient for normal incidence
-static bool XlessY; // whether boxX is not larger than boxY (used for SomTable)
 static doublecomplex * restrict somTable; // table of Sommerfeld integrals
+#ifdef SPARSE
+/* In sparse mode somTable contains values only for pairs (z,rho) occurring in the particle, specified by keys
+ * k*somNr2+(i^2+j^2), where k is the sum of z-indices of two dipoles and i,j are differences of their x- and y-indices.
+ * The table is the same on all processors, so it is stored once per node (see SharedVector).
+ */
+static size_t somNr2; // number of possible values of i^2+j^2
+static size_t somNkeys; // number of keys (and entries in somTable)
+static size_t * restrict somKeys; // sorted array of keys
+static size_t * restrict somHash; // open-addressing hash table of indices in somKeys (SIZE_MAX marks empty slots)
+static int somHashBits; // binary logarithm of size of somHash
+#else
+static bool XlessY; // whether boxX is not larger than boxY (used for SomTable)
 static size_t * restrict somIndex; // array for indexing somTable (in the xy-plane)
+#endif
 
+/* table of radial coefficients {Q,D} for all squared integer distances 0<n<radN (in units of squared dipole size), see
+ * RadialTable_int; NULL if not used
+ */
+static doublecomplex * restrict radTable;
+static size_t radN;
+static double * restrict gaussTable; // table of AverageGaussCube for integer coordinates 0<=i<gaussN (for nloc_av)
+static int gaussN;
+#define RAD_TABLE_MAX ((size_t)1<<21) // maximum size of radTable (64 MB)
 #ifdef USE_SSE3
 static __m128d c1, c2, c3, zo, inv_2pi, p360, prad_to_deg;
 static __m128d exptbl[361];
@@ -88,9 +118,29 @@ static __m128d exptbl[361];
 
 #ifndef NO_FORTRAN
 static double igtLimR2; // IGT distance threshold squared
+/* table of IGT values (6 values for each vector) for non-negative integer distance vectors {i,j,k}, which are actually
+ * required - by the local part of Dmatrix in FFT mode (then the table is freed right after InitDmatrix) or by pairs of
+ * dipoles in sparse mode. The vectors are specified by sorted keys (k*boxY+j)*boxX+i, which are found using the hash
+ * table. In sparse mode the table is the same on all processors, so it is stored once per node (see SharedVector).
+ */
+static doublecomplex * restrict igtTable; // NULL if not used
+static size_t igtNkeys; // number of keys (and entries in igtTable)
+static size_t * restrict igtKeys; // sorted array of keys
+static size_t * restrict igtHash; // hash table of indices in igtKeys
+static int igtHashBits; // binary logarithm of size of igtHash
+static double igtMem; // memory occupied by the table (in bytes)
+/* size of working array for dcuhre; it should be at least MAXSUB*(2*NDIM+2*NF+2)+17*NF+1=126189 for the parameters
+ * used in propaesplibreintadda.f (MAXCLS=10^6, KEY=0, NDIM=3, NF=12), see dcuhre.f
+ */
+#define IGT_NW 130000
+static double * restrict igtWork; // working arrays for dcuhre, IGT_NW doubles for each OpenMP thread
+// IGT cache file (see OpenIgtCache): sizes of header and of a single record (in bytes)
+#define IGT_HEAD_SIZE (sizeof(IGT_CACHE_MAGIC)+4*sizeof(double)+sizeof(uint64_t))
+#define IGT_REC_SIZE (3*sizeof(int)+6*sizeof(doublecomplex))
+#define IGT_CHUNK 16384 // number of records read or written at once
 // fort/propaesplibreintadda.f
 void propaespacelibreintadda_(const double *Rij,const double *ka,const double *gridspacex,const double *gridspacey,
-	const double *gridspacez,const double *relreq,double *result,int *ifail);
+	const double *gridspacez,const double *relreq,double *result,int *ifail,double *work,const int *nw);
 #endif
 // sinint.c
 void cisi(double x,double *ci,double *si);
@@ -143,9 +193,16 @@ void name##_real(const double qvec_in[static restrict 3],doublecomplex result[st
 	vCopy(qvec_in,qvec); \
 	func(qvec,result,arg); }
 
+// wrapper for <name> (direct interaction), based on a batch of integer inputs; arguments are described in .h file
+# define BATCH_WRAPPER(name) \
+void name##_batch(const int * restrict ijk,const size_t n,doublecomplex * restrict result) { \
+	size_t l; \
+	for (l=0;l<n;l++) name##_int(ijk[3*l],ijk[3*l+1],ijk[3*l+2],result+6*l); }
+
 // aggregate defines
-#define WRAPPERS_INTER(name) INT_WRAPPER_INTER(name) REAL_WRAPPER(name)
-#define WRAPPERS_INTER_3(name,func,arg) INT_WRAPPER_INTER_3(name,func,arg) REAL_WRAPPER_3(name,func,arg)
+#define WRAPPERS_INTER(name) INT_WRAPPER_INTER(name) REAL_WRAPPER(name) BATCH_WRAPPER(name)
+#define WRAPPERS_INTER_3(name,func,arg) INT_WRAPPER_INTER_3(name,func,arg) REAL_WRAPPER_3(name,func,arg) \
+	BATCH_WRAPPER(name)
 #define WRAPPERS_REFL(name) INT_WRAPPER_REFL(name) REAL_WRAPPER(name)
 
 /* this macro defines a void (error generating) real-input wrapper for Green's tensor formulations, which are, for
@@ -371,7 +428,169 @@ static inline void InterTerm_poi(double qvec[static 3],doublecomplex result[stat
 	PRINT_GVAL;
 }
 
-WRAPPERS_INTER(InterTerm_poi)
+INT_WRAPPER_INTER(InterTerm_poi)
+REAL_WRAPPER(InterTerm_poi)
+
+//=====================================================================================================================
+
+#define POI_BATCH 64 // size of internal blocks in InterTerm_poi_batch, sufficient for vectorization
+
+void InterTerm_poi_batch(const int * restrict ijk,const size_t n,doublecomplex * restrict result)
+/* same as InterTerm_poi, but for a batch of integer inputs (arguments are described in .h file). The calculation in
+ * each block is split into two loops. The first one computes all scalar radial coefficients (including sqrt and
+ * sin/cos) and is written to be vectorized by compiler (e.g. with -Ofast, gcc uses vector math library from glibc,
+ * including AVX2 or AVX-512 variants, if corresponding -march is specified). The second one assembles the tensors.
+ */
+{
+	double x[POI_BATCH],y[POI_BATCH],z[POI_BATCH],Qre[POI_BATCH],Qim[POI_BATCH],Dre[POI_BATCH],Dim[POI_BATCH];
+	size_t s,l,m;
+	doublecomplex Q,D,*res;
+
+	for (s=0;s<n;s+=POI_BATCH) {
+		m=MIN(POI_BATCH,n-s);
+		for (l=0;l<m;l++) {
+			const double xl=ijk[3*(s+l)]*dsX;
+			const double yl=ijk[3*(s+l)+1]*dsY;
+			const double zl=ijk[3*(s+l)+2]*dsZ;
+			const double r2=xl*xl+yl*yl+zl*zl;
+			const double rr=sqrt(r2);
+			const double kr=WaveNum*rr;
+			const double kr2=kr*kr;
+			const double invr3=1/(r2*rr);
+			// {c,sn}=exp(ikr)/r^3; t1,t2,t3 are the same as in InterTerm_core
+			const double c=cos(kr)*invr3, sn=sin(kr)*invr3;
+			const double t1=3-kr2, t2=-3*kr, t3=kr2-1;
+			// coefficient Q is additionally divided by r^2 to be used with non-normalized qmunu
+			Qre[l]=(t1*c-t2*sn)/r2;
+			Qim[l]=(t1*sn+t2*c)/r2;
+			Dre[l]=t3*c-kr*sn;
+			Dim[l]=t3*sn+kr*c;
+			x[l]=xl;
+			y[l]=yl;
+			z[l]=zl;
+		}
+		for (l=0;l<m;l++) {
+			Q=Qre[l]+I*Qim[l];
+			D=Dre[l]+I*Dim[l];
+			res=result+6*(s+l);
+			res[0]=Q*(x[l]*x[l])+D;
+			res[1]=Q*(x[l]*y[l]);
+			res[2]=Q*(x[l]*z[l]);
+			res[3]=Q*(y[l]*y[l])+D;
+			res[4]=Q*(y[l]*z[l]);
+			res[5]=Q*(z[l]*z[l])+D;
+		}
+	}
+}
+#undef POI_BATCH
+
+//=====================================================================================================================
+/* The following functions implement radial tables for formulations of the interaction term (for cubical dipoles),
+ * which can be expressed as G=Q(R)*(RR/R^2)+D(R)*I, i.e. the tensor structure is given by the unit vector along R and
+ * all the expensive computations (like special functions) are contained in scalar functions Q and D. For integer input
+ * the squared distance n=i^2+j^2+k^2 (in units of squared dipole size) is also an integer, so these functions are
+ * tabulated once for all n up to the maximum value in the computational box. This is exact (no interpolation error),
+ * while the number of values is about 3*box^2, i.e. much smaller than the number of calls of the int functions (about
+ * 8*box^3 in InitDmatrix and even larger in sparse mode). The table is limited by RAD_TABLE_MAX, larger distances are
+ * computed directly.
+ *
+ * Each formulation provides function RadialTerms_<name>(rr,QD) computing QD[0]=Q and QD[1]=D for distance rr, which is
+ * used both for tabulation and for real input. Then RADIAL_WRAPPER(name) produces the int-input function.
+ */
+
+static inline void RadialAssemble(const double qmunu[static 6],const doublecomplex QD[static 2],
+	doublecomplex result[static 6])
+// computes Green's tensor from radial coefficients QD and normalized outer-product qmunu
+{
+	int comp;
+
+	for (comp=0;comp<NDCOMP;comp++) {
+		result[comp]=QD[0]*qmunu[comp];
+		if (dmunu[comp]) result[comp]+=QD[1];
+	}
+}
+
+//=====================================================================================================================
+
+static inline bool RadialTable_int(const int i,const int j,const int k,doublecomplex result[static 6])
+/* computes Green's tensor for integer input (in units of dipole size) using radTable, returns false if the distance is
+ * outside the table (or zero), then result is not changed
+ */
+{
+	double qmunu[6],invn;
+	const size_t n=(size_t)i*i+(size_t)j*j+(size_t)k*k;
+
+	if (n==0 || n>=radN) return false;
+	invn=1.0/n;
+	qmunu[0]=i*i*invn;
+	qmunu[1]=i*j*invn;
+	qmunu[2]=i*k*invn;
+	qmunu[3]=j*j*invn;
+	qmunu[4]=j*k*invn;
+	qmunu[5]=k*k*invn;
+	RadialAssemble(qmunu,radTable+2*n,result);
+	return true;
+}
+
+// wrapper for <name> (direct interaction) using radTable, when possible; arguments are described in .h file
+# define RADIAL_WRAPPER(name) \
+void name##_int(const int i,const int j,const int k,doublecomplex result[static restrict 6]) { \
+	double qvec[3]; \
+	if (RadialTable_int(i,j,k,result)) return; \
+	UnitsGridToCoord(i,j,k,qvec); \
+	name(qvec,result); }
+
+// same as above, but calling function is different from name and accepts additional argument
+# define RADIAL_WRAPPER_3(name,func,arg) \
+void name##_int(const int i,const int j,const int k,doublecomplex result[static restrict 6]) { \
+	double qvec[3]; \
+	if (RadialTable_int(i,j,k,result)) return; \
+	UnitsGridToCoord(i,j,k,qvec); \
+	func(qvec,result,arg); }
+
+//=====================================================================================================================
+
+static inline void RadialTerms_poi(const double kr,const double kr2,const double invr3,doublecomplex QD[static 2])
+// radial coefficients for the point-dipole interaction (see InterTerm_core for the same in another form)
+{
+	const doublecomplex expval=invr3*accImExp(kr);
+
+	QD[0]=((3-kr2)-I*3*kr)*expval;
+	QD[1]=((kr2-1)+I*kr)*expval;
+}
+
+//=====================================================================================================================
+
+static void RadialTerms_fcd(const double rr,doublecomplex QD[static 2])
+/* radial coefficients for FCD, rr is the distance. See InterTerm_fcd for details
+ *
+ * It uses the routine to compute sine and cosine integrals (cisi), which is the most time-consuming part. So such
+ * calculations for integer input are performed only once using radTable.
+ */
+{
+	double kr,kr2,invr3,temp,kfr,ci,si,ci1,si1,ci2,si2,g0,g2;
+	doublecomplex expval,eikfr; // exp(ikR)/|R|^3, exp(i*k_F*R)
+
+	kr=WaveNum*rr;
+	kr2=kr*kr;
+	invr3=1/(rr*rr*rr);
+	RadialTerms_poi(kr,kr2,invr3,QD);
+	expval=invr3*accImExp(kr);
+	kfr=PI*rr/gridspace; // k_F*r, for FCD
+	eikfr=accImExp(kfr);
+	// ci,si_1,2 = ci,si_+,- = Ci,Si((k_F +,- k)r)
+	cisi(kfr+kr,&ci1,&si1);
+	cisi(kfr-kr,&ci2,&si2);
+	// ci=ci1-ci2; si=pi-si1-si2
+	ci=ci1-ci2;
+	si=PI-si1-si2;
+	g0=INV_PI*(cimag(expval)*ci+creal(expval)*si);
+	g2=INV_PI*(kr*(creal(expval)*ci-cimag(expval)*si)+2*ONE_THIRD*invr3*(kfr*creal(eikfr)-4*cimag(eikfr)))-g0;
+	temp=g0*kr2;
+	// brd=(delta[mu,nu]*(-g0*kr^2-g2)+qmunu*(g0*kr^2+3g2))/r^3; only the real part of the Green's tensor is corrected
+	QD[0]+=temp+3*g2;
+	QD[1]-=temp+g2;
+}
 
 //=====================================================================================================================
 
@@ -384,51 +603,52 @@ static inline void InterTerm_fcd(double qvec[static 3],doublecomplex result[stat
  * Piller N.B. "Increasing the performance of the coupled-dipole approximation: A spectral approach",
  * IEEE Trans.Ant.Propag. 46(8): 1126-1137. Here it differs by a factor of 4*pi*k^2.
  *
- * speed of FCD can be improved by using faster version of sici routine, using predefined tables, etc (e.g. as is
- * done in GSL library). But currently extra time for this computation is already smaller than one main iteration.
+ * The radial part is computed by RadialTerms_fcd (and tabulated for integer input)
  */
 // If needed, it can be updated to work fine for qvec==0
 {
-	// standard variable definitions used for functions InterParams and InterTerm_core
+	// standard variable definitions used for functions InterParams
 	double qmunu[6]; // normalized outer-product {qxx,qxy,qxz,qyy,qyz,qzz}
 	double rr,invr3,kr,kr2; // |R|, |R|^-3, kR, (kR)^2
-	doublecomplex expval; // exp(ikR)/|R|^3
 
-	double temp,kfr,ci,si,ci1,si1,ci2,si2,brd,g0,g2;
+	doublecomplex QD[2];
 	int comp;
-	doublecomplex eikfr; // exp(i*k_F*R)
 	// next line should never happen
 	if (rectDip) LogError(ONE_POS,"Incompatibility error in InterTerm_fcd");
 
 	InterParams(qvec,qmunu,&rr,&invr3,&kr,&kr2);
-	InterTerm_core(kr,kr2,invr3,qmunu,&expval,result);
-
-	kfr=PI*rr/gridspace; // k_F*r, for FCD
-	eikfr=accImExp(kfr);
-
-	// ci,si_1,2 = ci,si_+,- = Ci,Si((k_F +,- k)r)
-	cisi(kfr+kr,&ci1,&si1);
-	cisi(kfr-kr,&ci2,&si2);
-	// ci=ci1-ci2; si=pi-si1-si2
-	ci=ci1-ci2;
-	si=PI-si1-si2;
-	g0=INV_PI*(cimag(expval)*ci+creal(expval)*si);
-	g2=INV_PI*(kr*(creal(expval)*ci-cimag(expval)*si)+2*ONE_THIRD*invr3*(kfr*creal(eikfr)-4*cimag(eikfr)))-g0;
-	temp=g0*kr2;
-	for (comp=0;comp<NDCOMP;comp++) {
-		// brd=(delta[mu,nu]*(-g0*kr^2-g2)+qmunu*(g0*kr^2+3g2))/r^3
-		brd=qmunu[comp]*(temp+3*g2);
-		if (dmunu[comp]) brd-=temp+g2;
-		// result=Gp+brd; only the real part of the Green's tensor is corrected
-		result[comp]+=brd;
-	}
-	// the following won't be needed if the singular (L) term is also filtered (so-called, improved FCD)
+	RadialTerms_fcd(rr,QD);
+	RadialAssemble(qmunu,QD,result);
+	/* the following won't be needed if the singular (L) term is also filtered (so-called, improved FCD); it is always
+	 * zero for non-zero integer input
+	 */
 	double w=InsideCube(qvec,rr/gridspace);
 	if (w!=0) for (comp=0;comp<NDCOMP;comp++) if (dmunu[comp]) result[comp]-=w*FOUR_PI_OVER_THREE/dipvol;
 	PRINT_GVAL;
 }
 
-WRAPPERS_INTER(InterTerm_fcd)
+RADIAL_WRAPPER(InterTerm_fcd)
+REAL_WRAPPER(InterTerm_fcd)
+BATCH_WRAPPER(InterTerm_fcd)
+
+//=====================================================================================================================
+
+static void RadialTerms_fcd_st(const double rr,doublecomplex QD[static 2])
+// radial coefficients for static FCD, rr is the distance. See InterTerm_fcd_st for details
+{
+	double kr,kfr,ci,si,brd;
+	doublecomplex eikfr;
+
+	kr=WaveNum*rr;
+	RadialTerms_poi(kr,kr*kr,1/(rr*rr*rr),QD);
+	kfr=PI*rr/gridspace; // k_F*r, for FCD
+	eikfr=accImExp(kfr);
+	// result = Gp*[3*Si(k_F*r)+k_F*r*cos(k_F*r)-4*sin(k_F*r)]*2/(3*pi)
+	cisi(kfr,&ci,&si);
+	brd=TWO_OVER_PI*ONE_THIRD*(3*si+kfr*creal(eikfr)-4*cimag(eikfr));
+	QD[0]*=brd;
+	QD[1]*=brd;
+}
 
 //=====================================================================================================================
 
@@ -438,30 +658,23 @@ static inline void InterTerm_fcd_st(double qvec[static 3],doublecomplex result[s
  */
 // If needed, it can be updated to work fine for qvec==0
 {
-	// standard variable definitions used for functions InterParams and InterTerm_core
+	// standard variable definitions used for functions InterParams
 	double qmunu[6]; // normalized outer-product {qxx,qxy,qxz,qyy,qyz,qzz}
 	double rr,invr3,kr,kr2; // |R|, |R|^-3, kR, (kR)^2
-	doublecomplex expval; // exp(ikR)/|R|^3
 
-	double kfr,ci,si,brd;
-	int comp;
-	doublecomplex eikfr;
+	doublecomplex QD[2];
 	// next line should never happen
 	if (rectDip) LogError(ONE_POS,"Incompatibility error in InterTerm_fcd_st");
 
 	InterParams(qvec,qmunu,&rr,&invr3,&kr,&kr2);
-	InterTerm_core(kr,kr2,invr3,qmunu,&expval,result);
-
-	kfr=PI*rr/gridspace; // k_F*r, for FCD
-	eikfr=accImExp(kfr);
-	// result = Gp*[3*Si(k_F*r)+k_F*r*cos(k_F*r)-4*sin(k_F*r)]*2/(3*pi)
-	cisi(kfr,&ci,&si);
-	brd=TWO_OVER_PI*ONE_THIRD*(3*si+kfr*creal(eikfr)-4*cimag(eikfr));
-	for (comp=0;comp<NDCOMP;comp++) result[comp]*=brd;
+	RadialTerms_fcd_st(rr,QD);
+	RadialAssemble(qmunu,QD,result);
 	PRINT_GVAL;
 }
 
-WRAPPERS_INTER(InterTerm_fcd_st)
+RADIAL_WRAPPER(InterTerm_fcd_st)
+REAL_WRAPPER(InterTerm_fcd_st)
+BATCH_WRAPPER(InterTerm_fcd_st)
 
 //=====================================================================================================================
 
@@ -527,6 +740,44 @@ static inline double AverageGaussCube(double x)
 
 //=====================================================================================================================
 
+static void RadialTerms_nloc_both(const double rr,doublecomplex QD[static 2],const bool averageH)
+/* radial coefficients for the non-local interaction, rr is the distance. See InterTerm_nloc_both for details. If
+ * averageH, the non-locality function (which is not radial then) is not included
+ */
+{
+	double sx,x,t1,t2,expMx,invRp3;
+
+	if (nloc_Rp==0) {
+		t1=1/(rr*rr*rr);
+		t2=0;
+	}
+	else {
+		invRp3=1/(nloc_Rp*nloc_Rp*nloc_Rp);
+		sx=SQRT1_2*rr/nloc_Rp;
+		x=sx*sx;
+		expMx=exp(-sx*sx);
+		// the threshold for x is somewhat arbitrary
+		if (x>1) t1=(4/(3*SQRT_PI))*lower_gamma52(sx,expMx)/(rr*rr*rr);
+		else t1=SQRT2_9PI*x*gamma_scaled(2.5,x,expMx)*invRp3;
+		if (averageH) t2=0;
+		else t2=expMx*invRp3*SQRT2_9PI;
+	}
+	QD[0]=3*t1;
+	QD[1]=-(t1+t2);
+}
+
+// wrappers for tabulation
+static void RadialTerms_nloc(const double rr,doublecomplex QD[static 2])
+{
+	RadialTerms_nloc_both(rr,QD,false);
+}
+static void RadialTerms_nloc_av(const double rr,doublecomplex QD[static 2])
+{
+	RadialTerms_nloc_both(rr,QD,true);
+}
+
+//=====================================================================================================================
+
 static inline void InterTerm_nloc_both(double qvec[static 3],doublecomplex result[static 6],const bool averageH)
 /* Interaction term between two dipoles using the non-local interaction;
  * qvec is the real distance, result is for produced output
@@ -543,8 +794,8 @@ static inline void InterTerm_nloc_both(double qvec[static 3],doublecomplex resul
  * (4pi/3)h(R)=exp(-x)*sqrt(2/pi)/(3*Rp^3) - is the non-locality function. If averageH, it is replaced by its integral
  * over cube, which can be easily expressed through erf.
  *
- * Currently this function is faster than FCD, so we should not worry about speed. But if needed, calculation of both
- * h(R) and its integrals can be optimized by tabulating 1D functions (either exp, or combinations of erf)
+ * The radial part is computed by RadialTerms_nloc_both (and tabulated for integer input), while the averaged h is a
+ * product of three 1D functions, which are also tabulated (see InterTerm_nloc_av_int).
  */
 // If needed, it can be updated to work fine for qvec==0
 {
@@ -552,69 +803,156 @@ static inline void InterTerm_nloc_both(double qvec[static 3],doublecomplex resul
 	double qmunu[6]; // normalized outer-product {qxx,qxy,qxz,qyy,qyz,qzz}
 	double rr,rn,invr3,kr,kr2; // |R|, |R/d|, |R|^-3, kR, (kR)^2
 
-	double sx,x,t1,t2,expMx,invRp3;
+	doublecomplex QD[2];
 	// next line should never happen
 	if (rectDip) LogError(ONE_POS,"Incompatibility error in InterTerm_nloc_both");
 
 	InterParams(qvec,qmunu,&rr,&invr3,&kr,&kr2);
 	rn=rr/gridspace;
-	if (nloc_Rp==0) {
-		if (rr==0) LogError(ALL_POS,"Non-local interaction is not defined for both R and Rp equal to 0");
-		t1=invr3;
-		// when averaging, we check if the point r is inside the cube around r0. Conforms with general formula below
-		if (averageH) t2=FOUR_PI_OVER_THREE*InsideCube(qvec,rn);
-		else t2=0;
+	if (nloc_Rp==0 && rr==0) LogError(ALL_POS,"Non-local interaction is not defined for both R and Rp equal to 0");
+	RadialTerms_nloc_both(rr,QD,averageH);
+	if (averageH) {
+		// when Rp=0, we check if the point r is inside the cube around r0. Conforms with general formula
+		if (nloc_Rp==0) QD[1]-=FOUR_PI_OVER_THREE*InsideCube(qvec,rn);
+		else QD[1]-=PI_OVER_SIX*AverageGaussCube(qvec[0]*rr)*AverageGaussCube(qvec[1]*rr)
+			*AverageGaussCube(qvec[2]*rr);
 	}
-	else {
-		invRp3=1/(nloc_Rp*nloc_Rp*nloc_Rp);
-		sx=SQRT1_2*rr/nloc_Rp;
-		x=sx*sx;
-		expMx=exp(-sx*sx);
-		// the threshold for x is somewhat arbitrary
-		if (x>1) t1=(4/(3*SQRT_PI))*lower_gamma52(sx,expMx)*invr3;
-		else t1=SQRT2_9PI*x*gamma_scaled(2.5,x,expMx)*invRp3;
-		if (averageH)
-			t2=PI_OVER_SIX*AverageGaussCube(qvec[0]*rr)*AverageGaussCube(qvec[1]*rr)*AverageGaussCube(qvec[2]*rr);
-		else t2=expMx*invRp3*SQRT2_9PI;
+	RadialAssemble(qmunu,QD,result);
+	PRINT_GVAL;
+}
+
+// wrappers both for nloc and nloc_av
+RADIAL_WRAPPER_3(InterTerm_nloc,InterTerm_nloc_both,false)
+REAL_WRAPPER_3(InterTerm_nloc,InterTerm_nloc_both,false)
+REAL_WRAPPER_3(InterTerm_nloc_av,InterTerm_nloc_both,true)
+BATCH_WRAPPER(InterTerm_nloc)
+
+//=====================================================================================================================
+
+static inline double GaussCube_int(const int i)
+// AverageGaussCube for integer coordinate i (in units of dipole size), uses gaussTable when possible
+{
+	const int ia=abs(i);
+
+	if (ia<gaussN) return gaussTable[ia];
+	else return AverageGaussCube(ia*gridspace);
+}
+
+//=====================================================================================================================
+
+void InterTerm_nloc_av_int(const int i,const int j,const int k,doublecomplex result[static restrict 6])
+/* same as InterTerm_nloc_av, but based on integer input (arguments are described in .h file). Uses radTable and
+ * gaussTable, when possible. For non-zero integer input and Rp=0, the averaged h is always zero.
+ */
+{
+	double qvec[3];
+	int comp;
+
+	if (RadialTable_int(i,j,k,result)) {
+		if (nloc_Rp!=0) {
+			const double t2=PI_OVER_SIX*GaussCube_int(i)*GaussCube_int(j)*GaussCube_int(k);
+			for (comp=0;comp<NDCOMP;comp++) if (dmunu[comp]) result[comp]-=t2;
+		}
+		return;
 	}
+	UnitsGridToCoord(i,j,k,qvec);
+	InterTerm_nloc_both(qvec,result,true);
+}
 
-//#define INTERACT_DIAG(ind) { result[ind] = ((t1*qmunu[ind]+t3) + I*(kr+t2*qmunu[ind]))*(*expval); }
-//#define INTERACT_NONDIAG(ind) { result[ind] = (t1+I*t2)*qmunu[ind]*(*expval); }
-#define INTERACT_DIAG(ind) { result[ind] = 3*t1*qmunu[ind] - (t1+t2); }
-#define INTERACT_NONDIAG(ind) { result[ind] = 3*t1*qmunu[ind]; }
+BATCH_WRAPPER(InterTerm_nloc_av)
 
-	INTERACT_DIAG(0);    // xx
-	INTERACT_NONDIAG(1); // xy
-	INTERACT_NONDIAG(2); // xz
-	INTERACT_DIAG(3);    // yy
-	INTERACT_NONDIAG(4); // yz
-	INTERACT_DIAG(5);    // zz
+//=====================================================================================================================
+#if defined(SPARSE) || !defined(NO_FORTRAN)
+/* Hash tables with open addressing (empty slots are marked by SIZE_MAX) and linear probing are used for lookup of
+ * tabulated values by integer keys - for Sommerfeld integrals in sparse mode and for IGT values
+ */
 
-#undef INTERACT_DIAG
-#undef INTERACT_NONDIAG
+static inline int HashBits(const size_t n)
+// binary logarithm of the size of hash table for n keys (with load factor not larger than 1/2)
+{
+	int bits;
 
-	PRINT_GVAL;
+	for (bits=1;((size_t)1<<bits)<2*n;bits++);
+	return bits;
 }
 
-// wrappers both for nloc and nloc_av
-WRAPPERS_INTER_3(InterTerm_nloc,InterTerm_nloc_both,false)
-WRAPPERS_INTER_3(InterTerm_nloc_av,InterTerm_nloc_both,true)
+//=====================================================================================================================
+
+static inline size_t HashSlot(const size_t key,const int bits)
+// initial slot for a given key in a hash table of size 2^bits (Fibonacci hashing)
+{
+	return (size_t)(((uint64_t)key*UINT64_C(0x9E3779B97F4A7C15))>>(64-bits));
+}
+
+//=====================================================================================================================
+
+static size_t * InitHash(const size_t n,int *bits)
+// allocates and clears hash table for n keys (with load factor not larger than 1/2); bits is the binary log of its size
+{
+	size_t i,size,*hash;
+
+	*bits=HashBits(n);
+	size=(size_t)1<<*bits;
+	MALLOC_VECTOR(hash,sizet,size,ALL);
+	for (i=0;i<size;i++) hash[i]=SIZE_MAX;
+	return hash;
+}
+
+//=====================================================================================================================
+
+static size_t * BuildHash(const size_t * restrict keys,const size_t n,int *bits)
+/* builds hash table for array of n distinct keys, which stores indices in this array; bits is the binary log of its
+ * size
+ */
+{
+	size_t i,slot,*hash;
+
+	hash=InitHash(n,bits);
+	const size_t mask=((size_t)1<<*bits)-1;
+	for (i=0;i<n;i++) {
+		for (slot=HashSlot(keys[i],*bits);hash[slot]!=SIZE_MAX;slot=(slot+1)&mask);
+		hash[slot]=i;
+	}
+	return hash;
+}
+
+//=====================================================================================================================
+
+static inline size_t HashFind(const size_t * restrict hash,const int bits,const size_t * restrict keys,const size_t key)
+// returns index of key in array keys using hash table (built by BuildHash), or SIZE_MAX if the key is not present
+{
+	size_t slot,ind;
+	const size_t mask=((size_t)1<<bits)-1;
+
+	for (slot=HashSlot(key,bits);(ind=hash[slot])!=SIZE_MAX;slot=(slot+1)&mask) if (keys[ind]==key) return ind;
+	return SIZE_MAX;
+}
+
+#endif // SPARSE || !NO_FORTRAN
 
 //=====================================================================================================================
 #ifndef NO_FORTRAN
 
 static inline void InterTerm_igt(double qvec[static 3],doublecomplex result[static 6])
-// Interaction term between two dipoles with integration of Green's tensor. See InterTerm_poi for more details.
+/* Interaction term between two dipoles with integration of Green's tensor. See InterTerm_poi for more details.
+ * It is thread-safe, since each OpenMP thread uses its own part of igtWork.
+ */
 {
 	double tmp[12];
 	int comp,ifail;
+	const int nw=IGT_NW;
+#ifdef OPENMP
+	double * restrict work=igtWork+(size_t)IGT_NW*omp_get_thread_num();
+#else
+	double * restrict work=igtWork;
+#endif
 
 	if (igt_lim==UNDEF || DotProd(qvec,qvec)<=igtLimR2 ) {
 		/* passing complex vectors from Fortran to C is not necessarily portable (at least requires extra effort in
 		 * the Fortran code. So we do it through double. This is not bad for performance, since double is anyway used
 		 * internally for integration in this Fortran routine.
 		 */
-		propaespacelibreintadda_(qvec,&WaveNum,&dsX,&dsY,&dsZ,&igt_eps,tmp,&ifail);
+		propaespacelibreintadda_(qvec,&WaveNum,&dsX,&dsY,&dsZ,&igt_eps,tmp,&ifail,work,&nw);
 		if (ifail!=0) {
 			if (ifail==1) LogWarning(EC_WARN,ALL_POS,"Failed to reach relative accuracy of %g for Green's tensor "
 				"integration for distance "GFORMDEF3V,igt_eps,COMP3V(qvec));
@@ -641,26 +979,60 @@ static inline void InterTerm_igt(double qvec[static 3],doublecomplex result[stat
 	else InterTerm_poi(qvec,result);
 }
 
-WRAPPERS_INTER(InterTerm_igt)
+REAL_WRAPPER(InterTerm_igt)
+
+//=====================================================================================================================
+
+void InterTerm_igt_int(const int i,const int j,const int k,doublecomplex result[static restrict 6])
+/* same as InterTerm_igt, but based on integer input (arguments are described in .h file). Uses igtTable, when possible.
+ * The values for negative components of the distance vector are obtained by the symmetry of the cube with respect to
+ * reflections, which changes the signs of the corresponding non-diagonal components. The distance limit is tested
+ * first to avoid useless search in the table.
+ */
+{
+	double qvec[3];
+	const int ia=abs(i),ja=abs(j),ka=abs(k);
+
+	UnitsGridToCoord(i,j,k,qvec);
+	if (igtTable!=NULL && ia<boxX && ja<boxY && ka<boxZ && (igt_lim==UNDEF || DotProd(qvec,qvec)<=igtLimR2)) {
+		const size_t ind=HashFind(igtHash,igtHashBits,igtKeys,((size_t)ka*boxY+ja)*boxX+ia);
+		if (ind!=SIZE_MAX) {
+			const doublecomplex *val=igtTable+6*ind;
+			memcpy(result,val,6*sizeof(doublecomplex));
+			if ((i<0) != (j<0)) result[1]=-result[1];
+			if ((i<0) != (k<0)) result[2]=-result[2];
+			if ((j<0) != (k<0)) result[4]=-result[4];
+			return;
+		}
+	}
+	InterTerm_igt(qvec,result);
+}
+
+BATCH_WRAPPER(InterTerm_igt)
 
 #endif
 /* TO ADD NEW INTERACTION FORMULATION
  * Add above functions that actually perform the calculation of the interaction term, according to the new formulae. At
- * the end you need to have two functions according to the declarations InterTerm_int and InterTerm_real in
- * interaction.h. Their input and output arguments are described there as well. Precise definition of Green's tensor is
- * given in the manual, in particular, it is based on CGS system of units. There are two ways to proceed:
+ * the end you need to have three functions according to the declarations InterTerm_int, InterTerm_real, and
+ * InterTerm_batch in interaction.h. Their input and output arguments are described there as well. Precise definition
+ * of Green's tensor is given in the manual, in particular, it is based on CGS system of units. There are two ways to
+ * proceed:
  *
  * 1) Recommended. You create one main function with the following declaration
  * static inline void InterTerm_<name>(double qvec[static 3],doublecomplex result[static 6])
  * which works for double input vector. After the function definition you specify "WRAPPERS_INTER(InterTerm_<name>)",
- * which automatically produces declarations compatible to that in interaction.h. See InterTerm_poi() for example.
+ * which automatically produces declarations compatible to that in interaction.h. See InterTerm_igt_so() for example.
  *
  * 2) Create two separate functions named InterTerm_<name>_int and InterTerm_<name>_real with declarations described in
- * interaction.h. If the new formulation does not support arbitrary real input vector (e.g. it is based on tables), then
- * use "NO_REAL_WRAPPER(InterTerm_<name>)" instead of the real-input declaration.
+ * interaction.h, and specify "BATCH_WRAPPER(InterTerm_<name>)" after them. If the new formulation does not support
+ * arbitrary real input vector (e.g. it is based on tables), then use "NO_REAL_WRAPPER(InterTerm_<name>)" instead of the
+ * real-input declaration. A specialized (vectorized) batch function can also be implemented, see InterTerm_poi_batch().
  *
- * In any case you may benefit from existing utility functions InterParams() and InterTerm_core(). Adhering to the
- * naming conventions is important to be able to use macros here and below in InitInteraction().
+ * In any case you may benefit from existing utility functions InterParams() and InterTerm_core(). If the formulation
+ * (for cubical dipoles) is determined by two scalar radial functions, it is recommended to implement them as
+ * RadialTerms_<name>() and use "RADIAL_WRAPPER(InterTerm_<name>)" instead of the int wrapper, and InitRadialTable() in
+ * InitInteraction() - see InterTerm_fcd() for example. Adhering to the naming conventions is important to be able to
+ * use macros here and below in InitInteraction().
  */
 
 //=====================================================================================================================
@@ -738,6 +1110,328 @@ static inline void SingleSomIntegral(double rho,const double z,doublecomplex val
 
 //=====================================================================================================================
 
+static void LagrangeWeights(const double t,const int n,int *p0,double w[static 4])
+/* computes weights of Lagrange interpolation at point t (in units of mesh step) on a uniform mesh with n nodes (0,...,
+ * n-1). Up to 4 nodes are used (cubic interpolation), the first of them is returned in p0. The stencil is centered
+ * around t, but shifted inwards near the boundaries of the mesh. At mesh nodes the weights are exactly 0 or 1.
+ */
+{
+	int l,m;
+	const int np=MIN(n,4);
+
+	*p0=MIN(MAX((int)floor(t)-1,0),n-np);
+	for (l=0;l<np;l++) {
+		w[l]=1;
+		for (m=0;m<np;m++) if (m!=l) w[l]*=(t-(*p0+m))/(l-m);
+	}
+	for (;l<4;l++) w[l]=0;
+}
+
+//=====================================================================================================================
+
+/* Uniform mesh in the plane of (rho,z) to interpolate Sommerfeld integrals. Values along z coincide with (a subset of)
+ * the actual grid values z_k=k*dsZ+ZsumShift (k=0,...,local_Nz_Rm-1), so the mesh is specified by the integer step sz.
+ * Along rho the mesh step hr is arbitrary. Four values of integrals for node (p,q), i.e. rho=p*hr and z=z_{q*sz}, are
+ * stored starting from val[4*(q*nr+p)].
+ */
+struct som_mesh {
+	int nr,nz;   // number of nodes along rho and z
+	double hr;   // step along rho (um)
+	int sz;      // step along z (in units of dsZ)
+	doublecomplex *val; // values of integrals
+};
+
+//=====================================================================================================================
+
+static void InterpSomMesh(const struct som_mesh *ms,const double rho,const double kz,doublecomplex res[static 4])
+/* interpolates Sommerfeld integrals from mesh ms to point (rho,z_k); kz is the (generally non-integer) z-index of the
+ * point in units of dsZ
+ */
+{
+	int pr,pz,l,m,c;
+	double wr[4],wz[4];
+	const doublecomplex *v;
+
+	LagrangeWeights(rho/ms->hr,ms->nr,&pr,wr);
+	LagrangeWeights(kz/ms->sz,ms->nz,&pz,wz);
+	for (c=0;c<4;c++) res[c]=0;
+	for (m=0;m<4 && m<ms->nz;m++) for (l=0;l<4 && l<ms->nr;l++) {
+		v=ms->val+4*((size_t)(pz+m)*ms->nr+pr+l);
+		for (c=0;c<4;c++) res[c]+=wz[m]*wr[l]*v[c];
+	}
+}
+
+//=====================================================================================================================
+
+static double RefineSomMesh(const struct som_mesh *old,struct som_mesh *ms)
+/* builds mesh ms with twice smaller steps than in mesh old (along z - only while the step is larger than dsZ). Values
+ * at common nodes are copied, while the rest are computed directly. Returns the maximum relative error of interpolation
+ * from mesh old, estimated at all new nodes. The error is normalized by the maximum absolute value of the corresponding
+ * integral over the whole mesh, since the integrals decay fast with rho and normalization by local (e.g. per-row)
+ * maxima overestimates the error in the regions, where the integrals are small and thus irrelevant.
+ * If old is NULL, the mesh ms should have all fields (except val) set, and it is computed from scratch.
+ */
+{
+	int n;
+	double err=0;
+
+	if (old!=NULL) {
+		ms->hr=old->hr/2;
+		ms->nr=2*old->nr-1;
+		if (old->sz>1) {
+			ms->sz=old->sz/2;
+			ms->nz=2*old->nz-1;
+		}
+		else {
+			ms->sz=1;
+			ms->nz=old->nz;
+		}
+	}
+	MALLOC_VECTOR(ms->val,complex,4*(size_t)ms->nr*ms->nz,ALL);
+	const int zfact=(old!=NULL) ? old->sz/ms->sz : 1;
+#ifdef OPENMP
+#	pragma omp parallel for schedule(dynamic)
+#endif
+	for (n=0;n<ms->nr*ms->nz;n++) {
+		const int p=n%ms->nr,q=n/ms->nr;
+		doublecomplex *v=ms->val+4*(size_t)n;
+		if (old!=NULL && p%2==0 && q%zfact==0)
+			memcpy(v,old->val+4*((size_t)(q/zfact)*old->nr+p/2),4*sizeof(doublecomplex));
+		else SingleSomIntegral(p*ms->hr,q*ms->sz*dsZ+ZsumShift,v);
+	}
+	if (old==NULL) return 0;
+	// maximum absolute values of each integral over the whole mesh
+	double vmax[4]={0,0,0,0};
+	for (n=0;n<ms->nr*ms->nz;n++) for (int c=0;c<4;c++) {
+		const double absv=cabs(ms->val[4*(size_t)n+c]);
+		if (absv>vmax[c]) vmax[c]=absv;
+	}
+	// estimate error at all new nodes (those not present in the old mesh)
+#ifdef OPENMP
+#	pragma omp parallel for schedule(dynamic) reduction(max:err)
+#endif
+	for (n=0;n<ms->nr*ms->nz;n++) {
+		const int p=n%ms->nr,q=n/ms->nr;
+		int c;
+		double tmp;
+		doublecomplex intp[4];
+		const doublecomplex *v=ms->val+4*(size_t)n;
+
+		if (p%2==0 && q%zfact==0) continue;
+		InterpSomMesh(old,p*ms->hr,q*ms->sz,intp);
+		for (c=0;c<4;c++) if (vmax[c]>0) {
+			tmp=cabs(intp[c]-v[c])/vmax[c];
+			if (tmp>err) err=tmp;
+		}
+	}
+	return err;
+}
+
+//=====================================================================================================================
+
+static bool BuildSomMesh(struct som_mesh *mf,const size_t tsize)
+/* builds (rho,z) mesh for interpolation of Sommerfeld integrals, which is adaptively refined (by halving both steps)
+ * until the estimated relative error of the interpolation is below som_eps. The error is estimated by comparing the
+ * interpolated values from the coarser mesh to the exact ones at the nodes of the finer mesh; then the finer mesh is
+ * returned in mf, which is thus expected to be even more accurate.
+ * The initial steps are about lambda/2 (but not smaller than the dipole size). The procedure is stopped if the number
+ * of mesh nodes becomes larger than tsize (the number of required values), then false is returned (so direct
+ * evaluation should be used).
+ *
+ * In MPI FFT mode each processor refines its own mesh (for its local values of z), so the results may slightly depend
+ * on the number of processors. In sparse mode all processors build identical meshes.
+ */
+{
+	int j,steps;
+	struct som_mesh m[2];
+	double err,errOld;
+	const double ds=dsX; // = dsY, tested in CalcSomTable
+
+	// mesh steps are powers of 2 (in units of dipole size)
+	for (steps=1;2*steps*MAX(ds,dsZ)<=PI/WaveNum;steps*=2);
+	m[0].hr=steps*ds;
+	m[0].sz=steps;
+	m[0].nr=(int)ceil(hypot(boxX-1,boxY-1)/steps)+1;
+	m[0].nz=(local_Nz_Rm-1+steps-1)/steps+1;
+	RefineSomMesh(NULL,m);
+	j=0;
+	errOld=DBL_MAX;
+	while (true) {
+		if (2*(size_t)m[j].nr*m[j].nz>tsize) { // m[1-j] will be at least 2 times larger
+			Free_cVector(m[j].val);
+			return false;
+		}
+		err=RefineSomMesh(m+j,m+1-j);
+		Free_cVector(m[j].val);
+		j=1-j;
+		if (err<=som_eps) break;
+		/* for cubic interpolation the error should decrease by a factor of 16 (at least, 2) with each refinement,
+		 * otherwise further refinement is not expected to reach som_eps at reasonable cost
+		 */
+		if (err>errOld/2) {
+			LogWarning(EC_WARN,ONE_POS,"Requested accuracy of interpolation of Sommerfeld integrals ("GFORMDEF") was "
+				"not reached, since the estimated error ("GFORMDEF") stopped decreasing with refinement of the mesh",
+				som_eps,err);
+			break;
+		}
+		errOld=err;
+	}
+	if (IFROOT) PRINTFB("Sommerfeld integrals are interpolated from %dx%d mesh (estimated relative error %g)\n",
+		m[j].nr,m[j].nz,err);
+	*mf=m[j];
+	return true;
+}
+
+//=====================================================================================================================
+
+#ifdef SPARSE
+
+static size_t SomHashFind(const size_t key)
+// returns index of key in somKeys using hash table
+{
+	const size_t ind=HashFind(somHash,somHashBits,somKeys,key);
+
+	if (ind==SIZE_MAX)
+		LogError(ALL_POS,"Pair (z,rho) with key %zu is not present in the table of Sommerfeld integrals",key);
+	return ind;
+}
+
+//=====================================================================================================================
+
+static size_t SomKey(const int * restrict pos1,const int * restrict pos2)
+// key for Sommerfeld integrals (see somKeys) for a pair of dipoles with positions pos1 and pos2
+{
+	const int dx=pos1[0]-pos2[0],dy=pos1[1]-pos2[1];
+
+	return (size_t)(pos1[2]+pos2[2])*somNr2+(size_t)(dx*dx+dy*dy);
+}
+
+//=====================================================================================================================
+
+static int CompareSizet(const void *a,const void *b)
+// comparison function for qsort
+{
+	const size_t x=*(const size_t *)a,y=*(const size_t *)b;
+	return (x>y)-(x<y);
+}
+
+//=====================================================================================================================
+
+static size_t SortUnique(size_t * restrict arr,const size_t n)
+// sorts array arr and removes duplicates; returns new number of elements
+{
+	size_t i,m;
+
+	if (n==0) return 0;
+	qsort(arr,n,sizeof(size_t),CompareSizet);
+	for (i=1,m=1;i<n;i++) if (arr[i]!=arr[m-1]) arr[m++]=arr[i];
+	return m;
+}
+
+//=====================================================================================================================
+
+static size_t CollectKeys(size_t (*KeyFunc)(const int * restrict pos1,const int * restrict pos2),
+	size_t * restrict *keys)
+/* collects all distinct keys, given by KeyFunc (it returns SIZE_MAX for pairs to be skipped), for pairs of local and
+ * all (non-void) dipoles. The work is O(local_nvoid_Ndip*nvoid_Ndip), which is the same as for a single matrix-vector
+ * product in sparse mode. Distinct keys are accumulated in a growing open-addressing hash set (its empty slots are
+ * marked by SIZE_MAX), which is then compacted into a sorted array (returned in keys).
+ */
+{
+	size_t i,j,n,key,slot,mask,*set,*old;
+	size_t nset=0;
+	int bits;
+
+	set=InitHash(4096,&bits);
+	for (i=0;i<local_nvoid_Ndip;i++) for (j=0;j<nvoid_Ndip;j++) {
+		key=(*KeyFunc)(position+3*i,position_full+3*j);
+		if (key==SIZE_MAX) continue;
+		mask=((size_t)1<<bits)-1;
+		for (slot=HashSlot(key,bits);set[slot]!=SIZE_MAX;slot=(slot+1)&mask) if (set[slot]==key) break;
+		if (set[slot]==key) continue;
+		set[slot]=key;
+		nset++;
+		if (2*nset>mask) { // grow the set twice and rehash
+			old=set;
+			set=InitHash(2*nset,&bits);
+			mask=((size_t)1<<bits)-1;
+			for (n=0;n<=(mask>>1);n++) if (old[n]!=SIZE_MAX) {
+				key=old[n];
+				for (slot=HashSlot(key,bits);set[slot]!=SIZE_MAX;slot=(slot+1)&mask);
+				set[slot]=key;
+			}
+			Free_general(old);
+		}
+	}
+	// compact the set in place
+	for (n=0,i=0;i<((size_t)1<<bits);i++) if (set[i]!=SIZE_MAX) set[n++]=set[i];
+	*keys=set;
+	return SortUnique(set,n);
+}
+
+//=====================================================================================================================
+
+static void CalcSomHash(void)
+/* Calculates table of Sommerfeld integrals in sparse mode only for pairs (z,rho) actually occurring in the particle
+ * (issue 175), and builds hash table for lookup. First, each processor collects the keys for its local dipoles, then
+ * all keys are gathered (and duplicates removed). The evaluation of integrals is distributed in equal chunks among
+ * processors, and the results are gathered on all of them. So the cost scales with the number of distinct pairs of
+ * occupied dipoles instead of the volume of the computational box.
+ */
+{
+	size_t i,n,start,*keys,*counts;
+	struct som_mesh mesh;
+	bool interp;
+
+	somNr2=(size_t)(boxX-1)*(boxX-1)+(size_t)(boxY-1)*(boxY-1)+1;
+	MultOverflow(2*boxZ-1,somNr2,ONE_POS,"keys for Sommerfeld integrals");
+	if (prognosis) { // the number of keys is not known, so the upper estimate is used (the full box)
+		const size_t nmax=(2*boxZ-1)*(size_t)boxX*boxY;
+		memory+=SharedSize(nmax*4*sizeof(doublecomplex))+nmax*5*sizeof(size_t);
+		return;
+	}
+	if (IFROOT) PRINTFB("Calculating table of Sommerfeld integrals\n");
+	n=CollectKeys(SomKey,&keys);
+	MALLOC_VECTOR(counts,sizet,nprocs,ALL);
+	somNkeys=AllGatherCounts(n,counts);
+	// place local keys at their position in the gathered array
+	MALLOC_VECTOR(somKeys,sizet,somNkeys,ALL);
+	for (start=0,i=0;i<(size_t)ringid;i++) start+=counts[i];
+	memcpy(somKeys+start,keys,n*sizeof(size_t));
+	Free_general(keys);
+	AllGatherVar(somKeys,sizet_type,counts,NULL);
+	somNkeys=SortUnique(somKeys,somNkeys);
+	// build the lookup hash table
+	somHash=BuildHash(somKeys,somNkeys,&somHashBits);
+	memory+=SharedSize(somNkeys*4*sizeof(doublecomplex))+(somNkeys+((size_t)1<<somHashBits))*sizeof(size_t);
+	// distribute evaluation of integrals in chunks among processors
+	for (i=0;i<(size_t)nprocs;i++) counts[i]=4*(somNkeys/nprocs+(i<somNkeys%nprocs));
+	for (start=0,i=0;i<(size_t)ringid;i++) start+=counts[i]/4;
+	n=counts[ringid]/4;
+	MALLOC_SHARED(somTable,4*somNkeys); // one copy per node
+	interp=(som_eps!=UNDEF && BuildSomMesh(&mesh,somNkeys));
+	if (som_eps!=UNDEF && !interp && IFROOT)
+		PRINTFB("Interpolation is not beneficial, calculating all integrals directly\n");
+#ifdef OPENMP
+#	pragma omp parallel for schedule(dynamic)
+#endif
+	for (i=start;i<start+n;i++) {
+		const int k=(int)(somKeys[i]/somNr2);
+		const double rho=sqrt((double)(somKeys[i]%somNr2))*dsX;
+		if (interp) InterpSomMesh(&mesh,rho,k,somTable+4*i);
+		else SingleSomIntegral(rho,k*dsZ+ZsumShift,somTable+4*i);
+	}
+	if (interp) Free_cVector(mesh.val);
+	AllGatherVar(somTable,cmplx_type,counts,NULL);
+	Free_general(counts);
+	if (IFROOT) PRINTFB("Number of distinct pairs (z,rho): %zu (in the full box: %zu)\n",somNkeys,
+		(2*boxZ-1)*(size_t)boxX*(boxY+1)/2);
+}
+
+#endif // SPARSE
+
+//=====================================================================================================================
+
 static void CalcSomTable(void)
 /* calculates a table of (essential Sommerfeld integrals), which are further combined into reflected Green's tensor
  * For z values - all local grid; for x- and y-values only positive values are considered and additionally y<=x.
@@ -745,26 +1439,22 @@ static void CalcSomTable(void)
  * That is good for FFT code, since all these values are required anyway. A minor improvement can be achieved by
  * locating different pairs of i,j that lead to the same rho (like 3,4 and 5,0), but the fraction of such matching pairs
  * is very small (also see below). Another way for improvement is to set a (coarser) 2D grid in plane of z-rho and
- * perform interpolation on it (as done in Schmehl's thesis). But that will add another free parameter affecting the
- * final accuracy.
+ * perform interpolation on it (as done in Schmehl's thesis). But that adds another free parameter affecting the
+ * final accuracy, so it is only used if required by the command line (som_eps is set), see BuildSomMesh().
  *
  * However, in sparse mode this procedure is inefficient, since incurs (potentially) a lot of unnecessary evaluations
  * of Sommerfeld integrals. For really sparse aggregates the better way is to buildup a lookup table, using only
- * actually used pairs of (z,rho), as is done in DDA-SI code. A hash table can be used for that.
- * TODO: Implement such improvement for the sparse mode (issue 175)
+ * actually used pairs of (z,rho), as is done in DDA-SI code. This is implemented with a hash table in CalcSomHash().
  *
  * Using only actually used value of (z,rho) can be also relevant for FFT mode (consider, e.g. a sphere and z close to 0
  * and to 2*boxZ-1). However, searching through such pairs seems to be O(N^2) operation, which is unacceptable in FFT
  * mode.
- *
- * Another problem in SPARSE mode is that currently all values of z are computed on each processor (in MPI mode). This
- * is related to the current parallelization mode (issue 160), but it can be improved by computing all values in chunks
- * and then gathering them on each processor. Better to combine it with the hash table above.
  */
 {
-	int i,j,k;
-	double z;
-	size_t ind;
+#ifndef SPARSE
+	int j,kj;
+	struct som_mesh mesh;
+#endif
 
 	/* The logic below is heavily based on dsX=dsY. In principle, it can be extended to integer ratios, but doesn't seem
 	 * worth the effort. First, it is hard to find interesting practical cases of particles on substrate that would
@@ -772,6 +1462,9 @@ static void CalcSomTable(void)
 	 * (as discussed above).
 	 */
 	if (dsX!=dsY) LogError(ONE_POS,"Incompatibility error in CalcSomTable");
+#ifdef SPARSE
+	CalcSomHash();
+#else
 	XlessY=(boxX<=boxY);
 	// create index for plane x,y; if boxX<=boxY the space above the main diagonal is indexed (so x<=y) and vice versa
 	MALLOC_VECTOR(somIndex,sizet,boxY+1,ALL);
@@ -784,15 +1477,39 @@ static void CalcSomTable(void)
 	if (!prognosis) {
 		MALLOC_VECTOR(somTable,complex,tmp,ALL);
 		if (IFROOT) PRINTFB("Calculating table of Sommerfeld integrals\n");
-		ind=0;
-		for (k=0;k<local_Nz_Rm;k++) {
-			z=k*dsZ+ZsumShift;
-			for (j=0;j<boxY;j++) {
-				if (XlessY) for (i=0;i<=j && i<boxX;i++,ind++) SingleSomIntegral(hypot(i*dsX,j*dsY),z,somTable+4*ind);
-				else for (i=j;i<boxX;i++,ind++) SingleSomIntegral(hypot(i*dsX,j*dsY),z,somTable+4*ind);
+		if (local_Nz_Rm==0) return;
+		if (som_eps!=UNDEF) {
+			if (BuildSomMesh(&mesh,local_Nz_Rm*somIndex[boxY])) {
+#ifdef OPENMP
+#	pragma omp parallel for schedule(dynamic)
+#endif
+				for (kj=0;kj<local_Nz_Rm*boxY;kj++) {
+					const int k=kj/boxY,jy=kj%boxY;
+					int i;
+					size_t ind=k*somIndex[boxY]+somIndex[jy];
+					if (XlessY) for (i=0;i<=jy && i<boxX;i++,ind++)
+						InterpSomMesh(&mesh,hypot(i,jy)*dsX,k,somTable+4*ind);
+					else for (i=jy;i<boxX;i++,ind++) InterpSomMesh(&mesh,hypot(i,jy)*dsX,k,somTable+4*ind);
+				}
+				Free_cVector(mesh.val);
+				return;
 			}
+			if (IFROOT) PRINTFB("Interpolation is not beneficial, calculating all integrals directly\n");
+		}
+		// each row (fixed y and z) of the table is independent (and evlua is reentrant)
+#ifdef OPENMP
+#	pragma omp parallel for schedule(dynamic)
+#endif
+		for (kj=0;kj<local_Nz_Rm*boxY;kj++) {
+			const int k=kj/boxY,jy=kj%boxY;
+			const double z=k*dsZ+ZsumShift;
+			int i;
+			size_t ind=k*somIndex[boxY]+somIndex[jy];
+			if (XlessY) for (i=0;i<=jy && i<boxX;i++,ind++) SingleSomIntegral(hypot(i*dsX,jy*dsY),z,somTable+4*ind);
+			else for (i=jy;i<boxX;i++,ind++) SingleSomIntegral(hypot(i*dsX,jy*dsY),z,somTable+4*ind);
 		}
 	}
+#endif
 }
 
 //=====================================================================================================================
@@ -850,9 +1567,12 @@ void ReflTerm_som_int(const int i,const int j,const int k,doublecomplex result[s
 
 	// second, Sommerfeld integral part
 	// compute table index
+	size_t ind;
+#ifdef SPARSE
+	ind=4*SomHashFind(k*somNr2+(size_t)(i*i+j*j));
+#else
 	int iT=abs(i);
 	int jT=abs(j);
-	size_t ind;
 	// index for the table
 	if (XlessY) {
 		if (iT<=jT) ind=somIndex[jT]+iT;
@@ -863,6 +1583,7 @@ void ReflTerm_som_int(const int i,const int j,const int k,doublecomplex result[s
 		else ind=somIndex[iT]+jT-iT; // effectively swap iT and jT
 	}
 	ind=4*(ind+k*somIndex[boxY]);
+#endif
 	double x=qvec[0];
 	double y=qvec[1];
 	double rho=hypot(x,y);
@@ -914,28 +1635,462 @@ void ReflTerm_som_real(const double qvec[static restrict 3],doublecomplex result
  * naming conventions is important to be able to use macros here and below in InitInteraction().
  */
 
+#ifndef NO_FORTRAN
+
+static size_t IgtKey(const int i,const int j,const int k)
+/* key of IGT value (see igtKeys) for distance vector {i,j,k} with non-negative components, or SIZE_MAX if the value is
+ * not tabulated - for zero vector (not used in DDA) and beyond igt_lim (tested exactly as in InterTerm_igt)
+ */
+{
+	double qvec[3];
+
+	if (i==0 && j==0 && k==0) return SIZE_MAX;
+	if (igt_lim!=UNDEF) {
+		UnitsGridToCoord(i,j,k,qvec);
+		if (DotProd(qvec,qvec)>igtLimR2) return SIZE_MAX;
+	}
+	return ((size_t)k*boxY+j)*boxX+i;
+}
+
+//=====================================================================================================================
+
+static inline void IgtKeyToVec(const size_t key,int ijk[static 3])
+// inverse of IgtKey - computes distance vector {i,j,k} from its key
+{
+	ijk[0]=(int)(key%(size_t)boxX);
+	ijk[1]=(int)(key/(size_t)boxX%(size_t)boxY);
+	ijk[2]=(int)(key/(size_t)boxX/(size_t)boxY);
+}
+
+//=====================================================================================================================
+
+#ifdef SPARSE
+
+static size_t IgtPairKey(const int * restrict pos1,const int * restrict pos2)
+// key of IGT value for a pair of dipoles with positions pos1 and pos2 (see IgtKey)
+{
+	return IgtKey(abs(pos1[0]-pos2[0]),abs(pos1[1]-pos2[1]),abs(pos1[2]-pos2[2]));
+}
+
+#else
+
+static void IgtLayers(const int start,const int end,const size_t grid,const int box,bool * restrict need,
+	bool * restrict own)
+/* marks the absolute values of a component of distance vectors (along y or z), which are required for the local part
+ * of Dmatrix in InitDmatrix, given the local range [start,end) of its indices along this axis and the grid size. The
+ * values are also marked in own, if the index of the corresponding positive component is in the local range, so that
+ * each value is owned by exactly one processor (along this axis). Arrays need and own are of size box.
+ */
+{
+	int i,c;
+
+	for (i=0;i<box;i++) need[i]=own[i]=false;
+	for (i=start;i<end;i++) {
+		c = (i>(int)grid/2) ? i-(int)grid : i; // the same correction as in InitDmatrix
+		if (abs(c)<box) need[abs(c)]=true;
+		if (c>=0 && c<box) own[c]=true;
+	}
+}
+
+#endif // SPARSE
+
+//=====================================================================================================================
+
+static FILE *OpenIgtCache(const char * restrict fname,const double key[static 4],size_t *n)
+/* opens cache file fname with IGT values and reads its header (on root processor only). Returns NULL if the file does
+ * not exist or its key differs from the given one. The key consists of WaveNum*dsX, dsY/dsX, dsZ/dsX, and igt_eps; the
+ * file name also depends on it, but the key is tested exactly. The number of records is returned in n.
+ *
+ * Format of the file: header of IGT_HEAD_SIZE bytes - IGT_CACHE_MAGIC, key (4 doubles), and the number of records
+ * (uint64), followed by the records of IGT_REC_SIZE bytes (in arbitrary order, but without duplicates). Each record
+ * consists of the distance vector {i,j,k} (3 non-negative ints) and 6 complex values multiplied by dsX^3.
+ */
+{
+	FILE * restrict file;
+	char magic[sizeof(IGT_CACHE_MAGIC)];
+	double fkey[4];
+	uint64_t u64;
+
+	if ((file=fopen(fname,"rb"))==NULL) return NULL;
+	if (fread(magic,1,sizeof(magic),file)!=sizeof(magic) || memcmp(magic,IGT_CACHE_MAGIC,sizeof(magic))!=0
+		|| fread(fkey,sizeof(double),4,file)!=4 || memcmp(fkey,key,sizeof(fkey))!=0
+		|| fread(&u64,sizeof(u64),1,file)!=1) {
+		LogWarning(EC_WARN,ONE_POS,"IGT cache file '%s' is incompatible with current parameters, ignoring it",fname);
+		fclose(file);
+		return NULL;
+	}
+	*n=(size_t)u64;
+	return file;
+}
+
+//=====================================================================================================================
+
+static size_t ReadIgtCache(FILE * restrict file,const char * restrict fname,size_t * restrict n,const size_t r0,
+	const size_t r1,bool * restrict done)
+/* reads n records from cache file (opened by OpenIgtCache on root processor) in chunks, which are broadcast to all
+ * processors. Each of them loads the values for the entries of igtTable in the range [r0,r1) and marks them in done
+ * (indexed relative to r0). For truncated file the reading is stopped (the remaining entries are left not marked), and
+ * n is set to the number of complete records. Returns the number of loaded values.
+ */
+{
+	size_t st,m,got,r,ind,nold;
+	int ijk[3],c;
+	unsigned char * restrict buf;
+	const double scale=1/(dsX*dsX*dsX);
+
+	nold=0;
+	MALLOC_VECTOR(buf,uchar,IGT_CHUNK*IGT_REC_SIZE,ALL);
+	for (st=0;st<*n;st+=m) {
+		got=m=MIN(IGT_CHUNK,*n-st);
+		if (IFROOT && (got=fread(buf,IGT_REC_SIZE,m,file))<m)
+			LogWarning(EC_WARN,ONE_POS,"IGT cache file '%s' is truncated, using only its part",fname);
+		MyBcast(&got,sizet_type,1,NULL);
+		MyBcast(buf,uchar_type,got*IGT_REC_SIZE,NULL);
+		for (r=0;r<got;r++) {
+			memcpy(ijk,buf+r*IGT_REC_SIZE,sizeof(ijk));
+			if (ijk[0]<0 || ijk[0]>=boxX || ijk[1]<0 || ijk[1]>=boxY || ijk[2]<0 || ijk[2]>=boxZ) continue;
+			ind=HashFind(igtHash,igtHashBits,igtKeys,((size_t)ijk[2]*boxY+ijk[1])*boxX+ijk[0]);
+			if (ind==SIZE_MAX || ind<r0 || ind>=r1 || done[ind-r0]) continue;
+			memcpy(igtTable+6*ind,buf+r*IGT_REC_SIZE+sizeof(ijk),6*sizeof(doublecomplex));
+			for (c=0;c<6;c++) igtTable[6*ind+c]*=scale;
+			done[ind-r0]=true;
+			nold++;
+		}
+		if (got<m) {
+			*n=st+got;
+			break;
+		}
+	}
+	Free_general(buf);
+	return nold;
+}
+
+//=====================================================================================================================
+
+static void SaveIgtCache(const char * restrict fname,const double key[static 4],FILE * restrict old,const size_t nold,
+	const size_t * restrict list,const size_t n,const size_t nnew)
+/* saves cache file fname (the format is described in OpenIgtCache), consisting of the first nold records of the old
+ * cache file (opened on root processor, it is closed afterwards) and the values from igtTable with n indices in list
+ * (on each processor); nnew is the total number of the latter. The file is written in parallel (see BinOutOpen) under a
+ * temporary name, which then replaces the old file.
+ */
+{
+	size_t c,nchunks,st,m,r,ind;
+	int ijk[3],comp;
+	uint64_t u64;
+	doublecomplex val[6];
+	char tname[MAX_FNAME];
+	unsigned char head[IGT_HEAD_SIZE];
+	unsigned char * restrict buf;
+	binout * restrict bo;
+	FILE * restrict file;
+	const double scale=dsX*dsX*dsX;
+
+	SnprintfErr(ONE_POS,tname,MAX_FNAME,"%s.tmp",fname);
+	// create directory igt_cache if needed
+	if (IFROOT && old==NULL) {
+		if ((file=fopen(tname,"wb"))==NULL) MkDirErr(igt_cache,ONE_POS);
+		else fclose(file);
+	}
+	// build header
+	memcpy(head,IGT_CACHE_MAGIC,sizeof(IGT_CACHE_MAGIC));
+	memcpy(head+sizeof(IGT_CACHE_MAGIC),key,4*sizeof(double));
+	u64=nold+nnew;
+	memcpy(head+sizeof(IGT_CACHE_MAGIC)+4*sizeof(double),&u64,sizeof(u64));
+	// write records in chunks to limit memory overhead; first - old records (by root)
+	MALLOC_VECTOR(buf,uchar,IGT_CHUNK*IGT_REC_SIZE,ALL);
+	bo=BinOutOpen(tname,head,IGT_HEAD_SIZE);
+	if (IFROOT && old!=NULL) FSeekErr(old,IGT_HEAD_SIZE,fname,ONE_POS);
+	nchunks=BinOutSeek(bo,IGT_HEAD_SIZE,IGT_REC_SIZE,IFROOT ? nold : 0,IGT_CHUNK,NULL);
+	for (c=0;c<nchunks;c++) {
+		st=c*IGT_CHUNK;
+		m = (IFROOT && st<nold) ? MIN(IGT_CHUNK,nold-st) : 0;
+		if (m>0 && fread(buf,IGT_REC_SIZE,m,old)!=m) LogError(ONE_POS,"Failed to read IGT cache file '%s'",fname);
+		BinOutWrite(bo,buf,m);
+	}
+	// then new records from each processor
+	nchunks=BinOutSeek(bo,IGT_HEAD_SIZE+nold*IGT_REC_SIZE,IGT_REC_SIZE,n,IGT_CHUNK,NULL);
+	for (c=0;c<nchunks;c++) {
+		st=c*IGT_CHUNK;
+		m = (st<n) ? MIN(IGT_CHUNK,n-st) : 0;
+		for (r=0;r<m;r++) {
+			ind=list[st+r];
+			IgtKeyToVec(igtKeys[ind],ijk);
+			for (comp=0;comp<6;comp++) val[comp]=igtTable[6*ind+comp]*scale;
+			memcpy(buf+r*IGT_REC_SIZE,ijk,sizeof(ijk));
+			memcpy(buf+r*IGT_REC_SIZE+sizeof(ijk),val,sizeof(val));
+		}
+		BinOutWrite(bo,buf,m);
+	}
+	BinOutClose(bo);
+	Free_general(buf);
+	if (IFROOT) {
+		if (old!=NULL) {
+			fclose(old);
+			remove(fname); // required for rename on Windows
+		}
+		if (rename(tname,fname)!=0) LogError(ONE_POS,"Failed to rename file '%s' to '%s'",tname,fname);
+	}
+}
+
+//=====================================================================================================================
+
+static void InitIgtTable(void)
+/* Computes table of IGT values for distance vectors, which are actually required (see igtTable). In FFT mode each
+ * processor considers only the local part of Dmatrix, for which the required vectors form a box (thin for large number
+ * of processors). In sparse mode the vectors are collected for all pairs of dipoles (as for Sommerfeld integrals in
+ * CalcSomHash), which are much less than the whole computational box for sparse aggregates. Then the evaluation is
+ * distributed in equal chunks among processors (and threads), and the results are gathered on all processors. So each
+ * value is computed only once (in FFT mode - apart from a few layers required by two processors).
+ *
+ * If igt_cache is set, the values are loaded from and saved to a file there (see OpenIgtCache). The values depend only
+ * on WaveNum*dsX, dsY/dsX, dsZ/dsX, and igt_eps (up to scaling by dsX^3). So the cache can be reused, e.g., for
+ * different particles (sizes) with the same kd. Only the missing values are computed, and they are added to the cache,
+ * so the latter accumulates all values computed so far.
+ */
+{
+	size_t p,n,r0,r1,nloc,nold,nnew,nfile,nread,tot[2],*list;
+	bool *done;
+	char fname[MAX_FNAME];
+	FILE *file;
+	const double key[4]={WaveNum*dsX,dsY/dsX,dsZ/dsX,igt_eps};
+#ifdef SPARSE
+	size_t start,*keys,*counts;
+#else
+	int i,j,k,ijk[3];
+	bool *needY,*ownY,*needZ,*ownZ;
+	const int nnn = reduced_FFT ? 1 : 2; // as in InitDmatrix
+#endif
+#ifdef OPENMP
+	const size_t nw=MultOverflow(IGT_NW,omp_get_max_threads(),ONE_POS,"igtWork");
+#else
+	const size_t nw=IGT_NW;
+#endif
+
+	memory+=nw*sizeof(double);
+	if (!prognosis) MALLOC_VECTOR(igtWork,double,nw,ALL);
+#ifdef SPARSE
+	if (prognosis) {
+		/* the number of keys is not known, so the upper estimate is used - the number of distance vectors inside the
+		 * computational box (and within igt_lim), but not larger than the number of pairs of dipoles
+		 */
+		int nb[3]={boxX,boxY,boxZ};
+		if (igt_lim!=UNDEF) {
+			const double lim=sqrt(igtLimR2);
+			nb[0]=MIN(boxX,(int)floor(lim/dsX)+1);
+			nb[1]=MIN(boxY,(int)floor(lim/dsY)+1);
+			nb[2]=MIN(boxZ,(int)floor(lim/dsZ)+1);
+		}
+		n=MIN((size_t)nb[0]*nb[1]*nb[2]-1,nvoid_Ndip*(nvoid_Ndip-1)/2);
+		igtMem=SharedSize(6*n*sizeof(doublecomplex))+(n+((size_t)1<<HashBits(n)))*sizeof(size_t);
+		memory+=igtMem;
+		return;
+	}
+	n=CollectKeys(IgtPairKey,&keys);
+	MALLOC_VECTOR(counts,sizet,nprocs,ALL);
+	igtNkeys=AllGatherCounts(n,counts);
+	// place local keys at their position in the gathered array
+	MALLOC_VECTOR(igtKeys,sizet,igtNkeys,ALL);
+	for (start=0,p=0;p<(size_t)ringid;p++) start+=counts[p];
+	memcpy(igtKeys+start,keys,n*sizeof(size_t));
+	Free_general(keys);
+	AllGatherVar(igtKeys,sizet_type,counts,NULL);
+	igtNkeys=SortUnique(igtKeys,igtNkeys);
+	igtHash=BuildHash(igtKeys,igtNkeys,&igtHashBits);
+	igtMem=SharedSize(6*igtNkeys*sizeof(doublecomplex))+(igtNkeys+((size_t)1<<igtHashBits))*sizeof(size_t);
+	memory+=igtMem;
+	// loading from cache and evaluation of values are distributed in chunks among processors
+	for (p=0;p<(size_t)nprocs;p++) counts[p]=6*(igtNkeys/nprocs+(p<igtNkeys%nprocs));
+	for (r0=0,p=0;p<(size_t)ringid;p++) r0+=counts[p]/6;
+	r1=r0+counts[ringid]/6;
+	MALLOC_SHARED(igtTable,6*igtNkeys); // one copy per node
+#else
+	MALLOC_VECTOR(needY,bool,boxY,ALL);
+	MALLOC_VECTOR(ownY,bool,boxY,ALL);
+	MALLOC_VECTOR(needZ,bool,boxZ,ALL);
+	MALLOC_VECTOR(ownZ,bool,boxZ,ALL);
+	IgtLayers(nnn*local_y0,nnn*local_y1,gridY,boxY,needY,ownY);
+	IgtLayers(nnn*local_z0,nnn*local_z1,gridZ,boxZ,needZ,ownZ);
+	// count the required keys, and then fill them (in increasing order)
+	for (n=0,k=0;k<boxZ;k++) if (needZ[k]) for (j=0;j<boxY;j++) if (needY[j])
+		for (i=0;i<boxX;i++) if (IgtKey(i,j,k)!=SIZE_MAX) n++;
+	igtMem=(6*sizeof(doublecomplex)+sizeof(size_t))*(double)n+sizeof(size_t)*(double)((size_t)1<<HashBits(n));
+	memory+=igtMem;
+	if (prognosis) {
+		Free_general(needY);
+		Free_general(ownY);
+		Free_general(needZ);
+		Free_general(ownZ);
+		return;
+	}
+	igtNkeys=n;
+	MALLOC_VECTOR(igtKeys,sizet,igtNkeys,ALL);
+	for (n=0,k=0;k<boxZ;k++) if (needZ[k]) for (j=0;j<boxY;j++) if (needY[j])
+		for (i=0;i<boxX;i++) if ((p=IgtKey(i,j,k))!=SIZE_MAX) igtKeys[n++]=p;
+	igtHash=BuildHash(igtKeys,igtNkeys,&igtHashBits);
+	// each processor computes all its values
+	r0=0;
+	r1=igtNkeys;
+	MALLOC_VECTOR(igtTable,complex,6*igtNkeys,ALL);
+#endif
+	nloc=r1-r0;
+	MALLOC_VECTOR(done,bool,nloc,ALL);
+	for (p=0;p<nloc;p++) done[p]=false;
+	// load values from cache
+	nold=nfile=nread=0;
+	file=NULL;
+	if (igt_cache!=NULL) {
+		SnprintfErr(ONE_POS,fname,MAX_FNAME,"%s/"F_IGT_CACHE,igt_cache,key[0],key[1],key[2],key[3]);
+		if (IFROOT && (file=OpenIgtCache(fname,key,&nfile))==NULL) nfile=0;
+		MyBcast(&nfile,sizet_type,1,NULL);
+		nread=nfile;
+		nold=ReadIgtCache(file,fname,&nread,r0,r1,done);
+	}
+	// list of values to be computed
+	MALLOC_VECTOR(list,sizet,nloc-nold,ALL);
+	for (nnew=0,p=0;p<nloc;p++) if (!done[p]) list[nnew++]=r0+p;
+	Free_general(done);
+	tot[0]=nold;
+	tot[1]=nnew;
+	MyInnerProduct(tot,sizet_type,2,NULL);
+	if (IFROOT) {
+		if (igt_cache!=NULL) {
+			PRINTFB("IGT cache '%s': %zu values loaded, %zu to be computed\n",fname,tot[0],tot[1]);
+		}
+		else PRINTFB("Calculating table of %zu integrated Green's tensors\n",tot[1]);
+	}
+#ifdef OPENMP
+#	pragma omp parallel for schedule(dynamic)
+#endif
+	for (p=0;p<nnew;p++) {
+		int vec[3];
+		double qvec[3];
+		IgtKeyToVec(igtKeys[list[p]],vec);
+		UnitsGridToCoord(vec[0],vec[1],vec[2],qvec);
+		InterTerm_igt(qvec,igtTable+6*list[p]);
+	}
+#ifdef SPARSE
+	AllGatherVar(igtTable,cmplx_type,counts,NULL);
+	Free_general(counts);
+#else
+	// only the owned values are saved to cache (to avoid duplicates)
+	for (n=0,p=0;p<nnew;p++) {
+		IgtKeyToVec(igtKeys[list[p]],ijk);
+		if (ownY[ijk[1]] && ownZ[ijk[2]]) list[n++]=list[p];
+	}
+	nnew=n;
+	Free_general(needY);
+	Free_general(ownY);
+	Free_general(needZ);
+	Free_general(ownZ);
+#endif
+	// save the cache, if anything is added to it (or it is truncated)
+	if (igt_cache!=NULL) {
+		tot[1]=nnew;
+		MyInnerProduct(tot+1,sizet_type,1,NULL);
+		if (tot[1]>0 || nread<nfile) SaveIgtCache(fname,key,file,nread,list,nnew,tot[1]);
+		else if (file!=NULL) fclose(file);
+	}
+	Free_general(list);
+}
+
+#endif // !NO_FORTRAN
+
+//=====================================================================================================================
+
+static void InitRadialTable(void (*func)(const double rr,doublecomplex QD[static 2]),const bool gauss)
+/* Computes radTable (see RadialTable_int) using func for all squared integer distances in the computational box, but
+ * not more than RAD_TABLE_MAX. The computation is distributed among processors and threads. If gauss, then gaussTable
+ * is also computed (for nloc_av with non-zero Rp).
+ */
+{
+	int i;
+	size_t n,start,*counts;
+
+	// boxes are at least 1, and the table is not needed if it contains only zero distance
+	radN=MIN((size_t)(boxX-1)*(boxX-1)+(size_t)(boxY-1)*(boxY-1)+(size_t)(boxZ-1)*(boxZ-1)+1,RAD_TABLE_MAX);
+	if (radN<2) {
+		radN=0;
+		return;
+	}
+	memory+=2*radN*sizeof(doublecomplex);
+	if (gauss) {
+		gaussN=MAX(MAX(boxX,boxY),boxZ);
+		memory+=gaussN*sizeof(double);
+	}
+	if (prognosis) {
+		radN=gaussN=0;
+		return;
+	}
+	MALLOC_VECTOR(radTable,complex,2*radN,ALL);
+	radTable[0]=radTable[1]=0; // not used
+	// distribute the computation (for 0<n<radN) among processors and threads
+	MALLOC_VECTOR(counts,sizet,nprocs,ALL);
+	for (i=0;i<nprocs;i++) counts[i]=2*((radN-1)/nprocs+((size_t)i<(radN-1)%nprocs));
+	for (start=1,i=0;i<ringid;i++) start+=counts[i]/2;
+#ifdef OPENMP
+#	pragma omp parallel for schedule(static)
+#endif
+	for (n=start;n<start+counts[ringid]/2;n++) (*func)(sqrt((double)n)*gridspace,radTable+2*n);
+	AllGatherVar(radTable+2,cmplx_type,counts,NULL);
+	Free_general(counts);
+	if (gauss) {
+		MALLOC_VECTOR(gaussTable,double,gaussN,ALL);
+		for (i=0;i<gaussN;i++) gaussTable[i]=AverageGaussCube(i*gridspace);
+	}
+}
+
 //=====================================================================================================================
 
 void InitInteraction(void)
 // Initialize the interaction calculations
 {
 #define SET_FUNC_POINTERS(type,name) { type##_int = &type##_##name##_int; type##_real = &type##_##name##_real; }
+#define SET_INTER_POINTERS(name) { SET_FUNC_POINTERS(InterTerm,name); InterTerm_batch = &InterTerm_##name##_batch; }
+#ifdef USE_SSE3
+	// should be initialized before any tables are computed below
+	c1 = _mm_set_pd(1.34959795251974073996e-11,3.92582397764340914444e-14);
+	c2 = _mm_set_pd(-8.86096155697856783296e-7,-3.86632385155548605680e-9);
+	c3 = _mm_set_pd(1.74532925199432957214e-2,1.52308709893354299569e-4);
+	zo = _mm_set_pd(0.0,1.0);
+	inv_2pi = _mm_set_sd(1.0/(2*PI));
+	p360 = _mm_set_sd(360.0);
+	prad_to_deg = _mm_set_sd(180.0/PI);
+
+	for (unsigned int i=0; i<=360; i++) {
+		double x = (PI/180.0)*(double)i;
+		exptbl[i] = _mm_set_pd(sin(x),cos(x));
+	}
+#endif
 	// set InterTerm_int (real) to point at the right functions
 	switch (IntRelation) {
-		case G_POINT_DIP: SET_FUNC_POINTERS(InterTerm,poi); break;
-		case G_FCD: SET_FUNC_POINTERS(InterTerm,fcd); break;
-		case G_FCD_ST: SET_FUNC_POINTERS(InterTerm,fcd_st); break;
-		case G_IGT_SO: SET_FUNC_POINTERS(InterTerm,igt_so); break;
-		case G_NLOC: SET_FUNC_POINTERS(InterTerm,nloc); break;
-		case G_NLOC_AV: SET_FUNC_POINTERS(InterTerm,nloc_av); break;
+		case G_POINT_DIP: SET_INTER_POINTERS(poi); break;
+		case G_FCD:
+			SET_INTER_POINTERS(fcd);
+			InitRadialTable(RadialTerms_fcd,false);
+			break;
+		case G_FCD_ST:
+			SET_INTER_POINTERS(fcd_st);
+			InitRadialTable(RadialTerms_fcd_st,false);
+			break;
+		case G_IGT_SO: SET_INTER_POINTERS(igt_so); break;
+		case G_NLOC:
+			SET_INTER_POINTERS(nloc);
+			InitRadialTable(RadialTerms_nloc,false);
+			break;
+		case G_NLOC_AV:
+			SET_INTER_POINTERS(nloc_av);
+			InitRadialTable(RadialTerms_nloc_av,nloc_Rp!=0);
+			break;
 #ifndef NO_FORTRAN
 		case G_IGT:
-			SET_FUNC_POINTERS(InterTerm,igt);
+			SET_INTER_POINTERS(igt);
 			// initialize IGT distance threshold
 			if (igt_lim!=UNDEF) {
 				igtLimR2=igt_lim*MAX(MAX(dsX,dsY),dsZ);
 				igtLimR2*=igtLimR2;
 			}
+			InitIgtTable();
 			break;
 #endif
 		/* TO ADD NEW INTERACTION FORMULATION
@@ -978,22 +2133,27 @@ void InitInteraction(void)
 		surfRCn=msubInf ? -1 : ((1-msub*msub)/(1+msub*msub));
 	}
 
-#ifdef USE_SSE3
-	c1 = _mm_set_pd(1.34959795251974073996e-11,3.92582397764340914444e-14);
-	c2 = _mm_set_pd(-8.86096155697856783296e-7,-3.86632385155548605680e-9);
-	c3 = _mm_set_pd(1.74532925199432957214e-2,1.52308709893354299569e-4);
-	zo = _mm_set_pd(0.0,1.0);
-	inv_2pi = _mm_set_sd(1.0/(2*PI));
-	p360 = _mm_set_sd(360.0);
-	prad_to_deg = _mm_set_sd(180.0/PI);
+#undef SET_FUNC_POINTERS
+#undef SET_INTER_POINTERS
+}
 
-	for (unsigned int i=0; i<=360; i++) {
-		double x = (PI/180.0)*(double)i;
-		exptbl[i] = _mm_set_pd(sin(x),cos(x));
+//=====================================================================================================================
+
+void FreeInteractionTables(void)
+/* Free tables, which are used only for the initialization of Dmatrix (in FFT mode), so should be called right after
+ * InitDmatrix(). Their memory is also subtracted from the total (it is accounted in memPeak by InitDmatrix).
+ */
+{
+#if !defined(SPARSE) && !defined(NO_FORTRAN)
+	if (IntRelation==G_IGT) {
+		Free_general(igtKeys);
+		Free_general(igtHash);
+		Free_cVector(igtTable);
+		igtKeys=igtHash=NULL;
+		igtTable=NULL; // afterwards values are computed directly
+		memory-=igtMem;
 	}
 #endif
-
-#undef SET_FUNC_POINTERS
 }
 
 //=====================================================================================================================
@@ -1002,9 +2162,27 @@ void FreeInteraction(void)
 // Free buffers used for interaction calculation
 {
 	if (surface && ReflRelation==GR_SOM) {
+#ifdef SPARSE
+		Free_general(somKeys);
+		Free_general(somHash);
+		Free_shared(somTable);
+#else
 		Free_general(somIndex);
 		Free_cVector(somTable);
+#endif
 	}
+#ifndef NO_FORTRAN
+	if (IntRelation==G_IGT) {
+#ifdef SPARSE // in FFT mode the table is freed by FreeInteractionTables()
+		Free_general(igtKeys);
+		Free_general(igtHash);
+		Free_shared(igtTable);
+#endif
+		Free_general(igtWork);
+	}
+#endif
+	Free_cVector(radTable);
+	Free_general(gaussTable);
 	/* TO ADD NEW INTERACTION FORMULATION
 	 * TO ADD NEW REFLECTION FORMULATION
 	 * If you allocate any memory (for tables, etc.), free it here
@@ -20,10 +20,12 @@
 // following function pointers are explained in interaction.c
 extern void (*InterTerm_int)(const int i,const int j,const int k,doublecomplex result[static restrict 6]);
 extern void (*InterTerm_real)(const double qvec[static restrict 3],doublecomplex result[static restrict 6]);
+extern void (*InterTerm_batch)(const int * restrict ijk,const size_t n,doublecomplex * restrict result);
 extern void (*ReflTerm_int)(const int i,const int j,const int k,doublecomplex result[static restrict 6]);
 extern void (*ReflTerm_real)(const double qvec[static restrict 3],doublecomplex result[static restrict 6]);
 
 void InitInteraction(void);
+void FreeInteractionTables(void);
 void FreeInteraction(void);
 
 #endif //__interaction_h
@@ -458,6 +458,15 @@ void FCloseErr(FILE * restrict file,const char * restrict fname,ERR_LOC_DECL)
 
 //======================================================================================================================
 
+void FSeekErr(FILE * restrict file,const size_t offset,const char * restrict fname,ERR_LOC_DECL)
+// sets position in file to 'offset' bytes from its beginning (can be larger than 2 GB) and checks for error
+{
+	if (FSEEK64(file,offset,SEEK_SET)!=0)
+		LogError(ERR_LOC_CALL,"Failed to seek to offset %zu in file '%s'",offset,fname);
+}
+
+//======================================================================================================================
+
 void RemoveErr(const char * restrict fname,ERR_LOC_DECL)
 // remove file and check the result
 {
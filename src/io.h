@@ -78,6 +78,7 @@ void PrintBoth(FILE * restrict file,const char * restrict fmt, ... ) ATT_PRINTF(
 
 FILE *FOpenErr(const char * restrict fname,const char * restrict mode,ERR_LOC_DECL);
 void FCloseErr(FILE * restrict file,const char * restrict fname,ERR_LOC_DECL);
+void FSeekErr(FILE * restrict file,size_t offset,const char * restrict fname,ERR_LOC_DECL);
 void RemoveErr(const char * restrict fname,ERR_LOC_DECL);
 void MkDirErr(const char * restrict dirname,ERR_LOC_DECL);
 
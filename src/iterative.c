@@ -1342,7 +1342,7 @@ static void CalcFieldWKB(doublecomplex * restrict Efield)
 	int i,k; // for traversing single-axis dimensions
 	size_t dip,ind,dip_sl; // for traversing slices or up to local_nRows
 	size_t boxX_l=(size_t)boxX; // to remove type conversion in indexing
-#define INDEX_GRID(i) (position[(i)+2]*boxXY+position[(i)+1]*boxX_l+position[i])
+#define INDEX_GRID(i) (position[(i)+2]*local_boxXY+position[(i)+1]*boxX_l+position[i])
 	/* can be optimized by reusing material_tmp from make_particle.c or keeping the values between the calls. But
 	 * this will require usage of extra memory. So the current option can be considered as corresponding to
 	 * '-opt mem'
@@ -1371,21 +1371,21 @@ static void CalcFieldWKB(doublecomplex * restrict Efield)
 		memPeak+=local_Ndip*sizeof(char);
 		a_mat=true;
 	}
-	if (boxXY<local_nRows) top=rvec;
+	if (local_boxXY<local_nRows) top=rvec;
 	else {
-		MALLOC_VECTOR(top,complex,boxXY,ALL);
-		memPeak+=boxXY*sizeof(doublecomplex);
+		MALLOC_VECTOR(top,complex,local_boxXY,ALL);
+		memPeak+=local_boxXY*sizeof(doublecomplex);
 		a_top=true;
 	}
 #else // define all vectors using memory assigned to Xmatrix; kind of weird but should be OK
 	arg=Xmatrix;
 #	ifdef PARALLEL
 	bottom=Xmatrix+local_Ndip;
-	top=bottom+boxXY;
+	top=bottom+local_boxXY;
 #	else
 	top=Xmatrix+local_Ndip;
 #	endif
-	mat=(unsigned char *)(top + boxXY);
+	mat=(unsigned char *)(top + local_boxXY);
 #endif
 	// calculate function of refractive index
 	for (i=0;i<Nmat;i++) vals[i]=I*(ref_index[i]-1)*kdZ/2;
@@ -1398,17 +1398,18 @@ static void CalcFieldWKB(doublecomplex * restrict Efield)
 	 * 'ind' traverses one slice, and 'dip' - all dipoles
 	 */
 	// First, calculate shifts relative to the bottom of current processor
-	for(ind=0;ind<boxXY;ind++) top[ind]=0;
-	for(k=local_z0,dip_sl=0;k<local_z1_coer;k++,dip_sl+=boxXY) for(ind=0,dip=dip_sl;ind<boxXY;ind++,dip++) {
-		arg[dip]=top[ind]+vals[mat[dip]];
-		top[ind]=arg[dip]+vals[mat[dip]];
-	}
+	for(ind=0;ind<local_boxXY;ind++) top[ind]=0;
+	for(k=local_z0,dip_sl=0;k<local_z1_coer;k++,dip_sl+=local_boxXY)
+		for(ind=0,dip=dip_sl;ind<local_boxXY;ind++,dip++) {
+			arg[dip]=top[ind]+vals[mat[dip]];
+			top[ind]=arg[dip]+vals[mat[dip]];
+		}
 #ifdef PARALLEL
 	// Second, fulfill boundary by exchanging shift values at top and bottom
 	if (ExchangePhaseShifts(bottom,top,&Timing_InitIterComm))
 		// Third (if required) update shift from the obtained values on the bottom
-		for(k=local_z0,dip_sl=0;k<local_z1_coer;k++,dip_sl+=boxXY) for(ind=0,dip=dip_sl;ind<boxXY;ind++,dip++)
-			arg[dip]+=bottom[ind];
+		for(k=local_z0,dip_sl=0;k<local_z1_coer;k++,dip_sl+=local_boxXY)
+			for(ind=0,dip=dip_sl;ind<local_boxXY;ind++,dip++) arg[dip]+=bottom[ind];
 #endif
 	// E=Einc*Exp(arg), but arg is defined on a set of all (including void) dipoles
 	for (ind=0;ind<local_nRows;ind+=3) {
@@ -63,9 +63,9 @@ if "%debug%"=="true" (
   set cwarn=-w
 )
 
-:: C sources are everything except prec_time.c and those with "ocl" or "_test" in its name
+:: C sources are everything except prec_time.c, hmatrix.c (sparse mode only), and those with "ocl" or "_test" in its name
 set cfiles=
-for /f %%G in ('dir /b *.c ^| find /V "ocl" ^| find /V "_test" ^| find /V "prec_time.c"') do (
+for /f %%G in ('dir /b *.c ^| find /V "ocl" ^| find /V "_test" ^| find /V "prec_time.c" ^| find /V "hmatrix.c"') do (
   call set cfiles=%%cfiles%% ..\%%G
 )
 
@@ -34,6 +34,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h> // for time and clock (used for random seed)
+#ifdef OPENMP
+#	include <omp.h>
+#endif
 
 // SEMI-GLOBAL VARIABLES
 
@@ -56,6 +59,9 @@ extern const int gr_mat;
 extern enum shform sg_format;
 extern const bool store_grans;
 #endif
+#if defined(PARALLEL) && !defined(SPARSE)
+extern const bool load_balance;
+#endif
 // defined and initialized in timing.c
 extern TIME_TYPE Timing_Particle;
 #ifndef SPARSE
@@ -70,11 +76,30 @@ const char *sh_form_str1,*sh_form_str2; // strings for log file with shape param
 size_t gr_N;                     // number of granules
 double gr_vf_real;               // actual granules volume fraction
 size_t mat_count[MAX_NMAT+1];    // number of dipoles in each domain
+#if defined(PARALLEL) && !defined(SPARSE)
+// used in calculator.c, fft.c, and matvec.c; distribution of dipoles over FFT slabs, when '-load_balance' is used
+unsigned short * restrict slabPosition; // the same as 'position' but for this distribution
+size_t * restrict slabSpanStart;        // the same as 'spanStart' but for this distribution
+size_t slab_nvoid_Ndip,slab_nSpan;      // numbers of local dipoles and spans in this distribution
+#endif
 
 // LOCAL VARIABLES
 
 #define GEOM_FORMAT "%d %d %d"        // format of the geom file
 #define GEOM_FORMAT_EXT "%d %d %d %d" // extended format of the geom file
+/* binary geometry format, see SaveGeometryBin(); it is recognized by magic string in the beginning of the file, so
+ * FLD_MAGIC in CalculateE.c should be different
+ */
+#define GEO_MAGIC     "ADDAGEO" // 8 bytes, including terminating zero
+#define GEO_BOM       0x01020304
+#define GEO_VERSION   1
+#define GEO_HEAD_SIZE 128
+#define GEO_LAYER     (2*sizeof(uint64_t)) // size of entry in the table of layers
+#define GEO_RUN       (2*sizeof(uint32_t)) // size of a single run
+#define GEO_CHUNK     16777216             // maximum number of records written at once
+#define STREAM_INIT_SIZE 1048576 // initial size of arrays for particle generation, when only non-void dipoles are stored
+#define ROW_TOL 1e-10            // tolerance for determining empty rows in RowRangeX
+#define LAYER_CHUNKS 4           // number of chunks of layers per thread for parallel particle generation
 /* DDSCAT shape formats; several format are used, since first variable is unpredictable and last two are not actually
  * used (only to produce warnings)
  */
@@ -90,6 +115,8 @@ static double dpl_def;           // default value of dpl
 static int minX,minY,minZ;       // minimum values of dipole positions in dipole file
 static FILE * restrict dipfile;  // handle of dipole file
 static enum shform read_format;  // format of dipole file, which is read
+static int bin_boxX,bin_boxY,bin_boxZ; // box sizes in binary dipole file (before applying jagged)
+static size_t bin_N,bin_Nruns;   // number of dipoles and runs in binary dipole file
 static double cX,cY,cZ;          // center for DipoleCoord in units of dipoles (counted from 0)
 static double drelX,drelY,drelZ; // ratios of dipole sizes to the maximal one (dsX/dsMax...)
 static double yx_ratio,zx_ratio; // ratios of particle dimensions along different axes
@@ -113,7 +140,6 @@ static double prang; // for prism
 static double seE,seN,seT,seR,seToverR,seInvR; // for superellipsoid
 // for axisymmetric; all coordinates defined here are relative
 static double * restrict contSegRoMin,* restrict contSegRoMax,* restrict contRo,* restrict contZ;
-static double contCurRo,contCurZ;
 static int contNseg;
 struct segment {
 	bool single;           // whether segment consists of a single joint
@@ -150,6 +176,144 @@ void ChebyshevParams(double eps_in,int n_in,double *dx,double *dz,double *sz,dou
 
 //======================================================================================================================
 
+static size_t WriteGeomSection(binout * restrict bo,const void * restrict buf,const size_t disp,
+	const size_t rec_size,const size_t n)
+/* writes local part of a section of binary geometry file, consisting of 'n' records of size 'rec_size' from 'buf'; see
+ * BinOutSeek() for the meaning of 'disp'. Returns the (global) index of the first local record.
+ */
+{
+	size_t c,nchunks,start,st;
+
+	nchunks=BinOutSeek(bo,disp,rec_size,n,GEO_CHUNK,&start);
+	for (c=0;c<nchunks;c++) {
+		st=c*GEO_CHUNK;
+		if (st<n) BinOutWrite(bo,(const unsigned char *)buf+st*rec_size,MIN(GEO_CHUNK,n-st));
+		else BinOutWrite(bo,buf,0);
+	}
+	return start;
+}
+
+//======================================================================================================================
+
+static void SaveGeometryBin(const char * restrict fname)
+/* saves dipole configuration to a binary file 'fname'. The file has the following layout (all values in native byte
+ * order, which can be checked by the byte-order mark):
+ * bytes 0-7    - magic string GEO_MAGIC (including terminating zero)
+ *       8-11   - byte-order mark GEO_BOM (uint32)
+ *       12-15  - format version (uint32)
+ *       16-19  - size of the header in bytes (uint32)
+ *       20-23  - number of domains Nmat (uint32)
+ *       24-35  - box sizes along x, y, and z (3 x uint32)
+ *       36-39  - reserved (zeros)
+ *       40-47  - number of (non-void) dipoles N (uint64)
+ *       48-55  - number of runs Nruns (uint64)
+ *       56-79  - lattice spacings along x, y, and z (3 x double)
+ *       80-127 - reserved (zeros)
+ * followed by three sections:
+ * 1) table of boxZ layers (z=const), each entry contains indices of the first run and the first dipole of the layer
+ *    (2 x uint64);
+ * 2) Nruns runs of occupied dipoles, each consisting of the starting index (y*boxX+x) inside the layer and the length
+ *    (2 x uint32), runs never cross the layer boundary;
+ * 3) only if Nmat>1, N domain numbers (starting from 0) as unsigned char.
+ * The dipoles are ordered by z, y, and x (the last is the fastest), as in the text formats. The table allows each
+ * processor to read only the part of the file, corresponding to its local z-range.
+ *
+ * In parallel mode all processors write their parts directly into the final file (using MPI-IO).
+ */
+{
+	unsigned char head[GEO_HEAD_SIZE];
+	uint32_t u32,* restrict runs;
+	uint64_t u64,* restrict table;
+	double tmp[3];
+	size_t i,j,nruns,tot_runs,r,ind,prev_ind,runs_disp,start;
+	int z,prev_z,nlay,lay;
+	binout * restrict bo;
+
+	/* first pass - count the runs; position (ushort) ensures that boxX*boxY fits into uint32. It is assumed that local
+	 * dipoles are ordered by z, y, and x, as produced by MakeParticle()
+	 */
+	nruns=0;
+	prev_z=-1;
+	prev_ind=0;
+	for (i=0,j=0;i<local_nvoid_Ndip;i++,j+=3) {
+		z=position[j+2];
+		ind=position[j+1]*(size_t)boxX+position[j];
+		if (z!=prev_z || ind!=prev_ind+1) nruns++;
+		prev_z=z;
+		prev_ind=ind;
+	}
+	nlay=local_z1_coer-local_z0;
+	MALLOC_VECTOR(runs,void,MAX(nruns,1)*GEO_RUN,ALL);
+	MALLOC_VECTOR(table,void,MAX(nlay,1)*GEO_LAYER,ALL);
+	// second pass - fill runs and table of layers (in local indices)
+	r=0;
+	lay=0;
+	prev_z=-1;
+	prev_ind=0;
+	for (i=0,j=0;i<local_nvoid_Ndip;i++,j+=3) {
+		z=position[j+2];
+		ind=position[j+1]*(size_t)boxX+position[j];
+		for (;lay<=z-local_z0;lay++) { // this also handles empty layers
+			table[2*lay]=r;
+			table[2*lay+1]=i;
+		}
+		if (z!=prev_z || ind!=prev_ind+1) {
+			runs[2*r]=(uint32_t)ind;
+			runs[2*r+1]=0;
+			r++;
+		}
+		runs[2*r-1]++;
+		prev_z=z;
+		prev_ind=ind;
+	}
+	for (;lay<nlay;lay++) {
+		table[2*lay]=nruns;
+		table[2*lay+1]=local_nvoid_Ndip;
+	}
+	tot_runs=nruns;
+	MyInnerProduct(&tot_runs,sizet_type,1,NULL);
+	// build header
+	memset(head,0,GEO_HEAD_SIZE);
+	memcpy(head,GEO_MAGIC,sizeof(GEO_MAGIC));
+	u32=GEO_BOM;
+	memcpy(head+8,&u32,sizeof(u32));
+	u32=GEO_VERSION;
+	memcpy(head+12,&u32,sizeof(u32));
+	u32=GEO_HEAD_SIZE;
+	memcpy(head+16,&u32,sizeof(u32));
+	u32=(uint32_t)Nmat;
+	memcpy(head+20,&u32,sizeof(u32));
+	u32=(uint32_t)boxX;
+	memcpy(head+24,&u32,sizeof(u32));
+	u32=(uint32_t)boxY;
+	memcpy(head+28,&u32,sizeof(u32));
+	u32=(uint32_t)boxZ;
+	memcpy(head+32,&u32,sizeof(u32));
+	u64=nvoid_Ndip;
+	memcpy(head+40,&u64,sizeof(u64));
+	u64=tot_runs;
+	memcpy(head+48,&u64,sizeof(u64));
+	tmp[0]=rectScaleX;
+	tmp[1]=rectScaleY;
+	tmp[2]=rectScaleZ;
+	memcpy(head+56,tmp,sizeof(tmp));
+	// write all sections
+	bo=BinOutOpen(fname,head,GEO_HEAD_SIZE);
+	runs_disp=GEO_HEAD_SIZE+boxZ*GEO_LAYER;
+	start=WriteGeomSection(bo,runs,runs_disp,GEO_RUN,nruns);
+	for (lay=0;lay<nlay;lay++) {
+		table[2*lay]+=start;
+		table[2*lay+1]+=local_nvoid_d0;
+	}
+	WriteGeomSection(bo,table,GEO_HEAD_SIZE,GEO_LAYER,nlay);
+	if (Nmat>1) WriteGeomSection(bo,material,runs_disp+tot_runs*GEO_RUN,sizeof(unsigned char),local_nvoid_Ndip);
+	BinOutClose(bo);
+	Free_general(runs);
+	Free_general(table);
+}
+
+//======================================================================================================================
+
 static void SaveGeometry(void)
 // saves dipole configuration to a file
 {
@@ -175,6 +339,7 @@ static void SaveGeometry(void)
 			case SF_TEXT_EXT: ext="geom"; break;
 			case SF_DDSCAT6:
 			case SF_DDSCAT7: ext="dat"; break;
+			case SF_BIN: ext="geom"F_BINSUF; break;
 			default: LogError(ONE_POS,"Unknown format for saved geometry file (%d)",(int)sg_format);
 				// no break
 		}
@@ -182,6 +347,14 @@ static void SaveGeometry(void)
 	}
 	// automatically change format if needed
 	if (sg_format==SF_TEXT && Nmat>1) sg_format=SF_TEXT_EXT;
+	// binary format is written directly into a single file, even in parallel mode
+	if (sg_format==SF_BIN) {
+		SnprintfErr(ALL_POS,fname,MAX_FNAME,"%s/%s",directory,save_geom_fname);
+		SaveGeometryBin(fname);
+		if (IFROOT) PRINTFB("Geometry saved to binary file\n");
+		Timing_FileIO+=GET_TIME()-tstart;
+		return;
+	}
 	// choose filename
 #ifdef PARALLEL
 	SnprintfErr(ALL_POS,fname,MAX_FNAME,"%s/"F_GEOM_TMP,directory,ringid);
@@ -215,6 +388,7 @@ static void SaveGeometry(void)
 					"(IX=IY=IZ=0)\n",(1-boxX)/2.0,(1-boxY)/2.0,(1-boxZ)/2.0);
 				fprintf(geom,"JA  IX  IY  IZ ICOMP(x,y,z)\n");
 				break;
+			case SF_BIN: break; // redundant, treated separately above
 		}
 #ifdef PARALLEL
 	} // end of if
@@ -235,6 +409,7 @@ static void SaveGeometry(void)
 				fprintf(geom,ddscat_format_write,i+local_nvoid_d0+1,position[j],position[j+1],position[j+2],mat,mat,
 					mat);
 				break;
+			case SF_BIN: break; // redundant, treated separately above
 		}
 	}
 	FCloseErr(geom,fname,ALL_POS);
@@ -454,17 +629,17 @@ static void InitContour(const char *fname,double *ratio,double *shSize)
 
 //======================================================================================================================
 
-bool CheckContourSegment(struct segment * restrict seg)
-/* Checks, whether point is under or above the segment, by traversing the tree of segments. It returns true, if
- * intersecting z value is larger than given z, and false otherwise. Point is defined by local variables contCurRo and
- * contCurZ.
+bool CheckContourSegment(const struct segment * restrict seg,const double ro,const double z)
+/* Checks, whether point (ro,z) is under or above the segment, by traversing the tree of segments. It returns true, if
+ * intersecting z value is larger than given z, and false otherwise. Point is passed as arguments (not through global
+ * variables) to enable parallel calls.
  */
 {
 	while (true) {
-		if (contCurZ < seg->zmin) return true;
-		else if (contCurZ > seg->zmax) return false;
-		else if (seg->single) return (contCurZ < seg->add + contCurRo*seg->slope);
-		else seg=(contCurRo<seg->romid ? seg->left : seg->right);
+		if (z < seg->zmin) return true;
+		else if (z > seg->zmax) return false;
+		else if (seg->single) return (z < seg->add + ro*seg->slope);
+		else seg=(ro<seg->romid ? seg->left : seg->right);
 	}
 }
 
@@ -484,13 +659,29 @@ void FreeContourSegment(struct segment * restrict seg)
 //======================================================================================================================
 
 #define KEY_LENGTH 2            // length of key for initialization of random generator
+#define TILE_KEY_LENGTH 4       // the same for a tile (see GenerateGranules)
 #define MAX_ZERO_FITS 1E4       // maximum number of zero fits in a row (each - many granules)
 #define MAX_FALSE_SKIP 10       // number of false skips in granule placement to complete the set
 #define MAX_FALSE_SKIP_SMALL 10 // the same for small granules
 #define MAX_GR_SET USHRT_MAX    // maximum size of granule set
 #define MIN_CELL_SIZE 4.0       // minimum cell size for small granules
-#define CHECK_CELL(a) CheckCell(gr,vgran,tree_index,Di2,occup[a],&fits) // macro for simplicity
-#define CHECK_CELL_TEST(a) (CHECK_CELL(a),fits)                         // ... combined with test for 'fits'
+#define CHECK_CELL(a) CheckCell(gr,gg->vgran,gg->tree_index,Di2,gg->occup[a],&fits) // macro for simplicity
+#define CHECK_CELL_TEST(a) (CHECK_CELL(a),fits)                                     // ... combined with test for 'fits'
+
+// parameters of the auxiliary grid and the current set of granules, used in parallel granule generation
+struct granul_grid {
+	int gX,gY,gZ;          // grid dimensions
+	size_t gXY;            // ... and their product
+	double gdX,gdY,gdZ;    // grid cell sizes
+	double x0,y0,z0;       // grid origin (in dipole grid)
+	double Di,Di2;         // diameter of granule and its square
+	int sx,sy,sz;          // maximum shifts for checks of neighboring cells (large granules)
+	int thick;             // thickness of a tile (number of grid layers)
+	unsigned short * restrict occup;      // information about the occupied cells
+	unsigned short * restrict tree_index; // index for traversing granules inside one cell (small)
+	unsigned char * restrict dom;         // information about the domain on a granule grid (large)
+	double * restrict vgran;              // coordinates of a set of granules
+};
 
 static inline int CheckCell(const double * restrict gr,const double * restrict vgran,
 	const unsigned short * restrict tree_index,const double Di2,const int start,bool * restrict fits)
@@ -511,6 +702,341 @@ static inline int CheckCell(const double * restrict gr,const double * restrict v
 	}
 	return last;
 }
+
+//======================================================================================================================
+
+static int SmallTile(const struct granul_grid * restrict gg,const int t,const int quota,const int off,
+	mt_state * restrict st,size_t * restrict count)
+/* Generates up to 'quota' small granules inside tile t of the auxiliary grid (using random stream 'st'), checking them
+ * only against other granules of the current set. Granules are stored starting from index 'off'; the function returns
+ * the number of placed granules and increments 'count' by the number of random placements. Only the cells of the tile
+ * are changed, so it can be called in parallel for tiles, which are not neighbors of each other.
+ */
+{
+	int ig,false_count,last,index,indX,indY,indZ,sx,sy,sz;
+	bool fits;
+	double gr[3],t1,t2,t3,tmp1;
+	const int gX=gg->gX,gY=gg->gY,gZ=gg->gZ,gXY=(int)gg->gXY;
+	const double gdX=gg->gdX,gdY=gg->gdY,gdZ=gg->gdZ,Di=gg->Di,Di2=gg->Di2;
+	const int kt0=t*gg->thick,kt1=MIN(kt0+gg->thick,gZ); // range of layers in the tile
+
+	ig=false_count=0;
+	while (ig<quota) {
+		(*count)++;
+		false_count++;
+		fits=true;
+		// random position in a grid
+		gr[0]=genrand_r(st,0,gX);
+		gr[1]=genrand_r(st,0,gY);
+		gr[2]=genrand_r(st,kt0,kt1);
+		// coordinates in a grid
+		t1=floor(gr[0]);
+		t2=floor(gr[1]);
+		t3=floor(gr[2]);
+		indX=(int)t1;
+		indY=(int)t2;
+		indZ=(int)t3;
+		t1=gr[0]-t1; // t_i are distances to the edges
+		t2=gr[1]-t2;
+		t3=gr[2]-t3;
+		// convert to usual coordinates (in dipole grid)
+		gr[0]=gr[0]*gdX+gg->x0;
+		gr[1]=gr[1]*gdY+gg->y0;
+		gr[2]=gr[2]*gdZ+gg->z0;
+		index=indZ*gXY+indY*gX+indX;
+		// 'last' is used only if fits, so when this test actually reaches last element
+		last=CHECK_CELL(index);
+		// weird construction (7-level nested 'ifs') but should be fast
+		if (fits) {
+			t1*=gdX; // transform shifts to usual coordinates; done only when needed
+			sx=0;
+			if (t1<Di) {
+				if (indX!=0) sx=-1;
+			}
+			else if ((t1=gdX-t1)<Di && indX!=gX-1) sx=1;
+			if (sx==0 || CHECK_CELL_TEST(index+sx)) { // test for x-neighbor
+				t2*=gdY;
+				sy=0;
+				if (t2<Di) {
+					if (indY!=0) sy=-gX;
+				}
+				else if ((t2=gdY-t2)<Di && indY!=gY-1) sy=gX;
+				if (sy==0 || CHECK_CELL_TEST(index+sy)) { // test for y-neighbor
+					t3*=gdZ;
+					sz=0;
+					if (t3<Di) {
+						if (indZ!=0) sz=-gXY;
+					}
+					else if ((t3=gdZ-t3)<Di && indZ!=gZ-1) sz=gXY;
+					if (sz!=0) {
+						if (CHECK_CELL_TEST(index+sz)) { // test for z-neighbor
+							if (sy!=0) {
+								tmp1=Di2-t2*t2-t3*t3;
+								// test for yz- and xyz-neighbors
+								if (tmp1>0 && CHECK_CELL_TEST(index+sy+sz )&& sx!=0 && t1*t1<tmp1)
+									CHECK_CELL(index+sx+sy+sz);
+							}
+							else if (sx!= 0 && t1*t1+t3*t3<Di2) CHECK_CELL(index+sx+sz);
+						}
+					}
+					// test for xy-neighbor
+					else if (sx!=0 && sy!=0 && t1*t1+t2*t2<Di2) CHECK_CELL(index+sx+sy);
+				}
+			}
+		}
+		if (fits) {
+			memcpy(gg->vgran+3*(off+ig),gr,3*sizeof(double));
+			gg->tree_index[off+ig]=MAX_GR_SET;
+			if (last==MAX_GR_SET) gg->occup[index]=(unsigned short)(off+ig);
+			else gg->tree_index[last]=(unsigned short)(off+ig);
+			ig++;
+			false_count=0;
+		}
+		if (false_count>MAX_FALSE_SKIP_SMALL) break;
+	}
+	return ig;
+}
+
+//======================================================================================================================
+
+static int LargeTile(const struct granul_grid * restrict gg,const int t,const int quota,const int off,
+	mt_state * restrict st,size_t * restrict count)
+/* The same as SmallTile, but for large granules. Each cell of the auxiliary grid can contain no more than one granule,
+ * and a quick check against the domain pattern is performed.
+ */
+{
+	int ig,false_count,bit,index,index1,dom_index,dom_index1,dom_index2,indX,indY,indZ,i,j,k,i0,i1,j0,j1,k0,k1;
+	bool fits;
+	double gr[3],t1,t2,t3;
+	const int gX=gg->gX,gY=gg->gY,gZ=gg->gZ,gXY=(int)gg->gXY,sx=gg->sx,sy=gg->sy,sz=gg->sz;
+	const double gdXh=gg->gdX/2,gdYh=gg->gdY/2,gdZh=gg->gdZ/2,Di2=gg->Di2;
+	const int kt0=t*gg->thick,kt1=MIN(kt0+gg->thick,gZ); // range of layers in the tile
+
+	ig=false_count=0;
+	while (ig<quota) {
+		(*count)++;
+		// random position in a double grid
+		gr[0]=genrand_r(st,0,2*gX);
+		gr[1]=genrand_r(st,0,2*gY);
+		gr[2]=genrand_r(st,2*kt0,2*kt1);
+		// coordinates in doubled grid
+		indX=(int)floor(gr[0]);
+		indY=(int)floor(gr[1]);
+		indZ=(int)floor(gr[2]);
+		bit=1<<((indX&1)+((indY&1)<<1)+((indZ&1)<<2)); // position bit inside one cell
+		// coordinates in usual grid
+		indX/=2;
+		indY/=2;
+		indZ/=2;
+		index=indZ*gXY+indY*gX+indX;
+		// two simple checks
+		if (!(gg->dom[index]&bit) && gg->occup[index]==MAX_GR_SET) {
+			// convert to usual coordinates (in dipole grid)
+			gr[0]=gr[0]*gdXh+gg->x0;
+			gr[1]=gr[1]*gdYh+gg->y0;
+			gr[2]=gr[2]*gdZh+gg->z0;
+			fits=true;
+			false_count++;
+			if ((i0=indX-sx)<0) i0=0;
+			if ((i1=indX+sx+1)>gX) i1=gX;
+			if ((j0=indY-sy)<0) j0=0;
+			if ((j1=indY+sy+1)>gY) j1=gY;
+			if ((k0=indZ-sz)<0) k0=0;
+			if ((k1=indZ+sz+1)>gZ) k1=gZ;
+			dom_index2=k0*gXY;
+			for (k=k0;k<k1;k++,dom_index2+=gXY) {
+				dom_index1=dom_index2+j0*gX;
+				for (j=j0;j<j1;j++,dom_index1+=gX) {
+					dom_index=dom_index1+i0;
+					for (i=i0;i<i1;i++,dom_index++) if (gg->occup[dom_index]!=MAX_GR_SET) {
+						index1=3*gg->occup[dom_index];
+						t1=gr[0]-gg->vgran[index1];
+						t2=gr[1]-gg->vgran[index1+1];
+						t3=gr[2]-gg->vgran[index1+2];
+						if ((t1*t1+t2*t2+t3*t3)<Di2) {
+							fits=false;
+							break;
+						}
+					}
+					if (!fits) break;
+				}
+				if (!fits) break;
+			}
+			if (fits) {
+				memcpy(gg->vgran+3*(off+ig),gr,3*sizeof(double));
+				gg->occup[index]=(unsigned short)(off+ig);
+				ig++;
+				false_count=0;
+				/* Here it is possible to correct the domain pattern because of the presence of a new granule. However
+				 * it probably will be useful only for large volume fractions
+				 */
+			}
+			if (false_count>MAX_FALSE_SKIP) break;
+		}
+	}
+	return ig;
+}
+
+//======================================================================================================================
+
+static int GenerateGranules(const struct granul_grid * restrict gg,const int cur_Ngr,const bool sm_gr,
+	const unsigned long * restrict key,const size_t nset,size_t * restrict count)
+/* Generates a set of up to cur_Ngr non-intersecting granules on the auxiliary grid, stores them in gg->vgran, and
+ * returns their number (count is incremented by the number of random placements). The grid is divided into tiles
+ * (slabs along z), so that a granule can intersect only with granules in the same or neighboring tiles. Then the tiles
+ * are processed in two passes (even and odd ones), each in parallel (when OPENMP is used). Each tile uses its own
+ * random stream, initialized by the main key together with set and tile numbers. Finally, the granules are shuffled
+ * using the main random stream. Therefore, the result is completely determined by the main key and is independent of
+ * the number of threads.
+ */
+{
+	int t,ntile,sum,rot,ig,jg,pass;
+	int k0,k1;
+	size_t ui,wsum,cnt;
+	int * restrict quota,* restrict off,* restrict placed;
+	size_t * restrict weight;
+	double tmp[3];
+
+	ntile=(gg->gZ+gg->thick-1)/gg->thick;
+	MALLOC_VECTOR(quota,int,ntile,ONE);
+	MALLOC_VECTOR(off,int,ntile,ONE);
+	MALLOC_VECTOR(placed,int,ntile,ONE);
+	MALLOC_VECTOR(weight,sizet,ntile,ONE);
+	// weight of a tile is the number of available cells in it
+	wsum=0;
+	for (t=0;t<ntile;t++) {
+		k0=t*gg->thick;
+		k1=MIN(k0+gg->thick,gg->gZ);
+		if (sm_gr) weight[t]=(k1-k0)*gg->gXY;
+		else {
+			weight[t]=0;
+			for (ui=k0*gg->gXY;ui<k1*gg->gXY;ui++) if (gg->dom[ui]!=0xFF) weight[t]++;
+		}
+		wsum+=weight[t];
+	}
+	/* distribute the number of granules among tiles proportional to weights; the remainder is distributed one by one
+	 * starting from a random tile. For large granules, the number for each tile is limited by the number of available
+	 * cells.
+	 */
+	sum=0;
+	for (t=0;t<ntile;t++) {
+		quota[t]=(int)((cur_Ngr*(double)weight[t])/wsum);
+		sum+=quota[t];
+	}
+	rot=(int)genrand(0,ntile);
+	for (t=rot;sum<cur_Ngr;t=(t+1)%ntile) if (sm_gr || (size_t)quota[t]<weight[t]) {
+		quota[t]++;
+		sum++;
+	}
+	off[0]=0;
+	for (t=1;t<ntile;t++) off[t]=off[t-1]+quota[t-1];
+	// main part
+	cnt=0;
+	for (pass=0;pass<2;pass++) {
+#ifdef OPENMP
+#	pragma omp parallel for schedule(dynamic) reduction(+:cnt)
+#endif
+		for (t=pass;t<ntile;t+=2) {
+			mt_state st;
+			unsigned long tkey[TILE_KEY_LENGTH]={key[0],key[1],(unsigned long)nset,(unsigned long)t};
+
+			if (quota[t]==0) placed[t]=0;
+			else {
+				init_by_array_r(&st,tkey,TILE_KEY_LENGTH);
+				if (sm_gr) placed[t]=SmallTile(gg,t,quota[t],off[t],&st,&cnt);
+				else placed[t]=LargeTile(gg,t,quota[t],off[t],&st,&cnt);
+			}
+		}
+	}
+	(*count)+=cnt;
+	// compact granules in the order of tiles
+	ig=0;
+	for (t=0;t<ntile;t++) {
+		memmove(gg->vgran+3*ig,gg->vgran+3*off[t],3*placed[t]*sizeof(double));
+		ig+=placed[t];
+	}
+	/* shuffle granules (Fisher-Yates algorithm), so that their order is not correlated with position. This is important
+	 * when only part of the set is used (to reach exactly the required number of granules).
+	 */
+	for (jg=ig-1;jg>0;jg--) {
+		t=(int)genrand(0,jg+1);
+		memcpy(tmp,gg->vgran+3*t,3*sizeof(double));
+		memcpy(gg->vgran+3*t,gg->vgran+3*jg,3*sizeof(double));
+		memcpy(gg->vgran+3*jg,tmp,3*sizeof(double));
+	}
+	Free_general(quota);
+	Free_general(off);
+	Free_general(placed);
+	Free_general(weight);
+	return ig;
+}
+
+//======================================================================================================================
+
+static bool GranuleInDomain(const double * restrict gr,const double R,const double R2)
+/* checks whether all local dipoles inside the granule (with center gr and radius R, R2=R^2) belong to the domain to be
+ * granulated
+ */
+{
+	int i,j,k,i0,i1,j0,j1,k0,k1;
+	size_t index,index1,index2;
+	double tmp1,tmp2;
+
+	k0=MAX((int)ceil(gr[2]-R),local_z0);
+	k1=MIN((int)floor(gr[2]+R),local_z1_coer-1);
+	index2=(k0-local_z0)*boxXY;
+	for (k=k0;k<=k1;k++,index2+=boxXY) {
+		tmp1=R2-(gr[2]-k)*(gr[2]-k);
+		tmp2=sqrt(tmp1);
+		j0=(int)ceil(gr[1]-tmp2);
+		j1=(int)floor(gr[1]+tmp2);
+		index1=index2+j0*boxX;
+		for (j=j0;j<=j1;j++,index1+=boxX) {
+			tmp2=sqrt(tmp1-(gr[1]-j)*(gr[1]-j));
+			i0=(int)ceil(gr[0]-tmp2);
+			i1=(int)floor(gr[0]+tmp2);
+			index=index1+i0;
+			for (i=i0;i<=i1;i++,index++) if (material_tmp[index]!=gr_mat) return false;
+		}
+	}
+	return true;
+}
+
+//======================================================================================================================
+
+static size_t FillGranule(const double * restrict gr,const double R,const double R2)
+/* fills local dipoles inside the granule (with center gr and radius R, R2=R^2) with granule material; returns the
+ * number of filled dipoles
+ */
+{
+	int i,j,k,i0,i1,j0,j1,k0,k1;
+	size_t index,index1,index2,nd;
+	double tmp1,tmp2;
+
+	nd=0;
+	k0=MAX((int)ceil(gr[2]-R),local_z0);
+	k1=MIN((int)floor(gr[2]+R),local_z1_coer-1);
+	index2=(k0-local_z0)*boxXY;
+	for (k=k0;k<=k1;k++,index2+=boxXY) {
+		tmp1=R2-(gr[2]-k)*(gr[2]-k);
+		tmp2=sqrt(tmp1);
+		j0=(int)ceil(gr[1]-tmp2);
+		j1=(int)floor(gr[1]+tmp2);
+		index1=index2+j0*boxX;
+		for (j=j0;j<=j1;j++,index1+=boxX) {
+			tmp2=sqrt(tmp1-(gr[1]-j)*(gr[1]-j));
+			i0=(int)ceil(gr[0]-tmp2);
+			i1=(int)floor(gr[0]+tmp2);
+			index=index1+i0;
+			for (i=i0;i<=i1;i++,index++) {
+				material_tmp[index]=(unsigned char)(Nmat-1);
+				nd++;
+			}
+		}
+	}
+	return nd;
+}
+
 //======================================================================================================================
 
 static size_t PlaceGranules(void)
@@ -529,21 +1055,25 @@ static size_t PlaceGranules(void)
  * statistical properties of the obtained granules distribution may be not perfect, however it seems good enough for our
  * applications.
  *
+ * Generation of each set of granules (on root processor) is performed in parallel (when OPENMP is used) by dividing
+ * the auxiliary grid into tiles (slabs along z) with independent random streams, see GenerateGranules. The resulting
+ * granule positions depend only on the random seed, but not on the number of threads. Checks of granules against the
+ * domain and filling of dipoles are also performed in parallel on each processor.
+ *
  * Currently it is not working with jagged. That should be improved, by rewriting the jagged calculation throughout the
  * program
  */
 {
-	int i,j,k,zerofit,last;
-	size_t n,count,count_gr,false_count,ui;
+	int i,j,k,zerofit;
+	size_t n,count,count_gr,ui;
+	size_t nset;                         // number of current set of granules
 	size_t nd;                           // number of dipoles occupied by granules
 	int index,index1,index2;             // indices for dipole grid
 	int dom_index,dom_index1,dom_index2; // indices for auxiliary grid
 	int gX,gY,gZ;                        // auxiliary grid dimensions
 	size_t gXY,gr_gN;                    // ... and their products
 	size_t avail;                        // number of available (free) domain cells
-	int gX2,gY2,gZ2,locgZ2;
-	int i0,i1,j0,j1,k0,k1;
-	bool fits;
+	int gX2,gY2,locgZ2;
 	int cur_Ngr,ig,max_Ngr; // number of granules in a current set, index, and maximum set size
 	double gdX,gdY,gdZ,gdXh,gdYh,gdZh; // auxiliary grid cell sizes and their halfs (h)
 	int locz0,locz1,locgZ,gr_locgN;
@@ -552,8 +1082,8 @@ static size_t PlaceGranules(void)
 	int id0,id1,jd0,jd1,kd0,kd1; // dipoles limit that fall inside inner box
 	int Nfit;        // number of successfully placed granules in a current set
 	double overhead; // estimate of the overhead needed to have exactly needed N of granules
-	double tmp1,tmp2,t1,t2,t3;
-		// maximum shifts for checks of neighboring cells in auxiliary grid; for 'small' it is the shift in index
+	double tmp1,tmp2;
+		// maximum shifts for checks of neighboring cells in auxiliary grid (only for large granules)
 	int sx,sy,sz;
 	unsigned long key[KEY_LENGTH];   // key to initialize random number generator
 	unsigned char * restrict dom;    // information about the domain on a granule grid
@@ -565,9 +1095,9 @@ static size_t PlaceGranules(void)
 	int * restrict ginX,* restrict ginY,* restrict ginZ; // indices to find dipoles inside auxiliary grid
 	int indX,indY,indZ;    // indices for doubled auxiliary grid
 	int bit;               // bit position in char of 'dom'
-	double gr[3];          // coordinates of a single granule
 	FILE * restrict file;  // file for saving granule positions
 	char fname[MAX_FNAME]; // filename of file
+	struct granul_grid gg; // parameters for generation of granule sets
 	double minval;         // minimum size of auxiliary grid
 
 	// next line should never happen
@@ -576,7 +1106,7 @@ static size_t PlaceGranules(void)
 	 * granules is largely independent (although there are some common parts, which motivates against complete
 	 * separation of them into two functions).
 	 */
-	zerofit=gX2=gY2=gZ2=locgZ2=id0=id1=jd0=jd1=kd0=kd1=indZ=locgZ=gr_locgN=sx=sy=sz=0;
+	zerofit=gX2=gY2=locgZ2=id0=id1=jd0=jd1=kd0=kd1=indZ=locgZ=gr_locgN=sx=sy=sz=0;
 	gdXh=gdYh=gdZh=0;
 	ginX=ginY=ginZ=NULL;
 	dom=NULL;
@@ -645,7 +1175,6 @@ static size_t PlaceGranules(void)
 		gdXh=gdX/2;
 		gY2=2*gY;
 		gdYh=gdY/2;
-		gZ2=2*gZ;
 		gdZh=gdZ/2;
 		/* this sets maximum distance of neighboring cells to check; condition gdX<R can only occur if gX<=7, which is
 		 * quite rare, so no optimization is performed. sx>3 can only occur if gX<=2 and then it doesn't make sense to
@@ -701,7 +1230,28 @@ static size_t PlaceGranules(void)
 		if (kd0>=ginZ[1]) indZ++;
 		kd1=MIN(ginZ[locgZ2],local_z1_coer);
 	}
-	n=count=count_gr=false_count=0;
+	// initialize parameters for generation of granule sets
+	gg.gX=gX;
+	gg.gY=gY;
+	gg.gZ=gZ;
+	gg.gXY=gXY;
+	gg.gdX=gdX;
+	gg.gdY=gdY;
+	gg.gdZ=gdZ;
+	gg.x0=x0;
+	gg.y0=y0;
+	gg.z0=z0;
+	gg.Di=Di;
+	gg.Di2=Di2;
+	gg.sx=sx;
+	gg.sy=sy;
+	gg.sz=sz;
+	gg.thick=sm_gr ? 1 : sz; // see comments on sx,sy,sz above
+	gg.occup=occup;
+	gg.tree_index=tree_index;
+	gg.dom=dom;
+	gg.vgran=vgran;
+	n=count=count_gr=nset=0;
 	nd=0;
 	// crude estimate of the probability to place a small granule into domain
 	if (sm_gr) overhead=Ndip/mat_count[gr_mat];
@@ -709,88 +1259,13 @@ static size_t PlaceGranules(void)
 	// main cycle
 	D("Starting main iteration cycle");
 	while (n<gr_N) {
+		nset++;
 		if (sm_gr) { // small granules
 			// just generate granules
 			if (IFROOT) {
 				cur_Ngr=MIN(ceil((gr_N-n)*overhead),max_Ngr);
-				// generate points and quick check
-				ig=false_count=0;
 				for (ui=0;ui<gr_gN;ui++) occup[ui]=MAX_GR_SET; // used as undefined
-				while (ig<cur_Ngr) {
-					count++;
-					false_count++;
-					fits=true;
-					// random position in a grid
-					gr[0]=genrand(0,gX);
-					gr[1]=genrand(0,gY);
-					gr[2]=genrand(0,gZ);
-					// coordinates in a grid
-					t1=floor(gr[0]);
-					t2=floor(gr[1]);
-					t3=floor(gr[2]);
-					indX=(int)t1;
-					indY=(int)t2;
-					indZ=(int)t3;
-					t1=gr[0]-t1; // t_i are distances to the edges
-					t2=gr[1]-t2;
-					t3=gr[2]-t3;
-					// convert to usual coordinates (in dipole grid)
-					gr[0]=gr[0]*gdX+x0;
-					gr[1]=gr[1]*gdY+y0;
-					gr[2]=gr[2]*gdZ+z0;
-					index=indZ*gXY+indY*gX+indX;
-					// 'last' is used only if fits, so when this test actually reaches last element
-					last=CHECK_CELL(index);
-					// weird construction (7-level nested 'ifs') but should be fast
-					if (fits) {
-						t1*=gdX; // transform shifts to usual coordinates; done only when needed
-						sx=0;
-						if (t1<Di) {
-							if (indX!=0) sx=-1;
-						}
-						else if ((t1=gdX-t1)<Di && indX!=gX-1) sx=1;
-						if (sx==0 || CHECK_CELL_TEST(index+sx)) { // test for x-neighbor
-							t2*=gdY;
-							sy=0;
-							if (t2<Di) {
-								if (indY!=0) sy=-gX;
-							}
-							else if ((t2=gdY-t2)<Di && indY!=gY-1) sy=gX;
-							if (sy==0 || CHECK_CELL_TEST(index+sy)) { // test for y-neighbor
-								t3*=gdZ;
-								sz=0;
-								if (t3<Di) {
-									if (indZ!=0) sz=-(int)gXY;
-								}
-								else if ((t3=gdZ-t3)<Di && indZ!=gZ-1) sz=gXY;
-								if (sz!=0) {
-									if (CHECK_CELL_TEST(index+sz)) { // test for z-neighbor
-										if (sy!=0) {
-											tmp1=Di2-t2*t2-t3*t3;
-											// test for yz- and xyz-neighbors
-											if (tmp1>0 && CHECK_CELL_TEST(index+sy+sz )&& sx!=0 && t1*t1<tmp1)
-												CHECK_CELL(index+sx+sy+sz);
-										}
-										else if (sx!= 0 && t1*t1+t3*t3<Di2) CHECK_CELL(index+sx+sz);
-									}
-								}
-								// test for xy-neighbor
-								else if (sx!=0 && sy!=0 && t1*t1+t2*t2<Di2) CHECK_CELL(index+sx+sy);
-							}
-						}
-					}
-					if (fits) {
-						memcpy(vgran+3*ig,gr,3*sizeof(double));
-						tree_index[ig]=MAX_GR_SET;
-						if (last==MAX_GR_SET) occup[index]=(unsigned short)ig;
-						else tree_index[last]=(unsigned short)ig;
-						ig++;
-						false_count=0;
-					}
-					if (false_count>MAX_FALSE_SKIP_SMALL) break;
-				}
-				// real number of placed granules for this set
-				cur_Ngr=ig;
+				cur_Ngr=GenerateGranules(&gg,cur_Ngr,true,key,nset,&count);
 			}
 		}
 		else { // large granules
@@ -846,71 +1321,8 @@ static size_t PlaceGranules(void)
 				tmp1=(gr_N-n)*overhead;
 				if (cur_Ngr>tmp1) cur_Ngr=(int)ceil(tmp1);
 				// generate points and quick check
-				ig=false_count=0;
 				for (ui=0;ui<gr_gN;ui++) occup[ui]=MAX_GR_SET; // used as undefined
-				while (ig<cur_Ngr) {
-					count++;
-					// random position in a double grid
-					gr[0]=genrand(0,gX2);
-					gr[1]=genrand(0,gY2);
-					gr[2]=genrand(0,gZ2);
-					// coordinates in doubled grid
-					indX=(int)floor(gr[0]);
-					indY=(int)floor(gr[1]);
-					indZ=(int)floor(gr[2]);
-					bit=1<<((indX&1)+((indY&1)<<1)+((indZ&1)<<2)); // position bit inside one cell
-					// coordinates in usual grid
-					indX/=2;
-					indY/=2;
-					indZ/=2;
-					index=indZ*gXY+indY*gX+indX;
-					// two simple checks
-					if (!(dom[index]&bit) && occup[index]==MAX_GR_SET) {
-						// convert to usual coordinates (in dipole grid)
-						gr[0]=gr[0]*gdXh+x0;
-						gr[1]=gr[1]*gdYh+y0;
-						gr[2]=gr[2]*gdZh+z0;
-						fits=true;
-						false_count++;
-						if ((i0=indX-sx)<0) i0=0;
-						if ((i1=indX+sx+1)>gX) i1=gX;
-						if ((j0=indY-sy)<0) j0=0;
-						if ((j1=indY+sy+1)>gY) j1=gY;
-						if ((k0=indZ-sz)<0) k0=0;
-						if ((k1=indZ+sz+1)>gZ) k1=gZ;
-						dom_index2=k0*gXY;
-						for (k=k0;k<k1;k++,dom_index2+=gXY) {
-							dom_index1=dom_index2+j0*gX;
-							for (j=j0;j<j1;j++,dom_index1+=gX) {
-								dom_index=dom_index1+i0;
-								for (i=i0;i<i1;i++,dom_index++) if (occup[dom_index]!=MAX_GR_SET) {
-									index1=3*occup[dom_index];
-									t1=gr[0]-vgran[index1];
-									t2=gr[1]-vgran[index1+1];
-									t3=gr[2]-vgran[index1+2];
-									if ((t1*t1+t2*t2+t3*t3)<Di2) {
-										fits=false;
-										break;
-									}
-								}
-								if (!fits) break;
-							}
-							if (!fits) break;
-						}
-						if (fits) {
-							memcpy(vgran+3*ig,gr,3*sizeof(double));
-							occup[index]=(unsigned short)ig;
-							ig++;
-							false_count=0;
-							/* Here it is possible to correct the domain pattern because of the presence of a new
-							 * granule. However it probably will be useful only for large volume fractions
-							 */
-						}
-						if (false_count>MAX_FALSE_SKIP) break;
-					}
-				}
-				// real number of placed granules for this set
-				cur_Ngr=ig;
+				cur_Ngr=GenerateGranules(&gg,cur_Ngr,false,key,nset,&count);
 			}
 		} // end of large granules
 		D("Set of possible granules produced");
@@ -919,67 +1331,21 @@ static size_t PlaceGranules(void)
 		MyBcast(vgran,double_type,3*cur_Ngr,&Timing_GranulComm);
 		count_gr+=cur_Ngr;
 		// final check if granules belong to the domain
-		for (ig=0;ig<cur_Ngr;ig++) {
-			memcpy(gr,vgran+3*ig,3*sizeof(double));
-			k0=MAX((int)ceil(gr[2]-R),local_z0);
-			k1=MIN((int)floor(gr[2]+R),local_z1_coer-1);
-			fits=true;
-			index2=(k0-local_z0)*boxXY;
-			for (k=k0;k<=k1;k++,index2+=boxXY) {
-				tmp1=R2-(gr[2]-k)*(gr[2]-k);
-				tmp2=sqrt(tmp1);
-				j0=(int)ceil(gr[1]-tmp2);
-				j1=(int)floor(gr[1]+tmp2);
-				index1=index2+j0*boxX;
-				for (j=j0;j<=j1;j++,index1+=boxX) {
-					tmp2=sqrt(tmp1-(gr[1]-j)*(gr[1]-j));
-					i0=(int)ceil(gr[0]-tmp2);
-					i1=(int)floor(gr[0]+tmp2);
-					index=index1+i0;
-					for (i=i0;i<=i1;i++,index++) {
-						if (material_tmp[index]!=gr_mat) {
-							fits=false;
-							break;
-						}
-					}
-					if (!fits) break;
-				}
-				if (!fits) break;
-			}
-			vfit[ig]=fits;
-		}
+#ifdef OPENMP
+#	pragma omp parallel for schedule(dynamic)
+#endif
+		for (ig=0;ig<cur_Ngr;ig++) vfit[ig]=GranuleInDomain(vgran+3*ig,R,R2);
 		// collect fits
 		ExchangeFits(vfit,cur_Ngr,&Timing_GranulComm);
-		// fit dipole grid with successive granules
+		// determine successful granules to be used (n may reach gr_N inside the set)
 		Nfit=n;
-		for (ig=0;ig<cur_Ngr && n<gr_N;ig++) {
-			if (vfit[ig]) { // a successful granule
-				n++;
-				// fill dipoles in the sphere with granule material
-				memcpy(gr,vgran+3*ig,3*sizeof(double));
-				k0=MAX((int)ceil(gr[2]-R),local_z0);
-				k1=MIN((int)floor(gr[2]+R),local_z1_coer-1);
-				index2=(k0-local_z0)*boxXY;
-				for (k=k0;k<=k1;k++,index2+=boxXY) {
-					tmp1=R2-(gr[2]-k)*(gr[2]-k);
-					tmp2=sqrt(tmp1);
-					j0=(int)ceil(gr[1]-tmp2);
-					j1=(int)floor(gr[1]+tmp2);
-					index1=index2+j0*boxX;
-					for (j=j0;j<=j1;j++,index1+=boxX) {
-						tmp2=sqrt(tmp1-(gr[1]-j)*(gr[1]-j));
-						i0=(int)ceil(gr[0]-tmp2);
-						i1=(int)floor(gr[0]+tmp2);
-						index=index1+i0;
-						for (i=i0;i<=i1;i++,index++) {
-							material_tmp[index]=(unsigned char)(Nmat-1);
-							nd++;
-						}
-					}
-				}
-			}
-		}
+		for (ig=0;ig<cur_Ngr && n<gr_N;ig++) if (vfit[ig]) n++;
 		cur_Ngr=ig; // this is non-trivial only if n=gr_N occurred above
+		// fill dipoles in the spheres with granule material; granules of a set do not intersect, hence can be processed
+#ifdef OPENMP
+#	pragma omp parallel for schedule(dynamic) reduction(+:nd)
+#endif
+		for (ig=0;ig<cur_Ngr;ig++) if (vfit[ig]) nd+=FillGranule(vgran+3*ig,R,R2);
 		// save correct granule positions to file
 		if (store_grans && IFROOT) for (ig=0;ig<cur_Ngr;ig++) if (vfit[ig]) fprintf(file,GFORM3L"\n",
 			gridspace*(vgran[3*ig]-cX),gridspace*(vgran[3*ig+1]-cY),gridspace*(vgran[3*ig+2]-cZ));
@@ -1029,6 +1395,7 @@ static size_t PlaceGranules(void)
 	return nd;
 }
 #undef KEY_LENGTH
+#undef TILE_KEY_LENGTH
 #undef MAX_ZERO_FITS
 #undef MAX_FALSE_SKIP
 #undef MAX_FALSE_SKIP_SMALL
@@ -1041,6 +1408,57 @@ static size_t PlaceGranules(void)
 
 #endif // !SPARSE
 
+static void BinReadAt(void * restrict buf,const size_t size,const size_t n,const size_t offset,
+	const char * restrict fname)
+// reads n elements of size 'size' from binary dipole file, starting from 'offset' bytes from its beginning
+{
+	if (n==0) return;
+	FSeekErr(dipfile,offset,fname,ALL_POS);
+	if (fread(buf,size,n,dipfile)!=n)
+		LogError(ALL_POS,"Failed to read %zu elements at offset %zu from binary dipole file %s",n,offset,fname);
+}
+
+//======================================================================================================================
+
+static void InitDipFileBin(const char * restrict fname,int *bX,int *bY,int *bZ,int *Nm)
+/* reads the header of binary dipole file (opened in InitDipFile), see SaveGeometryBin() for the description of the
+ * format. Since box sizes and number of dipoles are stored explicitly, the rest of the file is not scanned at all.
+ */
+{
+	unsigned char head[GEO_HEAD_SIZE];
+	uint32_t u32[7];
+	uint64_t u64[2];
+
+	BinReadAt(head,1,GEO_HEAD_SIZE,0,fname);
+	memcpy(u32,head+8,sizeof(u32));
+	memcpy(u64,head+40,sizeof(u64));
+	if (u32[0]!=GEO_BOM) LogError(ONE_POS,"Byte order of binary dipole file %s differs from that of the current "
+		"machine",fname);
+	if (u32[1]>GEO_VERSION) LogError(ONE_POS,"Binary dipole file %s has unsupported version of the format (%u)",fname,
+		(unsigned)u32[1]);
+	if (u32[2]<GEO_HEAD_SIZE) LogError(ONE_POS,"Inconsistent header size (%u) in binary dipole file %s",
+		(unsigned)u32[2],fname);
+	if (u32[3]<1 || u32[3]>MAX_NMAT) LogError(ONE_POS,"Number of domains (%u) in binary dipole file %s is outside of "
+		"the allowed range [1,%d]",(unsigned)u32[3],fname,MAX_NMAT);
+	if (u32[4]<1 || u32[5]<1 || u32[6]<1 || u32[4]>USHRT_MAX || u32[5]>USHRT_MAX || u32[6]>USHRT_MAX)
+		LogError(ONE_POS,"Box sizes (%ux%ux%u) in binary dipole file %s are either zero or too large",
+		(unsigned)u32[4],(unsigned)u32[5],(unsigned)u32[6],fname);
+	if (u64[0]==0) LogError(ONE_POS,"No dipole positions are found in %s",fname);
+	bin_boxX=(int)u32[4];
+	bin_boxY=(int)u32[5];
+	bin_boxZ=(int)u32[6];
+	bin_N=u64[0];
+	bin_Nruns=u64[1];
+	minX=minY=minZ=0;
+	*Nm=(int)u32[3];
+	nvoid_Ndip=bin_N*jagged*jagged*jagged;
+	*bX=jagged*bin_boxX;
+	*bY=jagged*bin_boxY;
+	*bZ=jagged*bin_boxZ;
+}
+
+//======================================================================================================================
+
 static void InitDipFile(const char * restrict fname,int *bX,int *bY,int *bZ,int *Nm,const char **rft)
 /* read dipole file first to determine box sizes and Nmat; input is not checked for very large numbers (integer
  * overflows) to increase speed; this function opens file for reading, the file is closed in ReadDipFile.
@@ -1058,6 +1476,18 @@ static void InitDipFile(const char * restrict fname,int *bX,int *bY,int *bZ,int
 	const char *rf_text;
 
 	TIME_TYPE tstart=GET_TIME();
+	// test for binary format first, by its magic string
+	dipfile=FOpenErr(fname,"rb",ALL_POS);
+	if (fread(linebuf,1,sizeof(GEO_MAGIC),dipfile)==sizeof(GEO_MAGIC)
+		&& memcmp(linebuf,GEO_MAGIC,sizeof(GEO_MAGIC))==0) {
+		read_format=SF_BIN;
+		*rft="ADDA binary format";
+		InitDipFileBin(fname,bX,bY,bZ,Nm);
+		Timing_FileIO+=GET_TIME()-tstart;
+		return;
+	}
+	// other formats are text ones
+	FCloseErr(dipfile,fname,ALL_POS);
 	dipfile=FOpenErr(fname,"r",ALL_POS);
 
 	// detect file format
@@ -1168,6 +1598,7 @@ static void InitDipFile(const char * restrict fname,int *bX,int *bY,int *bZ,int
 					anis_warned=true;
 				}
 				break;
+			case SF_BIN: break; // redundant, treated separately above
 		}
 		/* TO ADD NEW FORMAT OF SHAPE FILE
 		 * Add code to scan a single data line and perform consistency checks if necessary. The common variables to be
@@ -1211,6 +1642,7 @@ static void InitDipFile(const char * restrict fname,int *bX,int *bY,int *bZ,int
 			if (nd!=ds_Ndip) LogWarning(EC_WARN,ONE_POS,"Number of dipoles (%.0f), as given in the beginning of %s, is "
 				"not equal to the number of data lines actually present and scanned (%zu)",ds_Ndip,fname,nd);
 			break;
+		case SF_BIN: break; // redundant, treated separately above
 	}
 	nvoid_Ndip=nd*jagged*jagged*jagged;
 	/* TO ADD NEW FORMAT OF SHAPE FILE
@@ -1232,6 +1664,114 @@ static void InitDipFile(const char * restrict fname,int *bX,int *bY,int *bZ,int
 
 //======================================================================================================================
 
+static inline bool PutDipole(int x0,int y0,int z0,const int mat,size_t * restrict index)
+/* puts a dipole from the dipole file with position (x0,y0,z0) and domain number 'mat' (starting from 1) into particle
+ * arrays (actually a box of jagged*jagged*jagged dipoles). Returns false if it duplicates an existing dipole (only
+ * tested in FFT mode). In sparse mode 'index' is the index of the next dipole (is incremented by this function).
+ */
+{
+	int x,y,z;
+
+	// shift dipole position to be nonnegative
+	x0-=minX;
+	y0-=minY;
+	z0-=minZ;
+	// initialize box jagged*jagged*jagged instead of one dipole
+#ifndef SPARSE
+	bool res=true;
+	for (z=jagged*z0;z<jagged*(z0+1);z++) if (z>=local_z0 && z<local_z1_coer)
+		for (y=MAX(jagged*y0,local_y0);y<MIN(jagged*(y0+1),local_y1_coer);y++) for (x=jagged*x0;x<jagged*(x0+1);x++) {
+			*index=(z-local_z0)*local_boxXY+(y-local_y0)*(size_t)boxX+x;
+			if (material_tmp[*index]!=Nmat) res=false;
+			material_tmp[*index]=(unsigned char)(mat-1);
+	}
+	return res;
+#else
+	for (z=0;z<jagged;z++) for (y=0;y<jagged;y++) for (x=0;x<jagged;x++) {
+		if ((*index >= local_nvoid_d0) && (*index < local_nvoid_d1)) {
+			material[*index-local_nvoid_d0]=(unsigned char)(mat-1);
+			position_full[3*(*index)]=x0*jagged+x;
+			position_full[3*(*index)+1]=y0*jagged+y;
+			position_full[3*(*index)+2]=z0*jagged+z;
+		}
+		(*index)++;
+	}
+	return true;
+#endif // SPARSE
+}
+
+//======================================================================================================================
+
+static void ReadDipFileBin(const char * restrict fname)
+/* read binary dipole file, see SaveGeometryBin() for the description of the format. In FFT mode each processor reads
+ * only the layers, corresponding to its local z-range, using the table of layers to seek directly to the required
+ * runs and domain numbers. In sparse mode all runs are read (since position_full is required on every processor), but
+ * domain numbers are read only for local dipoles.
+ */
+{
+	int zf,zf0,zf1,mat;
+	size_t r,r0,r1,d,d0,d1,k,ind,index;
+	uint32_t * restrict runs;
+	uint64_t * restrict table;
+	unsigned char * restrict mats;
+	const size_t runs_disp=GEO_HEAD_SIZE+bin_boxZ*GEO_LAYER;
+	const size_t mat_disp=runs_disp+bin_Nruns*GEO_RUN;
+
+	// determine the range of layers (in units of file dipoles) to be read
+#ifndef SPARSE
+	if (local_z1_coer<=local_z0) return; // nothing to read
+	zf0=local_z0/jagged;
+	zf1=(local_z1_coer-1)/jagged+1;
+#else
+	zf0=0;
+	zf1=bin_boxZ;
+#endif
+	// read table entries, the last one (for zf1) is either read or set from the total counts
+	MALLOC_VECTOR(table,void,(zf1-zf0+1)*GEO_LAYER,ALL);
+	BinReadAt(table,GEO_LAYER,zf1-zf0,GEO_HEAD_SIZE+zf0*GEO_LAYER,fname);
+	if (zf1<bin_boxZ) BinReadAt(table+2*(zf1-zf0),GEO_LAYER,1,GEO_HEAD_SIZE+zf1*GEO_LAYER,fname);
+	else {
+		table[2*(zf1-zf0)]=bin_Nruns;
+		table[2*(zf1-zf0)+1]=bin_N;
+	}
+	r0=table[0];
+	r1=table[2*(zf1-zf0)];
+	if (r1<r0 || r1>bin_Nruns) LogError(ALL_POS,"Inconsistent table of layers in binary dipole file %s",fname);
+	// read runs
+	MALLOC_VECTOR(runs,void,MAX(r1-r0,1)*GEO_RUN,ALL);
+	BinReadAt(runs,GEO_RUN,r1-r0,runs_disp+r0*GEO_RUN,fname);
+	// read domain numbers, if present
+	d0=table[1];
+	d1=table[2*(zf1-zf0)+1];
+#ifdef SPARSE
+	// in sparse mode dipoles outside of [d0,d1) are skipped, and hence domain numbers for them are not needed
+	const size_t j3=(size_t)jagged*jagged*jagged;
+	d0=local_nvoid_d0/j3;
+	d1=(local_nvoid_d1+j3-1)/j3;
+#endif
+	mats=NULL;
+	if (Nmat>1) {
+		MALLOC_VECTOR(mats,uchar,MAX(d1-d0,1),ALL);
+		BinReadAt(mats,sizeof(unsigned char),d1-d0,mat_disp+d0,fname);
+	}
+	// process all dipoles in the runs
+	mat=1; // the default value for single-domain files
+	d=table[1];
+	index=0;
+	for (zf=zf0;zf<zf1;zf++) for (r=table[2*(zf-zf0)]-r0;r<table[2*(zf-zf0+1)]-r0;r++) {
+		for (k=0,ind=runs[2*r];k<runs[2*r+1];k++,ind++,d++) {
+			if (mats!=NULL && d>=d0 && d<d1) mat=mats[d-d0]+1;
+			PutDipole((int)(ind%bin_boxX),(int)(ind/bin_boxX),zf,mat,&index);
+		}
+	}
+	if (d!=table[2*(zf1-zf0)+1]) LogError(ALL_POS,"Inconsistent number of dipoles in binary dipole file %s",fname);
+	Free_general(table);
+	Free_general(runs);
+	if (mats!=NULL) Free_general(mats);
+}
+
+//======================================================================================================================
+
 static void ReadDipFile(const char * restrict fname)
 /* read dipole file; no consistency checks are made since they are made in InitDipFile. The file is opened in
  * InitDipFile; this function only closes the file.
@@ -1241,58 +1781,35 @@ static void ReadDipFile(const char * restrict fname)
  * the loop in MakeParticle() is skipped altogether.
  */
 {
-	int x,y,z,x0,y0,z0,mat,scanned;
+	int x0,y0,z0,mat,scanned;
 	size_t index=0,line=0;
 	char linebuf[BUF_LINE];
-#ifndef SPARSE
-	// to remove possible overflows
-	size_t boxX_l=(size_t)boxX;
-#endif // !SPARSE
 
 	TIME_TYPE tstart=GET_TIME();
 
-	mat=1; // the default value for single-domain shape formats
-	scanned=0; // redundant initialization to remove warnings
-	while (fgets(linebuf,BUF_LINE,dipfile)!=NULL) {
-		// scan numbers in a line
-		switch (read_format) {
-			case SF_TEXT: scanned=sscanf(linebuf,GEOM_FORMAT,&x0,&y0,&z0); break;
-			case SF_TEXT_EXT: scanned=sscanf(linebuf,GEOM_FORMAT_EXT,&x0,&y0,&z0,&mat); break;
-			case SF_DDSCAT6:
-			case SF_DDSCAT7: scanned=sscanf(linebuf,ddscat_format_read2,&x0,&y0,&z0,&mat); break;
-		}
-		/* TO ADD NEW FORMAT OF SHAPE FILE
-		 * Add code to scan a single data line. The common variables to be scanned are 'x0','y0','z0' (integer positions
-		 * of dipoles) and  possibly 'mat' - domain number. 'scanned' should be set to be tested against EOF below. The
-		 * code is similar to the one in InitDipFile() but can be simpler because no consistency checks are performed.
-		 */
-		line++;
-		// if sscanf returns EOF, that is a blank line -> just skip
-		if (scanned!=EOF) {
-			// shift dipole position to be nonnegative
-			x0-=minX;
-			y0-=minY;
-			z0-=minZ;
-			// initialize box jagged*jagged*jagged instead of one dipole
-#ifndef SPARSE
-			for (z=jagged*z0;z<jagged*(z0+1);z++) if (z>=local_z0 && z<local_z1_coer)
-				for (x=jagged*x0;x<jagged*(x0+1);x++) for (y=jagged*y0;y<jagged*(y0+1);y++) {
-					index=(z-local_z0)*boxXY+y*boxX_l+x;
-					if (material_tmp[index]!=Nmat)
-						LogError(ONE_POS,"Duplicate dipole was found at line %zu in dipole file %s",line,fname);
-					material_tmp[index]=(unsigned char)(mat-1);
-			}
-#else
-			for (z=0;z<jagged;z++) for (y=0;y<jagged;y++) for (x=0;x<jagged;x++) {
-				if ((index >= local_nvoid_d0) && (index < local_nvoid_d1)) {
-					material[index-local_nvoid_d0]=(unsigned char)(mat-1);
-					position_full[3*index]=x0*jagged+x;
-					position_full[3*index+1]=y0*jagged+y;
-					position_full[3*index+2]=z0*jagged+z;
-				}
-				index++;
+	if (read_format==SF_BIN) ReadDipFileBin(fname);
+	else {
+		mat=1; // the default value for single-domain shape formats
+		scanned=0; // redundant initialization to remove warnings
+		while (fgets(linebuf,BUF_LINE,dipfile)!=NULL) {
+			// scan numbers in a line
+			switch (read_format) {
+				case SF_TEXT: scanned=sscanf(linebuf,GEOM_FORMAT,&x0,&y0,&z0); break;
+				case SF_TEXT_EXT: scanned=sscanf(linebuf,GEOM_FORMAT_EXT,&x0,&y0,&z0,&mat); break;
+				case SF_DDSCAT6:
+				case SF_DDSCAT7: scanned=sscanf(linebuf,ddscat_format_read2,&x0,&y0,&z0,&mat); break;
+				case SF_BIN: break; // redundant, treated above
 			}
-#endif // SPARSE
+			/* TO ADD NEW FORMAT OF SHAPE FILE
+			 * Add code to scan a single data line. The common variables to be scanned are 'x0','y0','z0' (integer
+			 * positions of dipoles) and  possibly 'mat' - domain number. 'scanned' should be set to be tested against
+			 * EOF below. The code is similar to the one in InitDipFile() but can be simpler because no consistency
+			 * checks are performed.
+			 */
+			line++;
+			// if sscanf returns EOF, that is a blank line -> just skip
+			if (scanned!=EOF && !PutDipole(x0,y0,z0,mat,&index))
+				LogError(ONE_POS,"Duplicate dipole was found at line %zu in dipole file %s",line,fname);
 		}
 	}
 	FCloseErr(dipfile,fname,ALL_POS);
@@ -2106,39 +2623,466 @@ static inline int DescendingSearch(const double key,const double *arr,const int
 
 //======================================================================================================================
 
-void MakeParticle(void)
-// creates a particle; initializes all dipoles counts, dpl, dipole sizes
+#ifndef SPARSE
+
+static void RowRangeX(const double yr,const double zr,int *i0,int *i1)
+/* given coordinates yr and zr of a row of dipoles (in the same units as used in MakeParticle), determines the range of
+ * i (from i0 to i1-1), which may contain non-void dipoles. The bounds are conservative, i.e. they may include some void
+ * dipoles, since the shape is anyway tested for each dipole inside the range. This is implemented for shapes, which
+ * have simple bounding surfaces (sphere, cylinder, etc.), for all other shapes the whole row is used.
+ */
 {
+	double h2;   // square of half-width of the range (relative to the center)
+	double xc=0; // center of the range
+	double tmp,lo,hi;
 
-	size_t index,dip,i3;
-	TIME_TYPE tstart;
-	int i;
-#ifndef SPARSE
-	size_t local_nRows_tmp;
-	int j,k,ns;
-	double tmp1,tmp2,tmp3;
-	double xr,yr,zr;  // dipole coordinates relative to sizeX. xr is inside (-1/2,1/2), others - based on aspect ratios
+	switch (shape) {
+		case SH_AXISYMMETRIC:
+		case SH_CYLINDER:
+		case SH_PLATE:
+			if ((shape==SH_CYLINDER || shape==SH_PLATE) && fabs(zr)>hdratio) h2=-1;
+			else h2=0.25-yr*yr;
+			break;
+		case SH_BICOATED:
+		case SH_BISPHERE:
+			tmp=fabs(zr)-hdratio;
+			h2=0.25-yr*yr-tmp*tmp;
+			break;
+		case SH_BOX:
+			h2=(fabs(yr)<=haspY && fabs(zr)<=haspZ) ? 0.25 : -1;
+			break;
+		case SH_CAPSULE:
+			tmp=MAX(fabs(zr)-hdratio,0);
+			h2=0.25-yr*yr-tmp*tmp;
+			break;
+		case SH_CHEBYSHEV:
+			tmp=zr-zcenter;
+			h2=rc_2-yr*yr-tmp*tmp;
+			break;
+		case SH_COATED:
+		case SH_COATED2:
+		case SH_ONION:
+		case SH_SPHERE:
+			h2=0.25-yr*yr-zr*zr;
+			break;
+		case SH_ELLIPSOID:
+		case SH_ONION_ELL:
+			h2=0.25-yr*yr*invsqY-zr*zr*invsqZ;
+			break;
+		case SH_PRISM:
+			xc=xcenter;
+			h2=(fabs(zr)<=hdratio) ? rc_2-yr*yr : -1;
+			break;
+		case SH_SPHEREBOX:
+			h2=(fabs(yr)<=0.5 && fabs(zr)<=0.5) ? 0.25 : coat_r2-yr*yr-zr*zr;
+			break;
+		default: // whole row
+			*i0=0;
+			*i1=boxX;
+			return;
+	}
+	/* TO ADD NEW SHAPE
+	 * Optionally, add a case above (in alphabetical order), which sets 'h2' and (if needed) 'xc' such that all non-void
+	 * dipoles in the row satisfy (xr-xc)^2<=h2. Negative 'h2' means that the whole row is void.
+	 */
+	// the tolerance is used to avoid dropping a row due to round-off errors
+	if (h2<-ROW_TOL) {
+		*i0=*i1=0;
+		return;
+	}
+	tmp=sqrt(MAX(h2,0));
+	/* invert relations from MakeParticle: xr=0.5*xj/boxX, xj=2*jagged*b+jagged-boxX, where b=i/jagged is the block
+	 * number; the range of b is extended by one on each side to be completely robust to round-off errors
+	 */
+	lo=(2*boxX*(xc-tmp)+boxX-jagged)/(2*jagged);
+	hi=(2*boxX*(xc+tmp)+boxX-jagged)/(2*jagged);
+	*i0=(lo<=0) ? 0 : jagged*MAX((int)floor(lo)-1,0);
+	*i1=(hi>=boxX) ? boxX : MIN(jagged*((int)ceil(hi)+2),boxX);
+}
+
+//======================================================================================================================
+
+static int PointDomain(const double xr,const double yr,const double zr,const int yj,const int zj)
+/* returns the domain (from 0 to Nmat-1) of a point {xr,yr,zr} (in units described in RasterizeLayers) or Nmat if the
+ * point is void. yj and zj are the corresponding coordinates in units of d/2 (used only for a few shapes). Since it is
+ * called in parallel (when OPENMP is used), it should not change any global variables.
+ */
+{
+	int mat;
+	int ns;
+	double tmp1;
 	/* Normalized dipole coordinates for superellipsoid: |x/a|, |y/b|, |z/c|. They should be from 0 to 1 if no void grid
 	 * layers are used. Currently cannot be used for other shapes.
 	 */
 	double xn,yn,zn;
-	double xcoat,ycoat,zcoat,r2,ro2,z2,zshift,xshift;
-	int local_z0_unif; // should be global or semi-global
+	double xcoat,ycoat,zcoat,r2,ro,ro2,z2,zshift,xshift;
 	int largerZ,smallerZ; // number of larger and smaller z in intersections with contours
+
+	/* TO ADD NEW SHAPE
+	 * Add here all intermediate variables, which are used only inside this function. You may as well use 'tmp1'
+	 * variable defined above.
+	 */
+	mat=Nmat; // corresponds to void
+
+	switch (shape) {
+		case SH_AXISYMMETRIC:
+			ro2=xr*xr+yr*yr;
+			if (ro2>=ri_2 && ro2<=0.25) {
+				largerZ=smallerZ=0;
+				ro=sqrt(ro2);
+				for (ns=0;ns<contNseg;ns++) if (ro>=contSegRoMin[ns] && ro<=contSegRoMax[ns])
+					CheckContourSegment(contSeg+ns,ro,zr) ? largerZ++ : smallerZ++;
+				// check for consistency; if the code is perfect, this is not needed
+				if (IS_ODD(largerZ+smallerZ)) LogError(ALL_POS,"Point (ro,z)=("GFORMDEF","GFORMDEF") "
+					"produced weird result when checking whether it lies inside the contour. Larger than z %d "
+					"intersections, smaller - %d.",ro,zr,largerZ,smallerZ);
+				if (IS_ODD(largerZ)) mat=0;
+			}
+			break;
+		case SH_BICOATED:
+			ro2=xr*xr+yr*yr;
+			if (ro2<=0.25) {
+				tmp1=fabs(zr)-hdratio;
+				if (tmp1*tmp1+ro2<=0.25) {
+					if (tmp1*tmp1+ro2<=coat_r2) mat=1;
+					else mat=0;
+				}
+			}
+			break;
+		case SH_BIELLIPSOID:
+			if (zr<=boundZ) { // lower ellipsoid
+				if (fabs(xr)<=ell_x1) {
+					zshift=zr-zcenter1;
+					if (xr*xr+yr*yr*invsqY+zshift*zshift*invsqZ<=ell_rsq1) mat=0;
+				}
+			}
+			else { // upper ellipsoid
+				if (fabs(xr)<=ell_x2) {
+					zshift=zr-zcenter2;
+					if (xr*xr+yr*yr*invsqY2+zshift*zshift*invsqZ2<=ell_rsq2) mat=1;
+				}
+			}
+			break;
+		case SH_BISPHERE:
+			ro2=xr*xr+yr*yr;
+			if (ro2<=0.25) {
+				tmp1=fabs(zr)-hdratio;
+				if (tmp1*tmp1+ro2<=0.25) mat=0;
+			}
+			break;
+		case SH_BOX:
+			if (fabs(yr)<=haspY && fabs(zr)<=haspZ) mat=0;
+			break;
+		case SH_CAPSULE:
+			ro2=xr*xr+yr*yr;
+			if (ro2<=0.25) {
+				tmp1=fabs(zr)-hdratio;
+				if (tmp1<=0 || tmp1*tmp1+ro2<=0.25) mat=0;
+			}
+			break;
+		case SH_CHEBYSHEV:
+			ro2=xr*xr+yr*yr;
+			zshift=zr-zcenter;
+			r2=ro2+zshift*zshift;
+			if (r2<=ri_2) mat=0;
+			else if (r2<=rc_2) {
+				/* This can be optimized using Chebyshev polynomials, but would probably be efficient only for
+				 * relatively small n.
+				 */
+				tmp1=1+chebeps*cos(chebn*atan2(sqrt(ro2),zshift));
+				if (r2 <= r0_2*tmp1*tmp1) mat=0;
+			}
+			break;
+		case SH_COATED:
+			if (xr*xr+yr*yr+zr*zr<=0.25) { // first test to skip some dipoles immediately)
+				xcoat=xr-coat_x;
+				ycoat=yr-coat_y;
+				zcoat=zr-coat_z;
+				if (xcoat*xcoat+ycoat*ycoat+zcoat*zcoat<=coat_r2) mat=1;
+				else mat=0;
+			}
+			break;
+		case SH_COATED2:
+			r2=xr*xr+yr*yr+zr*zr;
+			if (r2<=0.25) {
+				if (r2<=core_r2) mat=2;
+				else if (r2<=shell_r2) mat=1;
+				else mat=0;
+			}
+			break;
+		case SH_CYLINDER:
+			if (xr*xr+yr*yr<=0.25 && fabs(zr)<=hdratio) mat=0;
+			break;
+		case SH_EGG:
+			ro2=xr*xr+yr*yr;
+			zshift=zr-zcenter;
+			z2=zshift*zshift;
+			if (ro2+egeps*z2+egnu*zshift*sqrt(ro2+z2)<=ad2) mat=0;
+			break;
+		case SH_ELLIPSOID:
+			if (xr*xr+yr*yr*invsqY+zr*zr*invsqZ<=0.25) mat=0;
+			break;
+		case SH_LINE:
+			/* since the step of yj and zj is 2*jagged, only one condition of each || can be true; second parts
+			 * of those || are for weird cases like '-shape line -grid 8 2 2'
+			 */
+			if ((yj==0 || yj==-jagged) && (zj==0 || zj==-jagged)) mat=0;
+			break;
+		case SH_ONION:
+			r2=xr*xr+yr*yr+zr*zr;
+			if (r2<=0.25) mat=DescendingSearch(r2,onion_r2,nlayers-1);
+			break;
+		case SH_ONION_ELL:
+			r2=xr*xr+yr*yr*invsqY+zr*zr*invsqZ;
+			// only consider dipoles inside particle
+			if (r2<=0.25) mat=DescendingSearch(r2,onion_r2,nlayers-1);
+			break;
+		case SH_PLATE:
+			ro2=xr*xr+yr*yr;
+			if (ro2<=0.25 && fabs(zr)<=hdratio) {
+				if (ro2<=ri_2) mat=0;
+				else {
+					tmp1=sqrt(ro2)-0.5+hdratio; // ro-ri
+					if (tmp1*tmp1+zr*zr<=hdratio*hdratio) mat=0;
+				}
+			}
+			break;
+		case SH_PRISM:
+			xshift=xr-xcenter;
+			ro2=xshift*xshift+yr*yr;
+			if (ro2<=rc_2 && fabs(zr)<=hdratio) {
+				if (ro2<=ri_2) mat=0;
+				/* this can be optimized considering special cases for small N. For larger N the relevant
+				 * fraction of dipoles decrease as N^-2, so this part is less problematic.
+				 */
+				else {
+					tmp1=cos(fmod(fabs(atan2(yr,xshift))+prang,2*prang)-prang);
+					if (tmp1*tmp1*ro2<=ri_2) mat=0;
+				}
+			}
+			break;
+		case SH_RBC:
+			ro2=xr*xr+yr*yr;
+			z2=zr*zr;
+			if (ro2*ro2+2*rbcS*ro2*z2+z2*z2+rbcP*ro2+rbcQ*z2+rbcR<=0) mat=0;
+			break;
+		case SH_READ: break; // just to have a complete set of cases; this cases is treated separately below
+		case SH_SPHERE:
+			if (xr*xr+yr*yr+zr*zr<=0.25) mat=0;
+			break;
+		case SH_SPHEREBOX:
+			if (xr*xr+yr*yr+zr*zr<=coat_r2) mat=1;
+			else if (fabs(yr)<=0.5 && fabs(zr)<=0.5) mat=0;
+			break;
+		case SH_SUPERELLIPSOID:
+			xn=fabs(2*xr);
+			yn=fabs(2*yr/yx_ratio);
+			zn=fabs(2*zr/zx_ratio);
+			// separate check for bounding box to avoid overflows in power functions
+			if (yn<=1 && zn<=1) {
+				/* First we consider zero e and n, then use two separate ways to separate the powers in (xn^r +
+				 * yn^r)^(t/r): either, (...)^(t/r) or (...)^t. This ensures that we do not have very small
+				 * value (susceptible to underflow) taken to a large power or vice versa. Moreover, the
+				 * description is continuous with decreasing n and/or e. Although the cases of n=0 or e=0 still
+				 * need a separate if clause, they do appear as natural limiting cases.
+				 */
+				if (seN==0 && seE==0) mat=0; // a box
+				else if (seE > MIN(seN,1)) { // implies that e!=0
+					/* n=0 => xy-sections are superellipses independent of z, while xz- and yz-sections are
+					 * rectangles
+					 */
+					tmp1=pow(xn,seR) + pow(yn,seR);
+					if (tmp1<=1 && (seN==0 || pow(tmp1,seToverR) + pow(zn,seT) <= 1) ) mat=0;
+				}
+				else { // here n!=0
+					/* e=0 => xz- and yz-sections are superellipses independent of y and x, respectively, while
+					 * xy-sections are rectangles
+					 */
+					if (seE==0) tmp1=MAX(xn,yn);
+					// in the following we ensure that the argument taken to (potentially large) power r is <=1
+					else if (xn<yn) tmp1=yn*pow(1+pow(xn/yn,seR),seInvR);
+					else if (xn>yn) tmp1=xn*pow(1+pow(yn/xn,seR),seInvR);
+					else tmp1=yn*pow(2,seInvR);
+					if (pow(tmp1,seT) + pow(zn,seT) <= 1) mat=0;
+				}
+			}
+			break;
+	}
+	/* TO ADD NEW SHAPE add a case above (in alphabetical order). Identifier ('SH_...') should be defined inside
+	 * 'enum sh' in const.h. This option should set 'mat' - index of domain for a point, specified by {xr,yr,zr}
+	 * - coordinates divided by grid size along X (xr inside (-1/2,1/2), others - depending on aspect ratios). C
+	 * array indexing used: mat=0 - first domain, etc. If point corresponds to void, do not set 'mat'. If you
+	 * need temporary local variables (which are used* only in this part of the code), either use 'tmp1' or define
+	 * your own (with more informative names) in the beginning of this function.
+	 */
+	return mat;
+}
+
+//======================================================================================================================
+
+static size_t RasterizeLayers(const int k0,const int k1,const bool stream,unsigned char * restrict *mat_buf,
+	unsigned short * restrict *pos_buf,size_t * restrict buf_size)
+/* Determines domains of all local dipoles in layers from k0 to k1-1 (global z) and stores them in arrays *mat_buf and
+ * *pos_buf (of current size *buf_size) starting from index 0; returns the number of stored dipoles. In stream mode only
+ * non-void dipoles are stored and the cells are evaluated only in the range of x, which may contain the particle in the
+ * current row (given by RowRangeX); the arrays are grown (reallocated), when needed. Otherwise, all dipoles are stored,
+ * so the arrays should be large enough to contain the whole layers. Since it is called in parallel for different layer
+ * ranges (when OPENMP is used), it should not change any global variables.
+ */
+{
+	size_t index,max_size,nRows;
+	int i,j,k,i0,i1,mat;
+	double xr,yr,zr;  // dipole coordinates relative to sizeX. xr is inside (-1/2,1/2), others - based on aspect ratios
 	/* The following are dipole coordinates (in units of d/2) relative to the grid center. For jagged they point to the
 	 * center of a larger dipole. Units are chosen to keep integer (otherwise half-integers are possible), but the step
 	 * of variation is 2*jagged.
 	 */
 	int xj,yj,zj;
-	int mat;
+
+	index=0;
+	max_size=(k1-k0)*local_boxXY;
+	for(k=k0;k<k1;k++) for(j=local_y0;j<local_y1_coer;j++) {
+		yj=2*jagged*(j/jagged)+jagged-boxY;
+		zj=2*jagged*(k/jagged)+jagged-boxZ;
+		/* all the following coordinates should be scaled by the same sizeX. So we scale xj,yj,zj by 2boxX with extra
+		 * ratio for rectangular dipoles. Thus, yr and zr are not necessarily in fixed ranges (like from -1/2 to 1/2).
+		 * This is done to treat adequately cases when particle dimensions are the same (along different axes), but e.g.
+		 * boxY!=boxX (so there are some extra void dipoles). All anisotropies in the particle itself are treated in
+		 * the specific shape modules in PointDomain (see e.g. ELLIPSOID).
+		 */
+		yr=(0.5*yj)/boxX*(rectScaleY/rectScaleX);
+		zr=(0.5*zj)/boxX*(rectScaleZ/rectScaleX);
+		if (stream) RowRangeX(yr,zr,&i0,&i1);
+		else {
+			i0=0;
+			i1=boxX;
+		}
+		for(i=i0;i<i1;i++) {
+			xj=2*jagged*(i/jagged)+jagged-boxX;
+			xr=(0.5*xj)/boxX;
+			mat=PointDomain(xr,yr,zr,yj,zj);
+			if (mat==Nmat && stream) continue;
+			if (index==*buf_size) { // can only happen in stream mode
+				*buf_size=MIN(2*(*buf_size),max_size);
+				nRows=MultOverflow(3,*buf_size,ALL_POS,"nRows");
+				REALLOC_VECTOR(*mat_buf,uchar,*buf_size,ALL);
+				REALLOC_VECTOR(*pos_buf,ushort,nRows,ALL);
+			}
+			(*pos_buf)[3*index]=(unsigned short)i;
+			(*pos_buf)[3*index+1]=(unsigned short)j;
+			(*pos_buf)[3*index+2]=(unsigned short)k;
+			// afterwards multiplied by dipole sizes
+			(*mat_buf)[index]=(unsigned char)mat;
+			index++;
+		}
+	}
+	return index;
+}
+
+//======================================================================================================================
+
+static size_t *BuildSpans(const unsigned short * restrict pos,const size_t n,size_t *nSpan)
+/* builds row-span index (in two passes) for 'n' dipoles with positions 'pos', a span is continued if the next dipole is
+ * adjacent along x; returns the array of starting dipoles of spans (of size nSpan+1)
+ */
+{
+	size_t dip,index,*start;
+
+#define NEXT_IN_ROW(i) (pos[3*(i)]==pos[3*(i)-3]+1 && pos[3*(i)+1]==pos[3*(i)-2] && pos[3*(i)+2]==pos[3*(i)-1])
+	*nSpan=0;
+	for (dip=0;dip<n;dip++) if (dip==0 || !NEXT_IN_ROW(dip)) (*nSpan)++;
+	MALLOC_VECTOR(start,sizet,*nSpan+1,ALL);
+	memory+=sizeof(size_t)*(*nSpan+1);
+	index=0;
+	for (dip=0;dip<n;dip++) if (dip==0 || !NEXT_IN_ROW(dip)) start[index++]=dip;
+	start[*nSpan]=n;
+#undef NEXT_IN_ROW
+	return start;
+}
+
+//======================================================================================================================
+
+#ifdef PARALLEL
+static void BalanceDipoles(int *z0)
+/* redistributes the occupied dipoles over processors in contiguous ranges of z-layers with approximately equal numbers
+ * of dipoles (-load_balance); returns the first layer of the local range in 'z0'. The original arrays (corresponding to
+ * FFT slabs) are kept as slabPosition (relative to local_z0) and slabSpanStart for use in MatVec, while 'material',
+ * 'position', 'DipoleCoord', and 'spanStart' are replaced by the balanced ones. Positions should still be absolute.
+ */
+{
+	size_t *layCount,n,dip;
+	unsigned char *mat;
+	unsigned short *pos,us_tmp;
+	double *coord;
+	int z;
+
+	// count dipoles in each layer of the whole box
+	MALLOC_VECTOR(layCount,sizet,boxZ,ALL);
+	for (z=0;z<boxZ;z++) layCount[z]=0;
+	for (dip=2;dip<local_nRows;dip+=3) layCount[position[dip]]++;
+	MyInnerProduct(layCount,sizet_type,boxZ,NULL);
+	n=SetLoadBalance(layCount,z0);
+	Free_general(layCount);
+	// move the data to the new distribution
+	MALLOC_VECTOR(mat,uchar,n,ALL);
+	MALLOC_VECTOR(pos,ushort,3*n,ALL);
+	MALLOC_VECTOR(coord,double,3*n,ALL);
+	RedistributeDipoles(material,mat,uchar_type,1,false,NULL);
+	RedistributeDipoles(position,pos,ushort_type,3,false,NULL);
+	RedistributeDipoles(DipoleCoord,coord,double_type,3,false,NULL);
+	Free_general(material);
+	Free_general(DipoleCoord);
+	material=mat;
+	DipoleCoord=coord;
+	memory+=(sizeof(char)+3*sizeof(double))*((double)n-local_nvoid_Ndip)+3*sizeof(short int)*(double)n;
+	// keep the distribution over FFT slabs; y-positions are not shifted, since only 1D grid of processors is allowed
+	slab_nvoid_Ndip=local_nvoid_Ndip;
+	slab_nSpan=local_nSpan;
+	slabSpanStart=spanStart;
+	slabPosition=position;
+	if (local_z0!=0) {
+		us_tmp=(unsigned short)local_z0;
+		for (dip=2;dip<local_nRows;dip+=3) slabPosition[dip]-=us_tmp;
+	}
+	// update the local counts
+	position=pos;
+	local_nvoid_Ndip=n;
+	local_nRows=3*n;
+	SetupLocalD();
+	spanStart=BuildSpans(position,local_nvoid_Ndip,&local_nSpan);
+}
+#endif // PARALLEL
+
+#endif // !SPARSE
+
+//======================================================================================================================
+
+void MakeParticle(void)
+// creates a particle; initializes all dipoles counts, dpl, dipole sizes
+{
+
+	size_t index,dip,i3;
+	TIME_TYPE tstart;
+	int i;
+#ifndef SPARSE
+	size_t local_nRows_tmp;
+	int ns;
+	double tmp1,tmp2,tmp3;
+	int local_z0_unif; // first z-layer of the local dipoles (differs from local_z0 for '-load_balance')
+	bool stream;     // whether only non-void dipoles are stored during particle generation
+	size_t tmp_size; // current size of temporary arrays
 	unsigned short us_tmp;
 	TIME_TYPE tgran;
+#	ifdef OPENMP
+	int c,nchunk,nz; // chunk index, number of chunks of layers, and number of local layers
+	struct {
+		unsigned char * restrict mat;
+		unsigned short * restrict pos;
+		size_t size,n; // allocated and filled sizes of arrays
+	} * restrict chunk; // data for chunks of layers
+#	endif
 #endif // !SPARSE
 
-	/* TO ADD NEW SHAPE
-	 * Add here all intermediate variables, which are used only inside this function. You may as well use 'tmp1'-'tmp3'
-	 * variables defined above.
-	 */
 	tstart=GET_TIME();
 
 	cX=(boxX-1)/2.0;
@@ -2146,231 +3090,66 @@ void MakeParticle(void)
 	cZ=(boxZ-1)/2.0;
 
 #ifndef SPARSE //shapes other than "read" are disabled in sparse mode
-	index=0;
-	local_nRows_tmp=MultOverflow(3,local_Ndip,ALL_POS,"local_nRows_tmp");
-
-	/* allocate temporary memory; even if prognosis, since they are needed for exact estimation; they will be
-	 * reallocated afterwards (when local_nRows is known).
+	/* For predefined shapes without granules only non-void dipoles are stored (in arrays growing when needed), see
+	 * RasterizeLayers for details. Otherwise (granules or shape read from file), the temporary arrays cover the whole
+	 * local box, since they are further processed in box coordinates. In both cases these arrays are either reallocated
+	 * or copied afterwards (when local_nRows is known); they are allocated even if prognosis, since they are needed for
+	 * exact estimation.
 	 */
-	MALLOC_VECTOR(material_tmp,uchar,local_Ndip,ALL);
+	stream=(shape!=SH_READ && !sh_granul);
+	if (stream) tmp_size=MAX(MIN(local_Ndip,STREAM_INIT_SIZE),1);
+	else tmp_size=local_Ndip;
+	local_nRows_tmp=MultOverflow(3,tmp_size,ALL_POS,"local_nRows_tmp");
+	MALLOC_VECTOR(material_tmp,uchar,tmp_size,ALL);
 	MALLOC_VECTOR(position_tmp,ushort,local_nRows_tmp,ALL);
 
-	for(k=local_z0;k<local_z1_coer;k++) for(j=0;j<boxY;j++) for(i=0;i<boxX;i++) {
-		xj=2*jagged*(i/jagged)+jagged-boxX;
-		yj=2*jagged*(j/jagged)+jagged-boxY;
-		zj=2*jagged*(k/jagged)+jagged-boxZ;
-		/* all the following coordinates should be scaled by the same sizeX. So we scale xj,yj,zj by 2boxX with extra
-		 * ratio for rectangular dipoles. Thus, yr and zr are not necessarily in fixed ranges (like from -1/2 to 1/2).
-		 * This is done to treat adequately cases when particle dimensions are the same (along different axes), but e.g.
-		 * boxY!=boxX (so there are some extra void dipoles). All anisotropies in the particle itself are treated in
-		 * the specific shape modules below (see e.g. ELLIPSOID).
-		 */
-		xr=(0.5*xj)/boxX;
-		yr=(0.5*yj)/boxX*(rectScaleY/rectScaleX);
-		zr=(0.5*zj)/boxX*(rectScaleZ/rectScaleX);
-
-		mat=Nmat; // corresponds to void
-
-		switch (shape) {
-			case SH_AXISYMMETRIC:
-				ro2=xr*xr+yr*yr;
-				if (ro2>=ri_2 && ro2<=0.25) {
-					largerZ=smallerZ=0;
-					contCurRo=sqrt(ro2);
-					contCurZ=zr;
-					for (ns=0;ns<contNseg;ns++) if (contCurRo>=contSegRoMin[ns] && contCurRo<=contSegRoMax[ns])
-						CheckContourSegment(contSeg+ns) ? largerZ++ : smallerZ++;
-					// check for consistency; if the code is perfect, this is not needed
-					if (IS_ODD(largerZ+smallerZ)) LogError(ALL_POS,"Point (ro,z)=("GFORMDEF","GFORMDEF") "
-						"produced weird result when checking whether it lies inside the contour. Larger than z %d "
-						"intersections, smaller - %d.",contCurRo,contCurZ,largerZ,smallerZ);
-					if (IS_ODD(largerZ)) mat=0;
-				}
-				break;
-			case SH_BICOATED:
-				ro2=xr*xr+yr*yr;
-				if (ro2<=0.25) {
-					tmp1=fabs(zr)-hdratio;
-					if (tmp1*tmp1+ro2<=0.25) {
-						if (tmp1*tmp1+ro2<=coat_r2) mat=1;
-						else mat=0;
-					}
-				}
-				break;
-			case SH_BIELLIPSOID:
-				if (zr<=boundZ) { // lower ellipsoid
-					if (fabs(xr)<=ell_x1) {
-						zshift=zr-zcenter1;
-						if (xr*xr+yr*yr*invsqY+zshift*zshift*invsqZ<=ell_rsq1) mat=0;
-					}
-				}
-				else { // upper ellipsoid
-					if (fabs(xr)<=ell_x2) {
-						zshift=zr-zcenter2;
-						if (xr*xr+yr*yr*invsqY2+zshift*zshift*invsqZ2<=ell_rsq2) mat=1;
-					}
-				}
-				break;
-			case SH_BISPHERE:
-				ro2=xr*xr+yr*yr;
-				if (ro2<=0.25) {
-					tmp1=fabs(zr)-hdratio;
-					if (tmp1*tmp1+ro2<=0.25) mat=0;
-				}
-				break;
-			case SH_BOX:
-				if (fabs(yr)<=haspY && fabs(zr)<=haspZ) mat=0;
-				break;
-			case SH_CAPSULE:
-				ro2=xr*xr+yr*yr;
-				if (ro2<=0.25) {
-					tmp1=fabs(zr)-hdratio;
-					if (tmp1<=0 || tmp1*tmp1+ro2<=0.25) mat=0;
-				}
-				break;
-			case SH_CHEBYSHEV:
-				ro2=xr*xr+yr*yr;
-				zshift=zr-zcenter;
-				r2=ro2+zshift*zshift;
-				if (r2<=ri_2) mat=0;
-				else if (r2<=rc_2) {
-					/* This can be optimized using Chebyshev polynomials, but would probably be efficient only for
-					 * relatively small n.
-					 */
-					tmp1=1+chebeps*cos(chebn*atan2(sqrt(ro2),zshift));
-					if (r2 <= r0_2*tmp1*tmp1) mat=0;
-				}
-				break;
-			case SH_COATED:
-				if (xr*xr+yr*yr+zr*zr<=0.25) { // first test to skip some dipoles immediately)
-					xcoat=xr-coat_x;
-					ycoat=yr-coat_y;
-					zcoat=zr-coat_z;
-					if (xcoat*xcoat+ycoat*ycoat+zcoat*zcoat<=coat_r2) mat=1;
-					else mat=0;
-				}
-				break;
-			case SH_COATED2:
-				r2=xr*xr+yr*yr+zr*zr;
-				if (r2<=0.25) {
-					if (r2<=core_r2) mat=2;
-					else if (r2<=shell_r2) mat=1;
-					else mat=0;
-				}
-				break;
-			case SH_CYLINDER:
-				if (xr*xr+yr*yr<=0.25 && fabs(zr)<=hdratio) mat=0;
-				break;
-			case SH_EGG:
-				ro2=xr*xr+yr*yr;
-				zshift=zr-zcenter;
-				z2=zshift*zshift;
-				if (ro2+egeps*z2+egnu*zshift*sqrt(ro2+z2)<=ad2) mat=0;
-				break;
-			case SH_ELLIPSOID:
-				if (xr*xr+yr*yr*invsqY+zr*zr*invsqZ<=0.25) mat=0;
-				break;
-			case SH_LINE:
-				/* since the step of yj and zj is 2*jagged, only one condition of each || can be true; second parts of
-				 * those || are for weird cases like '-shape line -grid 8 2 2'
-				 */
-				if ((yj==0 || yj==-jagged) && (zj==0 || zj==-jagged)) mat=0;
-				break;
-			case SH_ONION:
-				r2=xr*xr+yr*yr+zr*zr;
-				if (r2<=0.25) mat=DescendingSearch(r2,onion_r2,nlayers-1);
-				break;
-			case SH_ONION_ELL:
-				r2=xr*xr+yr*yr*invsqY+zr*zr*invsqZ;
-				// only consider dipoles inside particle
-				if (r2<=0.25) mat=DescendingSearch(r2,onion_r2,nlayers-1);
-				break;
-			case SH_PLATE:
-				ro2=xr*xr+yr*yr;
-				if (ro2<=0.25 && fabs(zr)<=hdratio) {
-					if (ro2<=ri_2) mat=0;
-					else {
-						tmp1=sqrt(ro2)-0.5+hdratio; // ro-ri
-						if (tmp1*tmp1+zr*zr<=hdratio*hdratio) mat=0;
-					}
-				}
-				break;
-			case SH_PRISM:
-				xshift=xr-xcenter;
-				ro2=xshift*xshift+yr*yr;
-				if (ro2<=rc_2 && fabs(zr)<=hdratio) {
-					if (ro2<=ri_2) mat=0;
-					/* this can be optimized considering special cases for small N. For larger N the relevant
-					 * fraction of dipoles decrease as N^-2, so this part is less problematic.
-					 */
-					else {
-						tmp1=cos(fmod(fabs(atan2(yr,xshift))+prang,2*prang)-prang);
-						if (tmp1*tmp1*ro2<=ri_2) mat=0;
-					}
-				}
-				break;
-			case SH_RBC:
-				ro2=xr*xr+yr*yr;
-				z2=zr*zr;
-				if (ro2*ro2+2*rbcS*ro2*z2+z2*z2+rbcP*ro2+rbcQ*z2+rbcR<=0) mat=0;
-				break;
-			case SH_READ: break; // just to have a complete set of cases; this cases is treated separately below
-			case SH_SPHERE:
-				if (xr*xr+yr*yr+zr*zr<=0.25) mat=0;
-				break;
-			case SH_SPHEREBOX:
-				if (xr*xr+yr*yr+zr*zr<=coat_r2) mat=1;
-				else if (fabs(yr)<=0.5 && fabs(zr)<=0.5) mat=0;
-				break;
-			case SH_SUPERELLIPSOID:
-				xn=fabs(2*xr);
-				yn=fabs(2*yr/yx_ratio);
-				zn=fabs(2*zr/zx_ratio);
-				// separate check for bounding box to avoid overflows in power functions
-				if (yn<=1 && zn<=1) {
-					/* First we consider zero e and n, then use two separate ways to separate the powers in
-					 * (xn^r + yn^r)^(t/r): either, (...)^(t/r) or (...)^t. This ensures that we do not have very small
-					 * value (susceptible to underflow) taken to a large power or vice versa. Moreover, the description
-					 * is continuous with decreasing n and/or e. Although the cases of n=0 or e=0 still need a separate
-					 * if clause, they do appear as natural limiting cases.
-					 */
-					if (seN==0 && seE==0) mat=0; // a box
-					else if (seE > MIN(seN,1)) { // implies that e!=0
-						/* n=0 => xy-sections are superellipses independent of z, while xz- and yz-sections are
-						 * rectangles
-						 */
-						tmp1=pow(xn,seR) + pow(yn,seR);
-						if (tmp1<=1 && (seN==0 || pow(tmp1,seToverR) + pow(zn,seT) <= 1) ) mat=0;
-					}
-					else { // here n!=0
-						/* e=0 => xz- and yz-sections are superellipses independent of y and x, respectively, while
-						 * xy-sections are rectangles
-						 */
-						if (seE==0) tmp1=MAX(xn,yn);
-						// in the following we ensure that the argument taken to (potentially large) power r is <=1
-						else if (xn<yn) tmp1=yn*pow(1+pow(xn/yn,seR),seInvR);
-						else if (xn>yn) tmp1=xn*pow(1+pow(yn/xn,seR),seInvR);
-						else tmp1=yn*pow(2,seInvR);
-						if (pow(tmp1,seT) + pow(zn,seT) <= 1) mat=0;
-					}
-				}
-				break;
+#ifdef OPENMP
+	/* Local layers are divided into chunks (several per thread for load balancing), which are processed in parallel.
+	 * In stream mode, each chunk is stored in separate arrays, which are then concatenated in the order of chunks.
+	 * Otherwise, each chunk is directly stored in the corresponding part of the temporary arrays. Thus, the result does
+	 * not depend on the number of threads.
+	 */
+	nz=local_z1_coer-local_z0;
+	nchunk=MIN(nz,LAYER_CHUNKS*omp_get_max_threads());
+	if (nchunk>1) {
+		MALLOC_VECTOR(chunk,void,nchunk*sizeof(*chunk),ALL);
+#	pragma omp parallel for schedule(dynamic)
+		for (c=0;c<nchunk;c++) {
+			int k0=local_z0+(int)(((size_t)c*nz)/nchunk);
+			int k1=local_z0+(int)(((size_t)(c+1)*nz)/nchunk);
+			if (stream) {
+				chunk[c].size=MAX(MIN((k1-k0)*local_boxXY,(size_t)(STREAM_INIT_SIZE/nchunk)),1);
+				MALLOC_VECTOR(chunk[c].mat,uchar,chunk[c].size,ALL);
+				MALLOC_VECTOR(chunk[c].pos,ushort,3*chunk[c].size,ALL);
+			}
+			else {
+				chunk[c].size=(k1-k0)*local_boxXY;
+				chunk[c].mat=material_tmp+(k0-local_z0)*local_boxXY;
+				chunk[c].pos=position_tmp+3*(k0-local_z0)*local_boxXY;
+			}
+			chunk[c].n=RasterizeLayers(k0,k1,stream,&chunk[c].mat,&chunk[c].pos,&chunk[c].size);
 		}
-		/* TO ADD NEW SHAPE
-		 * add a case above (in alphabetical order). Identifier ('SH_...') should be defined inside 'enum sh' in
-		 * const.h. This option should set 'mat' - index of domain for a point, specified by {xr,yr,zr} - coordinates
-		 * divided by grid size along X (xr inside (-1/2,1/2), others - depending on aspect ratios). C array indexing
-		 * used: mat=0 - first domain, etc. If point corresponds to void, do not set 'mat'. If you need temporary local
-		 * variables (which are used* only in this part of the code), either use 'tmp1'-'tmp3' or define your own (with
-		 * more informative names) in the beginning of this function.
-		 */
-		position_tmp[3*index]=(unsigned short)i;
-		position_tmp[3*index+1]=(unsigned short)j;
-		position_tmp[3*index+2]=(unsigned short)k;
-		// afterwards multiplied by dipole sizes
-		material_tmp[index]=(unsigned char)mat;
-		index++;
-	} // End box loop
+		if (stream) {
+			index=0;
+			for (c=0;c<nchunk;c++) index+=chunk[c].n;
+			tmp_size=MAX(index,1);
+			REALLOC_VECTOR(material_tmp,uchar,tmp_size,ALL);
+			REALLOC_VECTOR(position_tmp,ushort,MultOverflow(3,tmp_size,ALL_POS,"local_nRows_tmp"),ALL);
+			index=0;
+			for (c=0;c<nchunk;c++) {
+				memcpy(material_tmp+index,chunk[c].mat,chunk[c].n*sizeof(char));
+				memcpy(position_tmp+3*index,chunk[c].pos,3*chunk[c].n*sizeof(short int));
+				index+=chunk[c].n;
+				Free_general(chunk[c].mat);
+				Free_general(chunk[c].pos);
+			}
+		}
+		else index=local_Ndip;
+		Free_general(chunk);
+	}
+	else
+#endif
+	index=RasterizeLayers(local_z0,local_z1_coer,stream,&material_tmp,&position_tmp,&tmp_size);
 #else // SPARSE
 	// local_nvoid_d0 and local_nvoid_d1 are set earlier in ParSetup()
 	local_nvoid_Ndip=local_nvoid_d1-local_nvoid_d0;
@@ -2378,8 +3157,8 @@ void MakeParticle(void)
 	MALLOC_VECTOR(material,uchar,local_nvoid_Ndip,ALL);
 	// check if 3*nvoid_Ndip can be computed; check is redundant for sequential mode
 	size_t nRows=MultOverflow(3,nvoid_Ndip,ONE_POS_FUNC);
-	MALLOC_VECTOR(position_full,int,nRows,ALL);
-	memory+=3*sizeof(int)*nvoid_Ndip+sizeof(char)*local_nvoid_Ndip;
+	MALLOC_SHARED(position_full,nRows); // one copy per node
+	memory+=SharedSize(3*sizeof(int)*nvoid_Ndip)+sizeof(char)*local_nvoid_Ndip;
 #endif // SPARSE
 	if (shape==SH_READ) ReadDipFile(shape_fname);
 	// initialization of mat_count and dipoles counts
@@ -2388,7 +3167,8 @@ void MakeParticle(void)
 	for(dip=0;dip<local_Ndip;dip++) mat_count[material[dip]]++;
 	MyInnerProduct(mat_count,sizet_type,Nmat+1,NULL);
 #else
-	for(dip=0;dip<local_Ndip;dip++) mat_count[material_tmp[dip]]++;
+	for(dip=0;dip<index;dip++) mat_count[material_tmp[dip]]++;
+	mat_count[Nmat]+=local_Ndip-index; // void dipoles, which were not stored (in stream mode)
 	local_nvoid_Ndip=local_Ndip-mat_count[Nmat];
 	SetupLocalD();
 	MyInnerProduct(mat_count,sizet_type,Nmat+1,NULL);
@@ -2473,20 +3253,28 @@ void MakeParticle(void)
 	/* allocate main particle arrays, using precise local_nRows even when prognosis is used to enable save_geom
 	 * afterwards.
 	 */
-	MALLOC_VECTOR(material,uchar,local_nvoid_Ndip,ALL);
-	MALLOC_VECTOR(position,ushort,local_nRows,ALL);
-	memory+=(3*sizeof(short int)+sizeof(char))*local_nvoid_Ndip;
-	// copy nontrivial part of arrays
-	index=0;
-	for (dip=0;dip<local_Ndip;dip++) if (material_tmp[dip]<Nmat) {
-		material[index]=material_tmp[dip];
-		memcpy(position+3*index,position_tmp+3*dip,3*sizeof(short int));
-		index++;
+	if (stream) { // temporary arrays contain only non-void dipoles, so they are just shrunk to the final size
+		material=material_tmp;
+		position=position_tmp;
+		REALLOC_VECTOR(material,uchar,MAX(local_nvoid_Ndip,1),ALL);
+		REALLOC_VECTOR(position,ushort,MAX(local_nRows,1),ALL);
 	}
-
-	// free temporary memory
-	Free_general(material_tmp);
-	Free_general(position_tmp);
+	else {
+		MALLOC_VECTOR(material,uchar,local_nvoid_Ndip,ALL);
+		MALLOC_VECTOR(position,ushort,local_nRows,ALL);
+		// copy nontrivial part of arrays
+		index=0;
+		for (dip=0;dip<local_Ndip;dip++) if (material_tmp[dip]<Nmat) {
+			material[index]=material_tmp[dip];
+			memcpy(position+3*index,position_tmp+3*dip,3*sizeof(short int));
+			index++;
+		}
+		// free temporary memory
+		Free_general(material_tmp);
+		Free_general(position_tmp);
+	}
+	memory+=(3*sizeof(short int)+sizeof(char))*local_nvoid_Ndip;
+	spanStart=BuildSpans(position,local_nvoid_Ndip,&local_nSpan);
 	if (shape==SH_AXISYMMETRIC) {
 		for (ns=0;ns<contNseg;ns++) FreeContourSegment(contSeg+ns);
 		Free_general(contSegRoMin);
@@ -2516,8 +3304,8 @@ void MakeParticle(void)
 	if (surface && hsub<=-minZco) LogError(ALL_POS,"The particle must be entirely above the substrate. There exist a "
 		"dipole with z="GFORMDEF" (relative to the center), making specified height of the center ("GFORMDEF") too "
 		"small",minZco,hsub);
-	// save geometry
-	if (save_geom)
+	// save geometry; all orientation groups (-orient_groups) have the same one, so only the first one saves it
+	if (save_geom && orientGroup==0)
 #ifndef SPARSE
 		SaveGeometry();
 #else
@@ -2525,23 +3313,31 @@ void MakeParticle(void)
 #endif // SPARSE
 
 #ifndef SPARSE
-	/* adjust z-axis of position vector, to speed-up matrix-vector multiplication a little bit; after this point
-	 * 'position(z)' is taken relative to the local_z0.
+	local_z0_unif=local_z0;
+#	ifdef PARALLEL
+	if (load_balance) BalanceDipoles(&local_z0_unif);
+#	endif
+	/* adjust y- and z-axes of position vector, to speed-up matrix-vector multiplication a little bit; after this point
+	 * 'position(y)' and 'position(z)' are taken relative to the local_y0 and local_z0_unif, respectively.
 	 */
-	if (local_z0!=0) {
-		us_tmp=(unsigned short)local_z0;
+	if (local_y0!=0) {
+		us_tmp=(unsigned short)local_y0;
+		for (dip=1;dip<3*local_nvoid_Ndip;dip+=3) position[dip]-=us_tmp;
+	}
+	if (local_z0_unif!=0) {
+		us_tmp=(unsigned short)local_z0_unif;
 		for (dip=2;dip<3*local_nvoid_Ndip;dip+=3) position[dip]-=us_tmp;
 	}
-	local_Nz_unif=position[3*local_nvoid_Ndip-1]+1;
-	local_z0_unif=local_z0; // TODO: should be changed afterwards
+	local_Nz_unif = (local_nvoid_Ndip==0) ? 1 : position[3*local_nvoid_Ndip-1]+1;
 #endif // !SPARSE
 
 	box_origin_unif[0]=-dsX*cX;
-	box_origin_unif[1]=-dsY*cY;
 #ifndef SPARSE
+	box_origin_unif[1]=dsY*(local_y0-cY);
 	box_origin_unif[2]=dsZ*(local_z0_unif-cZ);
 	if (surface) ZsumShift=2*(hsub+(local_z0-cZ)*dsZ);
 #else
+	box_origin_unif[1]=-dsY*cY;
 	box_origin_unif[2]=-dsZ*cZ;
 	if (surface) ZsumShift=2*(hsub-cZ*dsZ);
 #	ifdef PARALLEL
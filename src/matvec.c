@@ -19,6 +19,7 @@
 #include "cmplx.h"
 #include "comm.h"
 #include "fft.h"
+#include "hmatrix.h"
 #include "io.h"
 #include "interaction.h"
 #include "linalg.h"
@@ -27,17 +28,34 @@
 #include "vars.h"
 // system headers
 #include <stdlib.h>
+#ifdef OPENMP
+#	include <omp.h>
+#endif
 
 // SEMI-GLOBAL VARIABLES
 
 #ifdef SPARSE
 // defined and initialized in calculator.c
-extern doublecomplex * restrict arg_full;
+extern doublecomplex * restrict arg_full,* restrict sym_buf,* restrict Gstore,* restrict Rstore,*ring_buf[2];
+// defined and initialized in param.c
+extern const bool sparse_sym;
+extern const double aca_eps;
 #else
 // defined and initialized in fft.c
 extern const doublecomplex * restrict Dmatrix,* restrict Rmatrix;
 extern doublecomplex * restrict Xmatrix,* restrict slices,* restrict slices_tr,* restrict slicesR,* restrict slicesR_tr;
 extern const size_t DsizeY,DsizeZ,RsizeY;
+#	ifdef PARALLEL
+// defined and initialized in param.c
+extern const bool bt_overlap,load_balance;
+extern const int procGridY;
+// defined and initialized in fft.c
+extern doublecomplex * restrict slabBuf;
+// defined and initialized in make_particle.c
+extern const unsigned short * restrict slabPosition;
+extern const size_t * restrict slabSpanStart;
+extern const size_t slab_nSpan;
+#	endif
 #endif // !SPARSE
 // defined and initialized in timing.c
 extern size_t TotalMatVec;
@@ -69,7 +87,8 @@ static inline size_t IndexSliceYZ(const size_t y,const size_t z)
 static inline size_t IndexGarbledX(const size_t x,const size_t y,const size_t z)
 {
 #ifdef PARALLEL
-	return ((z%local_Nz)*smallY+y)*gridX+(z/local_Nz)*local_Nx+x%local_Nx;
+	// the block of x-values is placed at the position of the processor, which stored this y and z before transposition
+	return ((z%local_Nz)*local_Ny+y%local_Ny)*gridX+((z/local_Nz)*procGridY+y/local_Ny)*local_Nx+x%local_Nx;
 #else
 	return (z*smallY+y)*gridX+x;
 #endif
@@ -79,7 +98,7 @@ static inline size_t IndexGarbledX(const size_t x,const size_t y,const size_t z)
 
 static inline size_t IndexXmatrix(const size_t x,const size_t y,const size_t z)
 {
-	return (z*smallY+y)*gridX+x;
+	return (z*local_Ny+y)*gridX+x;
 }
 
 //======================================================================================================================
@@ -140,7 +159,7 @@ void MatVec (doublecomplex * restrict argvec,    // the argument vector
 	size_t j,x;
 	bool ipr,transposed;
 	size_t boxY_st=boxY,boxZ_st=boxZ; // copies with different type
-	size_t i;
+	size_t i,s;
 	doublecomplex fmat[6],xv[3],yv[3],xvR[3],yvR[3];
 	size_t index,y,z,Xcomp;
 	unsigned char mat;
@@ -201,26 +220,61 @@ void MatVec (doublecomplex * restrict argvec,    // the argument vector
 	// transform from coordinates to grid and multiply with coupling constant
 	if (her) nConj(argvec); // conjugated back afterwards
 
-	for (i=0;i<local_nvoid_Ndip;i++) {
-		// fill grid with argvec*sqrt_cc
-		j=3*i;
-		mat=material[i];
+#ifdef PARALLEL
+	if (load_balance) {
+		/* the product is computed for the balanced distribution of dipoles (resultvec is used as a buffer) and then
+		 * moved to the distribution over FFT slabs
+		 */
+		for (i=0,j=0;i<local_nvoid_Ndip;i++,j+=3) {
+			mat=material[i];
+			for (Xcomp=0;Xcomp<3;Xcomp++) resultvec[j+Xcomp]=cc_sqrt[mat][Xcomp]*argvec[j+Xcomp];
+		}
+		RedistributeDipoles(resultvec,slabBuf,cmplx3_type,1,true,comm_timing);
+		for (s=0;s<slab_nSpan;s++) {
+			j=3*slabSpanStart[s];
+			index=IndexXmatrix(slabPosition[j],slabPosition[j+1],slabPosition[j+2]);
+			for (i=slabSpanStart[s];i<slabSpanStart[s+1];i++,index++)
+				for (Xcomp=0;Xcomp<3;Xcomp++) Xmatrix[index+Xcomp*local_Nsmall]=slabBuf[3*i+Xcomp];
+		}
+	}
+	else
+#endif
+	// the index in Xmatrix is computed once per span, since dipoles in a span are adjacent along x
+	for (s=0;s<local_nSpan;s++) {
+		j=3*spanStart[s];
 		index=IndexXmatrix(position[j],position[j+1],position[j+2]);
-		// Xmat=cc_sqrt*argvec
-		for (Xcomp=0;Xcomp<3;Xcomp++) Xmatrix[index+Xcomp*local_Nsmall]=cc_sqrt[mat][Xcomp]*argvec[j+Xcomp];
+		for (i=spanStart[s];i<spanStart[s+1];i++,index++) {
+			// fill grid with argvec*sqrt_cc
+			j=3*i;
+			mat=material[i];
+			// Xmat=cc_sqrt*argvec
+			for (Xcomp=0;Xcomp<3;Xcomp++) Xmatrix[index+Xcomp*local_Nsmall]=cc_sqrt[mat][Xcomp]*argvec[j+Xcomp];
+		}
 	}
 #ifdef PRECISE_TIMING
 	GET_SYSTEM_TIME(tvp+1);
 	Elapsed(tvp,tvp+1,&Timing_Mult1);
 #endif
 	// FFT X
+#ifdef PARALLEL
+	if (bt_overlap) for (Xcomp=0;Xcomp<3;Xcomp++) { // transposition of each component overlaps with FFT of the next one
+		fftXcomp(FFT_FORWARD,(int)Xcomp);
+		if (Xcomp==2) BlockTransposeWait(0,comm_timing); // the same half of the buffer is used for components 0 and 2
+		BlockTransposeStart(Xmatrix,(int)Xcomp,comm_timing);
+	}
+	else
+#endif
 	fftX(FFT_FORWARD); // fftX (buf)Xmatrix
 #ifdef PRECISE_TIMING
 	GET_SYSTEM_TIME(tvp+2);
 	Elapsed(tvp+1,tvp+2,&Timing_FFTXf);
 #endif
 #ifdef PARALLEL
-	BlockTranspose(Xmatrix,comm_timing);
+	if (bt_overlap) {
+		BlockTransposeWait(1,comm_timing);
+		BlockTransposeWait(2,comm_timing);
+	}
+	else BlockTranspose(Xmatrix,false,comm_timing);
 #endif
 #ifdef PRECISE_TIMING
 	GET_SYSTEM_TIME(tvp+3);
@@ -336,11 +390,23 @@ void MatVec (doublecomplex * restrict argvec,    // the argument vector
 	} // end of loop over slices
 	// FFT-X back the result
 #ifdef PARALLEL
-	BlockTranspose(Xmatrix,comm_timing);
+	if (bt_overlap) {
+		BlockTransposeStart(Xmatrix,0,comm_timing);
+		BlockTransposeStart(Xmatrix,1,comm_timing);
+	}
+	else BlockTranspose(Xmatrix,true,comm_timing);
 #endif
 #ifdef PRECISE_TIMING
 	GET_SYSTEM_TIME(tvp+14);
 	Elapsed(tvp+13,tvp+14,&Timing_BTb);
+#endif
+#ifdef PARALLEL
+	if (bt_overlap) for (Xcomp=0;Xcomp<3;Xcomp++) { // FFT of each component overlaps with transposition of the next one
+		BlockTransposeWait((int)Xcomp,comm_timing);
+		if (Xcomp==0) BlockTransposeStart(Xmatrix,2,comm_timing);
+		fftXcomp(FFT_BACKWARD,(int)Xcomp);
+	}
+	else
 #endif
 	fftX(FFT_BACKWARD); // fftX (buf)Xmatrix
 #ifdef PRECISE_TIMING
@@ -348,14 +414,35 @@ void MatVec (doublecomplex * restrict argvec,    // the argument vector
 	Elapsed(tvp+14,tvp+15,&Timing_FFTXb);
 #endif
 	// fill resultvec
-	for (i=0;i<local_nvoid_Ndip;i++) {
-		j=3*i;
-		mat=material[i];
+#ifdef PARALLEL
+	if (load_balance) { // reverse of the procedure in the beginning
+		for (s=0;s<slab_nSpan;s++) {
+			j=3*slabSpanStart[s];
+			index=IndexXmatrix(slabPosition[j],slabPosition[j+1],slabPosition[j+2]);
+			for (i=slabSpanStart[s];i<slabSpanStart[s+1];i++,index++)
+				for (Xcomp=0;Xcomp<3;Xcomp++) slabBuf[3*i+Xcomp]=Xmatrix[index+Xcomp*local_Nsmall];
+		}
+		RedistributeDipoles(slabBuf,resultvec,cmplx3_type,1,false,comm_timing);
+		for (i=0,j=0;i<local_nvoid_Ndip;i++,j+=3) {
+			mat=material[i];
+			for (Xcomp=0;Xcomp<3;Xcomp++) // result=argvec+cc_sqrt*Xmat
+				resultvec[j+Xcomp]=argvec[j+Xcomp]+cc_sqrt[mat][Xcomp]*resultvec[j+Xcomp];
+			if (ipr) *inprod+=cvNorm2(resultvec+j);
+		}
+	}
+	else
+#endif
+	for (s=0;s<local_nSpan;s++) {
+		j=3*spanStart[s];
 		index=IndexXmatrix(position[j],position[j+1],position[j+2]);
-		for (Xcomp=0;Xcomp<3;Xcomp++) // result=argvec+cc_sqrt*Xmat
-			resultvec[j+Xcomp]=argvec[j+Xcomp]+cc_sqrt[mat][Xcomp]*Xmatrix[index+Xcomp*local_Nsmall];
-		// norm is unaffected by conjugation, hence can be computed here
-		if (ipr) *inprod+=cvNorm2(resultvec+j);
+		for (i=spanStart[s];i<spanStart[s+1];i++,index++) {
+			j=3*i;
+			mat=material[i];
+			for (Xcomp=0;Xcomp<3;Xcomp++) // result=argvec+cc_sqrt*Xmat
+				resultvec[j+Xcomp]=argvec[j+Xcomp]+cc_sqrt[mat][Xcomp]*Xmatrix[index+Xcomp*local_Nsmall];
+			// norm is unaffected by conjugation, hence can be computed here
+			if (ipr) *inprod+=cvNorm2(resultvec+j);
+		}
 	}
 	if (her) {
 		nConj(resultvec);
@@ -427,8 +514,116 @@ void MatVec (doublecomplex * restrict argvec,    // the argument vector
 
 //======================================================================================================================
 
+void InitSparseStore(void)
+// computes and stores the interaction terms for all local dipoles, which are then used in MatVec
+{
+	size_t i;
+	const size_t rowSize=NDCOMP*nvoid_Ndip;
+
+#ifdef OPENMP
+#	pragma omp parallel for schedule(dynamic)
+#endif
+	for (i=0;i<local_nvoid_Ndip;i++) RowStore(i,Gstore+rowSize*i,surface ? Rstore+rowSize*i : NULL);
+}
+
+//======================================================================================================================
+
+#define SPARSE_TILE 256 // number of dipoles in a tile (both along i and j), the tile of argvec fits into L1 cache
+
+static void MatVecSym(doublecomplex * restrict resultvec)
+/* Computes the product of the interaction matrix by arg_full for local dipoles (without the diagonal part), using the
+ * symmetry G_ij=G_ji for pairs of local dipoles. Pairs of tiles (ib,jb) with jb>=ib are processed once, then the
+ * computed terms are applied to both tiles. Therefore, each thread writes to arbitrary parts of the result, which is
+ * solved by separate buffers (sym_buf) for each thread except the first one, which are summed up in the end.
+ */
+{
+	const size_t n3=3*local_nvoid_Ndip,d0=local_nvoid_d0,d1=local_nvoid_d0+local_nvoid_Ndip;
+	const size_t nTiles=(local_nvoid_Ndip+SPARSE_TILE-1)/SPARSE_TILE;
+
+#ifdef OPENMP
+#	pragma omp parallel
+#endif
+	{
+		doublecomplex * restrict res=resultvec;
+		size_t ib,k;
+#ifdef OPENMP
+		const int t=omp_get_thread_num(),nthr=omp_get_num_threads();
+		int t2;
+		if (t>0) res=sym_buf+(t-1)*n3;
+#endif
+		for (k=0;k<n3;k++) res[k]=0;
+#ifdef OPENMP
+#		pragma omp for schedule(dynamic)
+#endif
+		for (ib=0;ib<nTiles;ib++) {
+			const size_t i0=ib*SPARSE_TILE,i1=MIN(i0+SPARSE_TILE,local_nvoid_Ndip);
+			size_t i,j0,jb;
+			// dipoles on other processors are processed in a standard way
+			for (j0=0;j0<d0;j0+=SPARSE_TILE) for (i=i0;i<i1;i++)
+				RowProd(arg_full+3*j0,res,i,j0,MIN(j0+SPARSE_TILE,d0));
+			for (j0=d1;j0<nvoid_Ndip;j0+=SPARSE_TILE) for (i=i0;i<i1;i++)
+				RowProd(arg_full+3*j0,res,i,j0,MIN(j0+SPARSE_TILE,nvoid_Ndip));
+			// diagonal tile
+			for (i=i0;i<i1;i++) {
+				RowProdSym(arg_full,res,i,i+1,i1);
+				if (surface) SelfReflProd(arg_full,res,i);
+			}
+			// other local tiles
+			for (jb=ib+1;jb<nTiles;jb++) for (i=i0;i<i1;i++)
+				RowProdSym(arg_full,res,i,jb*SPARSE_TILE,MIN((jb+1)*SPARSE_TILE,local_nvoid_Ndip));
+		}
+#ifdef OPENMP
+		// there is an implicit barrier at the end of the previous loop
+#		pragma omp for schedule(static)
+		for (k=0;k<n3;k++) for (t2=0;t2<nthr-1;t2++) resultvec[k]+=sym_buf[t2*n3+k];
+#endif
+	}
+}
+
+//======================================================================================================================
+
+static void MatVecRing(doublecomplex * restrict resultvec,TIME_TYPE *comm_timing UOIP)
+/* Computes the product of the interaction matrix by the argument vector for local dipoles (without the diagonal part),
+ * when the local part of the latter is in ring_buf[0]. Instead of gathering the full argument vector, its blocks
+ * (belonging to different processors) are passed along the ring of processors. The product with the current block is
+ * computed while the next one is being transferred, hence only two blocks are stored at any time.
+ */
+{
+	const size_t nTiles=(local_nvoid_Ndip+SPARSE_TILE-1)/SPARSE_TILE;
+	size_t k,jd0,jn;
+	int step,cur;
+
+	for (k=0;k<3*local_nvoid_Ndip;k++) resultvec[k]=0;
+	for (step=0,cur=0;step<nprocs;step++,cur=1-cur) {
+		const doublecomplex * restrict block=ring_buf[cur];
+		size_t ib;
+
+		jn=RingBlock(step,&jd0);
+#ifdef PARALLEL
+		if (step<nprocs-1) RingShift(block,ring_buf[1-cur],step);
+#endif
+#ifdef OPENMP
+#		pragma omp parallel for schedule(dynamic)
+#endif
+		for (ib=0;ib<nTiles;ib++) {
+			const size_t i0=ib*SPARSE_TILE,i1=MIN(i0+SPARSE_TILE,local_nvoid_Ndip);
+			size_t ii,j0;
+			for (j0=jd0;j0<jd0+jn;j0+=SPARSE_TILE) for (ii=i0;ii<i1;ii++)
+				RowProd(block+3*(j0-jd0),resultvec,ii,j0,MIN(j0+SPARSE_TILE,jd0+jn));
+		}
+#ifdef PARALLEL
+		if (step<nprocs-1) RingWait(comm_timing);
+#endif
+	}
+}
+
+//======================================================================================================================
+
 /* The sparse MatVec is implemented completely separately from the non-sparse version. Although there is some code
  * duplication, this probably makes the both versions easier to maintain.
+ *
+ * The product is computed by tiles of SPARSE_TILE dipoles, both to reuse the cache and to distribute the work among
+ * OpenMP threads (by rows).
 */
 void MatVec (doublecomplex * restrict argvec,    // the argument vector
              doublecomplex * restrict resultvec, // the result vector
@@ -438,19 +633,52 @@ void MatVec (doublecomplex * restrict argvec,    // the argument vector
              TIME_TYPE *comm_timing) // this variable is incremented by communication time
 {
 	const bool ipr = (inprod != NULL);
-	size_t i,j,i3;
+	size_t i,j,ib;
+	const size_t nTiles=(local_nvoid_Ndip+SPARSE_TILE-1)/SPARSE_TILE;
+
+	// local part of the argument vector is placed either in ring_buf (for the ring exchange) or in arg_full
+	doublecomplex * restrict argloc = (ring_buf[0]!=NULL) ? ring_buf[0] : arg_full+3*local_nvoid_d0;
 
 	TIME_TYPE tstart=GET_TIME();
 	if (her) nConj(argvec);
+	// arg_full may be shared with other processors on the node, which can still be using it in the previous MatVec
+	if (ring_buf[0]==NULL) SyncShared(arg_full);
 	// TODO: can be replaced by nMult_mat
-	for (j=0; j<local_nvoid_Ndip; j++) CcMul(argvec,arg_full+3*local_nvoid_d0,j);
+	for (j=0; j<local_nvoid_Ndip; j++) CcMul(argvec,argloc,j);
 #	ifdef PARALLEL
-	AllGather(NULL,arg_full,cmplx3_type,comm_timing);
+	if (ring_buf[0]==NULL) AllGather(NULL,arg_full,cmplx3_type,comm_timing);
 #	endif
-	for (i=0; i<local_nvoid_Ndip; i++) {
-		i3 = 3*i;
-		cvInit(resultvec+i3);
-		for (j=0; j<nvoid_Ndip; j++) AijProd(arg_full,resultvec,i,j);
+	if (ring_buf[0]!=NULL) MatVecRing(resultvec,comm_timing);
+	else if (aca_eps!=UNDEF) HmatrixProd(arg_full,resultvec);
+	else if (Gstore!=NULL) {
+#ifdef OPENMP
+#		pragma omp parallel for schedule(static)
+#endif
+		for (i=0;i<local_nvoid_Ndip;i++) {
+			const doublecomplex * restrict Grow=Gstore+NDCOMP*nvoid_Ndip*i;
+			doublecomplex res[3];
+			size_t jj;
+			cvInit(res);
+			for (jj=0;jj<nvoid_Ndip;jj++) SymProdAdd(Grow+NDCOMP*jj,arg_full+3*jj,res);
+			if (surface) {
+				const doublecomplex * restrict Rrow=Rstore+NDCOMP*nvoid_Ndip*i;
+				for (jj=0;jj<nvoid_Ndip;jj++) ReflProdAdd(Rrow+NDCOMP*jj,arg_full+3*jj,res);
+			}
+			memcpy(resultvec+3*i,res,3*sizeof(doublecomplex));
+		}
+	}
+	else if (sparse_sym) MatVecSym(resultvec);
+	else {
+#ifdef OPENMP
+#		pragma omp parallel for schedule(dynamic)
+#endif
+		for (ib=0;ib<nTiles;ib++) {
+			const size_t i0=ib*SPARSE_TILE,i1=MIN(i0+SPARSE_TILE,local_nvoid_Ndip);
+			size_t ii,j0;
+			for (ii=i0;ii<i1;ii++) cvInit(resultvec+3*ii);
+			for (j0=0;j0<nvoid_Ndip;j0+=SPARSE_TILE) for (ii=i0;ii<i1;ii++)
+				RowProd(arg_full+3*j0,resultvec,ii,j0,MIN(j0+SPARSE_TILE,nvoid_Ndip));
+		}
 	}
 	// TODO: can be replaced by a specially designed function from linalg.c
 	for (i=0; i<local_nvoid_Ndip; i++) DiagProd(argvec,resultvec,i);
@@ -462,5 +690,6 @@ void MatVec (doublecomplex * restrict argvec,    // the argument vector
 	(*timing) += GET_TIME() - tstart;
 	TotalMatVec++;
 }
+#undef SPARSE_TILE
 
 #endif // SPARSE
@@ -23,6 +23,11 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#ifdef WINDOWS
+#	include <windows.h> // for GlobalMemoryStatusEx
+#elif defined(POSIX)
+#	include <unistd.h>  // for sysconf
+#endif
 
 #ifdef FFTW3
 #	include <fftw3.h> // for fftw_malloc; types.h should be defined before (to match C99 complex type)
@@ -52,6 +57,25 @@ size_t MultOverflow(const size_t a,const size_t b,OTHER_ARGUMENTS)
 	return(a*b);
 }
 
+//======================================================================================================================
+
+double AvailableMemory(void)
+// returns available physical memory (in bytes) or 0, if it can't be determined
+{
+#ifdef WINDOWS
+	MEMORYSTATUSEX status;
+
+	status.dwLength=sizeof(status);
+	if (GlobalMemoryStatusEx(&status)) return (double)status.ullAvailPhys;
+#elif defined(POSIX) && defined(_SC_AVPHYS_PAGES) // the latter is not defined, e.g., on macOS
+	const long pages=sysconf(_SC_AVPHYS_PAGES);
+	const long pageSize=sysconf(_SC_PAGESIZE);
+
+	if (pages>0 && pageSize>0) return (double)pages*(double)pageSize;
+#endif
+	return 0;
+}
+
 //======================================================================================================================
 doublecomplex *complexVector(const size_t size,OTHER_ARGUMENTS)
 // allocates complex vector
@@ -184,6 +208,19 @@ unsigned short *ushortVector(const size_t size,OTHER_ARGUMENTS)
 
 //======================================================================================================================
 
+unsigned short *ushortRealloc(unsigned short *ptr,const size_t size,OTHER_ARGUMENTS)
+// reallocates unsigned short vector ptr to a new size
+{
+	unsigned short *v;
+
+	CHECK_SIZE(size,short);
+	v=(unsigned short *)realloc(ptr,size*sizeof(short));
+	CHECK_NULL(size,v);
+	return v;
+}
+
+//======================================================================================================================
+
 char *charVector(const size_t size,OTHER_ARGUMENTS)
 // allocates unsigned char vector
 {
@@ -223,6 +260,19 @@ unsigned char *ucharVector(const size_t size,OTHER_ARGUMENTS)
 
 //======================================================================================================================
 
+unsigned char *ucharRealloc(unsigned char *ptr,const size_t size,OTHER_ARGUMENTS)
+// reallocates unsigned char vector ptr to a new size
+{
+	unsigned char *v;
+
+	CHECK_SIZE(size,char);
+	v=(unsigned char *)realloc(ptr,size*sizeof(char));
+	CHECK_NULL(size,v);
+	return v;
+}
+
+//======================================================================================================================
+
 bool *boolVector(const size_t size,OTHER_ARGUMENTS)
 // allocates bool vector
 {
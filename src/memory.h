@@ -30,6 +30,7 @@
 
 void CheckOverflow(double size,OTHER_ARGUMENTS);
 size_t MultOverflow(size_t a,size_t b,OTHER_ARGUMENTS);
+double AvailableMemory(void);
 // allocate
 doublecomplex *complexVector(size_t size,OTHER_ARGUMENTS) ATT_MALLOC;
 double **doubleMatrix(size_t rows,size_t cols,OTHER_ARGUMENTS) ATT_MALLOC;
@@ -43,9 +44,11 @@ unsigned char *ucharVector(size_t size,OTHER_ARGUMENTS) ATT_MALLOC;
 bool *boolVector(size_t size,OTHER_ARGUMENTS) ATT_MALLOC;
 size_t *sizetVector(size_t size,OTHER_ARGUMENTS) ATT_MALLOC;
 void *voidVector(size_t size,OTHER_ARGUMENTS) ATT_MALLOC;
-// reallocate; only two for now, more can be easily added
+// reallocate; only a few for now, more can be easily added
 double *doubleRealloc(double *ptr,const size_t size,OTHER_ARGUMENTS) ATT_MALLOC;
 char *charRealloc(char *ptr,const size_t size,OTHER_ARGUMENTS) ATT_MALLOC;
+unsigned char *ucharRealloc(unsigned char *ptr,const size_t size,OTHER_ARGUMENTS) ATT_MALLOC;
+unsigned short *ushortRealloc(unsigned short *ptr,const size_t size,OTHER_ARGUMENTS) ATT_MALLOC;
 // free
 void Free_cVector(doublecomplex * restrict v);
 void Free_dMatrix(double ** restrict m,size_t rows);
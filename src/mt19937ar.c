@@ -46,23 +46,27 @@
 #include <stdio.h>
 #include "mt19937ar.h"
 
-/* Due to use of static local variables in this source file, the implementation is not thread-safe.
- * Should not be called in parallel from multiple threads (e.g. OpenMP)
+/* Due to use of static global state in this source file, the functions without '_r' suffix are not thread-safe.
+ * They should not be called in parallel from multiple threads (e.g. OpenMP). Reentrant functions (with '_r' suffix) are
+ * thread-safe as long as each thread uses its own state.
  */
 
 /* Period parameters */  
-#define N 624
+#define N MT_N
 #define M 397
 #define MATRIX_A 0x9908b0dfUL   /* constant vector a */
 #define UPPER_MASK 0x80000000UL /* most significant w-r bits */
 #define LOWER_MASK 0x7fffffffUL /* least significant r bits */
 
-static unsigned long mt[N]; /* the array for the state vector  */
-static int mti=N+1; /* mti==N+1 means mt[N] is not initialized */
+static mt_state gst={{0},N+1}; /* global state, used by functions without '_r' suffix */
 
-/* initializes mt[N] with a seed */
-void init_genrand(unsigned long s)
+/* The following functions are reentrant versions operating on explicit state 'st', which allows several independent
+   streams (e.g., one per thread). Added for ADDA, the algorithm itself is not changed */
+void init_genrand_r(mt_state *st, unsigned long s)
 {
+    unsigned long *mt=st->mt;
+    int mti;
+
     mt[0]= s & 0xffffffffUL;
     for (mti=1; mti<N; mti++) {
         mt[mti] = 
@@ -74,16 +78,14 @@ void init_genrand(unsigned long s)
         mt[mti] &= 0xffffffffUL;
         /* for >32 bit machines */
     }
+    st->mti=mti;
 }
 
-/* initialize by an array with array-length */
-/* init_key is the array for initializing keys */
-/* key_length is its length */
-/* slight change for C++, 2004/2/26 */
-void init_by_array(unsigned long init_key[], int key_length)
+void init_by_array_r(mt_state *st, unsigned long init_key[], int key_length)
 {
+    unsigned long *mt=st->mt;
     int i, j, k;
-    init_genrand(19650218UL);
+    init_genrand_r(st,19650218UL);
     i=1; j=0;
     k = (N>key_length ? N : key_length);
     for (; k; k--) {
@@ -105,18 +107,18 @@ void init_by_array(unsigned long init_key[], int key_length)
     mt[0] = 0x80000000UL; /* MSB is 1; assuring non-zero initial array */ 
 }
 
-/* generates a random number on [0,0xffffffff]-interval */
-unsigned long genrand_int32(void)
+unsigned long genrand_int32_r(mt_state *st)
 {
+    unsigned long *mt=st->mt;
     unsigned long y;
-    static unsigned long mag01[2]={0x0UL, MATRIX_A};
+    static const unsigned long mag01[2]={0x0UL, MATRIX_A};
     /* mag01[x] = x * MATRIX_A  for x=0,1 */
 
-    if (mti >= N) { /* generate N words at one time */
+    if (st->mti >= N) { /* generate N words at one time */
         int kk;
 
-        if (mti == N+1)   /* if init_genrand() has not been called, */
-            init_genrand(5489UL); /* a default initial seed is used */
+        if (st->mti == N+1)   /* if init_genrand() has not been called, */
+            init_genrand_r(st,5489UL); /* a default initial seed is used */
 
         for (kk=0;kk<N-M;kk++) {
             y = (mt[kk]&UPPER_MASK)|(mt[kk+1]&LOWER_MASK);
@@ -129,10 +131,10 @@ unsigned long genrand_int32(void)
         y = (mt[N-1]&UPPER_MASK)|(mt[0]&LOWER_MASK);
         mt[N-1] = mt[M-1] ^ (y >> 1) ^ mag01[y & 0x1UL];
 
-        mti = 0;
+        st->mti = 0;
     }
   
-    y = mt[mti++];
+    y = mt[st->mti++];
 
     /* Tempering */
     y ^= (y >> 11);
@@ -143,7 +145,27 @@ unsigned long genrand_int32(void)
     return y;
 }
 
-/* generates a random number on [0,0x7fffffff]-interval */
+/* initializes mt[N] with a seed */
+void init_genrand(unsigned long s)
+{
+    init_genrand_r(&gst,s);
+}
+
+/* initialize by an array with array-length */
+/* init_key is the array for initializing keys */
+/* key_length is its length */
+/* slight change for C++, 2004/2/26 */
+void init_by_array(unsigned long init_key[], int key_length)
+{
+    init_by_array_r(&gst,init_key,key_length);
+}
+
+/* generates a random number on [0,0xffffffff]-interval */
+unsigned long genrand_int32(void)
+{
+    return genrand_int32_r(&gst);
+}
+
 long genrand_int31(void)
 {
     return (long)(genrand_int32()>>1);
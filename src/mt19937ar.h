@@ -43,6 +43,14 @@
    email: m-mat @ math.sci.hiroshima-u.ac.jp (remove space)
 */
 
+#define MT_N 624 /* size of the state vector */
+
+/* state of the generator, to be used with reentrant functions (with suffix '_r') below */
+typedef struct {
+    unsigned long mt[MT_N]; /* the array for the state vector  */
+    int mti; /* mti==MT_N+1 means mt[MT_N] is not initialized */
+} mt_state;
+
 /* initializes mt[N] with a seed */
 void init_genrand(unsigned long s);
 
@@ -74,3 +82,10 @@ double genrand_res53(void);
 /* macro to quickly get random double from range [a,b)
    added by Maxim Yurkin */
 #define genrand(a,b) (genrand_int32()*(1.0/4294967296.0)*((b)-(a))+(a))
+
+/* reentrant versions of the above functions, operating on explicit state; they enable several independent streams
+   (e.g., one per thread) - added for ADDA */
+void init_genrand_r(mt_state *st, unsigned long s);
+void init_by_array_r(mt_state *st, unsigned long init_key[], int key_length);
+unsigned long genrand_int32_r(mt_state *st);
+#define genrand_r(st,a,b) (genrand_int32_r(st)*(1.0/4294967296.0)*((b)-(a))+(a))
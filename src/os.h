@@ -28,4 +28,25 @@
 #	define POSIX
 #endif
 
+/* 64-bit seek in a file (offset is relative to origin, as in fseek), since long is 32-bit on some platforms. On POSIX
+ * systems fseeko is used with 64-bit off_t (also on 32-bit systems). The corresponding feature-test macros take effect
+ * only if defined before any system header, which is the case for sources that include "os.h" (directly or through
+ * other project headers) before the system ones. On macOS these macros are not needed and would hide BSD extensions.
+ */
+#ifdef WINDOWS
+#	define FSEEK64(file,offset,origin) _fseeki64(file,(__int64)(offset),origin)
+#elif defined(POSIX)
+#	ifndef __APPLE__
+#		ifndef _POSIX_C_SOURCE
+#			define _POSIX_C_SOURCE 200112L
+#		endif
+#		ifndef _FILE_OFFSET_BITS
+#			define _FILE_OFFSET_BITS 64
+#		endif
+#	endif
+#	define FSEEK64(file,offset,origin) fseeko(file,(off_t)(offset),origin)
+#else
+#	define FSEEK64(file,offset,origin) fseek(file,(long)(offset),origin)
+#endif
+
 #endif // __os_h
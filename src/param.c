@@ -30,6 +30,9 @@
 // system headers
 #include <ctype.h>
 #include <math.h>
+#ifdef OPENMP
+#	include <omp.h>
+#endif
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -119,11 +122,16 @@ bool calc_mat_force;  // Calculate the scattering force by matrix-evaluation
 bool store_force;     // Write radiation pressure per dipole to file
 bool store_ampl;      // Write amplitude matrix to file
 int phi_int_type;     // type of phi integration (each bit determines whether to calculate with different multipliers)
+enum fform store_format; // format for storing fields on dipoles
 // used in calculator.c
 bool avg_inc_pol;            // whether to average CC over incident polarization
 double polNlocRp;            // Gaussian width for non-local polarizability
 const char *alldir_parms;    // name of file with alldir parameters
 const char *scat_grid_parms; // name of file with parameters of scattering grid
+#ifdef SPARSE
+enum spstore sparse_store;   // whether to store the interaction matrix
+bool sparse_ring;            // whether to pass blocks of argvec along the ring of processors instead of gathering it
+#endif
 // used in crosssec.c
 double incPolX_0[3],incPolY_0[3]; // initial incident polarizations (in lab RF)
 enum scat ScatRelation;           // type of formulae for scattering quantities
@@ -136,6 +144,8 @@ const char *beam_fnameX;
 // used in interaction.c
 double igt_lim; // limit (threshold) for integration in IGT
 double igt_eps; // relative error of integration in IGT
+const char *igt_cache; // directory for cache of IGT table (NULL - not used)
+double som_eps; // relative error of interpolation of Sommerfeld integrals (UNDEF - direct evaluation)
 double nloc_Rp; // Gaussian width for non-local interaction
 bool InteractionRealArgs; // whether interaction (or reflection) routines can be called with real arguments
 // used in io.c
@@ -169,10 +179,32 @@ int gr_mat;                      // domain number to granulate
 double a_eq;                     // volume-equivalent radius of the particle
 enum shform sg_format;           // format for saving geometry files
 bool store_grans;                // whether to save granule positions to file
+#ifdef SPARSE
+// used in matvec.c
+bool sparse_sym; // whether to use symmetry of the interaction matrix (G_ij=G_ji) in sparse MatVec
+double aca_eps;  // relative error of low-rank blocks in the hierarchical matrix (UNDEF - not used)
+#endif
+#if defined(PARALLEL) && !defined(SPARSE)
+// used in fft.c and matvec.c
+bool bt_overlap; // whether to overlap block transposition with FFT along x in MatVec
+// used in comm.c and fft.c
+enum btmethod bt_method; // method of block transposition
+// used in comm.c, fft.c, and make_particle.c
+int procGridY,procGridZ; // sizes of 2D grid of processors, over which the y and z ranges are distributed
+// used in make_particle.c and matvec.c
+bool load_balance; // whether to distribute dipoles over processors by their number (not by the number of z-layers)
+#endif
+#ifdef PARALLEL
+// used in calculator.c, comm.c, and timing.c
+int orient_groups; // number of groups of processors, calculating different orientations during orientation averaging
+#endif
 
 // LOCAL VARIABLES
 
 #define GFORM_RI_DIRNAME "%.4g" // format for refractive index in directory name
+#ifdef SPARSE
+#	define ACA_EPS_DEF 1E-5 // default accuracy of ACA (when '-sparse_aca' is given without argument)
+#endif
 
 static const char *run_name;    // first part of the dir name ('run' or 'test')
 static const char *avg_parms;   // name of file with orientation averaging parameters
@@ -382,6 +414,10 @@ PARSE_FUNC(anisotr);
 PARSE_FUNC(asym);
 PARSE_FUNC(beam);
 PARSE_FUNC(beam_center);
+#if defined(PARALLEL) && !defined(SPARSE)
+PARSE_FUNC(bt_method);
+PARSE_FUNC(bt_overlap);
+#endif
 PARSE_FUNC(chp_dir);
 PARSE_FUNC(chp_load);
 PARSE_FUNC(chp_type);
@@ -400,12 +436,16 @@ PARSE_FUNC(granul);
 #endif
 PARSE_FUNC(grid);
 PARSE_FUNC(h) ATT_NORETURN;
+PARSE_FUNC(igt_cache);
 PARSE_FUNC(init_field);
 PARSE_FUNC(int);
 PARSE_FUNC(int_surf);
 PARSE_FUNC(iter);
 PARSE_FUNC(jagged);
 PARSE_FUNC(lambda);
+#if defined(PARALLEL) && !defined(SPARSE)
+PARSE_FUNC(load_balance);
+#endif
 PARSE_FUNC(m);
 PARSE_FUNC(maxiter);
 PARSE_FUNC(no_reduced_fft);
@@ -413,8 +453,14 @@ PARSE_FUNC(no_vol_cor);
 PARSE_FUNC(ntheta);
 PARSE_FUNC(opt);
 PARSE_FUNC(orient);
+#ifdef PARALLEL
+PARSE_FUNC(orient_groups);
+#endif
 PARSE_FUNC(phi_integr);
 PARSE_FUNC(pol);
+#if defined(PARALLEL) && !defined(SPARSE)
+PARSE_FUNC(proc_grid);
+#endif
 PARSE_FUNC(prognosis);
 PARSE_FUNC(prop);
 PARSE_FUNC(recalc_resid);
@@ -432,9 +478,16 @@ PARSE_FUNC(sg_format);
 PARSE_FUNC(shape);
 PARSE_FUNC(size);
 PARSE_FUNC(so_buf);
+#ifdef SPARSE
+PARSE_FUNC(sparse_aca);
+PARSE_FUNC(sparse_ring);
+PARSE_FUNC(sparse_store);
+PARSE_FUNC(sparse_sym);
+#endif
 PARSE_FUNC(store_beam);
 PARSE_FUNC(store_dip_pol);
 PARSE_FUNC(store_force);
+PARSE_FUNC(store_format);
 #ifndef SPARSE
 PARSE_FUNC(store_grans);
 #endif
@@ -466,6 +519,23 @@ static struct opt_struct options[]={
 		"beams it corresponds to the most symmetric point with zero phase, while for a point source or a fast "
 		"electron, it determines the real position in space.\n"
 		"Default: 0 0 0",3,NULL},
+#if defined(PARALLEL) && !defined(SPARSE)
+	{PAR(bt_method),"{pair|alltoall|neighbor|node|auto}","Sets the method of block transposition (MPI communication "
+		"in the matrix-vector product and in the initialization of the interaction matrix): sequence of pairwise "
+		"exchanges ('pair'), MPI_Alltoall ('alltoall'), neighborhood collective on the graph of all processors "
+		"('neighbor'), or node-aware exchange ('node'), which transfers the data between processors on the same node "
+		"through shared memory and uses pairwise exchanges only between the nodes. 'auto' chooses the fastest of them "
+		"by a short benchmark at startup (results are shown in the log). The latter methods require the "
+		"communication buffer of the size of the argument vector on the expanded grid (for each processor). 'neighbor' "
+		"and 'node' require MPI 3.0. Can not be used together with '-bt_overlap'.\n"
+		"Default: pair",1,NULL},
+	{PAR(bt_overlap),"","Split the Fourier transform along x and the following block transposition (MPI communication) "
+		"in the matrix-vector product into three parts (by vector components), so that the transposition of one part "
+		"overlaps with the Fourier transform of the next one, and the same in the reverse order. This may significantly "
+		"decrease the communication time at large number of processors (if supported by the MPI implementation and "
+		"the network). The size of the communication buffer (for each processor) is 2/3 of that of the argument vector on "
+		"the expanded grid instead of 2/nprocs, i.e. it is larger for more than 3 processors.",0,NULL},
+#endif
 	{PAR(chp_dir),"<dirname>","Sets directory for the checkpoint (both for saving and loading).\n"
 		"Default: "FD_CHP_DIR,1,NULL},
 	{PAR(chp_load),"","Restart a simulation from a checkpoint",0,NULL},
@@ -512,6 +582,11 @@ static struct opt_struct options[]={
 		"name of the option should be given without preceding dash). For some options (e.g. '-beam' or '-shape') "
 		"specific help on a particular suboption <subopt> may be shown.\n"
 		"Example: shape coated",UNDEF,NULL},
+	{PAR(igt_cache),"<dirname>","Sets directory for the cache of integrated Green's tensors (used with '-int igt'). "
+		"The required tensors are loaded from the file there (if it exists and matches the current kd, dipole aspect "
+		"ratios and integration precision), only the missing values are computed, and they are added to the file. "
+		"This speeds up repeated runs, e.g. for different particles with the same discretization.\n"
+		"Default: not used",1,NULL},
 	{PAR(init_field),"{auto|inc|read <filenameY> [<filenameX>]|wkb|zero}",
 		"Sets prescription to calculate initial (starting) field for the iterative solver.\n"
 		"'auto' - automatically choose from 'zero' and 'inc' based on the lower residual value.\n"
@@ -552,20 +627,20 @@ static struct opt_struct options[]={
 		 * {...} and its description to the next string. If the new interaction formulation requires unusually large
 		 * computational time, add a special note for sparse mode (after '#ifdef SPARSE').
 		 */
-	{PAR(int_surf),"{img|som}",
+	{PAR(int_surf),"{img|som [<prec>]}",
 		"Sets prescription to calculate the reflection term.\n"
 		"'img' - approximation based on a single image dipole (fast but inaccurate).\n"
-		"'som' - direct evaluation of Sommerfeld integrals.\n"
+		"'som' - direct evaluation of Sommerfeld integrals. If <prec> is given, the integrals are instead computed on "
+		"a coarser (rho,z) mesh, which is refined until the estimated error of (cubic) interpolation, relative to the "
+		"maximum absolute value of the integral, is below epsilon=10^(-<prec>).\n"
 	#ifdef SPARSE
 		"!!! In sparse mode 'som' is expected to be very slow.\n"
 	#endif
-		"Default: som (but 'img' if surface is perfectly reflecting)",1,NULL},
+		"Default: som (but 'img' if surface is perfectly reflecting)",UNDEF,NULL},
 		/* TO ADD NEW REFLECTION FORMULATION
 		 * Modify string constants after 'PAR(int_surf)': add new argument (possibly with additional sub-arguments) to
 		 * list {...} and its description to the next string. If the new reflection formulation requires unusually
 		 * large computational time, add a special note for sparse mode (after '#ifdef SPARSE').
-		 * !!! If subarguments are added, second-to-last argument should be changed from 1 to UNDEF, and consistency
-		 * test for number of arguments should be implemented in PARSE_FUNC(int_surf) below.
 		 */
 	{PAR(iter),"{bcgs2|bicg|bicgstab|cgnr|csym|qmr|qmr2}","Sets the iterative solver.\n"
 		"Default: qmr",1,NULL},
@@ -578,6 +653,15 @@ static struct opt_struct options[]={
 		"Default: 1",1,NULL},
 	{PAR(lambda),"<arg>","Sets incident wavelength in um, float.\n"
 		"Default: 2*pi",1,NULL},
+#if defined(PARALLEL) && !defined(SPARSE)
+	{PAR(load_balance),"","Distribute the occupied dipoles over processors in contiguous ranges of z-layers with "
+		"approximately equal numbers of dipoles (instead of equal numbers of layers). This balances all computations "
+		"performed over the dipoles (incident beam, scattered fields, etc.), which is relevant for particles with "
+		"strongly varying cross section along z, e.g. spheres or particles near the substrate. The Fourier transforms "
+		"are still divided uniformly, hence each matrix-vector product requires an additional exchange of the vector "
+		"values between processors. The resulting distribution is shown in the log. Can not be used with '-proc_grid' "
+		"with <py> larger than 1 or with '-init_field wkb'.",0,NULL},
+#endif
 	{PAR(m),"{<m1Re> <m1Im> [...]|<m1xxRe> <m1xxIm> <m1yyRe> <m1yyIm> <m1zzRe> <m1zzIm> [...]}","Sets refractive "
 		"indices, float. Each pair of arguments specifies real and imaginary part of the refractive index of one of "
 		"the domains. If '-anisotr' is specified, three refractive indices correspond to one domain (diagonal elements "
@@ -603,10 +687,23 @@ static struct opt_struct options[]={
 		"Default: speed",1,NULL},
 	{PAR(orient),"{<alpha> <beta> <gamma>|avg [<filename>]}","Either sets an orientation of the particle by three "
 		"Euler angles 'alpha','beta','gamma' (in degrees) or specifies that orientation averaging should be "
-		"performed. <filename> sets a file with parameters for orientation averaging. Here zyz-notation (or "
-		"y-convention) is used for Euler angles.\n"
+		"performed. <filename> sets a file with parameters for orientation averaging, including the scheme of "
+		"integration over 'beta' and 'gamma' (Romberg, Lebedev quadrature, or scrambled Sobol points). For Romberg "
+		"integration full ranges of 'beta' and 'gamma' are automatically reduced using particle symmetries (unless "
+		"'-sym no' is given). Here zyz-notation (or y-convention) is used for Euler angles.\n"
 		"Default orientation: 0 0 0\n"
 		"Default <filename>: "FD_AVG_PARMS,UNDEF,NULL},
+#ifdef PARALLEL
+	{PAR(orient_groups),"<n>","Splits all processors into <n> equal groups (integer, the number of processors should "
+		"be divisible by it), which calculate different orientations simultaneously during orientation averaging. "
+		"Each group solves the problem on its own (it should be large enough to fit into memory), while the root "
+		"processor distributes among the groups all orientations of each refinement stage of the integration and "
+		"collects the results. This improves the parallel efficiency, when the number of processors is large "
+		"compared to the problem size. Roots of all groups, except the first one, save their output into "
+		F_LOG_GROUP" and "F_STDOUT_GROUP" files (with group number as argument). Can only be used with '-orient "
+		"avg'.\n"
+		"Default: 1",1,NULL},
+#endif
 	{PAR(phi_integr),"<arg>","Turns on and specifies the type of Mueller matrix integration over azimuthal angle "
 		"'phi'. <arg> is an integer from 1 to 31, each bit of which, from lowest to highest, indicates whether the "
 		"integration should be performed with multipliers 1, cos(2*phi), sin(2*phi), cos(4*phi), and sin(4*phi) "
@@ -633,6 +730,18 @@ static struct opt_struct options[]={
 		 * Modify string constants after 'PAR(pol)': add new argument (possibly with additional sub-arguments) to list
 		 * {...} and its description to the next string.
 		 */
+#if defined(PARALLEL) && !defined(SPARSE)
+	{PAR(proc_grid),"<py> <pz>","Sets the 2D grid of processors (integers, <py>*<pz> should be equal to the number of "
+		"processors in each group, see '-orient_groups'), over which the computational grid is distributed along y and "
+		"z, respectively, before the Fourier transform along x. Afterwards it is distributed along x over all "
+		"processors, and the block transposition between these two distributions is performed in two stages inside "
+		"groups of <pz> and <py> processors. Thus, the number of processors is limited by half the grid size along z "
+		"only for <pz> (the grid is also padded accordingly), which is relevant for flat particles. Moreover, the "
+		"number of messages in the transposition is decreased, but the communication buffers are larger. For <py> "
+		"larger than 1, '-granul', saving the geometry in binary format, '-beam read', and '-init_field read' are not "
+		"supported.\n"
+		"Default: 1 <number of processors in a group>",2,NULL},
+#endif
 	{PAR(prognosis),"","Do not actually perform simulation (not even memory allocation) but only estimate the required "
 		"RAM. Implies '-test'.",0,NULL},
 	{PAR(prop),"<x> <y> <z>","Sets propagation direction of incident radiation, float. Normalization (to the unity "
@@ -667,10 +776,12 @@ static struct opt_struct options[]={
 		"reference frame) and propagation direction of incident wave. For default incidence this is the xz-plane. It "
 		"can also be implicitly enabled by other options.",0,NULL},
 #ifndef SPARSE
-	{PAR(sg_format),"{text|text_ext|ddscat6|ddscat7}","Specifies format for saving geometry files. First two are ADDA "
-		"default formats for single- and multi-domain particles respectively. 'text' is automatically changed to "
+	{PAR(sg_format),"{text|text_ext|ddscat6|ddscat7|bin}","Specifies format for saving geometry files. First two are "
+		"ADDA default formats for single- and multi-domain particles respectively. 'text' is automatically changed to "
 		"'text_ext' for multi-domain particles. Two DDSCAT formats correspond to its shape options 'FRMFIL' (version "
-		"6) and 'FROM_FILE' (version 7) and output of 'calltarget' utility.\n"
+		"6) and 'FROM_FILE' (version 7) and output of 'calltarget' utility. 'bin' is a compact binary ADDA format (with "
+		"run-length encoding of occupied dipoles), which is much faster to save and read for large number of dipoles. "
+		"All formats are automatically recognized by '-shape read'.\n"
 		"Default: text",1,NULL},
 #endif // !SPARSE
 		/* TO ADD NEW FORMAT OF SHAPE FILE
@@ -689,9 +800,43 @@ static struct opt_struct options[]={
 		"buffer (typically, 0.5-4 KB).\n"
 		"Default: 'line' or 'full' when the stdout is printed directly to a terminal or is redirected, respectively",
 		1,NULL},
+#ifdef SPARSE
+	{PAR(sparse_aca),"[<arg>]","Use a hierarchical matrix in the matrix-vector product. Dipoles are grouped into a tree "
+		"of clusters, and interactions between well-separated clusters are approximated by low-rank blocks, computed "
+		"once by the adaptive cross approximation (ACA) with relative error epsilon=10^(-<arg>). Interactions between "
+		"nearby clusters are computed directly in each product. Only one block of each symmetric pair is approximated, "
+		"so the matrix stays complex-symmetric. This greatly accelerates simulations of large particles at the expense "
+		"of an additional error of the order of epsilon (and a few more iterations). The option pays off only when "
+		"most dipole pairs are in low-rank blocks (their fraction is shown in the log), which requires at least about "
+		"10^4 dipoles for a compact particle. For smaller particles it slows down both the initialization and the "
+		"matrix-vector product. Memory for the hierarchical matrix is not included in the estimate of '-prognosis'. "
+		"Options '-sparse_ring', '-sparse_store', and '-sparse_sym' are ignored.\n"
+		"Default: 5 (epsilon=1E-5)",UNDEF,NULL},
+	{PAR(sparse_ring),"","Do not gather the full argument vector on each processor in the matrix-vector product. "
+		"Instead, its local blocks are passed along the ring of processors, and the product with the current block is "
+		"computed while the next one is being transferred. This reduces the memory (per processor) for the argument "
+		"vector from 48*N to 96*Nloc bytes, where N and Nloc are the total and local numbers of dipoles, and overlaps "
+		"the communication with computation. Option '-sparse_sym' is ignored.",0,NULL},
+	{PAR(sparse_store),"{none|full|auto}","Whether to compute all interaction terms for local dipoles once and store "
+		"them in memory ('full'), or to recompute them in each matrix-vector product ('none'). The former requires "
+		"96*N*Nloc bytes (twice more for '-surf'), where N and Nloc are the total and local numbers of dipoles, but "
+		"makes the matrix-vector product much faster. 'auto' stores the terms only if they fit into half of the "
+		"available physical memory (if it can be determined).\n"
+		"Default: none",1,NULL},
+	{PAR(sparse_sym),"","Compute each interaction term only once for a pair of dipoles and apply it in both directions "
+		"(since G_ij=G_ji) in the matrix-vector product. This reduces the number of computed terms almost twice. In MPI "
+		"mode, this applies only to pairs of dipoles on the same processor. With OpenMP, it requires an additional "
+		"vector of the local size for each thread (except one).",0,NULL},
+#endif
 	{PAR(store_beam),"","Save incident beam to a file",0,NULL},
 	{PAR(store_dip_pol),"","Save dipole polarizations to a file",0,NULL},
 	{PAR(store_force),"","Calculate the radiation force on each dipole. Implies '-Cpr'",0,NULL},
+	{PAR(store_format),"{text|bin}","Specifies format for saving fields on dipoles (by '-store_beam', "
+		"'-store_dip_pol', '-store_force', and '-store_int_field'). 'text' has one line per dipole, while 'bin' is a "
+		"self-describing binary format (with extension '.bin'), which is much faster and more compact for large number "
+		"of dipoles. In MPI mode, the binary file is written by all processors directly (using MPI-IO). It can be "
+		"converted into the text format by the tool 'misc/field_bin2txt'.\n"
+		"Default: text",1,NULL},
 #ifndef SPARSE
 	{PAR(store_grans),"","Save granule coordinates (placed by '-granul' option) to a file",0,NULL},
 #endif
@@ -1088,6 +1233,27 @@ PARSE_FUNC(beam_center)
 	ScanDouble3Error(argv+1,beam_center_0);
 	beam_center_used = true;
 }
+#if defined(PARALLEL) && !defined(SPARSE)
+PARSE_FUNC(bt_method)
+{
+	if (strcmp(argv[1],"pair")==0) bt_method=BTM_PAIR;
+	else if (strcmp(argv[1],"alltoall")==0) bt_method=BTM_ALLTOALL;
+	else if (strcmp(argv[1],"neighbor")==0) bt_method=BTM_NEIGHBOR;
+	else if (strcmp(argv[1],"node")==0) bt_method=BTM_NODE;
+	else if (strcmp(argv[1],"auto")==0) bt_method=BTM_AUTO;
+	else NotSupported("Block transposition method",argv[1]);
+#ifndef SUPPORT_MPI_NEIGHBOR
+	if (bt_method==BTM_NEIGHBOR) PrintErrorHelp("Block transposition method 'neighbor' requires MPI 3.0");
+#endif
+#ifndef SUPPORT_MPI_SHARED
+	if (bt_method==BTM_NODE) PrintErrorHelp("Block transposition method 'node' requires MPI 3.0");
+#endif
+}
+PARSE_FUNC(bt_overlap)
+{
+	bt_overlap=true;
+}
+#endif
 PARSE_FUNC(chp_dir)
 {
 	chp_dir=ScanStrError(argv[1],MAX_DIRNAME);
@@ -1239,6 +1405,10 @@ PARSE_FUNC(h)
 	// exit
 	Stop(EXIT_SUCCESS);
 }
+PARSE_FUNC(igt_cache)
+{
+	igt_cache=ScanStrError(argv[1],MAX_DIRNAME);
+}
 PARSE_FUNC(init_field)
 {
 	bool noExtraArgs=true;
@@ -1316,15 +1486,28 @@ PARSE_FUNC(int)
 }
 PARSE_FUNC(int_surf)
 {
+	double tmp;
+	bool noExtraArgs=true;
+
+	if (Narg<1 || Narg>2) NargError(Narg,"from 1 to 2");
 	if (strcmp(argv[1],"img")==0) ReflRelation=GR_IMG;
-	else if (strcmp(argv[1],"som")==0) ReflRelation=GR_SOM;
+	else if (strcmp(argv[1],"som")==0) {
+		ReflRelation=GR_SOM;
+		if (Narg==2) {
+			ScanDoubleError(argv[2],&tmp);
+			TestPositive(tmp,"precision of Sommerfeld-integral interpolation");
+			som_eps=pow(10,-tmp);
+		}
+		noExtraArgs=false;
+	}
 	else NotSupported("Reflection term prescription",argv[1]);
 	/* TO ADD NEW REFLECTION FORMULATION
 	 * add the line to else-if sequence above in the alphabetical order, analogous to the ones already present. The
-	 * variable parts of the line are its name used in command line and its descriptor, defined in const.h.
-	 * !!! If subarguments need to be used a test for them should be implemented throughout the function, similar to
-	 * PARSE_FUNC(int) above
+	 * variable parts of the line are its name used in command line and its descriptor, defined in const.h. If
+	 * subarguments are used, test their quantity explicitly, process (scan) subarguments, and set noExtraArgs to false.
+	 * See "som" for example. You may also need to change the test for Narg in the beginning of this function.
 	 */
+	TestExtraNarg(Narg,noExtraArgs,argv[1]);
 }
 PARSE_FUNC(iter)
 {
@@ -1351,6 +1534,12 @@ PARSE_FUNC(lambda)
 	ScanDoubleError(argv[1],&lambda);
 	TestPositive(lambda,"wavelength");
 }
+#if defined(PARALLEL) && !defined(SPARSE)
+PARSE_FUNC(load_balance)
+{
+	load_balance=true;
+}
+#endif
 PARSE_FUNC(m)
 {
 	int i;
@@ -1412,6 +1601,13 @@ PARSE_FUNC(orient)
 	 */
 	orient_used=true;
 }
+#ifdef PARALLEL
+PARSE_FUNC(orient_groups)
+{
+	ScanIntError(argv[1],&orient_groups);
+	TestPositive_i(orient_groups,"number of orientation groups");
+}
+#endif
 PARSE_FUNC(phi_integr)
 {
 	phi_integr = true;
@@ -1462,6 +1658,15 @@ PARSE_FUNC(pol)
 	else NotSupported("Polarizability relation",argv[1]);
 	TestExtraNarg(Narg,noExtraArgs,argv[1]);
 }
+#if defined(PARALLEL) && !defined(SPARSE)
+PARSE_FUNC(proc_grid)
+{
+	ScanIntError(argv[1],&procGridY);
+	TestPositive_i(procGridY,"processor grid size along y");
+	ScanIntError(argv[2],&procGridZ);
+	TestPositive_i(procGridZ,"processor grid size along z");
+}
+#endif
 PARSE_FUNC(prognosis)
 {
 	prognosis=true;
@@ -1537,6 +1742,7 @@ PARSE_FUNC(sg_format)
 	else if (strcmp(argv[1],"text_ext")==0) sg_format=SF_TEXT_EXT;
 	else if (strcmp(argv[1],"ddscat6")==0) sg_format=SF_DDSCAT6;
 	else if (strcmp(argv[1],"ddscat7")==0) sg_format=SF_DDSCAT7;
+	else if (strcmp(argv[1],"bin")==0) sg_format=SF_BIN;
 	/* TO ADD NEW FORMAT OF SHAPE FILE
 	 * Based on argument of command line option '-sg_format' assign value to variable 'sg_format' (one of handles
 	 * defined in const.h).
@@ -1611,6 +1817,35 @@ PARSE_FUNC(so_buf)
 	else NotSupported("Buffering mode for stdout",argv[1]);
 	so_buf_used=true;
 }
+#ifdef SPARSE
+PARSE_FUNC(sparse_aca)
+{
+	double tmp;
+
+	if (Narg>1) NargError(Narg,"0 or 1");
+	if (Narg==1) {
+		ScanDoubleError(argv[1],&tmp);
+		TestPositive(tmp,"exponent of ACA accuracy");
+		aca_eps=pow(10,-tmp);
+	}
+	else aca_eps=ACA_EPS_DEF;
+}
+PARSE_FUNC(sparse_ring)
+{
+	sparse_ring=true;
+}
+PARSE_FUNC(sparse_store)
+{
+	if (strcmp(argv[1],"none")==0) sparse_store=SS_NONE;
+	else if (strcmp(argv[1],"full")==0) sparse_store=SS_FULL;
+	else if (strcmp(argv[1],"auto")==0) sparse_store=SS_AUTO;
+	else NotSupported("Storage mode of the interaction matrix",argv[1]);
+}
+PARSE_FUNC(sparse_sym)
+{
+	sparse_sym=true;
+}
+#endif
 PARSE_FUNC(store_beam)
 {
 	store_beam = true;
@@ -1624,6 +1859,12 @@ PARSE_FUNC(store_force)
 	store_force = true;
 	calc_mat_force = true;
 }
+PARSE_FUNC(store_format)
+{
+	if (strcmp(argv[1],"text")==0) store_format=FF_TEXT;
+	else if (strcmp(argv[1],"bin")==0) store_format=FF_BIN;
+	else NotSupported("Format for storing fields",argv[1]);
+}
 #ifndef SPARSE
 PARSE_FUNC(store_grans)
 {
@@ -1846,6 +2087,9 @@ PARSE_FUNC(V)
 #endif
 #ifdef NO_GITHASH
 		"NO_GITHASH, "
+#endif
+#ifdef OPENMP
+		"OPENMP, "
 #endif
 		"";
 		printf("Extra build options: ");
@@ -2003,6 +2247,7 @@ void InitVariables(void)
 	shapename="sphere";
 	store_int_field=false;
 	store_dip_pol=false;
+	store_format=FF_TEXT;
 	PolRelation=(enum pol)UNDEF;
 	avg_inc_pol=false;
 	ScatRelation=SQ_DRAINE;
@@ -2054,6 +2299,8 @@ void InitVariables(void)
 	Ncomp=1;
 	igt_lim=UNDEF;
 	igt_eps=UNDEF;
+	igt_cache=NULL;
+	som_eps=UNDEF;
 	InitField=IF_AUTO;
 	recalc_resid=false;
 	surface=false;
@@ -2066,6 +2313,21 @@ void InitVariables(void)
 	rectScaleY=1.0;
 	rectScaleZ=1.0;
 	so_buf_used=false;
+#if defined(PARALLEL) && !defined(SPARSE)
+	bt_overlap=false;
+	bt_method=BTM_PAIR;
+	procGridY=procGridZ=UNDEF; // the default is set in VariablesInterconnect, since it depends on orient_groups
+	load_balance=false;
+#endif
+#ifdef PARALLEL
+	orient_groups=1;
+#endif
+#ifdef SPARSE
+	aca_eps=UNDEF;
+	sparse_ring=false;
+	sparse_store=SS_NONE;
+	sparse_sym=false;
+#endif
 	sobuf=0; // should not be tested against this default value (as it may conflict with existing modes)
 #ifdef WINDOWS
 	emulLinebuf=false;
@@ -2180,6 +2442,62 @@ void VariablesInterconnect(void)
 	}
 	// if not initialized before, IGT precision is set to that of the iterative solver
 	if (igt_eps==UNDEF) igt_eps=iter_eps;
+	if (igt_cache!=NULL && IntRelation!=G_IGT)
+		LogWarning(EC_WARN,ONE_POS,"'-igt_cache' has effect only with '-int igt', ignoring it");
+#ifdef SPARSE
+	if (aca_eps!=UNDEF && (sparse_ring || sparse_store!=SS_NONE || sparse_sym)) {
+		LogWarning(EC_WARN,ONE_POS,"'-sparse_ring', '-sparse_store', and '-sparse_sym' are ignored, since "
+			"'-sparse_aca' is used");
+		sparse_ring=false;
+		sparse_store=SS_NONE;
+		sparse_sym=false;
+	}
+	if (sparse_ring && sparse_store==SS_FULL) { // for 'auto' this is tested in calculator.c
+		LogWarning(EC_WARN,ONE_POS,"'-sparse_ring' is ignored, since '-sparse_store full' is used");
+		sparse_ring=false;
+	}
+	if (sparse_ring && sparse_sym) {
+		LogWarning(EC_WARN,ONE_POS,"'-sparse_sym' is ignored, since '-sparse_ring' is used");
+		sparse_sym=false;
+	}
+#endif
+#ifdef PARALLEL
+	if (orient_groups>1) {
+		if (!orient_avg) PrintError("'-orient_groups' can only be used together with '-orient avg'");
+		if (nprocs%orient_groups!=0) PrintError("The number of processors (%d) is not divisible by the number of "
+			"orientation groups (%d)",nprocs,orient_groups);
+	}
+#endif
+#if defined(PARALLEL) && !defined(SPARSE)
+	if (procGridY==UNDEF) {
+		procGridY=1;
+		procGridZ=nprocs/orient_groups;
+	}
+	else if (procGridY*procGridZ!=nprocs/orient_groups) {
+		if (orient_groups==1) PrintError("The product of processor grid sizes (%d*%d) is not equal to the number of "
+			"processors (%d)",procGridY,procGridZ,nprocs);
+		else PrintError("The product of processor grid sizes (%d*%d) is not equal to the number of processors in "
+			"each orientation group (%d)",procGridY,procGridZ,nprocs/orient_groups);
+	}
+	if (procGridY>1) {
+		if (sh_granul) PrintError("Currently '-granul' can not be used with '-proc_grid', distributing the y-range");
+		if (save_geom && sg_format==SF_BIN) PrintError("Currently saving the geometry in binary format can not be "
+			"used with '-proc_grid', distributing the y-range");
+		if (beamtype==B_READ) PrintError("Currently '-beam read' can not be used with '-proc_grid', distributing the "
+			"y-range");
+		if (InitField==IF_READ) PrintError("Currently '-init_field read' can not be used with '-proc_grid', "
+			"distributing the y-range");
+		if (bt_overlap && procGridZ>1) {
+			LogWarning(EC_WARN,ONE_POS,"'-bt_overlap' is ignored, since it is not compatible with the two-stage block "
+				"transposition for a 2D grid of processors");
+			bt_overlap=false;
+		}
+		if (load_balance) PrintError("'-load_balance' can not be used with '-proc_grid', distributing the y-range");
+	}
+	if (bt_overlap && bt_method!=BTM_PAIR) PrintError("'-bt_overlap' can not be used together with '-bt_method'");
+	if (load_balance && InitField==IF_WKB)
+		PrintError("Currently '-load_balance' can not be used with '-init_field wkb'");
+#endif
 	// default polarizability formulation depends on rect_dip
 	if (PolRelation==(enum pol)UNDEF) PolRelation = rectDip ? POL_CLDR : POL_LDR;
 	// parameter incompatibilities
@@ -2324,7 +2642,6 @@ void VariablesInterconnect(void)
 	// initialize averaging over orientation
 	if (orient_avg) {
 		ReadAvgParms(avg_parms);
-		symX=symY=symZ=symR=false;
 		avg_inc_pol=true;
 	}
 	else { // initialize rotation stuff and test symmetries of the beam in particle reference frame
@@ -2355,8 +2672,15 @@ void FinalizeSymmetry(void) {
 	else if (sym_type==SYM_ENF) symX=symY=symZ=symR=true;
 	// test based on SR^2 = SX*SY; uses handmade XOR
 	if (symR && ((symX&&!symY) || (symY&&!symX))) LogError(ONE_POS,"Inconsistency in internally defined symmetries");
+	/* for orientation averaging symmetries of the particle are used only to reduce the range of orientations, since
+	 * the particle is rotated afterwards
+	 */
+	if (orient_avg) {
+		ReduceAvgParms();
+		symX=symY=symZ=symR=false;
+	}
 	// additional tests in case of two polarization runs
-	if (!(symR && !scat_grid)) {
+	if (!symR) {
 		if (beamtype==B_READ && beam_fnameX==NULL)
 			PrintError("Only one beam file is specified, while two incident polarizations need to be considered");
 		if (InitField==IF_READ && infi_fnameX==NULL) PrintError("Only one file with initial field is specified, while "
@@ -2378,6 +2702,7 @@ void DirectoryLog(const int argc,char **argv)
 	FILEHANDLE lockid;
 #ifdef PARALLEL
 	char *ptmp,*ptmp2;
+	char fname[MAX_FNAME];
 #endif
 
 	// devise directory name (for output files)
@@ -2425,6 +2750,22 @@ void DirectoryLog(const int argc,char **argv)
 	// make logname; do it for all processors to enable additional logging in LogError
 	if (IFROOT) SnprintfErr(ONE_POS,logfname,MAX_FNAME,"%s/"F_LOG,directory);
 	else SnprintfErr(ALL_POS,logfname,MAX_FNAME,"%s/"F_LOG_ERR,directory,ringid);
+#ifdef PARALLEL
+	/* split processors into orientation groups; afterwards ringid and nprocs refer to the group. Roots of all groups,
+	 * except the first one, save their log and standard output into separate files, which requires the output directory
+	 * to be already created
+	 */
+	if (orient_groups>1) {
+		Synchronize();
+		SplitOrientGroups();
+		if (IFROOT && orientGroup!=0) {
+			SnprintfErr(ALL_POS,logfname,MAX_FNAME,"%s/"F_LOG_GROUP,directory,orientGroup);
+			SnprintfErr(ALL_POS,fname,MAX_FNAME,"%s/"F_STDOUT_GROUP,directory,orientGroup);
+			if (freopen(fname,"w",stdout)==NULL) LogError(ALL_POS,"Failed to redirect standard output to file '%s'",
+				fname);
+		}
+	}
+#endif
 	// start logfile
 	if (IFROOT) {
 		// open logfile
@@ -2443,13 +2784,16 @@ void DirectoryLog(const int argc,char **argv)
 		// write number of processors and computer name
 #ifdef PARALLEL
 		// write number of processors
-		fprintf(logfile,"The program was run on: %d processors (cores)",nprocs);
+		fprintf(logfile,"The program was run on: %d processors (cores)",nprocs*orient_groups);
 		// add PBS or SGE host name if present, otherwise use compname
 		if ((ptmp=getenv("PBS_O_HOST"))!=NULL || (ptmp=getenv("SGE_O_HOST"))!=NULL) fprintf(logfile," from %s\n",ptmp);
 		else if (compname!=NULL) fprintf(logfile," from %s\n",compname);
 		else fprintf(logfile,"\n");
 #else // sequential
 		if (compname!=NULL) fprintf(logfile,"The program was run on: %s\n",compname);
+#endif
+#ifdef OPENMP
+		fprintf(logfile,"Number of OpenMP threads (per process): %d\n",omp_get_max_threads());
 #endif
 		// log command line
 		fprintf(logfile,"command: '");
@@ -2520,6 +2864,9 @@ void PrintInfo(void)
 			fprintf(logfile,"  per domain: 1. %zu\n",mat_count[0]);
 			for (i=1;i<Nmat;i++) fprintf(logfile,"              %d. %zu\n",i+1,mat_count[i]);
 		}
+#if defined(PARALLEL) && !defined(SPARSE)
+		if (load_balance) PrintLoadBalance(logfile);
+#endif
 		fprintf(logfile,"Volume-equivalent size parameter: "GFORM"\n",ka_eq);
 		// log incident beam and polarization
 		fprintf(logfile,"\n---In laboratory reference frame:---\nIncident beam: %s\n",beam_descr);
@@ -2542,7 +2889,13 @@ void PrintInfo(void)
 		}
 		fprintf(logfile,"\n");
 		// log particle orientation
-		if (orient_avg) fprintf(logfile,"Particle orientation - averaged\n%s\n",avg_string);
+		if (orient_avg) {
+			fprintf(logfile,"Particle orientation - averaged\n%s\n",avg_string);
+#ifdef PARALLEL
+			if (orient_groups>1) fprintf(logfile,"Orientations are distributed among %d groups of %d processors "
+				"(this is group %d)\n\n",orient_groups,nprocs,orientGroup);
+#endif
+		}
 		else {
 			// log incident polarization after transformation
 			if (alph_deg!=0 || bet_deg!=0 || gam_deg!=0) {
@@ -2610,6 +2963,7 @@ void PrintInfo(void)
 				fprintf(logfile,"'Integrated Green's tensor' (accuracy "GFORMDEF", ",igt_eps);
 				if (igt_lim==UNDEF) fprintf(logfile,"no distance limit)\n");
 				else fprintf(logfile,"for distance < "GFORMDEF" dipole sizes)\n",igt_lim);
+				if (igt_cache!=NULL) fprintf(logfile,"    cache directory = '%s'\n",igt_cache);
 				break;
 			case G_IGT_SO: fprintf(logfile,"'Integrated Green's tensor [approximation O(kd^2)]'\n"); break;
 			case G_NLOC: fprintf(logfile,"'Non-local' (point-value, Gaussian width Rp="GFORMDEF")\n",nloc_Rp); break;
@@ -2625,7 +2979,11 @@ void PrintInfo(void)
 			fprintf(logfile,"Reflected Green's tensor formulae: ");
 			switch (ReflRelation) {
 				case GR_IMG: fprintf(logfile,"'Image-dipole approximation'\n"); break;
-				case GR_SOM: fprintf(logfile,"'Sommerfeld integrals'\n"); break;
+				case GR_SOM:
+					fprintf(logfile,"'Sommerfeld integrals'");
+					if (som_eps!=UNDEF) fprintf(logfile," (interpolated with accuracy "GFORMDEF")",som_eps);
+					fprintf(logfile,"\n");
+					break;
 			}
 		}
 		/* TO ADD NEW REFLECTION FORMULATION
@@ -2639,7 +2997,10 @@ void PrintInfo(void)
 #elif defined(FFT_TEMPERTON)
 		fprintf(logfile,"by C.Temperton\n");
 #elif defined(SPARSE)
-		fprintf(logfile,"none (sparse mode)\n");
+		if (aca_eps!=UNDEF) fprintf(logfile,"none (sparse mode, hierarchical matrix with ACA accuracy "GFORMDEF")\n",
+			aca_eps);
+		else fprintf(logfile,"none (sparse mode%s)\n",sparse_sym ? ", using symmetry of the interaction matrix" :
+			(sparse_ring ? ", ring exchange of the argument vector" : ""));
 #endif
 #if defined(OPENCL) && !defined(SPARSE)
 		fprintf(logfile,"OpenCL FFT algorithm: ");
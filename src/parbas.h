@@ -70,6 +70,14 @@
 #	define RUN_MPI_SUBVER_REQ MPI_SUBVER_REQ
 #endif
 
+/* Neighborhood collectives and shared-memory windows are used only for some methods of block transposition (see
+ * '-bt_method'), hence they do not change the minimum requirements
+ */
+#if MPI_PREREQ(3,0)
+#	define SUPPORT_MPI_NEIGHBOR
+#	define SUPPORT_MPI_SHARED
+#endif
+
 #ifdef SUPPORT_MPI_BOOL
 #	define mpi_bool MPI_C_BOOL
 #else
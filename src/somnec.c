@@ -74,27 +74,38 @@
 
 #define cmplx(r,i) ((r)+(i)*I)
 
+/* State of a single evaluation of Sommerfeld integrals (former common blocks /evlcom/ and /cntour/ of the original
+ * code). It is local to evlua and passed down to all routines, which makes evlua reentrant, i.e. it can be called
+ * simultaneously from several threads (after som_init)
+ */
+struct evlstate {
+	int jh;         // whether Hankel-function form is used
+	double zph,rho; // coordinates of the evaluation point
+	complex double a,b; // end points of the current segment of the integration contour
+};
+
 // TODO: change the order of functions below, so that their separate declarations would not be needed
 static void bessel(complex double z,complex double *j0,complex double *j0p);
-static void gshank(complex double start,complex double dela,complex double *sum,int nans,complex double *seed,int ibk,
-	complex double bk,complex double delb);
+static void gshank(struct evlstate *st,complex double start,complex double dela,complex double *sum,int nans,
+	complex double *seed,int ibk,complex double bk,complex double delb);
 static void hankel(complex double z,complex double *h0,complex double *h0p);
-static void lambda(double t,complex double *xlam,complex double *dxlam);
-static void rom1(int n,complex double *sum,int nx);
-static void saoa(double t,complex double *ans);
+static void lambda(const struct evlstate *st,double t,complex double *xlam,complex double *dxlam);
+static void rom1(struct evlstate *st,int n,complex double *sum,int nx);
+static void saoa(const struct evlstate *st,double t,complex double *ans);
 static void test(double f1r,double f2r,double *tr,double f1i,double f2i,double *ti,double dmin);
 
-// TODO: specify which function arguments are const, and try to make the whole routine thread-safe
-// common /evlcom/
-static int jh;
-static double ck2,ck2sq,tkmag,tsmag,ck1r,zph,rho;
+// TODO: specify which function arguments are const
+/* the following are set by som_init and are only read afterwards (part of common /evlcom/). The same is true for the
+ * tables used in bessel and hankel
+ */
+static double ck2,ck2sq,tkmag,tsmag,ck1r;
 static complex double ct1,ct2,ct3,ck1,ck1sq,cksm;
 static complex double xl0; // location of surface-plasmon pole
 static bool pole;   // whether the surface-plasmon pole is real (lies on the principal Riemann sheet)
 static bool denser; // whether the substrate material is denser than the upper medium (vacuum)
-
-// common /cntour/
-static complex double a,b;
+// constant tables for series expansions in bessel (bm,sa1,sa2) and hankel (hm,sa1-sa4)
+static int bm[101],hm[101];
+static double sa1[25],sa2[25],sa3[25],sa4[25];
 
 //======================================================================================================================
 
@@ -107,10 +118,51 @@ static inline double cAbs2(const complex double z)
 
 //======================================================================================================================
 
+static void InitTables(void)
+// initializes constant tables for bessel and hankel
+{
+	int i,k,last;
+	double psi,tst;
+
+	psi=-GAMMA;
+	for (k=1;k<=25;k++) {
+		i=k-1;
+		sa1[i]=-0.25/(k*k);
+		sa2[i]=1.0/(k+1.0);
+		psi += 1.0/k;
+		sa3[i]=psi+psi;
+		sa4[i]=(psi+psi+1.0/(k+1.0))/(k+1.0);
+	}
+	for (i=1;i<=101;i++) {
+		tst=1.0;
+		last=0;
+		for (k=0;k<24;k++) {
+			last=k;
+			tst*=-i*sa1[k];
+			if (tst<1e-6) break;
+		}
+		bm[i-1]=last+1;
+		tst=1.0;
+		for (k=0;k<24;k++) {
+			last=k;
+			tst*=-i*sa1[k];
+			if (tst*sa3[k]<1e-6) break;
+		}
+		hm[i-1]=last+1;
+	}
+}
+
+//======================================================================================================================
+
 void som_init(complex double epscf)
+/* initializes all constants, which depend only on the substrate permittivity. Should be called once before any calls
+ * to evlua (and not concurrently with them)
+ */
 {
 	complex double erv, ezv;
 
+	InitTables();
+
 	ck2=TP;
 	ck2sq=ck2*ck2;
 	// Sommerfeld integral evaluation uses exp(-iwt)
@@ -138,10 +190,11 @@ void som_init(complex double epscf)
 
 //======================================================================================================================
 
-static void residual(complex double *ans)
+static void residual(const struct evlstate *st,complex double *ans)
 // increments answer by residual of integrals, involving Hankel functions, over the pole xl0
 {
 	complex double cgam2,h0,h0p,com,den2;
+	const double zph=st->zph,rho=st->rho;
 
 	hankel(xl0*rho,&h0,&h0p); // assumes that rho!=0
 	cgam2=I*xl0*ck2/ck1; // here we employ known value of xl0, and that Re(xl0)>Re(k2)
@@ -164,31 +217,9 @@ static void bessel(complex double z,complex double *j0,complex double *j0p)
 // evaluates the zero-order Bessel function and its derivative for complex argument z
 {
 	int k,ib;
-	static int m[101],init=FALSE;
-	static double a1[25],a2[25];
 	double zms;
 	complex double p0z,p1z,q0z,q1z,zi,zi2,zk,cz,sz,j0x=0,j0px=0;
 
-	// initialization of constants
-	if (!init) {
-		int i;
-		for (k=1;k<=25;k++) {
-			i=k-1;
-			a1[i]=-0.25/(k*k);
-			a2[i]=1.0/(k+1.0);
-		}
-		for (i=1;i<=101;i++) {
-			double tst=1.0;
-			for (k=0;k<24;k++) {
-				init=k;
-				tst*=-i*a1[k];
-				if (tst<1e-6) break;
-			}
-			m[i-1]=init+1;
-		}
-		init=TRUE;
-	}
-
 	zms=cAbs2(z);
 	if (zms<=1e-12) {
 		*j0=1;
@@ -200,15 +231,15 @@ static void bessel(complex double z,complex double *j0,complex double *j0p)
 		if (zms>36.0) ib=1;
 		// series expansion
 		int iz=(int)zms;
-		int miz=m[iz];
+		int miz=bm[iz];
 		*j0=1;
 		*j0p=*j0;
 		zk=*j0;
 		zi=z*z;
 		for (k=0;k<miz;k++) {
-			zk*=a1[k]*zi;
+			zk*=sa1[k]*zi;
 			*j0+=zk;
-			*j0p+=a2[k]*zk;
+			*j0p+=sa2[k]*zk;
 		}
 		*j0p*=-0.5*z;
 
@@ -258,11 +289,13 @@ void evlua(double zphIn,double rhoIn,complex double *erv,complex double *ezv,com
  */
 {
 	int i,jump;
-	static double del,slope,rmis;
-	static complex double cp1,cp2,cp3,bk,delta,delta2,sum[6],ans[6];
+	double del,slope,rmis;
+	complex double cp1,cp2,cp3,bk=0,delta,delta2,sum[6],ans[6];
+	struct evlstate state,*st=&state;
+	const double zph=zphIn,rho=rhoIn;
 
-	zph=zphIn;
-	rho=rhoIn;
+	st->zph=zph;
+	st->rho=rho;
 
 	// TODO: test input parameters to be positive (at most, one zero is allowed)
 	del=zph;
@@ -274,8 +307,8 @@ void evlua(double zphIn,double rhoIn,complex double *erv,complex double *ezv,com
 		 * TODO: for large rho, it makes sense to move the inflection point closer to the real axis (due to exponential
 		 *       increase of Bessel function with |Im(argument)|
 		 */
-		jh=0;
-		a=0;
+		st->jh=0;
+		st->a=0;
 		del=1.0/del;
 
 		if (del>tkmag) {
@@ -284,20 +317,20 @@ void evlua(double zphIn,double rhoIn,complex double *erv,complex double *ezv,com
 			 * (at least, of the J0'). This is not explained in the docs, and it is not clear, why the k1 (not k2) is
 			 * used for the boundary value tkmag. Still, any changes will require extensive testing to justify.
 			 */
-			b=cmplx(0.1*tkmag,-0.1*tkmag);
-			rom1(6,sum,2); // from zero to intermediate point
-			a=b;
-			b=cmplx(del,-del);
-			rom1(6,ans,2); // from intermediate point to the inflection one on the figure
+			st->b=cmplx(0.1*tkmag,-0.1*tkmag);
+			rom1(st,6,sum,2); // from zero to intermediate point
+			st->a=st->b;
+			st->b=cmplx(del,-del);
+			rom1(st,6,ans,2); // from intermediate point to the inflection one on the figure
 			for (i=0;i<6;i++) sum[i]+=ans[i];
 		}
 		else {
-			b=cmplx(del,-del);
-			rom1(6,sum,2); // from zero to inflection point on the figure
+			st->b=cmplx(del,-del);
+			rom1(st,6,sum,2); // from zero to inflection point on the figure
 		}
 
 		delta=PTP*del;
-		gshank(b,delta,ans,6,sum,0,b,b); // horizontal line to infinity on the figure
+		gshank(st,st->b,delta,ans,6,sum,0,st->b,st->b); // horizontal line to infinity on the figure
 		ans[5]*=ck1;
 
 		/* ADDA: conjugate was removed */
@@ -310,7 +343,7 @@ void evlua(double zphIn,double rhoIn,complex double *erv,complex double *ezv,com
 	} // end of mode=1 (Bessel form)
 
 	// Hankel-function form of Sommerfeld integrals, based on H0^(1)(rho*xl)
-	jh=1;
+	st->jh=1;
 	// the following ensures that the contour never crosses the branch cut from ck1
 	cp1=(creal(ck1)+cimag(ck1)>0.41*ck2) ? I*0.4*ck2 : 0.99*ck1;
 	// bottom position of the contour (imaginary part); should be small for large rho to avoid loss of precision
@@ -320,12 +353,12 @@ void evlua(double zphIn,double rhoIn,complex double *erv,complex double *ezv,com
 	 * fine for all other contours. Otherwise (if denser is false), we need to consider the pole more carefully below
 	 */
 	cp3=((pole && denser) ? creal(xl0) + 0.02*ck2 : 1.02*ck2)  + I*imB;
-	a=cp1;
-	b=cp2;
-	rom1(6,sum,2); // from a to b on the figure
-	a=cp2;
-	b=cp3;
-	rom1(6,ans,2); // from b to c on the figure
+	st->a=cp1;
+	st->b=cp2;
+	rom1(st,6,sum,2); // from a to b on the figure
+	st->a=cp2;
+	st->b=cp3;
+	rom1(st,6,ans,2); // from b to c on the figure
 
 	/* minus signs are used somewhat complicatedly in the following, motivated by the fact that some integrals are
 	 * computed from infinity to a point, i.e., in reverse direction to that assumed by gshank
@@ -345,7 +378,7 @@ void evlua(double zphIn,double rhoIn,complex double *erv,complex double *ezv,com
 	delta=cmplx(-1,slope)*del/sqrt(1+slope*slope);
 	delta2=-conj(delta);
 	// TODO: replace bk with 0 in last two arguments to gshank, whenever they are not used (i.e., when ibk=0)
-	gshank(cp1,delta,ans,6,sum,0,bk,bk); // from infinity to a on the figure
+	gshank(st,cp1,delta,ans,6,sum,0,bk,bk); // from infinity to a on the figure
 	// by this point ans hold minus integral from infinity to c through a and b
 	/* TODO: make the use of point e explicit here, and also test whether a straight line will be sufficient (as is done
 	 * below for a simpler contour). However, this test may be already implicit in the following slope comparisons.
@@ -384,14 +417,14 @@ void evlua(double zphIn,double rhoIn,complex double *erv,complex double *ezv,com
 			cp1=ck1-cmplx(0.1,0.2);
 			cp2=cp1+0.2;
 			bk=cmplx(0,del);
-			gshank(cp1,bk,sum,6,ans,0,bk,bk); // from e to infinity on the figure
-			a=cp1;
-			b=cp2;
-			rom1(6,ans,1);
+			gshank(st,cp1,bk,sum,6,ans,0,bk,bk); // from e to infinity on the figure
+			st->a=cp1;
+			st->b=cp2;
+			rom1(st,6,ans,1);
 			// invert sign from previous parts of contour
 			for (i=0;i<6;i++) ans[i]-=sum[i];
-			gshank(cp3,bk,sum,6,ans,0,bk,bk); // from c to infinity on the figure
-			gshank(cp2,delta2,ans,6,sum,0,bk,bk); // from f to infinity on the figure
+			gshank(st,cp3,bk,sum,6,ans,0,bk,bk); // from c to infinity on the figure
+			gshank(st,cp2,delta2,ans,6,sum,0,bk,bk); // from f to infinity on the figure
 		}
 	} // end of mode=3 (longer Hankel form)
 	else jump=FALSE;
@@ -409,8 +442,8 @@ void evlua(double zphIn,double rhoIn,complex double *erv,complex double *ezv,com
 			/* test if a direct line from cp3 will hit the branch cut from k1; if yes, integrate from from c to d and
 			 * then to infinity, otherwise - directly from c to infinity
 			 */
-			if (cimag(d34)<slope*creal(d34)) gshank(cp3,del*d34/cabs(d34),ans,6,sum,1,cp4,delta2);
-			else gshank(cp3,delta2,ans,6,sum,0,0,0);
+			if (cimag(d34)<slope*creal(d34)) gshank(st,cp3,del*d34/cabs(d34),ans,6,sum,1,cp4,delta2);
+			else gshank(st,cp3,delta2,ans,6,sum,0,0,0);
 		}
 		else { // here we do not need to worry about the branch cut from k1, but need to account for the SP pole
 			if (pole) { // this can be optimized by singularity extraction
@@ -419,22 +452,22 @@ void evlua(double zphIn,double rhoIn,complex double *erv,complex double *ezv,com
 				// tangent of angle from direction to the pole to the slope (rho/Z)
 				double tanA=(creal(dP3)*slope-cimag(dP3))/(creal(dP3)+cimag(dP3)*slope);
 				if (tanA>EPS_TAN) { // leaves pole to the right at sufficient distance
-					gshank(cp3,delta2,ans,6,sum,0,0,0);
-					residual(ans);
+					gshank(st,cp3,delta2,ans,6,sum,0,0,0);
+					residual(st,ans);
 				}
 				// leaves pole to the left at sufficient distance
-				else if (tanA<-EPS_TAN) gshank(cp3,delta2,ans,6,sum,0,0,0);
+				else if (tanA<-EPS_TAN) gshank(st,cp3,delta2,ans,6,sum,0,0,0);
 				/* The following chooses one of the paths around the pole, shifted by angle EPS from the exact direction
 				 * to the pole. Generally, we choose the closest one, but ensure that the slope of the first segment is
 				 * strictly between 0 and infinity
 				 */
 				else if ( ( tanA>0 && cimag(dP3)*EPS_TAN<creal(dP3) ) || creal(dP3)*EPS_TAN>=cimag(dP3) ) {
-					gshank(cp3,del*rot*dP3/cabs(dP3),ans,6,sum,1,cp3+dP3*rot,delta2);
-					residual(ans);
+					gshank(st,cp3,del*rot*dP3/cabs(dP3),ans,6,sum,1,cp3+dP3*rot,delta2);
+					residual(st,ans);
 				}
-				else gshank(cp3,del*conj(rot)*dP3/cabs(dP3),ans,6,sum,1,cp3+dP3*conj(rot),delta2);
+				else gshank(st,cp3,del*conj(rot)*dP3/cabs(dP3),ans,6,sum,1,cp3+dP3*conj(rot),delta2);
 			}
-			else gshank(cp3,delta2,ans,6,sum,0,0,0); // from c directly to infinity on the figure
+			else gshank(st,cp3,delta2,ans,6,sum,0,0,0); // from c directly to infinity on the figure
 		}
 	}
 	ans[5]*=ck1;
@@ -449,17 +482,17 @@ void evlua(double zphIn,double rhoIn,complex double *erv,complex double *ezv,com
 
 //======================================================================================================================
 
-static void gshank(complex double start,complex double dela,complex double *sum,int nans,complex double *seed,int ibk,
-	complex double bk,complex double delb)
+static void gshank(struct evlstate *st,complex double start,complex double dela,complex double *sum,int nans,
+	complex double *seed,int ibk,complex double bk,complex double delb)
 /* integrates the 6 Sommerfeld integrals from start to infinity (until convergence) in lambda.
  * At the break point, bk, the step increment may be changed from dela to delb.
  * Shank's algorithm to accelerate convergence of a slowly converging series is used
  */
 {
 	int ibx,j,i,jm,intx,inx,brk=0;
-	static double rbk,amg,den,denm;
-	static complex double a1,a2,as1,as2,del,aa;
-	static complex double q1[6][MAXH],q2[6][MAXH],ans1[6],ans2[6];
+	double rbk,amg,den,denm;
+	complex double a1,a2,as1,as2,del,aa;
+	complex double q1[6][MAXH],q2[6][MAXH],ans1[6],ans2[6];
 
 	rbk=creal(bk);
 	del=dela;
@@ -467,40 +500,40 @@ static void gshank(complex double start,complex double dela,complex double *sum,
 	else ibx=0;
 
 	for (i=0;i<nans;i++) ans2[i]=seed[i];
-	b=start;
+	st->b=start;
 
 	for (intx=1;intx<=MAXH;intx++) {
 		inx=intx-1;
-		a=b;
-		b+=del;
+		st->a=st->b;
+		st->b+=del;
 
-		if (ibx==0 && creal(b)>=rbk) {
+		if (ibx==0 && creal(st->b)>=rbk) {
 			// hit break point, reset seed and start over
 			ibx=1;
-			b=bk;
+			st->b=bk;
 			del=delb;
-			rom1(nans,sum,2);
+			rom1(st,nans,sum,2);
 			for (i=0;i<nans;i++) ans2[i]+=sum[i];
 			intx=0;
 			continue;
 		}
 
-		rom1(nans,sum,2);
+		rom1(st,nans,sum,2);
 		for (i=0;i<nans;i++) ans1[i]=ans2[i]+sum[i];
-		a=b;
-		b+=del;
-		if (ibx==0 && creal(b)>=rbk) {
+		st->a=st->b;
+		st->b+=del;
+		if (ibx==0 && creal(st->b)>=rbk) {
 			// hit break point, reset seed and start over
 			ibx=2;
-			b=bk;
+			st->b=bk;
 			del=delb;
-			rom1(nans,sum,2);
+			rom1(st,nans,sum,2);
 			for (i=0;i<nans;i++) ans2[i]=ans1[i]+sum[i];
 			intx=0;
 			continue;
 		}
 
-		rom1(nans,sum,2);
+		rom1(st,nans,sum,2);
 		for (i=0;i<nans;i++) ans2[i]=ans1[i]+sum[i];
 
 		den=0.;
@@ -558,7 +591,7 @@ static void gshank(complex double start,complex double dela,complex double *sum,
 		}
 	}
 	// No convergence
-	printf("z=%g, rho=%g\n",zph,rho);
+	printf("z=%g, rho=%g\n",st->zph,st->rho);
 	fprintf(stderr,"No convergence in gshank() - aborting. Try to increase MAXH in somnec.c and recompile\n");
 	exit(-6);
 }
@@ -569,35 +602,9 @@ static void hankel(complex double z,complex double *h0,complex double *h0p)
 // evaluates the Hankel function of the first kind, order zero, and its derivative for complex argument z
 {
 	int k,ib;
-	static int m[101],init=FALSE;
-	static double a1[25],a2[25],a3[25],a4[25],psi,tst,zms;
+	double zms;
 	complex double clogz,j0,j0p,p0z,p1z,q0z,q1z,y0=0,y0p=0,zi,zi2,zk;
 
-	// initialization of constants
-	if (!init) {
-		int i;
-		psi=-GAMMA;
-		for (k=1;k<=25;k++) {
-			i=k-1;
-			a1[i]=-0.25/(k*k);
-			a2[i]=1.0/(k+1.0);
-			psi += 1.0/k;
-			a3[i]=psi+psi;
-			a4[i]=(psi+psi+1.0/(k+1.0))/(k+1.0);
-		}
-
-		for (i=1;i<=101;i++) {
-			tst=1.0;
-			for (k=0;k<24;k++) {
-				init=k;
-				tst*=-i*a1[k];
-				if (tst*a3[k]<1e-6) break;
-			}
-			m[i-1]=init+1;
-		}
-		init=TRUE;
-	}
-
 	zms=cAbs2(z);
 	if (zms==0) {
 		fprintf(stderr,"somnec.c: hankel not valid for z=0 - aborting\n");
@@ -608,7 +615,7 @@ static void hankel(complex double z,complex double *h0,complex double *h0p)
 		if (zms>16) ib=1;
 		// series expansion
 		int iz=(int)zms;
-		int miz=m[iz];
+		int miz=hm[iz];
 		j0=1;
 		j0p=j0;
 		y0=0;
@@ -616,11 +623,11 @@ static void hankel(complex double z,complex double *h0,complex double *h0p)
 		zk=j0;
 		zi=z*z;
 		for (k=0;k<miz;k++) {
-			zk*=a1[k]*zi;
+			zk*=sa1[k]*zi;
 			j0+=zk;
-			j0p+=a2[k]*zk;
-			y0+=a3[k]*zk;
-			y0p+=a4[k]*zk;
+			j0p+=sa2[k]*zk;
+			y0+=sa3[k]*zk;
+			y0p+=sa4[k]*zk;
 		}
 		j0p*=-0.5*z;
 		clogz=clog(0.5*z);
@@ -656,23 +663,23 @@ static void hankel(complex double z,complex double *h0,complex double *h0p)
 
 //======================================================================================================================
 
-static void lambda(double t,complex double *xlam,complex double *dxlam)
+static void lambda(const struct evlstate *st,double t,complex double *xlam,complex double *dxlam)
 // compute integration parameter xlam=lambda from parameter t
 {
-	*dxlam=b-a;
-	*xlam=a+*dxlam*t;
+	*dxlam=st->b-st->a;
+	*xlam=st->a+*dxlam*t;
 	return;
 }
 
 //======================================================================================================================
 
-static void rom1(int n,complex double *sum,int nx)
+static void rom1(struct evlstate *st,int n,complex double *sum,int nx)
 // integrates the 6 Sommerfeld integrals from a to b in lambda. Variable-interval-width Romberg integration is used
 {
 	int jump,lstep,nogo,i,ns,nt;
-	static double z,ze,s,ep,zend,dz=0,dzot=0,tr,ti;
-	static complex double t00,t11,t02;
-	static complex double g1[6],g2[6],g3[6],g4[6],g5[6],t01[6],t10[6],t20[6];
+	double z,ze,s,ep,zend,dz=0,dzot=0,tr,ti;
+	complex double t00,t11,t02;
+	complex double g1[6],g2[6],g3[6],g4[6],g5[6],t01[6],t10[6],t20[6];
 
 	lstep=0;
 	z=0;
@@ -683,7 +690,7 @@ static void rom1(int n,complex double *sum,int nx)
 	for (i=0;i<n;i++) sum[i]=0;
 	ns=nx;
 	nt=0;
-	saoa(z,g1);
+	saoa(st,z,g1);
 
 	jump=FALSE;
 	while (TRUE) {
@@ -694,8 +701,8 @@ static void rom1(int n,complex double *sum,int nx)
 				if (dz<=ep) return;
 			}
 			dzot=dz*0.5;
-			saoa(z+dzot,g3);
-			saoa(z+dz,g5);
+			saoa(st,z+dzot,g3);
+			saoa(st,z+dz,g5);
 		}
 		nogo=FALSE;
 		for (i=0;i<n;i++) {
@@ -720,8 +727,8 @@ static void rom1(int n,complex double *sum,int nx)
 			continue;
 		}
 
-		saoa(z+dz*0.25,g2);
-		saoa(z+dz*0.75,g4);
+		saoa(st,z+dz*0.25,g2);
+		saoa(st,z+dz*0.75,g4);
 		nogo=FALSE;
 		for (i=0;i<n;i++) {
 			t02=(t01[i]+dzot*(g2[i]+g4[i]))*0.5;
@@ -759,7 +766,7 @@ static void rom1(int n,complex double *sum,int nx)
 		}
 		if (!lstep) {
 			lstep=TRUE;
-			lambda(z,&t00,&t11);
+			lambda(st,z,&t00,&t11);
 		}
 		for (i=0;i<n;i++) sum[i]+=t20[i];
 		nt++;
@@ -778,15 +785,16 @@ static void rom1(int n,complex double *sum,int nx)
 
 //======================================================================================================================
 
-static void saoa(double t,complex double *ans)
+static void saoa(const struct evlstate *st,double t,complex double *ans)
 // Computes the integrand for each of the 6 Sommerfeld integrals for source and observer above ground
 {
 	double xlr;
-	static complex double xl,dxl,cgam1,cgam2,b0,b0p,com,dgam,den1,den2;
+	complex double xl,dxl,cgam1,cgam2,b0,b0p,com,dgam,den1,den2;
+	const double zph=st->zph,rho=st->rho;
 
-	lambda(t,&xl,&dxl);
+	lambda(st,t,&xl,&dxl);
 	// evaluate gamma1 and gamma2 (cgam1, cgam2)
-	if (jh==0) {
+	if (st->jh==0) {
 		/* Bessel-function form.
 		 * Assuming k1,2 to belong to the first quadrant of the complex plane, the following expressions have branch
 		 * cuts from k to i*inf in an arc that stays within the first quadrant with Im(z)>=Im(k) and symmetrically from
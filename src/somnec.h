@@ -25,6 +25,7 @@
 #include <complex.h>
 
 void som_init(complex double epscf);
+// after som_init, evlua can be called concurrently from several threads
 void evlua(double zphIn,double rhoIn,complex double *erv,complex double *ezv,complex double *erh,complex double *eph,
 	int mode);
 
@@ -39,71 +39,74 @@ static inline void CcMul(doublecomplex * restrict argvec_src,doublecomplex * res
 
 //=====================================================================================================================
 
-static inline void AijProd(doublecomplex * restrict argvec,doublecomplex * restrict resultvec,const size_t i,
-	const size_t j)
-/* Handles the multiplication of the j'th block of argvec with the G_ij block of the G-matrix, and adds the result
- * to the i'th block of resultvec.
- */
-{	
-	doublecomplex iterm[6];
-	const size_t i3 = 3*i, j3 = 3*j;
-
+static inline void SymProdAdd(const doublecomplex iterm[static 6],const doublecomplex * restrict arg,
+	doublecomplex * restrict res3)
+// multiplies symmetric matrix iterm (of the direct interaction) by the 3-vector arg and adds the result to res3
+{
 	__m128d res, tmp;
 
 	IGNORE_WARNING(-Wstrict-aliasing); // cast from doublecomplex* to double* is perfectly valid in C99
-	const __m128d argX = _mm_load_pd((double *)(argvec+j3));
-	const __m128d argY = _mm_load_pd((double *)(argvec+j3+1));
-	const __m128d argZ = _mm_load_pd((double *)(argvec+j3+2));
+	const __m128d argX = _mm_load_pd((const double *)(arg));
+	const __m128d argY = _mm_load_pd((const double *)(arg+1));
+	const __m128d argZ = _mm_load_pd((const double *)(arg+2));
+
+	res = cmul(argX, *(const __m128d *)&(iterm[0]));
+	tmp = cmul(argY, *(const __m128d *)&(iterm[1]));
+	res = cadd(tmp,res);
+	tmp = cmul(argZ, *(const __m128d *)&(iterm[2]));
+	res = cadd(tmp,res);
+	*(__m128d *)&(res3[0]) = cadd(res, *(__m128d *)&(res3[0]));
+
+	res = cmul(argX, *(const __m128d *)&(iterm[1]));
+	tmp = cmul(argY, *(const __m128d *)&(iterm[3]));
+	res = cadd(tmp,res);
+	tmp = cmul(argZ, *(const __m128d *)&(iterm[4]));
+	res = cadd(tmp,res);
+	*(__m128d *)&(res3[1]) = cadd(res, *(__m128d *)&(res3[1]));
+
+	res = cmul(argX, *(const __m128d *)&(iterm[2]));
+	tmp = cmul(argY, *(const __m128d *)&(iterm[4]));
+	res = cadd(tmp,res);
+	tmp = cmul(argZ, *(const __m128d *)&(iterm[5]));
+	res = cadd(tmp,res);
+	*(__m128d *)&(res3[2]) = cadd(res, *(__m128d *)&(res3[2]));
 	STOP_IGNORE;
+}
 
-	if (j!=local_nvoid_d0+i) { // main interaction is not computed for coinciding dipoles
-		(*InterTerm_int)(position[i3]-position_full[j3], position[i3+1]-position_full[j3+1],
-			position[i3+2]-position_full[j3+2], iterm);
-		res = cmul(argX, *(__m128d *)&(iterm[0]));
-		tmp = cmul(argY, *(__m128d *)&(iterm[1]));
-		res = cadd(tmp,res);
-		tmp = cmul(argZ, *(__m128d *)&(iterm[2]));
-		res = cadd(tmp,res);
-		*(__m128d *)&(resultvec[i3]) = cadd(res, *(__m128d *)&(resultvec[i3]));
-
-		res = cmul(argX, *(__m128d *)&(iterm[1]));
-		tmp = cmul(argY, *(__m128d *)&(iterm[3]));
-		res = cadd(tmp,res);
-		tmp = cmul(argZ, *(__m128d *)&(iterm[4]));
-		res = cadd(tmp,res);
-		*(__m128d *)&(resultvec[i3+1]) = cadd(res, *(__m128d *)&(resultvec[i3+1]));
-
-		res = cmul(argX, *(__m128d *)&(iterm[2]));
-		tmp = cmul(argY, *(__m128d *)&(iterm[4]));
-		res = cadd(tmp,res);
-		tmp = cmul(argZ, *(__m128d *)&(iterm[5]));
-		res = cadd(tmp,res);
-		*(__m128d *)&(resultvec[i3+2]) = cadd(res, *(__m128d *)&(resultvec[i3+2]));
-	}
-	if (surface) { // surface interaction is computed always
-		(*ReflTerm_int)(position[i3]-position_full[j3], position[i3+1]-position_full[j3+1],
-			position[i3+2]+position_full[j3+2], iterm);
-		res = cmul(argX, *(__m128d *)&(iterm[0]));
-		tmp = cmul(argY, *(__m128d *)&(iterm[1]));
-		res = cadd(tmp,res);
-		tmp = cmul(argZ, *(__m128d *)&(iterm[2]));
-		res = cadd(tmp,res);
-		*(__m128d *)&(resultvec[i3]) = cadd(res, *(__m128d *)&(resultvec[i3]));
-
-		res = cmul(argX, *(__m128d *)&(iterm[1]));
-		tmp = cmul(argY, *(__m128d *)&(iterm[3]));
-		res = cadd(tmp,res);
-		tmp = cmul(argZ, *(__m128d *)&(iterm[4]));
-		res = cadd(tmp,res);
-		*(__m128d *)&(resultvec[i3+1]) = cadd(res, *(__m128d *)&(resultvec[i3+1]));
-
-		res = cmul(argZ, *(__m128d *)&(iterm[5]));
-		tmp = cmul(argX, *(__m128d *)&(iterm[2]));
-		res=_mm_sub_pd(res,tmp);
-		tmp = cmul(argY, *(__m128d *)&(iterm[4]));
-		res=_mm_sub_pd(res,tmp);
-		*(__m128d *)&(resultvec[i3+2]) = cadd(res, *(__m128d *)&(resultvec[i3+2]));
-	}
+//=====================================================================================================================
+
+static inline void ReflProdAdd(const doublecomplex iterm[static 6],const doublecomplex * restrict arg,
+	doublecomplex * restrict res3)
+// multiplies matrix iterm (of the reflected interaction) by the 3-vector arg and adds the result to res3
+{
+	__m128d res, tmp;
+
+	IGNORE_WARNING(-Wstrict-aliasing); // cast from doublecomplex* to double* is perfectly valid in C99
+	const __m128d argX = _mm_load_pd((const double *)(arg));
+	const __m128d argY = _mm_load_pd((const double *)(arg+1));
+	const __m128d argZ = _mm_load_pd((const double *)(arg+2));
+
+	res = cmul(argX, *(const __m128d *)&(iterm[0]));
+	tmp = cmul(argY, *(const __m128d *)&(iterm[1]));
+	res = cadd(tmp,res);
+	tmp = cmul(argZ, *(const __m128d *)&(iterm[2]));
+	res = cadd(tmp,res);
+	*(__m128d *)&(res3[0]) = cadd(res, *(__m128d *)&(res3[0]));
+
+	res = cmul(argX, *(const __m128d *)&(iterm[1]));
+	tmp = cmul(argY, *(const __m128d *)&(iterm[3]));
+	res = cadd(tmp,res);
+	tmp = cmul(argZ, *(const __m128d *)&(iterm[4]));
+	res = cadd(tmp,res);
+	*(__m128d *)&(res3[1]) = cadd(res, *(__m128d *)&(res3[1]));
+
+	res = cmul(argZ, *(const __m128d *)&(iterm[5]));
+	tmp = cmul(argX, *(const __m128d *)&(iterm[2]));
+	res=_mm_sub_pd(res,tmp);
+	tmp = cmul(argY, *(const __m128d *)&(iterm[4]));
+	res=_mm_sub_pd(res,tmp);
+	*(__m128d *)&(res3[2]) = cadd(res, *(__m128d *)&(res3[2]));
+	STOP_IGNORE;
 }
 
 //=====================================================================================================================
@@ -140,28 +143,26 @@ static inline void CcMul(doublecomplex * restrict argvec_src,doublecomplex * res
 
 //=====================================================================================================================
 
-static inline void AijProd(doublecomplex * restrict argvec,doublecomplex * restrict resultvec,const size_t i,
-	const size_t j)
-/* Handles the multiplication of the j'th block of argvec with the G_ij block of the G-matrix, and adds the result
- * to the i'th block of resultvec.
- */
+static inline void SymProdAdd(const doublecomplex iterm[static 6],const doublecomplex * restrict arg,
+	doublecomplex * restrict res3)
+// multiplies symmetric matrix iterm (of the direct interaction) by the 3-vector arg and adds the result to res3
 {
 	doublecomplex res[3];
-	doublecomplex iterm[6];
-	const size_t i3=3*i,j3=3*j;
-
-	if (j!=local_nvoid_d0+i) { // main interaction is not computed for coinciding dipoles
-		(*InterTerm_int)(position[i3]-position_full[j3],position[i3+1]-position_full[j3+1],
-			position[i3+2]-position_full[j3+2],iterm);
-		cSymMatrVec(iterm,argvec+j3,res);
-		cvAdd(res,resultvec+i3,resultvec+i3);
-	}
-	if (surface) { // surface interaction is computed always
-		(*ReflTerm_int)(position[i3]-position_full[j3],position[i3+1]-position_full[j3+1],
-			position[i3+2]+position_full[j3+2],iterm);
-		cReflMatrVec(iterm,argvec+j3,res);
-		cvAdd(res,resultvec+i3,resultvec+i3);
-	}
+
+	cSymMatrVec(iterm,arg,res);
+	cvAdd(res,res3,res3);
+}
+
+//=====================================================================================================================
+
+static inline void ReflProdAdd(const doublecomplex iterm[static 6],const doublecomplex * restrict arg,
+	doublecomplex * restrict res3)
+// multiplies matrix iterm (of the reflected interaction) by the 3-vector arg and adds the result to res3
+{
+	doublecomplex res[3];
+
+	cReflMatrVec(iterm,arg,res);
+	cvAdd(res,res3,res3);
 }
 
 //=====================================================================================================================
@@ -180,6 +181,129 @@ static inline void DiagProd(doublecomplex * restrict argvec,doublecomplex * rest
 
 #endif // !USE_SSE3
 
+//=====================================================================================================================
+
+#define ROW_BATCH 64 // number of dipoles j processed at once in RowProd, RowProdSym, and RowStore
+
+static inline void RowProd(const doublecomplex * restrict argvec,doublecomplex * restrict resultvec,const size_t i,
+	const size_t j0,const size_t j1)
+/* Handles the multiplication of the i'th (local) block row of the G-matrix by argvec, and adds the result to the i'th
+ * block of resultvec. Only dipoles j0<=j<j1 (global indices) are considered, and argvec contains only the elements for
+ * these dipoles (starting from j0), so it can be either a part of the full vector or a block received from another
+ * processor. The interaction terms G_ij are computed by InterTerm_batch for blocks of ROW_BATCH dipoles, which allows
+ * vectorization of this computation (the most time-consuming part of the sparse matrix-vector product).
+ */
+{
+	int ijk[3*ROW_BATCH];
+	size_t jb[ROW_BATCH];
+	doublecomplex iterm[NDCOMP*ROW_BATCH];
+	size_t j,jst,jend,n,m;
+	const size_t i3=3*i,self=local_nvoid_d0+i;
+
+	for (jst=j0;jst<j1;jst+=ROW_BATCH) {
+		jend=MIN(jst+ROW_BATCH,j1);
+		for (n=0,j=jst;j<jend;j++) if (j!=self) { // main interaction is not computed for coinciding dipoles
+			ijk[3*n]=position[i3]-position_full[3*j];
+			ijk[3*n+1]=position[i3+1]-position_full[3*j+1];
+			ijk[3*n+2]=position[i3+2]-position_full[3*j+2];
+			jb[n++]=j;
+		}
+		(*InterTerm_batch)(ijk,n,iterm);
+		for (m=0;m<n;m++) SymProdAdd(iterm+NDCOMP*m,argvec+3*(jb[m]-j0),resultvec+i3);
+	}
+	if (surface) for (j=j0;j<j1;j++) { // surface interaction is computed always
+		(*ReflTerm_int)(position[i3]-position_full[3*j],position[i3+1]-position_full[3*j+1],
+			position[i3+2]+position_full[3*j+2],iterm);
+		ReflProdAdd(iterm,argvec+3*(j-j0),resultvec+i3);
+	}
+}
+
+//=====================================================================================================================
+
+static inline void RowProdSym(const doublecomplex * restrict argvec,doublecomplex * restrict resultvec,const size_t i,
+	const size_t j0,const size_t j1)
+/* Same as RowProd, but for local dipoles i<j0<=j<j1 (all indices are local), and each computed interaction term is also
+ * used for the symmetric pair, i.e. G_ji*argvec_i is added to the j'th block of resultvec. G_ji=G_ij for the direct
+ * interaction, while the reflected one is transposed, which is equivalent to the change of sign of the 13 and 23
+ * components (see ReflTerm_int). The self-term of the reflected interaction is not computed here (see SelfReflProd).
+ */
+{
+	int ijk[3*ROW_BATCH];
+	size_t jb[ROW_BATCH];
+	doublecomplex iterm[NDCOMP*ROW_BATCH];
+	size_t j,jst,jend,n,m;
+	const size_t i3=3*i;
+	const doublecomplex * restrict argloc=argvec+3*local_nvoid_d0; // part of argvec corresponding to local dipoles
+
+	for (jst=j0;jst<j1;jst+=ROW_BATCH) {
+		jend=MIN(jst+ROW_BATCH,j1);
+		for (n=0,j=jst;j<jend;j++,n++) {
+			ijk[3*n]=position[i3]-position[3*j];
+			ijk[3*n+1]=position[i3+1]-position[3*j+1];
+			ijk[3*n+2]=position[i3+2]-position[3*j+2];
+			jb[n]=j;
+		}
+		(*InterTerm_batch)(ijk,n,iterm);
+		for (m=0;m<n;m++) {
+			SymProdAdd(iterm+NDCOMP*m,argloc+3*jb[m],resultvec+i3);
+			SymProdAdd(iterm+NDCOMP*m,argloc+i3,resultvec+3*jb[m]);
+		}
+	}
+	if (surface) for (j=j0;j<j1;j++) {
+		(*ReflTerm_int)(position[i3]-position[3*j],position[i3+1]-position[3*j+1],
+			position[i3+2]+position[3*j+2],iterm);
+		ReflProdAdd(iterm,argloc+3*j,resultvec+i3);
+		iterm[2]=-iterm[2];
+		iterm[4]=-iterm[4];
+		ReflProdAdd(iterm,argloc+i3,resultvec+3*j);
+	}
+}
+
+//======================================================================================================================
+
+static inline void RowStore(const size_t i,doublecomplex * restrict Grow,doublecomplex * restrict Rrow)
+/* Computes the interaction terms of the i'th (local) dipole with all dipoles and stores them (NDCOMP components for
+ * each dipole) in Grow, and the reflected terms (only if surface) - in Rrow. The direct term of the dipole itself is
+ * set to zero, so the stored row can be multiplied by the full argvec without exceptions.
+ */
+{
+	int ijk[3*ROW_BATCH];
+	size_t j,jst,jend,n;
+	const size_t i3=3*i,self=local_nvoid_d0+i;
+
+	for (jst=0;jst<nvoid_Ndip;jst=jend) {
+		if (jst==self) {
+			for (n=0;n<NDCOMP;n++) Grow[NDCOMP*self+n]=0;
+			jend=self+1;
+			continue;
+		}
+		jend=MIN(jst+ROW_BATCH,nvoid_Ndip);
+		if (self>jst && self<jend) jend=self;
+		for (n=0,j=jst;j<jend;j++,n++) {
+			ijk[3*n]=position[i3]-position_full[3*j];
+			ijk[3*n+1]=position[i3+1]-position_full[3*j+1];
+			ijk[3*n+2]=position[i3+2]-position_full[3*j+2];
+		}
+		(*InterTerm_batch)(ijk,n,Grow+NDCOMP*jst);
+	}
+	if (surface) for (j=0;j<nvoid_Ndip;j++) (*ReflTerm_int)(position[i3]-position_full[3*j],
+		position[i3+1]-position_full[3*j+1],position[i3+2]+position_full[3*j+2],Rrow+NDCOMP*j);
+}
+#undef ROW_BATCH
+
+//=====================================================================================================================
+
+static inline void SelfReflProd(const doublecomplex * restrict argvec,doublecomplex * restrict resultvec,
+	const size_t i)
+// adds the reflected interaction of the i'th (local) dipole with itself to the i'th block of resultvec
+{
+	doublecomplex iterm[NDCOMP];
+	const size_t i3=3*i;
+
+	(*ReflTerm_int)(0,0,2*position[i3+2],iterm);
+	ReflProdAdd(iterm,argvec+3*local_nvoid_d0+i3,resultvec+i3);
+}
+
 #endif // __sparse_ops_h
 
 #endif // SPARSE
@@ -31,6 +31,11 @@
 
 // SEMI-GLOBAL VARIABLES
 
+#ifdef PARALLEL
+// defined and initialized in param.c
+extern const int orient_groups;
+#endif
+
 // used in CalculateE.c
 TIME_TYPE Timing_EPlane,Timing_EPlaneComm,    // for Eplane calculation: total and comm
           Timing_IntField,Timing_IntFieldOne, // for internal fields: total & one calculation
@@ -41,6 +46,9 @@ size_t TotalEFieldPlane; // total number of planes for scattered field calculati
 TIME_TYPE Timing_Init, // for total initialization of the program (before CalculateE)
           Timing_Init_Int; // for initialization of interaction routines (including computing tables)
 size_t TotalEval;      // total number of orientation evaluations
+#ifdef PARALLEL
+TIME_TYPE Timing_OrientComm; // communication for orientation averaging (integration over alpha and between groups)
+#endif
 #ifdef OPENCL
 TIME_TYPE Timing_OCL_Init; // for initialization of OpenCL (including building program)
 #endif
@@ -111,6 +119,9 @@ void InitTiming(void)
 	TotalIter=TotalMatVec=TotalEval=TotalEFieldPlane=0;
 	Timing_EField=Timing_FileIO=Timing_IntField=Timing_ScatQuan=Timing_Integration=0;
 	Timing_ScatQuanComm=Timing_InitDmComm=0;
+#ifdef PARALLEL
+	Timing_OrientComm=0;
+#endif
 #ifdef SPARSE
 	Timing_Dm_Init=Timing_Granul=Timing_FFT_Init=Timing_GranulComm=0;
 #endif	
@@ -265,6 +276,10 @@ void FinalStatistics(void)
 				"File I/O:            "FFORMT"\n",TO_SEC(Timing_FileIO));
 		if (!prognosis) fprintf (logfile,
 				"Integration:         "FFORMT"\n",TO_SEC(Timing_Integration));
+#ifdef PARALLEL
+		if (!prognosis && orient_avg) fprintf (logfile,
+				"  communication:       "FFORMT"\n",TO_SEC(Timing_OrientComm));
+#endif
 		// close logfile
 		FCloseErr(logfile,F_LOG,ONE_POS);
 	}
@@ -50,6 +50,15 @@ typedef struct	 // values of angles
 	double * restrict val; // values of points; restrict should be minded in the code !!!
 } angle_set;
 
+typedef struct            // parameters of integration over the unit sphere (beta and gamma for orientation averaging)
+{
+	enum avgscheme scheme; // integration scheme; for AVG_ROMBERG the other fields are not used (see Parms_1D)
+	int N;                 // number of points (for Lebedev)
+	int Jmin;              // minimal number of refinements, the number of points is 2^J (for Sobol)
+	int Jmax;              // maximal number of refinements (for Sobol)
+	double eps;            // convergence criterion
+} Parms_sphere;
+
 typedef struct	        // integration parameters
 {	                    // !!! All angles are in degrees
 	enum scatgrid type; // if pairs are used or grid
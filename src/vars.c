@@ -104,6 +104,7 @@ doublecomplex * restrict EgridX,* restrict EgridY;
 
 int nprocs;                        // total number of processes
 int ringid;                        // ID of current process
+int orientGroup;                   // orientation group of current process (-orient_groups)
 
 size_t local_Ndip;                 // number of local total dipoles
 size_t local_nvoid_Ndip;           // number of local and ...
@@ -136,8 +137,15 @@ double hsub;            // height of particle center above surface
 
 #ifndef SPARSE // These variables are exclusive to the FFT mode
 
-// position of the dipoles; in the very end of make_particle() z-components are adjusted to be relative to the local_z0
+/* position of the dipoles; in the very end of make_particle() y- and z-components are adjusted to be relative to the
+ * local_y0 and local_z0, respectively
+ */
 unsigned short * restrict position;
+/* row-span index: local dipoles from spanStart[s] to spanStart[s+1]-1 form a contiguous run along x (with the same y and
+ * z); spanStart has local_nSpan+1 elements
+ */
+size_t * restrict spanStart;
+size_t local_nSpan;
 // auxiliary grids and their partition over processors
 size_t gridX,gridY,gridZ; /* sizes of the 'matrix' X, size_t - to remove type conversions we assume that 'int' is enough
                              for it, but this declaration is to avoid type casting in calculations */
@@ -150,13 +158,17 @@ size_t local_Nz;          // number of z layers (based on the division of smallZ
 int local_Nz_unif;        /* number of z layers (distance between max and min values), belonging to this processor,
                              after all non_void dipoles are uniformly distributed between all processors */
 int local_z1_coer;        // ending z, coerced to be not greater than boxZ (and not smaller than local_z0)
+int local_y0,local_y1;    // starting and ending y for current processor
+size_t local_Ny;          // number of y rows (based on the division of smallY)
+int local_y1_coer;        // ending y, coerced to be not greater than boxY (and not smaller than local_y0)
+size_t local_boxXY;       // boxX*(local_y1_coer-local_y0), size of local part of a layer (z=const) of the box
 	// starting, ending x for current processor and number of x layers (based on the division of smallX)
 size_t local_x0,local_x1,local_Nx;
 
 #else // These variables are exclusive to the sparse mode
 
 int *position; // no reason to restrict this to short in sparse mode; actually it points to a part of position_full
-// in sparse mode, all coordinates must be available to each process
+// in sparse mode, all coordinates must be available to each process (stored once per node, see SharedVector)
 int * restrict position_full;
 
 #endif // !SPARSE
@@ -73,7 +73,7 @@ extern angle_set alpha_int;
 extern scat_grid_angles angles;
 extern doublecomplex * restrict EgridX,* restrict EgridY;
 
-extern int nprocs,ringid;
+extern int nprocs,ringid,orientGroup;
 
 extern size_t local_Ndip,local_nvoid_Ndip,local_nRows,local_nvoid_d0,local_nvoid_d1,nvoid_Ndip;
 
@@ -89,13 +89,15 @@ extern double inc_scale,hsub;
 #ifndef SPARSE // These variables are exclusive to the FFT mode
 
 extern unsigned short * restrict position;
+extern size_t * restrict spanStart;
+extern size_t local_nSpan;
 // auxiliary grids and their partition over processors
 extern size_t gridX,gridY,gridZ;
 extern size_t gridYZ;
 extern size_t smallY,smallZ;
 extern size_t local_Nsmall;
-extern int local_z0,local_z1,local_z1_coer,local_Nz_unif;
-extern size_t local_Nz,local_x0,local_x1,local_Nx;
+extern int local_z0,local_z1,local_z1_coer,local_Nz_unif,local_y0,local_y1,local_y1_coer;
+extern size_t local_Nz,local_x0,local_x1,local_Nx,local_Ny,local_boxXY;
 
 #else // These variables are exclusive to the sparse mode
 